@@ -1,7 +1,20 @@
-from .euclidean import euclidean
-from .cosine import cosine
+import os
 
-__all__ = ["euclidean", "cosine"]
+from . import euclidean
+from . import cosine
+from . import pairwise
+from .euclidean import euclidean_distance, distance, simd_level
+from .cosine import cosine_similarity, cosine_similarities, norms, normalize
+from .pairwise import cdist, one_to_many
+
+__all__ = ["euclidean", "cosine", "pairwise", "euclidean_distance", "distance", "cosine_similarity",
+           "cosine_similarities", "norms", "normalize", "cdist", "one_to_many",
+           "simd_level", "get_include"]
+
+
+def get_include():
+    """Directory to add to the include path for the installed C++ headers ("DistanceMetrics/<name>.h")."""
+    return os.path.join(os.path.dirname(__file__), "include")
 
 try:
     # For Python 3.8 and newer
@@ -0,0 +1,248 @@
+#pragma once
+
+#include <Python.h>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+// Read-only 1-D or 2-D view over float32/float64 data. Objects that export the buffer protocol
+// (NumPy arrays, memoryviews, array.array) are read in place, honouring their strides, so no
+// element is boxed or copied. Anything else that is a sequence of numbers (lists, integer arrays)
+// is converted once into an owned float64 buffer.
+class BufferView {
+public:
+    enum class Type { Float32, Float64 };
+
+    BufferView() = default;
+    ~BufferView() { release(); }
+
+    BufferView(const BufferView&) = delete;
+    BufferView& operator=(const BufferView&) = delete;
+
+    // Acquire obj as an ndim-dimensional (1 or 2) view. Returns false with a Python exception set;
+    // type_error is the TypeError message used when obj is neither a buffer nor a sequence.
+    bool acquire(PyObject* obj, int ndim,
+                 const char* type_error = "Expected a float32/float64 buffer or a sequence of numbers.") {
+        release();
+        if (ndim != 1 && ndim != 2) {
+            PyErr_SetString(PyExc_SystemError, "BufferView supports 1-D and 2-D data only.");
+            return false;
+        }
+        if (PyObject_CheckBuffer(obj)) {
+            if (PyObject_GetBuffer(obj, &buffer, PyBUF_RECORDS_RO) == 0) {
+                has_buffer = true;
+                if (parse_format()) {
+                    if (buffer.ndim != ndim) {
+                        release();
+                        PyErr_Format(PyExc_ValueError, "Expected a %d-dimensional array.", ndim);
+                        return false;
+                    }
+                    base = static_cast<const char*>(buffer.buf);
+                    num_cols = static_cast<size_t>(buffer.shape[ndim - 1]);
+                    col_stride = buffer.strides[ndim - 1];
+                    num_rows = ndim == 2 ? static_cast<size_t>(buffer.shape[0]) : 1;
+                    row_stride = ndim == 2 ? buffer.strides[0] : static_cast<Py_ssize_t>(num_cols) * col_stride;
+                    return true;
+                }
+                // Other element types (integers, half floats, non-native byte order) are converted below
+                release();
+            } else {
+                PyErr_Clear();
+            }
+        }
+        return ndim == 1 ? convert_vector(obj, type_error) : convert_matrix(obj, type_error);
+    }
+
+    size_t rows() const { return num_rows; }  // 1 for vectors
+    size_t cols() const { return num_cols; }
+    size_t size() const { return num_rows * num_cols; }
+    Type type() const { return element_type; }
+
+    // True when the rows are packed back to back with no padding between elements
+    bool contiguous() const {
+        const Py_ssize_t item = static_cast<Py_ssize_t>(item_size());
+        return (num_cols <= 1 || col_stride == item) &&
+               (num_rows <= 1 || row_stride == static_cast<Py_ssize_t>(num_cols) * item);
+    }
+
+    // Element (row, col) as a double
+    double at(size_t row, size_t col) const {
+        const char* item = base + static_cast<Py_ssize_t>(row) * row_stride + static_cast<Py_ssize_t>(col) * col_stride;
+        return element_type == Type::Float32 ? static_cast<double>(load<float>(item)) : load<double>(item);
+    }
+
+    // Row-major data as T: the buffer itself when it already holds contiguous T elements,
+    // otherwise a converted copy written to scratch
+    template <typename T>
+    const T* data(std::vector<T>& scratch) const {
+        if (matches<T>() && contiguous()) {
+            return reinterpret_cast<const T*>(base);
+        }
+        scratch.resize(size());
+        for (size_t row = 0; row < num_rows; ++row) {
+            copy_row(row, scratch.data() + row * num_cols);
+        }
+        return scratch.data();
+    }
+
+    // One row as T, read in place when its elements are packed T values
+    template <typename T>
+    const T* row(size_t row, std::vector<T>& scratch) const {
+        const char* start = base + static_cast<Py_ssize_t>(row) * row_stride;
+        if (matches<T>() && (num_cols <= 1 || col_stride == static_cast<Py_ssize_t>(sizeof(T)))) {
+            return reinterpret_cast<const T*>(start);
+        }
+        scratch.resize(num_cols);
+        copy_row(row, scratch.data());
+        return scratch.data();
+    }
+
+private:
+    Py_buffer buffer;
+    bool has_buffer = false;
+    std::vector<double> owned;  // Converted elements for non-buffer inputs
+    const char* base = nullptr;
+    size_t num_rows = 0;
+    size_t num_cols = 0;
+    Py_ssize_t row_stride = 0;  // In bytes, as in the buffer protocol
+    Py_ssize_t col_stride = 0;
+    Type element_type = Type::Float64;
+
+    void release() {
+        if (has_buffer) {
+            PyBuffer_Release(&buffer);
+            has_buffer = false;
+        }
+        owned.clear();
+        base = nullptr;
+        num_rows = num_cols = 0;
+        row_stride = col_stride = 0;
+        element_type = Type::Float64;
+    }
+
+    size_t item_size() const { return element_type == Type::Float32 ? sizeof(float) : sizeof(double); }
+
+    template <typename T>
+    bool matches() const {
+        return element_type == (sizeof(T) == sizeof(float) ? Type::Float32 : Type::Float64);
+    }
+
+    // Unaligned-safe element load; compiles to a plain move on every target we build for
+    template <typename T>
+    static T load(const char* item) {
+        T value;
+        std::memcpy(&value, item, sizeof(T));
+        return value;
+    }
+
+    template <typename T>
+    void copy_row(size_t row, T* out) const {
+        const char* item = base + static_cast<Py_ssize_t>(row) * row_stride;
+        if (element_type == Type::Float32) {
+            for (size_t col = 0; col < num_cols; ++col, item += col_stride) {
+                out[col] = static_cast<T>(load<float>(item));
+            }
+        } else {
+            for (size_t col = 0; col < num_cols; ++col, item += col_stride) {
+                out[col] = static_cast<T>(load<double>(item));
+            }
+        }
+    }
+
+    // Accept native-order 'f' and 'd' items (with an optional '@', '=' or little-endian '<' prefix)
+    bool parse_format() {
+        const char* format = buffer.format != nullptr ? buffer.format : "B";
+        if (*format == '@' || *format == '=') {
+            ++format;
+        } else if (*format == '<') {
+            const uint16_t probe = 1;
+            uint8_t low;
+            std::memcpy(&low, &probe, 1);
+            if (low != 1) {
+                return false;
+            }
+            ++format;
+        }
+        if (std::strcmp(format, "f") == 0 && buffer.itemsize == sizeof(float)) {
+            element_type = Type::Float32;
+            return true;
+        }
+        if (std::strcmp(format, "d") == 0 && buffer.itemsize == sizeof(double)) {
+            element_type = Type::Float64;
+            return true;
+        }
+        return false;
+    }
+
+    // Append the numbers of a sequence to owned; returns the element count or -1 with an error set
+    Py_ssize_t append_sequence(PyObject* obj, const char* type_error) {
+        if (!PySequence_Check(obj) || PyUnicode_Check(obj) || PyBytes_Check(obj)) {
+            PyErr_SetString(PyExc_TypeError, type_error);
+            return -1;
+        }
+        PyObject* items = PySequence_Fast(obj, type_error);
+        if (items == nullptr) {
+            return -1;
+        }
+        const Py_ssize_t count = PySequence_Fast_GET_SIZE(items);
+        PyObject** elements = PySequence_Fast_ITEMS(items);
+        for (Py_ssize_t i = 0; i < count; ++i) {
+            const double value = PyFloat_AsDouble(elements[i]);
+            if (value == -1.0 && PyErr_Occurred()) {
+                Py_DECREF(items);
+                return -1;
+            }
+            owned.push_back(value);
+        }
+        Py_DECREF(items);
+        return count;
+    }
+
+    bool convert_vector(PyObject* obj, const char* type_error) {
+        const Py_ssize_t count = append_sequence(obj, type_error);
+        if (count < 0) {
+            release();
+            return false;
+        }
+        set_owned(1, static_cast<size_t>(count));
+        return true;
+    }
+
+    bool convert_matrix(PyObject* obj, const char* type_error) {
+        if (!PySequence_Check(obj) || PyUnicode_Check(obj) || PyBytes_Check(obj)) {
+            PyErr_SetString(PyExc_TypeError, type_error);
+            return false;
+        }
+        PyObject* rows = PySequence_Fast(obj, type_error);
+        if (rows == nullptr) {
+            return false;
+        }
+        const Py_ssize_t count = PySequence_Fast_GET_SIZE(rows);
+        Py_ssize_t width = 0;
+        for (Py_ssize_t i = 0; i < count; ++i) {
+            const Py_ssize_t row_width = append_sequence(PySequence_Fast_GET_ITEM(rows, i), type_error);
+            if (row_width < 0 || (i > 0 && row_width != width)) {
+                if (row_width >= 0) {
+                    PyErr_SetString(PyExc_ValueError, "All rows must have the same length.");
+                }
+                Py_DECREF(rows);
+                release();
+                return false;
+            }
+            width = row_width;
+        }
+        Py_DECREF(rows);
+        set_owned(static_cast<size_t>(count), static_cast<size_t>(width));
+        return true;
+    }
+
+    void set_owned(size_t rows, size_t cols) {
+        element_type = Type::Float64;
+        base = reinterpret_cast<const char*>(owned.data());
+        num_rows = rows;
+        num_cols = cols;
+        col_stride = sizeof(double);
+        row_stride = static_cast<Py_ssize_t>(cols * sizeof(double));
+    }
+};
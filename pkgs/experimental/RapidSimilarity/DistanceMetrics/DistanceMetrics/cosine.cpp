@@ -2,74 +2,207 @@
 #include <numpy/arrayobject.h>
 #include <vector>
 #include <cmath>
+#include <algorithm>
 
-// Function to compute dot product of two vectors
-double dot_product(const std::vector<double>& vec1, const std::vector<double>& vec2) {
-    double result = 0.0;
-    for (size_t i = 0; i < vec1.size(); ++i) {
-        result += vec1[i] * vec2[i];
+#include "buffer_view.h"
+#include "simd_kernels.h"
+
+// Python wrapper for cosine_similarity function
+static PyObject* py_cosine_similarity(PyObject* self, PyObject* args) {
+    PyObject *vec1_obj, *vec2_obj;
+
+    // Parse input tuples
+    if (!PyArg_ParseTuple(args, "OO", &vec1_obj, &vec2_obj)) {
+        return NULL;
     }
+
+    // View lists, NumPy arrays and memoryviews without boxing or copying float buffers
+    BufferView vec1, vec2;
+    if (!vec1.acquire(vec1_obj, 1, "Expected lists for vectors.") ||
+        !vec2.acquire(vec2_obj, 1, "Expected lists for vectors.")) {
+        return NULL;
+    }
+    if (vec1.size() != vec2.size()) {
+        PyErr_SetString(PyExc_ValueError, "Vectors must be of the same length.");
+        return NULL;
+    }
+
+    // Compute cosine similarity with the SIMD kernels; zero vectors give 0
+    double result;
+    if (vec1.type() == BufferView::Type::Float32 && vec2.type() == BufferView::Type::Float32) {
+        std::vector<float> scratch1, scratch2;
+        result = simd::cosine(vec1.row(0, scratch1), vec2.row(0, scratch2), vec1.size());
+    } else {
+        std::vector<double> scratch1, scratch2;
+        result = simd::cosine(vec1.row(0, scratch1), vec2.row(0, scratch2), vec1.size());
+    }
+
+    return Py_BuildValue("d", result); // Return result as a Python float
+}
+
+// float32 inputs keep float32 results; everything else is computed in float64
+static bool use_float32(const BufferView& view) {
+    return view.type() == BufferView::Type::Float32;
+}
+
+template <typename T>
+static int numpy_type() {
+    return sizeof(T) == sizeof(float) ? NPY_FLOAT : NPY_DOUBLE;
+}
+
+template <typename T>
+static T* array_data(PyObject* array) {
+    return static_cast<T*>(PyArray_DATA(reinterpret_cast<PyArrayObject*>(array)));
+}
+
+template <typename T>
+static PyObject* row_norms(const BufferView& rows) {
+    npy_intp dims[1] = {static_cast<npy_intp>(rows.rows())};
+    PyObject* result = PyArray_SimpleNew(1, dims, numpy_type<T>());
+    if (result == NULL) {
+        return NULL;
+    }
+    std::vector<T> scratch;
+    const T* data = rows.data(scratch);
+    T* out = array_data<T>(result);
+    Py_BEGIN_ALLOW_THREADS
+    simd::row_norms(data, rows.rows(), rows.cols(), out);
+    Py_END_ALLOW_THREADS
     return result;
 }
 
-// Function to compute the norm of a vector
-double norm(const std::vector<double>& vec) {
-    return std::sqrt(dot_product(vec, vec));
+// Euclidean norm of every row, to be cached next to the vectors for repeated cosine queries
+static PyObject* py_norms(PyObject* self, PyObject* args) {
+    PyObject* rows_obj;
+    if (!PyArg_ParseTuple(args, "O", &rows_obj)) {
+        return NULL;
+    }
+    BufferView rows;
+    if (!rows.acquire(rows_obj, 2, "Expected a 2-dimensional array.")) {
+        return NULL;
+    }
+    return use_float32(rows) ? row_norms<float>(rows) : row_norms<double>(rows);
 }
 
-// Function to compute cosine similarity between two vectors
-double cosine_similarity(const std::vector<double>& vec1, const std::vector<double>& vec2) {
-    double norm1 = norm(vec1);
-    double norm2 = norm(vec2);
-    
-    // Handle edge case for zero vectors
-    if (norm1 == 0.0 || norm2 == 0.0) {
-        return 0.0; // Cosine similarity is undefined for zero vectors
-    }
-    
-    return dot_product(vec1, vec2) / (norm1 * norm2);
+template <typename T>
+static PyObject* normalized_rows(const BufferView& rows) {
+    npy_intp dims[2] = {static_cast<npy_intp>(rows.rows()), static_cast<npy_intp>(rows.cols())};
+    PyObject* result = PyArray_SimpleNew(2, dims, numpy_type<T>());
+    if (result == NULL) {
+        return NULL;
+    }
+    std::vector<T> scratch;
+    const T* data = rows.data(scratch);
+    T* out = array_data<T>(result);
+    const size_t n = rows.rows(), dim = rows.cols();
+    Py_BEGIN_ALLOW_THREADS
+    std::copy(data, data + n * dim, out);
+    for (size_t i = 0; i < n; ++i) {
+        simd::normalize(out + i * dim, dim);
+    }
+    Py_END_ALLOW_THREADS
+    return result;
 }
 
-// Python wrapper for cosine_similarity function
-static PyObject* py_cosine_similarity(PyObject* self, PyObject* args) {
-    PyObject *vec1_obj, *vec2_obj;
-    
-    // Parse input tuples
-    if (!PyArg_ParseTuple(args, "OO", &vec1_obj, &vec2_obj)) {
+// Copy of the rows scaled to unit length, so cosine similarity becomes a plain dot product
+static PyObject* py_normalize(PyObject* self, PyObject* args) {
+    PyObject* rows_obj;
+    if (!PyArg_ParseTuple(args, "O", &rows_obj)) {
         return NULL;
     }
+    BufferView rows;
+    if (!rows.acquire(rows_obj, 2, "Expected a 2-dimensional array.")) {
+        return NULL;
+    }
+    return use_float32(rows) ? normalized_rows<float>(rows) : normalized_rows<double>(rows);
+}
 
-    // Convert Python lists to std::vector
-    std::vector<double> vec1, vec2;
-    if (PyList_Check(vec1_obj) && PyList_Check(vec2_obj)) {
-        Py_ssize_t size1 = PyList_Size(vec1_obj);
-        Py_ssize_t size2 = PyList_Size(vec2_obj);
-        
-        if (size1 != size2) {
-            PyErr_SetString(PyExc_ValueError, "Vectors must be of the same length.");
-            return NULL;
-        }
+// Similarity of query to every row. With cached norms, or with pre-normalized rows, each row
+// costs exactly one dot product; otherwise the fused kernel reads it once for all three terms.
+template <typename T>
+static PyObject* similarities(const BufferView& query, const BufferView& rows, const BufferView* norms, bool normalized) {
+    npy_intp dims[1] = {static_cast<npy_intp>(rows.rows())};
+    PyObject* result = PyArray_SimpleNew(1, dims, numpy_type<T>());
+    if (result == NULL) {
+        return NULL;
+    }
+    std::vector<T> query_scratch, row_scratch, norm_scratch;
+    const T* q = query.data(query_scratch);
+    const T* norm_data = norms != NULL ? norms->data(norm_scratch) : NULL;
+    T* out = array_data<T>(result);
+    const size_t n = rows.rows(), dim = rows.cols();
+    const simd::Kernels<T>& kernels = simd::kernels<T>();
 
-        for (Py_ssize_t i = 0; i < size1; ++i) {
-            PyObject *item = PyList_GetItem(vec1_obj, i);
-            vec1.push_back(PyFloat_AsDouble(item));
-            item = PyList_GetItem(vec2_obj, i);
-            vec2.push_back(PyFloat_AsDouble(item));
+    // Fetch every row before dropping the GIL so strided or converted inputs are ready
+    const T* data = rows.data(row_scratch);
+    Py_BEGIN_ALLOW_THREADS
+    if (normalized) {
+        std::vector<T> unit(q, q + dim);
+        simd::normalize(unit.data(), dim);
+        for (size_t i = 0; i < n; ++i) {
+            out[i] = kernels.dot(unit.data(), data + i * dim, dim);
+        }
+    } else if (norm_data != NULL) {
+        const T query_norm = std::sqrt(kernels.dot(q, q, dim));
+        for (size_t i = 0; i < n; ++i) {
+            out[i] = simd::cosine_with_norms(q, query_norm, data + i * dim, norm_data[i], dim);
         }
     } else {
-        PyErr_SetString(PyExc_TypeError, "Expected lists for vectors.");
+        for (size_t i = 0; i < n; ++i) {
+            out[i] = simd::cosine(q, data + i * dim, dim);
+        }
+    }
+    Py_END_ALLOW_THREADS
+    return result;
+}
+
+static PyObject* py_cosine_similarities(PyObject* self, PyObject* args, PyObject* kwds) {
+    static const char* kwlist[] = {"query", "rows", "norms", "normalized", NULL};
+    PyObject* query_obj;
+    PyObject* rows_obj;
+    PyObject* norms_obj = Py_None;
+    int normalized = 0;
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "OO|Op", const_cast<char**>(kwlist), &query_obj, &rows_obj,
+                                     &norms_obj, &normalized)) {
         return NULL;
     }
 
-    // Compute cosine similarity
-    double result = cosine_similarity(vec1, vec2);
-    
-    return Py_BuildValue("d", result); // Return result as a Python float
+    BufferView query, rows, norms;
+    if (!query.acquire(query_obj, 1, "Expected lists for vectors.") ||
+        !rows.acquire(rows_obj, 2, "Expected a 2-dimensional array.")) {
+        return NULL;
+    }
+    if (rows.rows() > 0 && query.size() != rows.cols()) {
+        PyErr_SetString(PyExc_ValueError, "Vectors must be of the same length.");
+        return NULL;
+    }
+    const bool has_norms = norms_obj != Py_None;
+    if (has_norms) {
+        if (!norms.acquire(norms_obj, 1, "Expected an array of norms.")) {
+            return NULL;
+        }
+        if (norms.size() != rows.rows()) {
+            PyErr_SetString(PyExc_ValueError, "Expected one norm per row.");
+            return NULL;
+        }
+    }
+
+    // float32 only when every input already is, so cached float64 norms are not truncated
+    const bool float32 = use_float32(query) && use_float32(rows) && (!has_norms || use_float32(norms));
+    const BufferView* norms_view = has_norms ? &norms : NULL;
+    return float32 ? similarities<float>(query, rows, norms_view, normalized != 0)
+                   : similarities<double>(query, rows, norms_view, normalized != 0);
 }
 
 // Module method definitions
 static PyMethodDef CosineMethods[] = {
     {"cosine_similarity", py_cosine_similarity, METH_VARARGS, "Compute cosine similarity between two vectors."},
+    {"norms", py_norms, METH_VARARGS, "Euclidean norm of every row of a 2-D array."},
+    {"normalize", py_normalize, METH_VARARGS, "Copy of a 2-D array with every row scaled to unit length."},
+    {"cosine_similarities", (PyCFunction)(void (*)(void))py_cosine_similarities, METH_VARARGS | METH_KEYWORDS,
+     "Cosine similarity of a query to every row of a 2-D array.\n\n"
+     "Pass norms=norms(rows) to reuse cached row norms, or normalized=True when the rows are already\n"
+     "unit length; either way each row costs a single dot product."},
     {NULL, NULL, 0, NULL} // Sentinel
 };
 
@@ -85,5 +218,6 @@ static struct PyModuleDef cosine_module = {
 // Module initialization function
 PyMODINIT_FUNC PyInit_cosine(void) {
     import_array(); // Initialize NumPy API
+    simd::init(); // Pick the distance kernels for this CPU once
     return PyModule_Create(&cosine_module);
 }
\ No newline at end of file
@@ -0,0 +1,122 @@
+#pragma once
+
+#include <cstdint>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+  #define RS_ARCH_X86 1
+  #ifdef _MSC_VER
+    #include <intrin.h>
+  #else
+    #include <cpuid.h>
+  #endif
+#elif defined(__aarch64__) || defined(_M_ARM64)
+  #define RS_ARCH_ARM64 1
+#endif
+
+// Instruction sets the distance kernels are specialised for, in increasing order of preference
+enum class SimdLevel { Scalar = 0, SSE2, AVX2, AVX512, NEON };
+
+inline const char* simd_level_name(SimdLevel level) {
+    switch (level) {
+        case SimdLevel::SSE2: return "sse2";
+        case SimdLevel::AVX2: return "avx2";
+        case SimdLevel::AVX512: return "avx512";
+        case SimdLevel::NEON: return "neon";
+        default: return "scalar";
+    }
+}
+
+// What the running CPU and operating system support. The probes are the CPUID / xgetbv checks
+// from swarmauri_experimental's cpu_vectorization_detection.cpp.
+struct CpuFeatures {
+    bool sse2 = false;
+    bool avx = false;      // CPU support plus OS-saved YMM state
+    bool avx2 = false;
+    bool fma = false;
+    bool f16c = false;     // Half-precision conversions, used by the float16 storage kernels
+    bool avx512f = false;  // CPU support plus OS-saved opmask and ZMM state
+    bool neon = false;
+};
+
+#if defined(RS_ARCH_X86)
+namespace cpu_detail {
+
+inline void cpuid(unsigned int leaf, unsigned int subleaf, unsigned int regs[4]) {
+#ifdef _MSC_VER
+    int info[4];
+    __cpuidex(info, static_cast<int>(leaf), static_cast<int>(subleaf));
+    for (int i = 0; i < 4; ++i) {
+        regs[i] = static_cast<unsigned int>(info[i]);
+    }
+#else
+    if (!__get_cpuid_count(leaf, subleaf, &regs[0], &regs[1], &regs[2], &regs[3])) {
+        regs[0] = regs[1] = regs[2] = regs[3] = 0;
+    }
+#endif
+}
+
+inline uint64_t xgetbv(unsigned int index) {
+#ifdef _MSC_VER
+    return _xgetbv(index);
+#else
+    uint32_t eax, edx;
+    __asm__ __volatile__("xgetbv" : "=a"(eax), "=d"(edx) : "c"(index));
+    return (static_cast<uint64_t>(edx) << 32) | eax;
+#endif
+}
+
+} // namespace cpu_detail
+#endif
+
+inline CpuFeatures detect_cpu_features() {
+    CpuFeatures features;
+#if defined(RS_ARCH_X86)
+    unsigned int regs[4];
+    cpu_detail::cpuid(0, 0, regs);
+    const unsigned int max_leaf = regs[0];
+    cpu_detail::cpuid(1, 0, regs);
+    features.sse2 = (regs[3] & (1u << 26)) != 0;
+    const bool osxsave = (regs[2] & (1u << 27)) != 0;
+    const uint64_t xcr0 = osxsave ? cpu_detail::xgetbv(0) : 0;
+    // The OS must save XMM/YMM state (bits 1-2) and, for AVX-512, opmask/ZMM state (bits 5-7)
+    features.avx = (regs[2] & (1u << 28)) != 0 && (xcr0 & 0x6) == 0x6;
+    features.fma = features.avx && (regs[2] & (1u << 12)) != 0;
+    features.f16c = features.avx && (regs[2] & (1u << 29)) != 0;
+    if (max_leaf >= 7) {
+        cpu_detail::cpuid(7, 0, regs);
+        features.avx2 = features.avx && (regs[1] & (1u << 5)) != 0;
+        features.avx512f = (regs[1] & (1u << 16)) != 0 && (xcr0 & 0xe6) == 0xe6;
+    }
+#elif defined(RS_ARCH_ARM64)
+    features.neon = true; // Advanced SIMD is mandatory on AArch64
+#endif
+    return features;
+}
+
+// Best kernel level the CPU can run
+inline SimdLevel best_simd_level(const CpuFeatures& features) {
+    if (features.avx512f) {
+        return SimdLevel::AVX512;
+    }
+    if (features.avx2 && features.fma) {
+        return SimdLevel::AVX2;
+    }
+    if (features.sse2) {
+        return SimdLevel::SSE2;
+    }
+    if (features.neon) {
+        return SimdLevel::NEON;
+    }
+    return SimdLevel::Scalar;
+}
+
+// Whether kernels for level can run on this CPU
+inline bool simd_level_supported(SimdLevel level, const CpuFeatures& features) {
+    switch (level) {
+        case SimdLevel::SSE2: return features.sse2;
+        case SimdLevel::AVX2: return features.avx2 && features.fma;
+        case SimdLevel::AVX512: return features.avx512f;
+        case SimdLevel::NEON: return features.neon;
+        default: return true;
+    }
+}
@@ -0,0 +1,126 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Immutable value of type T that readers use without any lock while writers replace it (RCU).
+// A writer builds the next version aside and publish()es it with one atomic pointer swap; a
+// reader takes a Snapshot, which pins it and keeps the version it loaded alive until the Snapshot
+// goes out of scope, however many versions are published meanwhile.
+//
+// Reclamation is epoch based: a snapshot marks one reader slot with the global epoch it started
+// in, and a replaced version is freed once every marked slot started after its replacement. Pins
+// and unpins are a compare-and-swap and a store on a slot of their own cache line, so readers
+// never wait for a writer or for each other. Writers must be serialized by the caller; the one
+// that publishes may read the current version through latest(). Versions retired while readers
+// are pinned are freed by a later publish(), or by the destructor, which must not run while a
+// Snapshot is alive.
+template <typename T>
+class Versioned {
+public:
+    explicit Versioned(std::unique_ptr<const T> initial) : current_(initial.release()) {}
+
+    ~Versioned() {
+        delete current_.load(std::memory_order_relaxed);
+        for (auto& entry : retired_) {
+            delete entry.second;
+        }
+    }
+
+    Versioned(const Versioned&) = delete;
+    Versioned& operator=(const Versioned&) = delete;
+
+    // Pinned version; movable, not copyable
+    class Snapshot {
+    public:
+        Snapshot(Snapshot&& other) noexcept : slot_(other.slot_), value_(other.value_) { other.slot_ = nullptr; }
+        Snapshot& operator=(Snapshot&&) = delete;
+        ~Snapshot() {
+            if (slot_ != nullptr) {
+                slot_->store(0, std::memory_order_release);
+            }
+        }
+
+        const T& operator*() const { return *value_; }
+        const T* operator->() const { return value_; }
+
+    private:
+        friend class Versioned;
+        Snapshot(std::atomic<uint64_t>* slot, const T* value) : slot_(slot), value_(value) {}
+
+        std::atomic<uint64_t>* slot_;
+        const T* value_;
+    };
+
+    // The current version, pinned until the Snapshot is destroyed; lock-free
+    Snapshot read() const {
+        std::atomic<uint64_t>* slot = pin();
+        return Snapshot(slot, current_.load());
+    }
+
+    // The current version as seen by the writer, which is the only one to replace it
+    const T& latest() const { return *current_.load(std::memory_order_relaxed); }
+
+    // Make next the current version; the replaced one is freed once no reader can still hold it
+    void publish(std::unique_ptr<const T> next) {
+        const T* previous = current_.exchange(next.release());
+        // Readers pinned in epochs up to `replaced` may have loaded `previous`
+        const uint64_t replaced = epoch_.fetch_add(1);
+        retired_.emplace_back(replaced, previous);
+        reclaim();
+    }
+
+private:
+    static constexpr size_t kSlots = 128;
+
+    struct alignas(64) Slot {
+        std::atomic<uint64_t> epoch{0}; // 0 while the slot is free
+    };
+
+    std::atomic<const T*> current_;
+    std::atomic<uint64_t> epoch_{1};
+    mutable Slot slots_[kSlots];
+    std::vector<std::pair<uint64_t, const T*>> retired_; // (last epoch it was current in, version)
+
+    // Claim a free slot, starting from one fixed per thread so that threads rarely collide
+    std::atomic<uint64_t>* pin() const {
+        static std::atomic<size_t> threads{0};
+        thread_local const size_t home = threads.fetch_add(1, std::memory_order_relaxed);
+        for (size_t attempt = 0;; ++attempt) {
+            Slot& slot = slots_[(home + attempt) % kSlots];
+            uint64_t idle = 0;
+            if (slot.epoch.load(std::memory_order_relaxed) == 0 &&
+                slot.epoch.compare_exchange_strong(idle, epoch_.load())) {
+                return &slot.epoch;
+            }
+            if (attempt % kSlots == kSlots - 1) {
+                std::this_thread::yield(); // More readers than slots: wait for one to finish
+            }
+        }
+    }
+
+    // Free the retired versions that every pinned reader started after
+    void reclaim() {
+        uint64_t oldest = UINT64_MAX;
+        for (const Slot& slot : slots_) {
+            const uint64_t epoch = slot.epoch.load();
+            if (epoch != 0 && epoch < oldest) {
+                oldest = epoch;
+            }
+        }
+        size_t kept = 0;
+        for (auto& entry : retired_) {
+            if (entry.first < oldest) {
+                delete entry.second;
+            } else {
+                retired_[kept++] = entry;
+            }
+        }
+        retired_.resize(kept);
+    }
+};
@@ -3,69 +3,94 @@
 #include <cmath>
 #include <vector>
 
-// Function to calculate Euclidean distance between two vectors
-static double euclidean_distance(const std::vector<double>& a, const std::vector<double>& b) {
-    double sum = 0.0;
-    for (size_t i = 0; i < a.size(); ++i) {
-        double diff = a[i] - b[i];
-        sum += diff * diff; // Accumulate squared differences
+#include "buffer_view.h"
+#include "metrics.h"
+#include "simd_kernels.h"
+
+// Metric value of two vectors given as arrays or sequences, as a Python float
+template <typename Metric>
+static PyObject* pair_distance(PyObject* obj_a, PyObject* obj_b) {
+    // View both inputs in place; float32/float64 buffers are not copied
+    const char* type_error = "Both arguments must be arrays or sequences of numbers.";
+    BufferView view_a, view_b;
+    if (!view_a.acquire(obj_a, 1, type_error) || !view_b.acquire(obj_b, 1, type_error)) {
+        return NULL;
+    }
+    if (view_a.size() != view_b.size()) {
+        PyErr_SetString(PyExc_ValueError, "Input arrays must have the same size.");
+        return NULL;
     }
-    return std::sqrt(sum); // Return the square root of the sum
+
+    // Calculate the distance with the metric traits, in float32 only when both inputs already are
+    double distance;
+    if (view_a.type() == BufferView::Type::Float32 && view_b.type() == BufferView::Type::Float32) {
+        std::vector<float> scratch_a, scratch_b;
+        distance = metrics::evaluate<Metric>(view_a.row(0, scratch_a), view_b.row(0, scratch_b), view_a.size());
+    } else {
+        std::vector<double> scratch_a, scratch_b;
+        distance = metrics::evaluate<Metric>(view_a.row(0, scratch_a), view_b.row(0, scratch_b), view_a.size());
+    }
+
+    // Return the result as a Python float
+    return PyFloat_FromDouble(distance);
 }
 
 // Python wrapper for the Euclidean distance function
 static PyObject* py_euclidean_distance(PyObject* self, PyObject* args) {
-    PyObject *list_a, *list_b;
-    
+    PyObject *obj_a, *obj_b;
+
     // Parse Python arguments
-    if (!PyArg_ParseTuple(args, "OO", &list_a, &list_b)) {
+    if (!PyArg_ParseTuple(args, "OO", &obj_a, &obj_b)) {
         return NULL; // Return NULL on failure
     }
+    return pair_distance<metrics::Euclidean>(obj_a, obj_b);
+}
 
-    // Ensure the input is numpy arrays
-    if (!PyArray_Check(list_a) || !PyArray_Check(list_b)) {
-        PyErr_SetString(PyExc_TypeError, "Both arguments must be numpy arrays.");
+// distance(a, b, metric="euclidean") for any metric of metrics.h
+static PyObject* py_distance(PyObject* self, PyObject* args, PyObject* kwds) {
+    static const char* kwlist[] = {"a", "b", "metric", NULL};
+    PyObject *obj_a, *obj_b;
+    const char* metric_name = "euclidean";
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "OO|s", const_cast<char**>(kwlist), &obj_a, &obj_b, &metric_name)) {
         return NULL;
     }
-
-    // Convert numpy arrays to vectors
-    double* data_a = static_cast<double*>(PyArray_DATA((PyArrayObject*)list_a));
-    double* data_b = static_cast<double*>(PyArray_DATA((PyArrayObject*)list_b));
-    npy_intp size_a = PyArray_SIZE((PyArrayObject*)list_a);
-    npy_intp size_b = PyArray_SIZE((PyArrayObject*)list_b);
-
-    if (size_a != size_b) {
-        PyErr_SetString(PyExc_ValueError, "Input arrays must have the same size.");
+    metrics::Metric metric;
+    if (!metrics::parse_metric(metric_name, metric)) {
+        PyErr_SetString(PyExc_ValueError, metrics::kUnknownMetric);
         return NULL;
     }
+    return metrics::visit(metric, [&](auto trait) { return pair_distance<decltype(trait)>(obj_a, obj_b); });
+}
 
-    std::vector<double> vec_a(data_a, data_a + size_a);
-    std::vector<double> vec_b(data_b, data_b + size_b);
-    
-    // Calculate the Euclidean distance
-    double distance = euclidean_distance(vec_a, vec_b);
-
-    // Return the result as a Python float
-    return PyFloat_FromDouble(distance);
+// Name of the kernel set selected for this CPU
+static PyObject* py_simd_level(PyObject* self, PyObject* args) {
+    return PyUnicode_FromString(simd_level_name(simd::active_level()));
 }
 
 // Method definitions for the module
 static PyMethodDef DistanceMetricsMethods[] = {
     {"euclidean_distance", py_euclidean_distance, METH_VARARGS, "Calculate Euclidean distance between two vectors."},
+    {"distance", (PyCFunction)(void (*)(void))py_distance, METH_VARARGS | METH_KEYWORDS,
+     "distance(a, b, metric='euclidean')\n\n"
+     "Metric value of two vectors: 'euclidean', 'sqeuclidean', 'manhattan' and 'hamming' are distances,\n"
+     "'ip' (inner product) and 'cosine' (cosine similarity) are similarities."},
+    {"simd_level", py_simd_level, METH_NOARGS,
+     "Return the SIMD kernel level in use: 'scalar', 'sse2', 'avx2', 'avx512' or 'neon'."},
     {NULL, NULL, 0, NULL} // Sentinel
 };
 
 // Module definition
 static struct PyModuleDef distancemetricsmodule = {
     PyModuleDef_HEAD_INIT,
-    "DistanceMetrics", // Module name
+    "euclidean", // Module name
     NULL, // Module documentation
     -1, // Size of per-interpreter state of the module
     DistanceMetricsMethods // Methods of the module
 };
 
 // Module initialization function
-PyMODINIT_FUNC PyInit_DistanceMetrics(void) {
+PyMODINIT_FUNC PyInit_euclidean(void) {
     import_array(); // Initialize the NumPy API
+    simd::init(); // Pick the distance kernels for this CPU once
     return PyModule_Create(&distancemetricsmodule); // Create the module
 }
\ No newline at end of file
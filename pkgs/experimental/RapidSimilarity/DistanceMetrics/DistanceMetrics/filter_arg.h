@@ -0,0 +1,221 @@
+#pragma once
+
+#include <Python.h>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+
+#include "id_set.h"
+
+// The filter= argument of the index queries, parsed into an IdFilter (id_set.h):
+//   - None: every id;
+//   - a 1-D bool array (or a list of bools) with one entry per id: the ids marked True;
+//   - a 1-D integer array (or a sequence of ints): the allowed ids;
+//   - a (column, op, value) tuple: the ids whose entry in the 1-D integer (or bool) column
+//     satisfies op, one of "==", "!=", "<", "<=", ">", ">=", or "in" with a sequence of values.
+// Masks and columns that export the buffer protocol are read in place and stay acquired for the
+// life of the FilterArg, which must therefore outlive the query.
+class FilterArg {
+public:
+    static constexpr const char* kUsage =
+        "filter must be None, a bool mask, an array of allowed ids or a (column, op, value) tuple.";
+
+    FilterArg() = default;
+    ~FilterArg() { release(); }
+
+    FilterArg(const FilterArg&) = delete;
+    FilterArg& operator=(const FilterArg&) = delete;
+
+    // Returns false with a Python exception set
+    bool acquire(PyObject* obj) {
+        release();
+        if (obj == nullptr || obj == Py_None) {
+            return true;
+        }
+        if (PyTuple_Check(obj)) {
+            return acquire_predicate(obj);
+        }
+        IdFilter::Column column;
+        bool is_bool;
+        if (!acquire_column(obj, column, is_bool)) {
+            return false;
+        }
+        if (is_bool) {
+            filter_ = IdFilter::mask(column);
+            return true;
+        }
+        IdBitmap allowed;
+        for (size_t i = 0; i < column.size; ++i) {
+            const int64_t id = column.at(i);
+            if (id < 0) {
+                PyErr_SetString(PyExc_ValueError, "Allowed ids must be non-negative.");
+                return false;
+            }
+            if (static_cast<uint64_t>(id) <= std::numeric_limits<uint32_t>::max()) {
+                allowed.set(static_cast<size_t>(id)); // Larger ids match no point
+            }
+        }
+        release();
+        filter_ = IdFilter::allow(std::move(allowed));
+        return true;
+    }
+
+    const IdFilter& filter() const { return filter_; }
+
+private:
+    Py_buffer buffer;
+    bool has_buffer = false;
+    std::vector<int64_t> owned; // Converted entries of non-buffer sequences
+    IdFilter filter_;
+
+    void release() {
+        if (has_buffer) {
+            PyBuffer_Release(&buffer);
+            has_buffer = false;
+        }
+        owned.clear();
+        filter_ = IdFilter();
+    }
+
+    // Native-order '?' or integer items of up to 8 bytes (optionally prefixed '@', '=' or '<' on
+    // little-endian targets); unsigned 64-bit items, which do not fit the comparisons, are refused
+    bool parse_format(IdFilter::Column& column, bool& is_bool) const {
+        const char* format = buffer.format != nullptr ? buffer.format : "B";
+        if (*format == '@' || *format == '=') {
+            ++format;
+        } else if (*format == '<') {
+            const uint16_t probe = 1;
+            uint8_t low;
+            std::memcpy(&low, &probe, 1);
+            if (low != 1) {
+                return false;
+            }
+            ++format;
+        }
+        if (format[0] == '\0' || format[1] != '\0' || std::strchr("?bBhHiIlLqQ", format[0]) == nullptr) {
+            return false;
+        }
+        const size_t item_size = static_cast<size_t>(buffer.itemsize);
+        if (item_size != 1 && item_size != 2 && item_size != 4 && item_size != 8) {
+            return false;
+        }
+        column.is_signed = std::strchr("bhilq", format[0]) != nullptr;
+        if (item_size == 8 && !column.is_signed) {
+            return false;
+        }
+        column.item_size = item_size;
+        is_bool = format[0] == '?';
+        return true;
+    }
+
+    // A 1-D integer or bool column, read in place when obj exports a buffer
+    bool acquire_column(PyObject* obj, IdFilter::Column& column, bool& is_bool) {
+        if (PyObject_CheckBuffer(obj)) {
+            if (PyObject_GetBuffer(obj, &buffer, PyBUF_RECORDS_RO) != 0) {
+                return false;
+            }
+            has_buffer = true;
+            if (buffer.ndim != 1 || !parse_format(column, is_bool)) {
+                release();
+                PyErr_SetString(PyExc_TypeError,
+                                "Filter masks and columns must be 1-D arrays of bools or integers up to int64.");
+                return false;
+            }
+            column.base = static_cast<const char*>(buffer.buf);
+            column.stride = buffer.strides[0];
+            column.size = static_cast<size_t>(buffer.shape[0]);
+            return true;
+        }
+        if (!PySequence_Check(obj) || PyUnicode_Check(obj) || PyBytes_Check(obj)) {
+            PyErr_SetString(PyExc_TypeError, kUsage);
+            return false;
+        }
+        PyObject* items = PySequence_Fast(obj, kUsage);
+        if (items == nullptr) {
+            return false;
+        }
+        const Py_ssize_t count = PySequence_Fast_GET_SIZE(items);
+        PyObject** elements = PySequence_Fast_ITEMS(items);
+        is_bool = count > 0;
+        for (Py_ssize_t i = 0; i < count; ++i) {
+            is_bool = is_bool && PyBool_Check(elements[i]);
+            const long long value = PyLong_AsLongLong(elements[i]);
+            if (value == -1 && PyErr_Occurred()) {
+                Py_DECREF(items);
+                owned.clear();
+                return false;
+            }
+            owned.push_back(static_cast<int64_t>(value));
+        }
+        Py_DECREF(items);
+        column.base = reinterpret_cast<const char*>(owned.data());
+        column.stride = sizeof(int64_t);
+        column.size = owned.size();
+        column.item_size = sizeof(int64_t);
+        column.is_signed = true;
+        return true;
+    }
+
+    static bool parse_op(const char* name, IdFilter::Op& op) {
+        static const struct {
+            const char* name;
+            IdFilter::Op op;
+        } ops[] = {{"==", IdFilter::Op::Equal},     {"!=", IdFilter::Op::NotEqual},
+                   {"<", IdFilter::Op::Less},       {"<=", IdFilter::Op::LessEqual},
+                   {">", IdFilter::Op::Greater},    {">=", IdFilter::Op::GreaterEqual},
+                   {"in", IdFilter::Op::In}};
+        for (const auto& entry : ops) {
+            if (std::strcmp(name, entry.name) == 0) {
+                op = entry.op;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool acquire_predicate(PyObject* tuple) {
+        PyObject* column_obj;
+        const char* op_name;
+        PyObject* value_obj;
+        if (!PyArg_ParseTuple(tuple, "OsO;filter must be a (column, op, value) tuple", &column_obj, &op_name,
+                              &value_obj)) {
+            return false;
+        }
+        IdFilter::Op op;
+        if (!parse_op(op_name, op)) {
+            PyErr_SetString(PyExc_ValueError, "filter op must be '==', '!=', '<', '<=', '>', '>=' or 'in'.");
+            return false;
+        }
+        std::vector<int64_t> values;
+        if (op == IdFilter::Op::In) {
+            PyObject* items = PySequence_Fast(value_obj, "The value of an 'in' filter must be a sequence of ints.");
+            if (items == nullptr) {
+                return false;
+            }
+            for (Py_ssize_t i = 0; i < PySequence_Fast_GET_SIZE(items); ++i) {
+                const long long value = PyLong_AsLongLong(PySequence_Fast_GET_ITEM(items, i));
+                if (value == -1 && PyErr_Occurred()) {
+                    Py_DECREF(items);
+                    return false;
+                }
+                values.push_back(static_cast<int64_t>(value));
+            }
+            Py_DECREF(items);
+        } else {
+            const long long value = PyLong_AsLongLong(value_obj);
+            if (value == -1 && PyErr_Occurred()) {
+                return false;
+            }
+            values.push_back(static_cast<int64_t>(value));
+        }
+        IdFilter::Column column;
+        bool is_bool;
+        if (!acquire_column(column_obj, column, is_bool)) {
+            return false;
+        }
+        filter_ = IdFilter::where(column, op, std::move(values));
+        return true;
+    }
+};
@@ -0,0 +1,344 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <utility>
+
+// Growable bitmap over dense 32-bit ids, one bit per id. The indexes use it for tombstones (ids
+// deleted but still stored) and test it in their candidate loops before computing a distance.
+class IdBitmap {
+public:
+    IdBitmap() = default;
+    explicit IdBitmap(size_t size) { resize(size); }
+
+    // Make ids [0, size) addressable; new ids start cleared and the bitmap never shrinks
+    void resize(size_t size) {
+        if (size > size_) {
+            words_.resize((size + 63) / 64, 0);
+            size_ = size;
+        }
+    }
+
+    size_t size() const { return size_; }
+
+    // Ids at or beyond size() read as cleared
+    bool test(size_t id) const { return id < size_ && (words_[id >> 6] >> (id & 63)) & 1; }
+
+    // Set id and return whether it was clear before
+    bool set(size_t id) {
+        if (id >= size_) {
+            resize(id + 1);
+        }
+        const uint64_t bit = uint64_t(1) << (id & 63);
+        const bool was_clear = (words_[id >> 6] & bit) == 0;
+        words_[id >> 6] |= bit;
+        count_ += was_clear;
+        return was_clear;
+    }
+
+    void reset(size_t id) {
+        if (test(id)) {
+            words_[id >> 6] &= ~(uint64_t(1) << (id & 63));
+            --count_;
+        }
+    }
+
+    // Number of set ids
+    size_t count() const { return count_; }
+
+    // Packed words, 64 ids per word in ascending order, e.g. for an index file section
+    const std::vector<uint64_t>& words() const { return words_; }
+
+    // Bitmap of size ids over saved words; bits beyond size are dropped
+    static IdBitmap from_words(std::vector<uint64_t> words, size_t size) {
+        IdBitmap bitmap;
+        bitmap.words_ = std::move(words);
+        bitmap.words_.resize((size + 63) / 64, 0);
+        if (size % 64 != 0) {
+            bitmap.words_.back() &= (uint64_t(1) << (size % 64)) - 1;
+        }
+        bitmap.size_ = size;
+        for (uint64_t word : bitmap.words_) {
+            bitmap.count_ += static_cast<size_t>(__builtin_popcountll(word));
+        }
+        return bitmap;
+    }
+
+private:
+    std::vector<uint64_t> words_;
+    size_t size_ = 0;
+    size_t count_ = 0;
+};
+
+// Scratch set that deduplicates the candidates of one query, one bit per id. A thread keeps one
+// for all its queries (local()); it grows to the largest id bound seen, and reset() zeroes only the
+// words the previous query touched, so a query costs O(candidates) whatever the size of the index.
+class VisitedSet {
+public:
+    // Start a new query over ids [0, size)
+    void reset(size_t size) {
+        for (size_t word : touched_) {
+            words_[word] = 0;
+        }
+        touched_.clear();
+        if (words_.size() < (size + 63) / 64) {
+            words_.resize((size + 63) / 64, 0);
+        }
+    }
+
+    bool contains(size_t id) const { return (words_[id >> 6] >> (id & 63)) & 1; }
+
+    // Add id and return whether it was not in the set yet
+    bool insert(size_t id) {
+        uint64_t& word = words_[id >> 6];
+        const uint64_t bit = uint64_t(1) << (id & 63);
+        if (word & bit) {
+            return false;
+        }
+        if (word == 0) {
+            touched_.push_back(id >> 6);
+        }
+        word |= bit;
+        return true;
+    }
+
+    // The ids in the set in ascending order, read off the touched words
+    std::vector<uint32_t> sorted() {
+        std::sort(touched_.begin(), touched_.end());
+        std::vector<uint32_t> ids;
+        for (size_t w : touched_) {
+            for (uint64_t word = words_[w]; word != 0; word &= word - 1) {
+                ids.push_back(static_cast<uint32_t>((w << 6) + static_cast<size_t>(__builtin_ctzll(word))));
+            }
+        }
+        return ids;
+    }
+
+    // The calling thread's set
+    static VisitedSet& local() {
+        thread_local VisitedSet set;
+        return set;
+    }
+
+private:
+    std::vector<uint64_t> words_;
+    std::vector<size_t> touched_; // Words that hold a set bit
+};
+
+// Tombstone bitmap over 32-bit ids that one writer sets while any number of readers test it
+// without a lock. Bits live in pages of 2^20 ids that are allocated on first use and never moved
+// or freed before the bitmap, so a missing page simply reads as all clear. Writers (set, assign)
+// must be serialized by the caller.
+class AtomicIdBitmap {
+public:
+    AtomicIdBitmap() : pages_(new std::atomic<Page*>[kMaxPages]) {
+        for (size_t p = 0; p < kMaxPages; ++p) {
+            pages_[p].store(nullptr, std::memory_order_relaxed);
+        }
+    }
+
+    ~AtomicIdBitmap() {
+        for (size_t p = 0; p < kMaxPages; ++p) {
+            delete pages_[p].load(std::memory_order_relaxed);
+        }
+    }
+
+    AtomicIdBitmap(const AtomicIdBitmap&) = delete;
+    AtomicIdBitmap& operator=(const AtomicIdBitmap&) = delete;
+
+    bool test(size_t id) const {
+        const Page* page = id < kMaxIds ? pages_[id >> kPageShift].load(std::memory_order_acquire) : nullptr;
+        return page != nullptr && (page->words[(id & kPageMask) >> 6].load(std::memory_order_acquire) >> (id & 63)) & 1;
+    }
+
+    // Set id and return whether it was clear before
+    bool set(size_t id) {
+        std::atomic<uint64_t>& word = page_of(id).words[(id & kPageMask) >> 6];
+        const uint64_t bit = uint64_t(1) << (id & 63);
+        const bool was_clear = (word.fetch_or(bit) & bit) == 0;
+        if (was_clear) {
+            count_.fetch_add(1, std::memory_order_relaxed);
+        }
+        return was_clear;
+    }
+
+    // Number of set ids
+    size_t count() const { return count_.load(std::memory_order_relaxed); }
+
+    // Plain copy of ids [0, size), e.g. for a compaction that must see one fixed set of tombstones
+    IdBitmap snapshot(size_t size) const {
+        std::vector<uint64_t> words((size + 63) / 64, 0);
+        for (size_t w = 0; w < words.size(); ++w) {
+            const Page* page = pages_[(w << 6) >> kPageShift].load(std::memory_order_acquire);
+            if (page != nullptr) {
+                words[w] = page->words[((w << 6) & kPageMask) >> 6].load(std::memory_order_acquire);
+            }
+        }
+        return IdBitmap::from_words(std::move(words), size);
+    }
+
+    // Set every id set in bits (e.g. the tombstones of a loaded index)
+    void assign(const IdBitmap& bits) {
+        const std::vector<uint64_t>& words = bits.words();
+        for (size_t w = 0; w < words.size(); ++w) {
+            for (uint64_t word = words[w]; word != 0; word &= word - 1) {
+                set((w << 6) + static_cast<size_t>(__builtin_ctzll(word)));
+            }
+        }
+    }
+
+private:
+    static constexpr size_t kPageShift = 20;
+    static constexpr size_t kPageMask = (size_t(1) << kPageShift) - 1;
+    static constexpr size_t kMaxIds = size_t(1) << 32;
+    static constexpr size_t kMaxPages = kMaxIds >> kPageShift;
+
+    struct Page {
+        std::atomic<uint64_t> words[(size_t(1) << kPageShift) / 64];
+        Page() {
+            for (auto& word : words) {
+                word.store(0, std::memory_order_relaxed);
+            }
+        }
+    };
+
+    std::unique_ptr<std::atomic<Page*>[]> pages_;
+    std::atomic<size_t> count_{0};
+
+    Page& page_of(size_t id) {
+        if (id >= kMaxIds) {
+            throw std::out_of_range("Ids must fit in 32 bits.");
+        }
+        std::atomic<Page*>& slot = pages_[id >> kPageShift];
+        Page* page = slot.load(std::memory_order_relaxed);
+        if (page == nullptr) {
+            page = new Page();
+            slot.store(page, std::memory_order_release);
+        }
+        return *page;
+    }
+};
+
+// Candidate filter that keeps every id; the default of the indexes' filtered searches
+struct AcceptAll {
+    bool operator()(size_t) const { return true; }
+};
+
+// Filter given with a query: an allowed-id bitmap, a per-id byte mask, or a comparison on a per-id
+// integer attribute column. Masks and columns are borrowed and read in place, so a filter costs
+// nothing to set up; ids beyond the end of a mask or column are rejected. The indexes test it on
+// every candidate before computing a distance, and it is immutable, so one filter can be shared
+// by the threads of a batch query.
+class IdFilter {
+public:
+    enum class Op { Equal, NotEqual, Less, LessEqual, Greater, GreaterEqual, In };
+
+    // Integer entry of id i at base + i * stride, item_size bytes of native byte order
+    struct Column {
+        const char* base = nullptr;
+        ptrdiff_t stride = 0;
+        size_t size = 0;
+        size_t item_size = 1;
+        bool is_signed = false;
+
+        int64_t at(size_t i) const {
+            const char* item = base + static_cast<ptrdiff_t>(i) * stride;
+            switch (item_size) {
+            case 1: return is_signed ? int64_t(load<int8_t>(item)) : int64_t(load<uint8_t>(item));
+            case 2: return is_signed ? int64_t(load<int16_t>(item)) : int64_t(load<uint16_t>(item));
+            case 4: return is_signed ? int64_t(load<int32_t>(item)) : int64_t(load<uint32_t>(item));
+            default: return load<int64_t>(item);
+            }
+        }
+
+    private:
+        template <typename T>
+        static T load(const char* item) {
+            T value;
+            std::memcpy(&value, item, sizeof(T));
+            return value;
+        }
+    };
+
+    IdFilter() = default; // Accepts every id
+
+    static IdFilter allow(IdBitmap allowed) {
+        IdFilter filter;
+        filter.kind_ = Kind::Bitmap;
+        filter.allowed_ = std::move(allowed);
+        return filter;
+    }
+
+    // Ids whose mask entry is nonzero
+    static IdFilter mask(Column flags) {
+        IdFilter filter;
+        filter.kind_ = Kind::Mask;
+        filter.column_ = flags;
+        return filter;
+    }
+
+    // Ids whose attribute compares true against values[0], or for In equals any of values
+    static IdFilter where(Column column, Op op, std::vector<int64_t> values) {
+        IdFilter filter;
+        filter.kind_ = Kind::Attribute;
+        filter.column_ = column;
+        filter.op_ = op;
+        std::sort(values.begin(), values.end());
+        values.erase(std::unique(values.begin(), values.end()), values.end());
+        filter.values_ = std::move(values);
+        filter.value_ = filter.values_.empty() ? 0 : filter.values_[0];
+        return filter;
+    }
+
+    bool accepts_all() const { return kind_ == Kind::All; }
+
+    bool operator()(size_t id) const {
+        switch (kind_) {
+        case Kind::All:
+            return true;
+        case Kind::Bitmap:
+            return allowed_.test(id);
+        case Kind::Mask:
+            return id < column_.size && column_.at(id) != 0;
+        case Kind::Attribute:
+            return id < column_.size && matches(column_.at(id));
+        }
+        return false;
+    }
+
+private:
+    enum class Kind { All, Bitmap, Mask, Attribute };
+
+    Kind kind_ = Kind::All;
+    IdBitmap allowed_;
+    Column column_;
+    Op op_ = Op::Equal;
+    int64_t value_ = 0;
+    std::vector<int64_t> values_; // Sorted and distinct, for In
+
+    bool matches(int64_t attribute) const {
+        switch (op_) {
+        case Op::Equal: return attribute == value_;
+        case Op::NotEqual: return attribute != value_;
+        case Op::Less: return attribute < value_;
+        case Op::LessEqual: return attribute <= value_;
+        case Op::Greater: return attribute > value_;
+        case Op::GreaterEqual: return attribute >= value_;
+        case Op::In: return std::binary_search(values_.begin(), values_.end(), attribute);
+        }
+        return false;
+    }
+};
+
+// Call f with AcceptAll when filter keeps every id and with filter otherwise, so that unfiltered
+// queries run the search instantiated without any per-candidate test
+template <typename F>
+auto with_filter(const IdFilter& filter, F&& f) {
+    return filter.accepts_all() ? f(AcceptAll()) : f(filter);
+}
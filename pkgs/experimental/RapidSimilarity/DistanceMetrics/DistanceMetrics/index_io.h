@@ -0,0 +1,410 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <fstream>
+#include <sstream>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <type_traits>
+
+#if defined(_WIN32)
+  #ifndef NOMINMAX
+    #define NOMINMAX
+  #endif
+  #include <windows.h>
+#else
+  #include <fcntl.h>
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+  #include <unistd.h>
+#endif
+
+// On-disk index files. A file is a 64-byte header, a sequence of sections and a directory that
+// locates them; every section is one contiguous array starting on a 64-byte boundary. Integers
+// and floats are stored little-endian in native layout, so a file is loaded by mapping it
+// read-only and pointing the index arrays straight at their sections: nothing is parsed or
+// copied, and every process that maps the same file shares one page-cached copy.
+//
+// Each index writes its sections in a fixed order (parameters first) and reads them back in the
+// same order; the directory records every section's element size and count so a truncated or
+// foreign file is rejected instead of misread.
+namespace index_io {
+
+// Bumped whenever a section layout changes; 2 added the vector-store sections (storage.h), 3 the
+// metric of HNSW graphs, 4 the id bound of kd-trees and the tombstones of LSH indexes
+constexpr uint32_t kVersion = 4;
+constexpr size_t kAlignment = 64;
+constexpr uint32_t kByteOrderMark = 0x01020304;
+
+// What an index file holds; loading checks it against the expected kind
+enum class Kind : uint32_t {
+    KDTree = 1,
+    LSH = 2,
+    IVF = 3,
+    HNSW = 4
+};
+
+struct FileHeader {
+    char magic[8];             // "RSINDEX\0"
+    uint32_t version;
+    uint32_t kind;
+    uint32_t byte_order;       // kByteOrderMark as written by the producer
+    uint32_t num_sections;
+    uint64_t directory_offset; // Byte offset of num_sections SectionEntry records
+    uint64_t file_size;
+    uint8_t reserved[24];
+};
+static_assert(sizeof(FileHeader) == 64, "index file header must be 64 bytes");
+
+struct SectionEntry {
+    uint64_t offset;
+    uint64_t count;
+    uint32_t element_size;
+    uint32_t reserved;
+};
+static_assert(sizeof(SectionEntry) == 24, "index file directory entries must be 24 bytes");
+
+static const char kMagic[8] = {'R', 'S', 'I', 'N', 'D', 'E', 'X', '\0'};
+
+// Read-only memory map of a whole file, unmapped when the last Array viewing it goes away
+class MappedFile {
+public:
+    explicit MappedFile(const std::string& path) {
+#if defined(_WIN32)
+        file_ = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (file_ == INVALID_HANDLE_VALUE) {
+            throw std::runtime_error("Cannot open index file '" + path + "'.");
+        }
+        LARGE_INTEGER size;
+        if (!GetFileSizeEx(file_, &size)) {
+            CloseHandle(file_);
+            throw std::runtime_error("Cannot read the size of index file '" + path + "'.");
+        }
+        size_ = static_cast<size_t>(size.QuadPart);
+        if (size_ > 0) {
+            mapping_ = CreateFileMappingA(file_, NULL, PAGE_READONLY, 0, 0, NULL);
+            data_ = mapping_ == NULL ? NULL : MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0);
+            if (data_ == NULL) {
+                if (mapping_ != NULL) {
+                    CloseHandle(mapping_);
+                }
+                CloseHandle(file_);
+                throw std::runtime_error("Cannot map index file '" + path + "'.");
+            }
+        }
+#else
+        const int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw std::runtime_error("Cannot open index file '" + path + "'.");
+        }
+        struct stat info;
+        if (::fstat(fd, &info) != 0) {
+            ::close(fd);
+            throw std::runtime_error("Cannot read the size of index file '" + path + "'.");
+        }
+        size_ = static_cast<size_t>(info.st_size);
+        if (size_ > 0) {
+            void* data = ::mmap(NULL, size_, PROT_READ, MAP_SHARED, fd, 0);
+            if (data == MAP_FAILED) {
+                ::close(fd);
+                throw std::runtime_error("Cannot map index file '" + path + "'.");
+            }
+            data_ = data;
+        }
+        ::close(fd);  // The mapping stays valid without the descriptor
+#endif
+    }
+
+    ~MappedFile() {
+#if defined(_WIN32)
+        if (data_ != NULL) {
+            UnmapViewOfFile(data_);
+            CloseHandle(mapping_);
+        }
+        CloseHandle(file_);
+#else
+        if (data_ != NULL) {
+            ::munmap(data_, size_);
+        }
+#endif
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const unsigned char* data() const { return static_cast<const unsigned char*>(data_); }
+    size_t size() const { return size_; }
+
+private:
+    void* data_ = NULL;
+    size_t size_ = 0;
+#if defined(_WIN32)
+    HANDLE file_ = INVALID_HANDLE_VALUE;
+    HANDLE mapping_ = NULL;
+#endif
+};
+
+// Contiguous array that either owns its elements or views a section of a mapped file. Reads go
+// through data() / operator[] either way; edit() turns a mapped view into an owned copy first,
+// so an index loaded from disk stays mapped until it is modified.
+template <typename T>
+class Array {
+public:
+    Array() = default;
+    Array(std::vector<T> values) : owned_(std::move(values)) {}
+    Array(const T* view, size_t size, std::shared_ptr<const MappedFile> file)
+        : view_(view), size_(size), file_(std::move(file)) {}
+
+    Array& operator=(std::vector<T> values) {
+        owned_ = std::move(values);
+        release();
+        return *this;
+    }
+
+    const T* data() const { return file_ ? view_ : owned_.data(); }
+    size_t size() const { return file_ ? size_ : owned_.size(); }
+    bool empty() const { return size() == 0; }
+    bool mapped() const { return static_cast<bool>(file_); }
+    const T& operator[](size_t i) const { return data()[i]; }
+    const T* begin() const { return data(); }
+    const T* end() const { return data() + size(); }
+
+    // Owned elements for modification (copy-on-write for mapped views)
+    std::vector<T>& edit() {
+        if (file_) {
+            owned_.assign(view_, view_ + size_);
+            release();
+        }
+        return owned_;
+    }
+
+private:
+    std::vector<T> owned_;
+    const T* view_ = nullptr;
+    size_t size_ = 0;
+    std::shared_ptr<const MappedFile> file_;
+
+    void release() {
+        view_ = nullptr;
+        size_ = 0;
+        file_.reset();
+    }
+};
+
+// Streams sections into a temporary file next to path; commit() writes the directory and header
+// and renames it over path. The old file is never truncated, so an index still mapped from it
+// (loaded from path and saved back there) keeps reading valid data while it writes, and readers
+// of path see either the old or the new index, never a partial one. Without commit() the
+// temporary file is removed.
+class Writer {
+public:
+    Writer(const std::string& path, Kind kind)
+        : path_(path), temp_path_(temporary_path(path)), kind_(kind),
+          out_(temp_path_, std::ios::binary | std::ios::trunc) {
+        if (!out_) {
+            throw std::runtime_error("Cannot create index file '" + path + "'.");
+        }
+        const FileHeader placeholder = {};
+        out_.write(reinterpret_cast<const char*>(&placeholder), sizeof(placeholder));
+        offset_ = sizeof(placeholder);
+    }
+
+    // Append one section of count trivially copyable elements
+    template <typename T>
+    void write(const T* data, size_t count) {
+        static_assert(std::is_trivially_copyable<T>::value, "index sections hold plain data");
+        pad();
+        sections_.push_back(SectionEntry{offset_, count, static_cast<uint32_t>(sizeof(T)), 0});
+        if (count > 0) {
+            out_.write(reinterpret_cast<const char*>(data), static_cast<std::streamsize>(count * sizeof(T)));
+            offset_ += count * sizeof(T);
+        }
+    }
+
+    template <typename T>
+    void write(const std::vector<T>& values) { write(values.data(), values.size()); }
+
+    template <typename T>
+    void write(const Array<T>& values) { write(values.data(), values.size()); }
+
+    // Text section, e.g. the serialized state of a random number generator
+    void write_text(const std::string& text) { write(text.data(), text.size()); }
+
+    void commit() {
+        pad();
+        FileHeader header = {};
+        std::memcpy(header.magic, kMagic, sizeof(kMagic));
+        header.version = kVersion;
+        header.kind = static_cast<uint32_t>(kind_);
+        header.byte_order = kByteOrderMark;
+        header.num_sections = static_cast<uint32_t>(sections_.size());
+        header.directory_offset = offset_;
+        header.file_size = offset_ + sections_.size() * sizeof(SectionEntry);
+        out_.write(reinterpret_cast<const char*>(sections_.data()),
+                   static_cast<std::streamsize>(sections_.size() * sizeof(SectionEntry)));
+        out_.seekp(0);
+        out_.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out_.close();
+        if (!out_ || !replace_file(temp_path_, path_)) {
+            throw std::runtime_error("Cannot write index file '" + path_ + "'.");
+        }
+        committed_ = true;
+    }
+
+    ~Writer() {
+        if (!committed_) {
+            out_.close();
+            std::remove(temp_path_.c_str());
+        }
+    }
+
+    Writer(const Writer&) = delete;
+    Writer& operator=(const Writer&) = delete;
+
+private:
+    std::string path_;
+    std::string temp_path_;
+    Kind kind_;
+    std::ofstream out_;
+    uint64_t offset_ = 0;
+    std::vector<SectionEntry> sections_;
+    bool committed_ = false;
+
+    // Unique per process and writer, in the directory of path so the rename stays on one file system
+    static std::string temporary_path(const std::string& path) {
+        static std::atomic<unsigned long> counter{0};
+#if defined(_WIN32)
+        const unsigned long process = static_cast<unsigned long>(GetCurrentProcessId());
+#else
+        const unsigned long process = static_cast<unsigned long>(getpid());
+#endif
+        return path + ".tmp" + std::to_string(process) + "." + std::to_string(counter.fetch_add(1));
+    }
+
+    static bool replace_file(const std::string& from, const std::string& to) {
+#if defined(_WIN32)
+        return MoveFileExA(from.c_str(), to.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+        return std::rename(from.c_str(), to.c_str()) == 0;
+#endif
+    }
+
+    void pad() {
+        static const char zeros[kAlignment] = {};
+        const size_t padding = (kAlignment - offset_ % kAlignment) % kAlignment;
+        out_.write(zeros, static_cast<std::streamsize>(padding));
+        offset_ += padding;
+    }
+};
+
+// Maps a file and hands out its sections in order
+class Reader {
+public:
+    Reader(const std::string& path, Kind expected) : file_(std::make_shared<const MappedFile>(path)) {
+        FileHeader header;
+        if (file_->size() < sizeof(header)) {
+            throw std::invalid_argument("'" + path + "' is not a RapidSimilarity index file.");
+        }
+        std::memcpy(&header, file_->data(), sizeof(header));
+        if (std::memcmp(header.magic, kMagic, sizeof(kMagic)) != 0) {
+            throw std::invalid_argument("'" + path + "' is not a RapidSimilarity index file.");
+        }
+        if (header.byte_order != kByteOrderMark) {
+            throw std::invalid_argument("Index file '" + path + "' was written with a different byte order.");
+        }
+        if (header.version != kVersion) {
+            throw std::invalid_argument("Index file '" + path + "' has unsupported format version " +
+                                        std::to_string(header.version) + ".");
+        }
+        if (header.kind != static_cast<uint32_t>(expected)) {
+            throw std::invalid_argument("Index file '" + path + "' holds a different kind of index.");
+        }
+        const uint64_t directory_bytes = static_cast<uint64_t>(header.num_sections) * sizeof(SectionEntry);
+        if (header.file_size != file_->size() || header.directory_offset > file_->size() ||
+            directory_bytes > file_->size() - header.directory_offset) {
+            throw std::invalid_argument("Index file '" + path + "' is truncated.");
+        }
+        sections_.resize(header.num_sections);
+        std::memcpy(sections_.data(), file_->data() + header.directory_offset, directory_bytes);
+        for (const SectionEntry& section : sections_) {
+            if (section.offset % kAlignment != 0 || section.offset > header.directory_offset ||
+                section.count > (header.directory_offset - section.offset) / std::max<uint32_t>(section.element_size, 1)) {
+                throw std::invalid_argument("Index file '" + path + "' is corrupt.");
+            }
+        }
+    }
+
+    // Next section as a view into the mapping
+    template <typename T>
+    Array<T> array() {
+        const SectionEntry& section = next(sizeof(T));
+        return Array<T>(reinterpret_cast<const T*>(file_->data() + section.offset), static_cast<size_t>(section.count),
+                        file_);
+    }
+
+    // Next section copied out, for small arrays the index rebuilds or mutates anyway
+    template <typename T>
+    std::vector<T> vector() {
+        const SectionEntry& section = next(sizeof(T));
+        const T* data = reinterpret_cast<const T*>(file_->data() + section.offset);
+        return std::vector<T>(data, data + section.count);
+    }
+
+    // Next section, which must hold exactly count elements
+    template <typename T>
+    std::vector<T> vector(size_t count) {
+        std::vector<T> values = vector<T>();
+        if (values.size() != count) {
+            throw std::invalid_argument("Index file section has an unexpected length.");
+        }
+        return values;
+    }
+
+    std::string text() {
+        const SectionEntry& section = next(1);
+        return std::string(reinterpret_cast<const char*>(file_->data() + section.offset),
+                           static_cast<size_t>(section.count));
+    }
+
+private:
+    std::shared_ptr<const MappedFile> file_;
+    std::vector<SectionEntry> sections_;
+    size_t next_ = 0;
+
+    const SectionEntry& next(size_t element_size) {
+        if (next_ >= sections_.size()) {
+            throw std::invalid_argument("Index file ends before all of its sections.");
+        }
+        const SectionEntry& section = sections_[next_++];
+        if (section.element_size != element_size) {
+            throw std::invalid_argument("Index file section has an unexpected element type.");
+        }
+        return section;
+    }
+};
+
+// Text form of a random engine's state, so a loaded index keeps drawing the same sequence
+template <typename Engine>
+std::string engine_state(const Engine& engine) {
+    std::ostringstream out;
+    out << engine;
+    return out.str();
+}
+
+template <typename Engine>
+void restore_engine(Engine& engine, const std::string& state) {
+    std::istringstream in(state);
+    in >> engine;
+    if (!in) {
+        throw std::invalid_argument("Index file holds an invalid random generator state.");
+    }
+}
+
+} // namespace index_io
@@ -0,0 +1,275 @@
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+
+#include "simd_kernels.h"
+
+// The metrics every engine can search with, as traits the index templates take as a parameter.
+// Indexes keep a rank per candidate, where smaller is always nearer, and turn the k winners into
+// the metric's reported value at the end:
+//
+//   trait         rank                      value        reported order
+//   Euclidean     |a - b|^2                 sqrt(rank)   ascending distance
+//   SqEuclidean   |a - b|^2                 rank         ascending distance
+//   InnerProduct  -a.b                      -rank        descending similarity
+//   Cosine        -a.b / (|a| |b|)          -rank        descending similarity
+//   Manhattan     sum |a_i - b_i|           rank         ascending distance
+//   Hamming       count of a_i != b_i       rank         ascending distance
+//
+// The Euclidean and dot-product ranks go through the runtime-selected SIMD kernels; Manhattan and
+// Hamming are short loops written here, so they inline into the caller's candidate loop.
+namespace metrics {
+
+enum class Metric : uint32_t {
+    Euclidean,    // |x - y|
+    SqEuclidean,  // |x - y|^2
+    InnerProduct, // x.y
+    Cosine,       // x.y / (|x| |y|), 0 when either vector is zero
+    Manhattan,    // sum |x_i - y_i|
+    Hamming       // number of coordinates where x and y differ
+};
+
+// How a rank can be read off vectors kept in a compact store (see VectorStore::rank)
+enum class Basis {
+    SquaredL2, // rank is the squared Euclidean distance
+    Dot,       // rank is the negated inner product
+    Rows       // rank needs the decoded rows
+};
+
+struct Euclidean {
+    static constexpr Metric kind = Metric::Euclidean;
+    static constexpr Basis basis = Basis::SquaredL2;
+    static constexpr bool ascending = true;
+    static constexpr bool separable = true; // one coordinate's gap bounds the rank (kd-trees)
+
+    template <typename T>
+    static T rank(const T* a, const T* b, size_t n) {
+        return simd::kernels<T>().l2sq(a, b, n);
+    }
+    template <typename T>
+    static T value(T rank) {
+        return std::sqrt(rank < T(0) ? T(0) : rank);
+    }
+    // Rank of a reported value, for radius queries
+    template <typename T>
+    static T rank_of(T value) {
+        return value * value;
+    }
+    // Lower bound on the rank of any point whose coordinate is gap away from the query's
+    template <typename T>
+    static T axis_rank(T gap) {
+        return gap * gap;
+    }
+};
+
+struct SqEuclidean {
+    static constexpr Metric kind = Metric::SqEuclidean;
+    static constexpr Basis basis = Basis::SquaredL2;
+    static constexpr bool ascending = true;
+    static constexpr bool separable = true;
+
+    template <typename T>
+    static T rank(const T* a, const T* b, size_t n) {
+        return simd::kernels<T>().l2sq(a, b, n);
+    }
+    template <typename T>
+    static T value(T rank) {
+        return rank < T(0) ? T(0) : rank;
+    }
+    template <typename T>
+    static T rank_of(T value) {
+        return value;
+    }
+    template <typename T>
+    static T axis_rank(T gap) {
+        return gap * gap;
+    }
+};
+
+struct InnerProduct {
+    static constexpr Metric kind = Metric::InnerProduct;
+    static constexpr Basis basis = Basis::Dot;
+    static constexpr bool ascending = false;
+    static constexpr bool separable = false;
+
+    template <typename T>
+    static T rank(const T* a, const T* b, size_t n) {
+        return -simd::kernels<T>().dot(a, b, n);
+    }
+    template <typename T>
+    static T value(T rank) {
+        return -rank;
+    }
+    template <typename T>
+    static T rank_of(T value) {
+        return -value;
+    }
+};
+
+struct Cosine {
+    static constexpr Metric kind = Metric::Cosine;
+    static constexpr Basis basis = Basis::Rows;
+    static constexpr bool ascending = false;
+    static constexpr bool separable = false;
+
+    template <typename T>
+    static T rank(const T* a, const T* b, size_t n) {
+        return -simd::cosine(a, b, n);
+    }
+    template <typename T>
+    static T value(T rank) {
+        return -rank;
+    }
+    template <typename T>
+    static T rank_of(T value) {
+        return -value;
+    }
+};
+
+struct Manhattan {
+    static constexpr Metric kind = Metric::Manhattan;
+    static constexpr Basis basis = Basis::Rows;
+    static constexpr bool ascending = true;
+    static constexpr bool separable = true;
+
+    // Four partial sums so the additions do not wait on each other
+    template <typename T>
+    static T rank(const T* a, const T* b, size_t n) {
+        T sum[4] = {T(0), T(0), T(0), T(0)};
+        size_t i = 0;
+        for (; i + 4 <= n; i += 4) {
+            for (size_t j = 0; j < 4; ++j) {
+                sum[j] += std::abs(a[i + j] - b[i + j]);
+            }
+        }
+        for (; i < n; ++i) {
+            sum[0] += std::abs(a[i] - b[i]);
+        }
+        return (sum[0] + sum[1]) + (sum[2] + sum[3]);
+    }
+    template <typename T>
+    static T value(T rank) {
+        return rank;
+    }
+    template <typename T>
+    static T rank_of(T value) {
+        return value;
+    }
+    template <typename T>
+    static T axis_rank(T gap) {
+        return std::abs(gap);
+    }
+};
+
+struct Hamming {
+    static constexpr Metric kind = Metric::Hamming;
+    static constexpr Basis basis = Basis::Rows;
+    static constexpr bool ascending = true;
+    static constexpr bool separable = true;
+
+    // Counted in an integer so the loop vectorizes; exact for binary and categorical codes
+    template <typename T>
+    static T rank(const T* a, const T* b, size_t n) {
+        size_t differ = 0;
+        for (size_t i = 0; i < n; ++i) {
+            differ += a[i] != b[i];
+        }
+        return static_cast<T>(differ);
+    }
+    template <typename T>
+    static T value(T rank) {
+        return rank;
+    }
+    template <typename T>
+    static T rank_of(T value) {
+        return value;
+    }
+    // Points across the split differ from the query on that coordinate unless it lies on the plane
+    template <typename T>
+    static T axis_rank(T gap) {
+        return gap != T(0) ? T(1) : T(0);
+    }
+};
+
+// Metric value of a and b, e.g. for a single pair or a one-off scan
+template <typename M, typename T>
+T evaluate(const T* a, const T* b, size_t n) {
+    return M::value(M::rank(a, b, n));
+}
+
+// Call f with the trait of a runtime metric, so each (engine, metric) pair is its own instantiation
+template <typename F>
+auto visit(Metric metric, F&& f) -> decltype(f(Euclidean())) {
+    switch (metric) {
+        case Metric::SqEuclidean: return f(SqEuclidean());
+        case Metric::InnerProduct: return f(InnerProduct());
+        case Metric::Cosine: return f(Cosine());
+        case Metric::Manhattan: return f(Manhattan());
+        case Metric::Hamming: return f(Hamming());
+        default: return f(Euclidean());
+    }
+}
+
+// Whether smaller values are nearer (distances) or larger ones (similarities)
+inline bool ascending(Metric metric) {
+    return visit(metric, [](auto trait) { return decltype(trait)::ascending; });
+}
+
+// Whether kd-trees can prune on one coordinate's gap for this metric
+inline bool separable(Metric metric) {
+    return visit(metric, [](auto trait) { return decltype(trait)::separable; });
+}
+
+// Whether the metric is derived from inner products and norms alone (see pairwise.h)
+inline bool dot_based(Metric metric) {
+    return metric != Metric::Manhattan && metric != Metric::Hamming;
+}
+
+inline const char* metric_name(Metric metric) {
+    switch (metric) {
+        case Metric::SqEuclidean: return "sqeuclidean";
+        case Metric::InnerProduct: return "ip";
+        case Metric::Cosine: return "cosine";
+        case Metric::Manhattan: return "manhattan";
+        case Metric::Hamming: return "hamming";
+        default: return "euclidean";
+    }
+}
+
+// Parse a metric name as accepted from Python; returns false for unknown names
+inline bool parse_metric(const char* name, Metric& metric) {
+    if (std::strcmp(name, "euclidean") == 0 || std::strcmp(name, "l2") == 0) {
+        metric = Metric::Euclidean;
+    } else if (std::strcmp(name, "sqeuclidean") == 0) {
+        metric = Metric::SqEuclidean;
+    } else if (std::strcmp(name, "ip") == 0 || std::strcmp(name, "dot") == 0) {
+        metric = Metric::InnerProduct;
+    } else if (std::strcmp(name, "cosine") == 0) {
+        metric = Metric::Cosine;
+    } else if (std::strcmp(name, "manhattan") == 0 || std::strcmp(name, "l1") == 0) {
+        metric = Metric::Manhattan;
+    } else if (std::strcmp(name, "hamming") == 0) {
+        metric = Metric::Hamming;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// Message for names parse_metric rejects
+constexpr const char* kUnknownMetric =
+    "metric must be 'euclidean', 'sqeuclidean', 'ip', 'cosine', 'manhattan' or 'hamming'.";
+
+// Metric id read back from an index file
+inline Metric metric_from_id(uint64_t id) {
+    if (id > static_cast<uint64_t>(Metric::Hamming)) {
+        throw std::invalid_argument("Index file names an unknown metric.");
+    }
+    return static_cast<Metric>(id);
+}
+
+} // namespace metrics
@@ -0,0 +1,155 @@
+#include <Python.h>
+#include <numpy/arrayobject.h>
+#include <vector>
+#include <exception>
+#include <new>
+#include <stdexcept>
+
+#include "buffer_view.h"
+#include "pairwise.h"
+#include "simd_kernels.h"
+
+// Translate the active C++ exception into a Python exception
+static PyObject* set_python_error() {
+    try {
+        throw;
+    } catch (const std::invalid_argument& e) {
+        PyErr_SetString(PyExc_ValueError, e.what());
+    } catch (const std::bad_alloc&) {
+        PyErr_NoMemory();
+    } catch (const std::exception& e) {
+        PyErr_SetString(PyExc_RuntimeError, e.what());
+    }
+    return NULL;
+}
+
+// Distances between the rows of x and y into a new (rows of x, rows of y) array, or a 1-D array
+// when the query side is a single vector. float32 only when both inputs already are.
+template <typename T>
+static PyObject* distance_matrix(const BufferView& x, const BufferView& y, pairwise::Metric metric,
+                                 size_t num_threads, int ndim) {
+    const int type_num = sizeof(T) == sizeof(float) ? NPY_FLOAT : NPY_DOUBLE;
+    npy_intp dims[2] = {static_cast<npy_intp>(x.rows()), static_cast<npy_intp>(y.rows())};
+    PyObject* result = ndim == 2 ? PyArray_SimpleNew(2, dims, type_num) : PyArray_SimpleNew(1, dims + 1, type_num);
+    if (result == NULL) {
+        return NULL;
+    }
+
+    std::vector<T> x_scratch, y_scratch;
+    const T* x_data = x.data(x_scratch);
+    const T* y_data = y.data(y_scratch);
+    T* out = static_cast<T*>(PyArray_DATA(reinterpret_cast<PyArrayObject*>(result)));
+    std::exception_ptr error;
+
+    Py_BEGIN_ALLOW_THREADS
+    try {
+        pairwise::cdist(x_data, x.rows(), y_data, y.rows(), x.cols(), metric, out, num_threads);
+    } catch (...) {
+        error = std::current_exception();
+    }
+    Py_END_ALLOW_THREADS
+
+    if (error) {
+        Py_DECREF(result);
+        try {
+            std::rethrow_exception(error);
+        } catch (...) {
+            return set_python_error();
+        }
+    }
+    return result;
+}
+
+static PyObject* dispatch(const BufferView& x, const BufferView& y, const char* metric_name, Py_ssize_t num_threads,
+                          int ndim) {
+    pairwise::Metric metric;
+    if (!pairwise::parse_metric(metric_name, metric)) {
+        PyErr_SetString(PyExc_ValueError, metrics::kUnknownMetric);
+        return NULL;
+    }
+    if (num_threads < 0) {
+        PyErr_SetString(PyExc_ValueError, "num_threads must be non-negative.");
+        return NULL;
+    }
+    if ((x.rows() > 0 && x.cols() == 0) || (y.rows() > 0 && y.cols() == 0)) {
+        PyErr_SetString(PyExc_ValueError, "Vectors must have at least one dimension.");
+        return NULL;
+    }
+    if (x.rows() > 0 && y.rows() > 0 && x.cols() != y.cols()) {
+        PyErr_SetString(PyExc_ValueError, "Vectors must have the same number of dimensions.");
+        return NULL;
+    }
+    const bool float32 = x.type() == BufferView::Type::Float32 && y.type() == BufferView::Type::Float32;
+    const size_t threads = static_cast<size_t>(num_threads);
+    return float32 ? distance_matrix<float>(x, y, metric, threads, ndim)
+                   : distance_matrix<double>(x, y, metric, threads, ndim);
+}
+
+// cdist(X, Y, metric="euclidean", num_threads=0) -> (len(X), len(Y)) array
+static PyObject* py_cdist(PyObject* self, PyObject* args, PyObject* kwds) {
+    static const char* kwlist[] = {"X", "Y", "metric", "num_threads", NULL};
+    PyObject* x_obj;
+    PyObject* y_obj;
+    const char* metric = "euclidean";
+    Py_ssize_t num_threads = 0;
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "OO|sn", const_cast<char**>(kwlist), &x_obj, &y_obj, &metric,
+                                     &num_threads)) {
+        return NULL;
+    }
+
+    BufferView x, y;
+    if (!x.acquire(x_obj, 2, "X must be a 2-dimensional array.") ||
+        !y.acquire(y_obj, 2, "Y must be a 2-dimensional array.")) {
+        return NULL;
+    }
+    return dispatch(x, y, metric, num_threads, 2);
+}
+
+// one_to_many(q, X, metric="euclidean", num_threads=0) -> (len(X),) array
+static PyObject* py_one_to_many(PyObject* self, PyObject* args, PyObject* kwds) {
+    static const char* kwlist[] = {"q", "X", "metric", "num_threads", NULL};
+    PyObject* q_obj;
+    PyObject* x_obj;
+    const char* metric = "euclidean";
+    Py_ssize_t num_threads = 0;
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "OO|sn", const_cast<char**>(kwlist), &q_obj, &x_obj, &metric,
+                                     &num_threads)) {
+        return NULL;
+    }
+
+    BufferView q, x;
+    if (!q.acquire(q_obj, 1, "q must be a 1-dimensional array.") ||
+        !x.acquire(x_obj, 2, "X must be a 2-dimensional array.")) {
+        return NULL;
+    }
+    return dispatch(q, x, metric, num_threads, 1);
+}
+
+// Module method definitions
+static PyMethodDef PairwiseMethods[] = {
+    {"cdist", (PyCFunction)(void (*)(void))py_cdist, METH_VARARGS | METH_KEYWORDS,
+     "cdist(X, Y, metric='euclidean', num_threads=0)\n\n"
+     "Distances between every row of X and every row of Y as a (len(X), len(Y)) array.\n"
+     "metric is 'euclidean', 'sqeuclidean', 'ip' (inner product), 'cosine' (cosine similarity),\n"
+     "'manhattan' (L1) or 'hamming' (number of differing coordinates)."},
+    {"one_to_many", (PyCFunction)(void (*)(void))py_one_to_many, METH_VARARGS | METH_KEYWORDS,
+     "one_to_many(q, X, metric='euclidean', num_threads=0)\n\n"
+     "Distances between the vector q and every row of X as a 1-D array; metrics as for cdist."},
+    {NULL, NULL, 0, NULL}  // Sentinel
+};
+
+// Module definition
+static struct PyModuleDef pairwisemodule = {
+    PyModuleDef_HEAD_INIT,
+    "pairwise", // Module name
+    NULL, // Module documentation
+    -1, // Size of per-interpreter state of the module
+    PairwiseMethods // Methods of the module
+};
+
+// Module initialization function
+PyMODINIT_FUNC PyInit_pairwise(void) {
+    import_array(); // Initialize the NumPy API
+    simd::init(); // Pick the distance kernels for this CPU once
+    return PyModule_Create(&pairwisemodule);
+}
@@ -0,0 +1,135 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+
+#include "metrics.h"
+#include "simd_kernels.h"
+#include "thread_pool.h"
+
+// Dense distance matrices between two sets of row-major vectors. Every metric is derived from the
+// inner products x.y, which are computed tile by tile like a matrix product: a block of X rows is
+// swept over a block of Y rows small enough to stay in cache, four Y rows at a time so each load of
+// x feeds four accumulators. Euclidean distances then use |x|^2 + |y|^2 - 2 x.y.
+namespace pairwise {
+
+// Metric names and parsing are shared with the index engines (metrics.h)
+using metrics::Metric;
+using metrics::parse_metric;
+
+// Rows of X per tile; one tile of output is kRowBlock x (Y block) values
+constexpr size_t kRowBlock = 64;
+// Bytes of Y kept hot while a row block is swept over it (about half a typical L2)
+constexpr size_t kColBlockBytes = 128 * 1024;
+
+// Y rows per tile: a multiple of four that fits kColBlockBytes, at least four
+template <typename T>
+size_t col_block(size_t dim) {
+    const size_t rows = kColBlockBytes / (std::max<size_t>(dim, 1) * sizeof(T));
+    return std::max<size_t>(4, rows & ~static_cast<size_t>(3));
+}
+
+// Squared norms (Euclidean metrics) or norms (cosine) of every row; not needed for inner products
+// or the metrics that are not dot-based
+template <typename T>
+std::vector<T> metric_norms(const T* rows, size_t n, size_t dim, Metric metric) {
+    std::vector<T> norms;
+    if (metric == Metric::InnerProduct || !metrics::dot_based(metric)) {
+        return norms;
+    }
+    norms.resize(n);
+    if (metric == Metric::Cosine) {
+        simd::row_norms(rows, n, dim, norms.data());
+    } else {
+        const auto dot = simd::kernels<T>().dot;
+        for (size_t i = 0; i < n; ++i) {
+            norms[i] = dot(rows + i * dim, rows + i * dim, dim);
+        }
+    }
+    return norms;
+}
+
+// Turn an inner product into the metric's value given the norms from metric_norms
+template <typename T>
+T finish(T dot, Metric metric, const T* x_norms, size_t i, const T* y_norms, size_t j) {
+    switch (metric) {
+        case Metric::InnerProduct:
+            return dot;
+        case Metric::Cosine:
+            return x_norms[i] == T(0) || y_norms[j] == T(0) ? T(0) : dot / (x_norms[i] * y_norms[j]);
+        default: {
+            // Rounding can take the decomposition slightly below zero for near-identical rows
+            const T sq = std::max(T(0), x_norms[i] + y_norms[j] - T(2) * dot);
+            return metric == Metric::Euclidean ? std::sqrt(sq) : sq;
+        }
+    }
+}
+
+// One output tile: X rows [x_begin, x_end) against Y rows [y_begin, y_end)
+template <typename T>
+void tile(const T* X, const T* Y, size_t dim, size_t ny, Metric metric, const T* x_norms, const T* y_norms,
+          size_t x_begin, size_t x_end, size_t y_begin, size_t y_end, T* out) {
+    if (!metrics::dot_based(metric)) {
+        metrics::visit(metric, [&](auto trait) {
+            typedef decltype(trait) M;
+            for (size_t i = x_begin; i < x_end; ++i) {
+                for (size_t j = y_begin; j < y_end; ++j) {
+                    out[i * ny + j] = metrics::evaluate<M>(X + i * dim, Y + j * dim, dim);
+                }
+            }
+        });
+        return;
+    }
+    const simd::Kernels<T>& kernels = simd::kernels<T>();
+    T dots[4];
+    for (size_t i = x_begin; i < x_end; ++i) {
+        const T* x = X + i * dim;
+        T* out_row = out + i * ny;
+        size_t j = y_begin;
+        for (; j + 4 <= y_end; j += 4) {
+            kernels.dot_1x4(x, Y + j * dim, dim, dim, dots);
+            for (size_t t = 0; t < 4; ++t) {
+                out_row[j + t] = finish(dots[t], metric, x_norms, i, y_norms, j + t);
+            }
+        }
+        for (; j < y_end; ++j) {
+            out_row[j] = finish(kernels.dot(x, Y + j * dim, dim), metric, x_norms, i, y_norms, j);
+        }
+    }
+}
+
+// out[i * ny + j] = metric(X[i], Y[j]) for the (nx, dim) and (ny, dim) row-major inputs.
+// Tiles are spread over up to num_threads pool threads (0 means all), so a single query row
+// against a large Y is parallel too. Runs without touching Python; callers may release the GIL.
+template <typename T>
+void cdist(const T* X, size_t nx, const T* Y, size_t ny, size_t dim, Metric metric, T* out,
+           size_t num_threads = 0) {
+    if (nx == 0 || ny == 0) {
+        return;
+    }
+    const std::vector<T> x_norms = metric_norms(X, nx, dim, metric);
+    const std::vector<T> y_norms = X == Y && nx == ny ? x_norms : metric_norms(Y, ny, dim, metric);
+    const size_t rows_per_tile = std::min(kRowBlock, nx);
+    const size_t cols_per_tile = col_block<T>(dim);
+    const size_t row_tiles = (nx + rows_per_tile - 1) / rows_per_tile;
+    const size_t col_tiles = (ny + cols_per_tile - 1) / cols_per_tile;
+
+    ThreadPool::instance().parallel_for(row_tiles * col_tiles, num_threads, [&](size_t t) {
+        const size_t row_tile = t / col_tiles;
+        const size_t col_tile = t % col_tiles;
+        const size_t x_begin = row_tile * rows_per_tile;
+        const size_t y_begin = col_tile * cols_per_tile;
+        tile(X, Y, dim, ny, metric, x_norms.data(), y_norms.data(), x_begin, std::min(nx, x_begin + rows_per_tile),
+             y_begin, std::min(ny, y_begin + cols_per_tile), out);
+    });
+}
+
+// out[j] = metric(q, X[j]) for every row of the (n, dim) matrix X
+template <typename T>
+void one_to_many(const T* q, const T* X, size_t n, size_t dim, Metric metric, T* out, size_t num_threads = 0) {
+    cdist(q, 1, X, n, dim, metric, out, num_threads);
+}
+
+} // namespace pairwise
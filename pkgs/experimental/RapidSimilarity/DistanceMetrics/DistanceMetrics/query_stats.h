@@ -0,0 +1,281 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+// Per-query hot-path counters, compiled in only when RAPIDSIMILARITY_STATS is defined (meson
+// -Dquery_stats=true). Without it every call below is an empty inline function and QueryScope,
+// PhaseTimer and count() leave nothing behind in the query loops.
+//
+// A query opens a QueryScope on the thread that runs it, which makes its Trace the thread's
+// current one. The code underneath adds to that Trace through count() and PhaseTimer without
+// knowing who asked. When the scope closes, the trace is folded into the index's QueryStats,
+// one log2 histogram per counter and phase, using relaxed atomic adds only, so queries running
+// on many threads never wait for each other. The last trace of each thread can be kept for
+// inspection as well.
+namespace stats {
+
+#if defined(RAPIDSIMILARITY_STATS)
+constexpr bool kEnabled = true;
+#else
+constexpr bool kEnabled = false;
+#endif
+
+enum Counter : size_t {
+    Distances = 0, // Metric evaluations against stored vectors or centroids
+    Visited,       // Tree or graph nodes, LSH buckets or IVF lists looked at
+    Candidates,    // Points scored for the final top-k selection
+    Bytes,         // Vector bytes read by those distance evaluations
+    kCounters
+};
+
+enum Phase : size_t {
+    Hash = 0, // Hashing or quantizing the query
+    Probe,    // Choosing the buckets, lists or entry points to look at
+    Scan,     // Walking them and scoring what they hold
+    Select,   // Picking and ordering the result
+    kPhases
+};
+
+inline const char* counter_name(size_t counter) {
+    static const char* const names[kCounters] = {"distances", "visited", "candidates", "bytes"};
+    return names[counter];
+}
+
+inline const char* phase_name(size_t phase) {
+    static const char* const names[kPhases] = {"hash", "probe", "scan", "select"};
+    return names[phase];
+}
+
+// What one query did
+struct Trace {
+    uint64_t counters[kCounters] = {};
+    uint64_t phase_ns[kPhases] = {};
+    uint64_t total_ns = 0;
+};
+
+namespace detail {
+
+inline Trace*& current() {
+    thread_local Trace* trace = nullptr;
+    return trace;
+}
+
+inline uint64_t now_ns() {
+    return static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch())
+            .count());
+}
+
+} // namespace detail
+
+// Add n to a counter of the query running on this thread, if any
+inline void count(Counter counter, uint64_t n = 1) {
+    if constexpr (kEnabled) {
+        if (Trace* trace = detail::current()) {
+            trace->counters[counter] += n;
+        }
+    }
+}
+
+// Charges the time until it is destroyed, or until next() switches phases, to one phase of the
+// query running on this thread
+class PhaseTimer {
+public:
+    explicit PhaseTimer(Phase phase) : phase_(phase) {
+        if constexpr (kEnabled) {
+            start_ = detail::now_ns();
+        }
+    }
+
+    ~PhaseTimer() { stop(); }
+
+    PhaseTimer(const PhaseTimer&) = delete;
+    PhaseTimer& operator=(const PhaseTimer&) = delete;
+
+    // End the current phase and start timing phase
+    void next(Phase phase) {
+        if constexpr (kEnabled) {
+            stop();
+            phase_ = phase;
+            start_ = detail::now_ns();
+        }
+    }
+
+private:
+    void stop() {
+        if constexpr (kEnabled) {
+            if (Trace* trace = detail::current()) {
+                trace->phase_ns[phase_] += detail::now_ns() - start_;
+            }
+        }
+    }
+
+    Phase phase_;
+    uint64_t start_ = 0;
+};
+
+// Histogram of non-negative samples in power-of-two buckets: bucket 0 counts zeros and bucket b
+// counts values in [2^(b-1), 2^b). Safe to record into from any number of threads at once.
+class Histogram {
+public:
+    static constexpr size_t kBuckets = 65;
+
+    void record(uint64_t value) {
+        buckets_[bucket_of(value)].fetch_add(1, std::memory_order_relaxed);
+        sum_.fetch_add(value, std::memory_order_relaxed);
+        uint64_t seen = max_.load(std::memory_order_relaxed);
+        while (value > seen && !max_.compare_exchange_weak(seen, value, std::memory_order_relaxed)) {
+        }
+    }
+
+    uint64_t count() const {
+        uint64_t total = 0;
+        for (const auto& bucket : buckets_) {
+            total += bucket.load(std::memory_order_relaxed);
+        }
+        return total;
+    }
+
+    uint64_t bucket(size_t b) const { return buckets_[b].load(std::memory_order_relaxed); }
+    uint64_t sum() const { return sum_.load(std::memory_order_relaxed); }
+    uint64_t max() const { return max_.load(std::memory_order_relaxed); }
+
+    // Largest value bucket b can hold
+    static uint64_t upper_bound(size_t b) { return b == 0 ? 0 : b == 64 ? UINT64_MAX : (uint64_t(1) << b) - 1; }
+
+    // Upper bound of the bucket holding quantile q in [0, 1], capped at the largest sample
+    uint64_t quantile(double q) const {
+        const uint64_t total = count();
+        if (total == 0) {
+            return 0;
+        }
+        const uint64_t rank = static_cast<uint64_t>(q * static_cast<double>(total - 1));
+        uint64_t seen = 0;
+        for (size_t b = 0; b < kBuckets; ++b) {
+            seen += bucket(b);
+            if (seen > rank) {
+                const uint64_t bound = upper_bound(b);
+                return bound < max() ? bound : max();
+            }
+        }
+        return max();
+    }
+
+    void reset() {
+        for (auto& bucket : buckets_) {
+            bucket.store(0, std::memory_order_relaxed);
+        }
+        sum_.store(0, std::memory_order_relaxed);
+        max_.store(0, std::memory_order_relaxed);
+    }
+
+private:
+    static size_t bucket_of(uint64_t value) {
+        size_t b = 0;
+        while (value != 0) {
+            value >>= 1;
+            ++b;
+        }
+        return b;
+    }
+
+    std::atomic<uint64_t> buckets_[kBuckets] = {};
+    std::atomic<uint64_t> sum_{0};
+    std::atomic<uint64_t> max_{0};
+};
+
+// Distributions of every counter and phase time over the queries an index has answered
+class QueryStats {
+public:
+    void record(const Trace& trace) {
+        for (size_t c = 0; c < kCounters; ++c) {
+            counters_[c].record(trace.counters[c]);
+        }
+        for (size_t p = 0; p < kPhases; ++p) {
+            phases_[p].record(trace.phase_ns[p]);
+        }
+        latency_.record(trace.total_ns);
+    }
+
+    uint64_t queries() const { return latency_.count(); }
+    const Histogram& counter(size_t c) const { return counters_[c]; }
+    const Histogram& phase(size_t p) const { return phases_[p]; }
+    const Histogram& latency() const { return latency_; }
+
+    // Not atomic with respect to queries finishing meanwhile, which may be partly counted
+    void reset() {
+        for (auto& histogram : counters_) {
+            histogram.reset();
+        }
+        for (auto& histogram : phases_) {
+            histogram.reset();
+        }
+        latency_.reset();
+    }
+
+private:
+    Histogram counters_[kCounters];
+    Histogram phases_[kPhases];
+    Histogram latency_; // Nanoseconds per query
+};
+
+namespace detail {
+
+// Last kept trace of this thread and the stats it was recorded into
+struct LastTrace {
+    const QueryStats* owner = nullptr;
+    Trace trace;
+};
+
+inline LastTrace& last() {
+    thread_local LastTrace last;
+    return last;
+}
+
+} // namespace detail
+
+// Makes a fresh Trace current on this thread for the life of one query and records it into
+// stats at the end. With keep_trace the trace also stays readable through last_trace(stats).
+// Scopes nest: a query run inside another one (a shard, a sub-index) counts only toward itself.
+class QueryScope {
+public:
+    explicit QueryScope(QueryStats& stats, bool keep_trace = false) : stats_(stats), keep_trace_(keep_trace) {
+        if constexpr (kEnabled) {
+            previous_ = detail::current();
+            detail::current() = &trace_;
+            start_ = detail::now_ns();
+        }
+    }
+
+    ~QueryScope() {
+        if constexpr (kEnabled) {
+            trace_.total_ns = detail::now_ns() - start_;
+            detail::current() = previous_;
+            stats_.record(trace_);
+            if (keep_trace_) {
+                detail::last() = {&stats_, trace_};
+            }
+        }
+    }
+
+    QueryScope(const QueryScope&) = delete;
+    QueryScope& operator=(const QueryScope&) = delete;
+
+private:
+    QueryStats& stats_;
+    bool keep_trace_;
+    Trace trace_;
+    Trace* previous_ = nullptr;
+    uint64_t start_ = 0;
+};
+
+// Trace of the last kept query this thread ran against stats, or null
+inline const Trace* last_trace(const QueryStats& stats) {
+    const detail::LastTrace& last = detail::last();
+    return kEnabled && last.owner == &stats ? &last.trace : nullptr;
+}
+
+} // namespace stats
@@ -0,0 +1,1015 @@
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+
+#include "cpu_features.h"
+
+#if defined(RS_ARCH_X86)
+  #include <immintrin.h>
+  // Kernels for wider instruction sets are compiled for that ISA alone, so the module itself
+  // keeps the baseline target and still loads on older CPUs
+  #if defined(__GNUC__) || defined(__clang__)
+    #define RS_TARGET(isa) __attribute__((target(isa)))
+  #else
+    #define RS_TARGET(isa)
+  #endif
+#elif defined(RS_ARCH_ARM64)
+  #include <arm_neon.h>
+#endif
+
+// Hand-vectorized squared-L2, inner-product, fused cosine and 1x4 inner-product tile kernels for
+// float32 and float64, chosen at run time for the CPU we are running on. The kernel level is picked
+// once, the first time it is needed (extension modules force this from their init function), and
+// can be capped with the RAPIDSIMILARITY_SIMD environment variable (scalar, sse2, avx2, avx512 or
+// neon).
+namespace simd {
+
+// a.b, |a|^2 and |b|^2 gathered in one pass over both vectors
+template <typename T>
+struct DotNorms {
+    T dot;
+    T norm_a;
+    T norm_b;
+};
+
+template <typename T>
+struct Kernels {
+    T (*l2sq)(const T* a, const T* b, size_t n); // Squared Euclidean distance
+    T (*dot)(const T* a, const T* b, size_t n);  // Inner product
+    DotNorms<T> (*dot_norms)(const T* a, const T* b, size_t n); // Fused cosine terms
+    // a against the four rows b, b + ldb, b + 2 ldb, b + 3 ldb; a is loaded once per step for all
+    // four, the register tile behind the pairwise distance blocks
+    void (*dot_1x4)(const T* a, const T* b, size_t ldb, size_t n, T* out);
+};
+
+// Portable fallback; eight independent lanes leave the compiler room to vectorize
+namespace scalar {
+
+template <typename T>
+T l2sq(const T* a, const T* b, size_t n) {
+    T acc[8] = {};
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        for (size_t j = 0; j < 8; ++j) {
+            const T diff = a[i + j] - b[i + j];
+            acc[j] += diff * diff;
+        }
+    }
+    T sum = ((acc[0] + acc[1]) + (acc[2] + acc[3])) + ((acc[4] + acc[5]) + (acc[6] + acc[7]));
+    for (; i < n; ++i) {
+        const T diff = a[i] - b[i];
+        sum += diff * diff;
+    }
+    return sum;
+}
+
+template <typename T>
+T dot(const T* a, const T* b, size_t n) {
+    T acc[8] = {};
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        for (size_t j = 0; j < 8; ++j) {
+            acc[j] += a[i + j] * b[i + j];
+        }
+    }
+    T sum = ((acc[0] + acc[1]) + (acc[2] + acc[3])) + ((acc[4] + acc[5]) + (acc[6] + acc[7]));
+    for (; i < n; ++i) {
+        sum += a[i] * b[i];
+    }
+    return sum;
+}
+
+template <typename T>
+DotNorms<T> dot_norms(const T* a, const T* b, size_t n) {
+    T ab[4] = {}, aa[4] = {}, bb[4] = {};
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        for (size_t j = 0; j < 4; ++j) {
+            ab[j] += a[i + j] * b[i + j];
+            aa[j] += a[i + j] * a[i + j];
+            bb[j] += b[i + j] * b[i + j];
+        }
+    }
+    DotNorms<T> result = {(ab[0] + ab[1]) + (ab[2] + ab[3]), (aa[0] + aa[1]) + (aa[2] + aa[3]),
+                          (bb[0] + bb[1]) + (bb[2] + bb[3])};
+    for (; i < n; ++i) {
+        result.dot += a[i] * b[i];
+        result.norm_a += a[i] * a[i];
+        result.norm_b += b[i] * b[i];
+    }
+    return result;
+}
+
+// Four eight-lane dot products; the blocking in the callers still keeps b in cache
+template <typename T>
+void dot_1x4(const T* a, const T* b, size_t ldb, size_t n, T* out) {
+    for (size_t j = 0; j < 4; ++j) {
+        out[j] = dot(a, b + j * ldb, n);
+    }
+}
+
+} // namespace scalar
+
+#if defined(RS_ARCH_X86)
+namespace sse2 {
+
+RS_TARGET("sse2") inline float hsum(__m128 v) {
+    v = _mm_add_ps(v, _mm_movehl_ps(v, v));
+    v = _mm_add_ss(v, _mm_shuffle_ps(v, v, 0x55));
+    return _mm_cvtss_f32(v);
+}
+
+RS_TARGET("sse2") inline double hsum(__m128d v) {
+    return _mm_cvtsd_f64(_mm_add_sd(v, _mm_unpackhi_pd(v, v)));
+}
+
+RS_TARGET("sse2") inline float l2sq_f32(const float* a, const float* b, size_t n) {
+    __m128 acc0 = _mm_setzero_ps(), acc1 = _mm_setzero_ps();
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        const __m128 d0 = _mm_sub_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i));
+        const __m128 d1 = _mm_sub_ps(_mm_loadu_ps(a + i + 4), _mm_loadu_ps(b + i + 4));
+        acc0 = _mm_add_ps(acc0, _mm_mul_ps(d0, d0));
+        acc1 = _mm_add_ps(acc1, _mm_mul_ps(d1, d1));
+    }
+    for (; i + 4 <= n; i += 4) {
+        const __m128 d = _mm_sub_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i));
+        acc0 = _mm_add_ps(acc0, _mm_mul_ps(d, d));
+    }
+    float sum = hsum(_mm_add_ps(acc0, acc1));
+    for (; i < n; ++i) {
+        const float diff = a[i] - b[i];
+        sum += diff * diff;
+    }
+    return sum;
+}
+
+RS_TARGET("sse2") inline float dot_f32(const float* a, const float* b, size_t n) {
+    __m128 acc0 = _mm_setzero_ps(), acc1 = _mm_setzero_ps();
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+        acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_loadu_ps(a + i + 4), _mm_loadu_ps(b + i + 4)));
+    }
+    for (; i + 4 <= n; i += 4) {
+        acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+    }
+    float sum = hsum(_mm_add_ps(acc0, acc1));
+    for (; i < n; ++i) {
+        sum += a[i] * b[i];
+    }
+    return sum;
+}
+
+RS_TARGET("sse2") inline double l2sq_f64(const double* a, const double* b, size_t n) {
+    __m128d acc0 = _mm_setzero_pd(), acc1 = _mm_setzero_pd();
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        const __m128d d0 = _mm_sub_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i));
+        const __m128d d1 = _mm_sub_pd(_mm_loadu_pd(a + i + 2), _mm_loadu_pd(b + i + 2));
+        acc0 = _mm_add_pd(acc0, _mm_mul_pd(d0, d0));
+        acc1 = _mm_add_pd(acc1, _mm_mul_pd(d1, d1));
+    }
+    double sum = hsum(_mm_add_pd(acc0, acc1));
+    for (; i < n; ++i) {
+        const double diff = a[i] - b[i];
+        sum += diff * diff;
+    }
+    return sum;
+}
+
+RS_TARGET("sse2") inline double dot_f64(const double* a, const double* b, size_t n) {
+    __m128d acc0 = _mm_setzero_pd(), acc1 = _mm_setzero_pd();
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        acc0 = _mm_add_pd(acc0, _mm_mul_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+        acc1 = _mm_add_pd(acc1, _mm_mul_pd(_mm_loadu_pd(a + i + 2), _mm_loadu_pd(b + i + 2)));
+    }
+    double sum = hsum(_mm_add_pd(acc0, acc1));
+    for (; i < n; ++i) {
+        sum += a[i] * b[i];
+    }
+    return sum;
+}
+
+RS_TARGET("sse2") inline DotNorms<float> dot_norms_f32(const float* a, const float* b, size_t n) {
+    __m128 ab = _mm_setzero_ps(), aa = _mm_setzero_ps(), bb = _mm_setzero_ps();
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        const __m128 x = _mm_loadu_ps(a + i), y = _mm_loadu_ps(b + i);
+        ab = _mm_add_ps(ab, _mm_mul_ps(x, y));
+        aa = _mm_add_ps(aa, _mm_mul_ps(x, x));
+        bb = _mm_add_ps(bb, _mm_mul_ps(y, y));
+    }
+    DotNorms<float> result = {hsum(ab), hsum(aa), hsum(bb)};
+    for (; i < n; ++i) {
+        result.dot += a[i] * b[i];
+        result.norm_a += a[i] * a[i];
+        result.norm_b += b[i] * b[i];
+    }
+    return result;
+}
+
+RS_TARGET("sse2") inline DotNorms<double> dot_norms_f64(const double* a, const double* b, size_t n) {
+    __m128d ab = _mm_setzero_pd(), aa = _mm_setzero_pd(), bb = _mm_setzero_pd();
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2) {
+        const __m128d x = _mm_loadu_pd(a + i), y = _mm_loadu_pd(b + i);
+        ab = _mm_add_pd(ab, _mm_mul_pd(x, y));
+        aa = _mm_add_pd(aa, _mm_mul_pd(x, x));
+        bb = _mm_add_pd(bb, _mm_mul_pd(y, y));
+    }
+    DotNorms<double> result = {hsum(ab), hsum(aa), hsum(bb)};
+    for (; i < n; ++i) {
+        result.dot += a[i] * b[i];
+        result.norm_a += a[i] * a[i];
+        result.norm_b += b[i] * b[i];
+    }
+    return result;
+}
+
+RS_TARGET("sse2") inline void dot_1x4_f32(const float* a, const float* b, size_t ldb, size_t n, float* out) {
+    const float* b0 = b;
+    const float* b1 = b + ldb;
+    const float* b2 = b + 2 * ldb;
+    const float* b3 = b + 3 * ldb;
+    __m128 acc0 = _mm_setzero_ps(), acc1 = acc0, acc2 = acc0, acc3 = acc0;
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        const __m128 x = _mm_loadu_ps(a + i);
+        acc0 = _mm_add_ps(acc0, _mm_mul_ps(x, _mm_loadu_ps(b0 + i)));
+        acc1 = _mm_add_ps(acc1, _mm_mul_ps(x, _mm_loadu_ps(b1 + i)));
+        acc2 = _mm_add_ps(acc2, _mm_mul_ps(x, _mm_loadu_ps(b2 + i)));
+        acc3 = _mm_add_ps(acc3, _mm_mul_ps(x, _mm_loadu_ps(b3 + i)));
+    }
+    float sum0 = hsum(acc0), sum1 = hsum(acc1), sum2 = hsum(acc2), sum3 = hsum(acc3);
+    for (; i < n; ++i) {
+        const float x = a[i];
+        sum0 += x * b0[i];
+        sum1 += x * b1[i];
+        sum2 += x * b2[i];
+        sum3 += x * b3[i];
+    }
+    out[0] = sum0;
+    out[1] = sum1;
+    out[2] = sum2;
+    out[3] = sum3;
+}
+
+RS_TARGET("sse2") inline void dot_1x4_f64(const double* a, const double* b, size_t ldb, size_t n, double* out) {
+    const double* b0 = b;
+    const double* b1 = b + ldb;
+    const double* b2 = b + 2 * ldb;
+    const double* b3 = b + 3 * ldb;
+    __m128d acc0 = _mm_setzero_pd(), acc1 = acc0, acc2 = acc0, acc3 = acc0;
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2) {
+        const __m128d x = _mm_loadu_pd(a + i);
+        acc0 = _mm_add_pd(acc0, _mm_mul_pd(x, _mm_loadu_pd(b0 + i)));
+        acc1 = _mm_add_pd(acc1, _mm_mul_pd(x, _mm_loadu_pd(b1 + i)));
+        acc2 = _mm_add_pd(acc2, _mm_mul_pd(x, _mm_loadu_pd(b2 + i)));
+        acc3 = _mm_add_pd(acc3, _mm_mul_pd(x, _mm_loadu_pd(b3 + i)));
+    }
+    double sum0 = hsum(acc0), sum1 = hsum(acc1), sum2 = hsum(acc2), sum3 = hsum(acc3);
+    for (; i < n; ++i) {
+        const double x = a[i];
+        sum0 += x * b0[i];
+        sum1 += x * b1[i];
+        sum2 += x * b2[i];
+        sum3 += x * b3[i];
+    }
+    out[0] = sum0;
+    out[1] = sum1;
+    out[2] = sum2;
+    out[3] = sum3;
+}
+
+} // namespace sse2
+
+namespace avx2 {
+
+RS_TARGET("avx2,fma") inline float hsum(__m256 v) {
+    __m128 x = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    x = _mm_add_ps(x, _mm_movehl_ps(x, x));
+    x = _mm_add_ss(x, _mm_shuffle_ps(x, x, 0x55));
+    return _mm_cvtss_f32(x);
+}
+
+RS_TARGET("avx2,fma") inline double hsum(__m256d v) {
+    __m128d x = _mm_add_pd(_mm256_castpd256_pd128(v), _mm256_extractf128_pd(v, 1));
+    return _mm_cvtsd_f64(_mm_add_sd(x, _mm_unpackhi_pd(x, x)));
+}
+
+// Horizontal sums of four accumulators at once, written to out[0..3]
+RS_TARGET("avx2,fma") inline void hsum4(__m256 v0, __m256 v1, __m256 v2, __m256 v3, float* out) {
+    const __m256 sums = _mm256_hadd_ps(_mm256_hadd_ps(v0, v1), _mm256_hadd_ps(v2, v3));
+    _mm_storeu_ps(out, _mm_add_ps(_mm256_castps256_ps128(sums), _mm256_extractf128_ps(sums, 1)));
+}
+
+RS_TARGET("avx2,fma") inline void hsum4(__m256d v0, __m256d v1, __m256d v2, __m256d v3, double* out) {
+    const __m256d sums01 = _mm256_hadd_pd(v0, v1); // v0 pairs in lanes 0 and 2, v1 pairs in 1 and 3
+    const __m256d sums23 = _mm256_hadd_pd(v2, v3);
+    _mm_storeu_pd(out, _mm_add_pd(_mm256_castpd256_pd128(sums01), _mm256_extractf128_pd(sums01, 1)));
+    _mm_storeu_pd(out + 2, _mm_add_pd(_mm256_castpd256_pd128(sums23), _mm256_extractf128_pd(sums23, 1)));
+}
+
+RS_TARGET("avx2,fma") inline float l2sq_f32(const float* a, const float* b, size_t n) {
+    __m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        const __m256 d0 = _mm256_sub_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i));
+        const __m256 d1 = _mm256_sub_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8));
+        acc0 = _mm256_fmadd_ps(d0, d0, acc0);
+        acc1 = _mm256_fmadd_ps(d1, d1, acc1);
+    }
+    for (; i + 8 <= n; i += 8) {
+        const __m256 d = _mm256_sub_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i));
+        acc0 = _mm256_fmadd_ps(d, d, acc0);
+    }
+    float sum = hsum(_mm256_add_ps(acc0, acc1));
+    for (; i < n; ++i) {
+        const float diff = a[i] - b[i];
+        sum += diff * diff;
+    }
+    return sum;
+}
+
+RS_TARGET("avx2,fma") inline float dot_f32(const float* a, const float* b, size_t n) {
+    __m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc0);
+        acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8), acc1);
+    }
+    for (; i + 8 <= n; i += 8) {
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc0);
+    }
+    float sum = hsum(_mm256_add_ps(acc0, acc1));
+    for (; i < n; ++i) {
+        sum += a[i] * b[i];
+    }
+    return sum;
+}
+
+RS_TARGET("avx2,fma") inline double l2sq_f64(const double* a, const double* b, size_t n) {
+    __m256d acc0 = _mm256_setzero_pd(), acc1 = _mm256_setzero_pd();
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        const __m256d d0 = _mm256_sub_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i));
+        const __m256d d1 = _mm256_sub_pd(_mm256_loadu_pd(a + i + 4), _mm256_loadu_pd(b + i + 4));
+        acc0 = _mm256_fmadd_pd(d0, d0, acc0);
+        acc1 = _mm256_fmadd_pd(d1, d1, acc1);
+    }
+    for (; i + 4 <= n; i += 4) {
+        const __m256d d = _mm256_sub_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i));
+        acc0 = _mm256_fmadd_pd(d, d, acc0);
+    }
+    double sum = hsum(_mm256_add_pd(acc0, acc1));
+    for (; i < n; ++i) {
+        const double diff = a[i] - b[i];
+        sum += diff * diff;
+    }
+    return sum;
+}
+
+RS_TARGET("avx2,fma") inline double dot_f64(const double* a, const double* b, size_t n) {
+    __m256d acc0 = _mm256_setzero_pd(), acc1 = _mm256_setzero_pd();
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        acc0 = _mm256_fmadd_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i), acc0);
+        acc1 = _mm256_fmadd_pd(_mm256_loadu_pd(a + i + 4), _mm256_loadu_pd(b + i + 4), acc1);
+    }
+    for (; i + 4 <= n; i += 4) {
+        acc0 = _mm256_fmadd_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i), acc0);
+    }
+    double sum = hsum(_mm256_add_pd(acc0, acc1));
+    for (; i < n; ++i) {
+        sum += a[i] * b[i];
+    }
+    return sum;
+}
+
+RS_TARGET("avx2,fma") inline DotNorms<float> dot_norms_f32(const float* a, const float* b, size_t n) {
+    __m256 ab = _mm256_setzero_ps(), aa = _mm256_setzero_ps(), bb = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        const __m256 x = _mm256_loadu_ps(a + i), y = _mm256_loadu_ps(b + i);
+        ab = _mm256_fmadd_ps(x, y, ab);
+        aa = _mm256_fmadd_ps(x, x, aa);
+        bb = _mm256_fmadd_ps(y, y, bb);
+    }
+    DotNorms<float> result = {hsum(ab), hsum(aa), hsum(bb)};
+    for (; i < n; ++i) {
+        result.dot += a[i] * b[i];
+        result.norm_a += a[i] * a[i];
+        result.norm_b += b[i] * b[i];
+    }
+    return result;
+}
+
+RS_TARGET("avx2,fma") inline DotNorms<double> dot_norms_f64(const double* a, const double* b, size_t n) {
+    __m256d ab = _mm256_setzero_pd(), aa = _mm256_setzero_pd(), bb = _mm256_setzero_pd();
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        const __m256d x = _mm256_loadu_pd(a + i), y = _mm256_loadu_pd(b + i);
+        ab = _mm256_fmadd_pd(x, y, ab);
+        aa = _mm256_fmadd_pd(x, x, aa);
+        bb = _mm256_fmadd_pd(y, y, bb);
+    }
+    DotNorms<double> result = {hsum(ab), hsum(aa), hsum(bb)};
+    for (; i < n; ++i) {
+        result.dot += a[i] * b[i];
+        result.norm_a += a[i] * a[i];
+        result.norm_b += b[i] * b[i];
+    }
+    return result;
+}
+
+RS_TARGET("avx2,fma") inline void dot_1x4_f32(const float* a, const float* b, size_t ldb, size_t n, float* out) {
+    const float* b0 = b;
+    const float* b1 = b + ldb;
+    const float* b2 = b + 2 * ldb;
+    const float* b3 = b + 3 * ldb;
+    __m256 acc0 = _mm256_setzero_ps(), acc1 = acc0, acc2 = acc0, acc3 = acc0;
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        const __m256 x = _mm256_loadu_ps(a + i);
+        acc0 = _mm256_fmadd_ps(x, _mm256_loadu_ps(b0 + i), acc0);
+        acc1 = _mm256_fmadd_ps(x, _mm256_loadu_ps(b1 + i), acc1);
+        acc2 = _mm256_fmadd_ps(x, _mm256_loadu_ps(b2 + i), acc2);
+        acc3 = _mm256_fmadd_ps(x, _mm256_loadu_ps(b3 + i), acc3);
+    }
+    hsum4(acc0, acc1, acc2, acc3, out);
+    for (; i < n; ++i) {
+        const float x = a[i];
+        out[0] += x * b0[i];
+        out[1] += x * b1[i];
+        out[2] += x * b2[i];
+        out[3] += x * b3[i];
+    }
+}
+
+RS_TARGET("avx2,fma") inline void dot_1x4_f64(const double* a, const double* b, size_t ldb, size_t n, double* out) {
+    const double* b0 = b;
+    const double* b1 = b + ldb;
+    const double* b2 = b + 2 * ldb;
+    const double* b3 = b + 3 * ldb;
+    __m256d acc0 = _mm256_setzero_pd(), acc1 = acc0, acc2 = acc0, acc3 = acc0;
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        const __m256d x = _mm256_loadu_pd(a + i);
+        acc0 = _mm256_fmadd_pd(x, _mm256_loadu_pd(b0 + i), acc0);
+        acc1 = _mm256_fmadd_pd(x, _mm256_loadu_pd(b1 + i), acc1);
+        acc2 = _mm256_fmadd_pd(x, _mm256_loadu_pd(b2 + i), acc2);
+        acc3 = _mm256_fmadd_pd(x, _mm256_loadu_pd(b3 + i), acc3);
+    }
+    hsum4(acc0, acc1, acc2, acc3, out);
+    for (; i < n; ++i) {
+        const double x = a[i];
+        out[0] += x * b0[i];
+        out[1] += x * b1[i];
+        out[2] += x * b2[i];
+        out[3] += x * b3[i];
+    }
+}
+
+} // namespace avx2
+
+// AVX-512 handles the tail with a masked load instead of a scalar loop
+namespace avx512 {
+
+// Horizontal sums through memory: GCC 12's in-register reductions warn about undefined lanes
+RS_TARGET("avx512f") inline float hsum(__m512 v) {
+    alignas(64) float lanes[16];
+    _mm512_store_ps(lanes, v);
+    float sum = 0.0f;
+    for (float lane : lanes) {
+        sum += lane;
+    }
+    return sum;
+}
+
+RS_TARGET("avx512f") inline double hsum(__m512d v) {
+    alignas(64) double lanes[8];
+    _mm512_store_pd(lanes, v);
+    double sum = 0.0;
+    for (double lane : lanes) {
+        sum += lane;
+    }
+    return sum;
+}
+
+// Four horizontal sums at once, written to out[0..3]. A transpose-and-add keeps this in registers;
+// the merge-masked forms are used because the unmasked ones trip the same GCC warning.
+RS_TARGET("avx512f") inline void hsum4(__m512 v0, __m512 v1, __m512 v2, __m512 v3, float* out) {
+    const __mmask16 all = 0xFFFF;
+    const __m512 t01 = _mm512_add_ps(_mm512_mask_unpacklo_ps(v0, all, v0, v1),
+                                     _mm512_mask_unpackhi_ps(v0, all, v0, v1));
+    const __m512 t23 = _mm512_add_ps(_mm512_mask_unpacklo_ps(v2, all, v2, v3),
+                                     _mm512_mask_unpackhi_ps(v2, all, v2, v3));
+    const __m512d lo = _mm512_castps_pd(t01), hi = _mm512_castps_pd(t23);
+    // Each 128-bit lane now holds partial sums of v0, v1, v2, v3 in that order
+    __m512 sums = _mm512_add_ps(_mm512_castpd_ps(_mm512_mask_unpacklo_pd(lo, 0xFF, lo, hi)),
+                                _mm512_castpd_ps(_mm512_mask_unpackhi_pd(lo, 0xFF, lo, hi)));
+    sums = _mm512_add_ps(sums, _mm512_mask_shuffle_f32x4(sums, all, sums, sums, 0x4E));
+    sums = _mm512_add_ps(sums, _mm512_mask_shuffle_f32x4(sums, all, sums, sums, 0xB1));
+    _mm512_mask_storeu_ps(out, 0xF, sums);
+}
+
+RS_TARGET("avx512f") inline void hsum4(__m512d v0, __m512d v1, __m512d v2, __m512d v3, double* out) {
+    const __mmask8 all = 0xFF;
+    // Each 128-bit lane of t01 holds partial sums of (v0, v1), of t23 those of (v2, v3)
+    const __m512d t01 = _mm512_add_pd(_mm512_mask_unpacklo_pd(v0, all, v0, v1),
+                                      _mm512_mask_unpackhi_pd(v0, all, v0, v1));
+    const __m512d t23 = _mm512_add_pd(_mm512_mask_unpacklo_pd(v2, all, v2, v3),
+                                      _mm512_mask_unpackhi_pd(v2, all, v2, v3));
+    // Lanes (t01[0] + t01[1], t01[2] + t01[3], t23[0] + t23[1], t23[2] + t23[3])
+    __m512d sums = _mm512_add_pd(_mm512_mask_shuffle_f64x2(t01, all, t01, t23, 0x88),
+                                 _mm512_mask_shuffle_f64x2(t01, all, t01, t23, 0xDD));
+    sums = _mm512_add_pd(_mm512_mask_shuffle_f64x2(sums, all, sums, sums, 0x88),
+                         _mm512_mask_shuffle_f64x2(sums, all, sums, sums, 0xDD));
+    _mm512_mask_storeu_pd(out, 0xF, sums);
+}
+
+RS_TARGET("avx512f") inline float l2sq_f32(const float* a, const float* b, size_t n) {
+    __m512 acc0 = _mm512_setzero_ps(), acc1 = _mm512_setzero_ps();
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        const __m512 d0 = _mm512_sub_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i));
+        const __m512 d1 = _mm512_sub_ps(_mm512_loadu_ps(a + i + 16), _mm512_loadu_ps(b + i + 16));
+        acc0 = _mm512_fmadd_ps(d0, d0, acc0);
+        acc1 = _mm512_fmadd_ps(d1, d1, acc1);
+    }
+    for (; i + 16 <= n; i += 16) {
+        const __m512 d = _mm512_sub_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i));
+        acc0 = _mm512_fmadd_ps(d, d, acc0);
+    }
+    if (i < n) {
+        const __mmask16 mask = static_cast<__mmask16>((1u << (n - i)) - 1);
+        const __m512 d = _mm512_sub_ps(_mm512_maskz_loadu_ps(mask, a + i), _mm512_maskz_loadu_ps(mask, b + i));
+        acc1 = _mm512_fmadd_ps(d, d, acc1);
+    }
+    return hsum(_mm512_add_ps(acc0, acc1));
+}
+
+RS_TARGET("avx512f") inline float dot_f32(const float* a, const float* b, size_t n) {
+    __m512 acc0 = _mm512_setzero_ps(), acc1 = _mm512_setzero_ps();
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i), acc0);
+        acc1 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i + 16), _mm512_loadu_ps(b + i + 16), acc1);
+    }
+    for (; i + 16 <= n; i += 16) {
+        acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i), acc0);
+    }
+    if (i < n) {
+        const __mmask16 mask = static_cast<__mmask16>((1u << (n - i)) - 1);
+        acc1 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(mask, a + i), _mm512_maskz_loadu_ps(mask, b + i), acc1);
+    }
+    return hsum(_mm512_add_ps(acc0, acc1));
+}
+
+RS_TARGET("avx512f") inline double l2sq_f64(const double* a, const double* b, size_t n) {
+    __m512d acc0 = _mm512_setzero_pd(), acc1 = _mm512_setzero_pd();
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        const __m512d d0 = _mm512_sub_pd(_mm512_loadu_pd(a + i), _mm512_loadu_pd(b + i));
+        const __m512d d1 = _mm512_sub_pd(_mm512_loadu_pd(a + i + 8), _mm512_loadu_pd(b + i + 8));
+        acc0 = _mm512_fmadd_pd(d0, d0, acc0);
+        acc1 = _mm512_fmadd_pd(d1, d1, acc1);
+    }
+    for (; i + 8 <= n; i += 8) {
+        const __m512d d = _mm512_sub_pd(_mm512_loadu_pd(a + i), _mm512_loadu_pd(b + i));
+        acc0 = _mm512_fmadd_pd(d, d, acc0);
+    }
+    if (i < n) {
+        const __mmask8 mask = static_cast<__mmask8>((1u << (n - i)) - 1);
+        const __m512d d = _mm512_sub_pd(_mm512_maskz_loadu_pd(mask, a + i), _mm512_maskz_loadu_pd(mask, b + i));
+        acc1 = _mm512_fmadd_pd(d, d, acc1);
+    }
+    return hsum(_mm512_add_pd(acc0, acc1));
+}
+
+RS_TARGET("avx512f") inline double dot_f64(const double* a, const double* b, size_t n) {
+    __m512d acc0 = _mm512_setzero_pd(), acc1 = _mm512_setzero_pd();
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        acc0 = _mm512_fmadd_pd(_mm512_loadu_pd(a + i), _mm512_loadu_pd(b + i), acc0);
+        acc1 = _mm512_fmadd_pd(_mm512_loadu_pd(a + i + 8), _mm512_loadu_pd(b + i + 8), acc1);
+    }
+    for (; i + 8 <= n; i += 8) {
+        acc0 = _mm512_fmadd_pd(_mm512_loadu_pd(a + i), _mm512_loadu_pd(b + i), acc0);
+    }
+    if (i < n) {
+        const __mmask8 mask = static_cast<__mmask8>((1u << (n - i)) - 1);
+        acc1 = _mm512_fmadd_pd(_mm512_maskz_loadu_pd(mask, a + i), _mm512_maskz_loadu_pd(mask, b + i), acc1);
+    }
+    return hsum(_mm512_add_pd(acc0, acc1));
+}
+
+RS_TARGET("avx512f") inline DotNorms<float> dot_norms_f32(const float* a, const float* b, size_t n) {
+    __m512 ab = _mm512_setzero_ps(), aa = _mm512_setzero_ps(), bb = _mm512_setzero_ps();
+    for (size_t i = 0; i < n; i += 16) {
+        const __mmask16 mask = n - i >= 16 ? static_cast<__mmask16>(0xFFFF) : static_cast<__mmask16>((1u << (n - i)) - 1);
+        const __m512 x = _mm512_maskz_loadu_ps(mask, a + i), y = _mm512_maskz_loadu_ps(mask, b + i);
+        ab = _mm512_fmadd_ps(x, y, ab);
+        aa = _mm512_fmadd_ps(x, x, aa);
+        bb = _mm512_fmadd_ps(y, y, bb);
+    }
+    return {hsum(ab), hsum(aa), hsum(bb)};
+}
+
+RS_TARGET("avx512f") inline DotNorms<double> dot_norms_f64(const double* a, const double* b, size_t n) {
+    __m512d ab = _mm512_setzero_pd(), aa = _mm512_setzero_pd(), bb = _mm512_setzero_pd();
+    for (size_t i = 0; i < n; i += 8) {
+        const __mmask8 mask = n - i >= 8 ? static_cast<__mmask8>(0xFF) : static_cast<__mmask8>((1u << (n - i)) - 1);
+        const __m512d x = _mm512_maskz_loadu_pd(mask, a + i), y = _mm512_maskz_loadu_pd(mask, b + i);
+        ab = _mm512_fmadd_pd(x, y, ab);
+        aa = _mm512_fmadd_pd(x, x, aa);
+        bb = _mm512_fmadd_pd(y, y, bb);
+    }
+    return {hsum(ab), hsum(aa), hsum(bb)};
+}
+
+RS_TARGET("avx512f") inline void dot_1x4_f32(const float* a, const float* b, size_t ldb, size_t n, float* out) {
+    const float* b0 = b;
+    const float* b1 = b + ldb;
+    const float* b2 = b + 2 * ldb;
+    const float* b3 = b + 3 * ldb;
+    __m512 acc0 = _mm512_setzero_ps(), acc1 = acc0, acc2 = acc0, acc3 = acc0;
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        const __m512 x = _mm512_loadu_ps(a + i);
+        acc0 = _mm512_fmadd_ps(x, _mm512_loadu_ps(b0 + i), acc0);
+        acc1 = _mm512_fmadd_ps(x, _mm512_loadu_ps(b1 + i), acc1);
+        acc2 = _mm512_fmadd_ps(x, _mm512_loadu_ps(b2 + i), acc2);
+        acc3 = _mm512_fmadd_ps(x, _mm512_loadu_ps(b3 + i), acc3);
+    }
+    if (i < n) {
+        const __mmask16 mask = static_cast<__mmask16>((1u << (n - i)) - 1);
+        const __m512 x = _mm512_maskz_loadu_ps(mask, a + i);
+        acc0 = _mm512_fmadd_ps(x, _mm512_maskz_loadu_ps(mask, b0 + i), acc0);
+        acc1 = _mm512_fmadd_ps(x, _mm512_maskz_loadu_ps(mask, b1 + i), acc1);
+        acc2 = _mm512_fmadd_ps(x, _mm512_maskz_loadu_ps(mask, b2 + i), acc2);
+        acc3 = _mm512_fmadd_ps(x, _mm512_maskz_loadu_ps(mask, b3 + i), acc3);
+    }
+    hsum4(acc0, acc1, acc2, acc3, out);
+}
+
+RS_TARGET("avx512f") inline void dot_1x4_f64(const double* a, const double* b, size_t ldb, size_t n, double* out) {
+    const double* b0 = b;
+    const double* b1 = b + ldb;
+    const double* b2 = b + 2 * ldb;
+    const double* b3 = b + 3 * ldb;
+    __m512d acc0 = _mm512_setzero_pd(), acc1 = acc0, acc2 = acc0, acc3 = acc0;
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        const __m512d x = _mm512_loadu_pd(a + i);
+        acc0 = _mm512_fmadd_pd(x, _mm512_loadu_pd(b0 + i), acc0);
+        acc1 = _mm512_fmadd_pd(x, _mm512_loadu_pd(b1 + i), acc1);
+        acc2 = _mm512_fmadd_pd(x, _mm512_loadu_pd(b2 + i), acc2);
+        acc3 = _mm512_fmadd_pd(x, _mm512_loadu_pd(b3 + i), acc3);
+    }
+    if (i < n) {
+        const __mmask8 mask = static_cast<__mmask8>((1u << (n - i)) - 1);
+        const __m512d x = _mm512_maskz_loadu_pd(mask, a + i);
+        acc0 = _mm512_fmadd_pd(x, _mm512_maskz_loadu_pd(mask, b0 + i), acc0);
+        acc1 = _mm512_fmadd_pd(x, _mm512_maskz_loadu_pd(mask, b1 + i), acc1);
+        acc2 = _mm512_fmadd_pd(x, _mm512_maskz_loadu_pd(mask, b2 + i), acc2);
+        acc3 = _mm512_fmadd_pd(x, _mm512_maskz_loadu_pd(mask, b3 + i), acc3);
+    }
+    hsum4(acc0, acc1, acc2, acc3, out);
+}
+
+} // namespace avx512
+#endif // RS_ARCH_X86
+
+#if defined(RS_ARCH_ARM64)
+namespace neon {
+
+inline float l2sq_f32(const float* a, const float* b, size_t n) {
+    float32x4_t acc0 = vdupq_n_f32(0.0f), acc1 = vdupq_n_f32(0.0f);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        const float32x4_t d0 = vsubq_f32(vld1q_f32(a + i), vld1q_f32(b + i));
+        const float32x4_t d1 = vsubq_f32(vld1q_f32(a + i + 4), vld1q_f32(b + i + 4));
+        acc0 = vfmaq_f32(acc0, d0, d0);
+        acc1 = vfmaq_f32(acc1, d1, d1);
+    }
+    for (; i + 4 <= n; i += 4) {
+        const float32x4_t d = vsubq_f32(vld1q_f32(a + i), vld1q_f32(b + i));
+        acc0 = vfmaq_f32(acc0, d, d);
+    }
+    float sum = vaddvq_f32(vaddq_f32(acc0, acc1));
+    for (; i < n; ++i) {
+        const float diff = a[i] - b[i];
+        sum += diff * diff;
+    }
+    return sum;
+}
+
+inline float dot_f32(const float* a, const float* b, size_t n) {
+    float32x4_t acc0 = vdupq_n_f32(0.0f), acc1 = vdupq_n_f32(0.0f);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        acc0 = vfmaq_f32(acc0, vld1q_f32(a + i), vld1q_f32(b + i));
+        acc1 = vfmaq_f32(acc1, vld1q_f32(a + i + 4), vld1q_f32(b + i + 4));
+    }
+    for (; i + 4 <= n; i += 4) {
+        acc0 = vfmaq_f32(acc0, vld1q_f32(a + i), vld1q_f32(b + i));
+    }
+    float sum = vaddvq_f32(vaddq_f32(acc0, acc1));
+    for (; i < n; ++i) {
+        sum += a[i] * b[i];
+    }
+    return sum;
+}
+
+inline double l2sq_f64(const double* a, const double* b, size_t n) {
+    float64x2_t acc0 = vdupq_n_f64(0.0), acc1 = vdupq_n_f64(0.0);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        const float64x2_t d0 = vsubq_f64(vld1q_f64(a + i), vld1q_f64(b + i));
+        const float64x2_t d1 = vsubq_f64(vld1q_f64(a + i + 2), vld1q_f64(b + i + 2));
+        acc0 = vfmaq_f64(acc0, d0, d0);
+        acc1 = vfmaq_f64(acc1, d1, d1);
+    }
+    double sum = vaddvq_f64(vaddq_f64(acc0, acc1));
+    for (; i < n; ++i) {
+        const double diff = a[i] - b[i];
+        sum += diff * diff;
+    }
+    return sum;
+}
+
+inline double dot_f64(const double* a, const double* b, size_t n) {
+    float64x2_t acc0 = vdupq_n_f64(0.0), acc1 = vdupq_n_f64(0.0);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        acc0 = vfmaq_f64(acc0, vld1q_f64(a + i), vld1q_f64(b + i));
+        acc1 = vfmaq_f64(acc1, vld1q_f64(a + i + 2), vld1q_f64(b + i + 2));
+    }
+    double sum = vaddvq_f64(vaddq_f64(acc0, acc1));
+    for (; i < n; ++i) {
+        sum += a[i] * b[i];
+    }
+    return sum;
+}
+
+inline DotNorms<float> dot_norms_f32(const float* a, const float* b, size_t n) {
+    float32x4_t ab = vdupq_n_f32(0.0f), aa = vdupq_n_f32(0.0f), bb = vdupq_n_f32(0.0f);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        const float32x4_t x = vld1q_f32(a + i), y = vld1q_f32(b + i);
+        ab = vfmaq_f32(ab, x, y);
+        aa = vfmaq_f32(aa, x, x);
+        bb = vfmaq_f32(bb, y, y);
+    }
+    DotNorms<float> result = {vaddvq_f32(ab), vaddvq_f32(aa), vaddvq_f32(bb)};
+    for (; i < n; ++i) {
+        result.dot += a[i] * b[i];
+        result.norm_a += a[i] * a[i];
+        result.norm_b += b[i] * b[i];
+    }
+    return result;
+}
+
+inline DotNorms<double> dot_norms_f64(const double* a, const double* b, size_t n) {
+    float64x2_t ab = vdupq_n_f64(0.0), aa = vdupq_n_f64(0.0), bb = vdupq_n_f64(0.0);
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2) {
+        const float64x2_t x = vld1q_f64(a + i), y = vld1q_f64(b + i);
+        ab = vfmaq_f64(ab, x, y);
+        aa = vfmaq_f64(aa, x, x);
+        bb = vfmaq_f64(bb, y, y);
+    }
+    DotNorms<double> result = {vaddvq_f64(ab), vaddvq_f64(aa), vaddvq_f64(bb)};
+    for (; i < n; ++i) {
+        result.dot += a[i] * b[i];
+        result.norm_a += a[i] * a[i];
+        result.norm_b += b[i] * b[i];
+    }
+    return result;
+}
+
+inline void dot_1x4_f32(const float* a, const float* b, size_t ldb, size_t n, float* out) {
+    const float* b0 = b;
+    const float* b1 = b + ldb;
+    const float* b2 = b + 2 * ldb;
+    const float* b3 = b + 3 * ldb;
+    float32x4_t acc0 = vdupq_n_f32(0.0f), acc1 = acc0, acc2 = acc0, acc3 = acc0;
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        const float32x4_t x = vld1q_f32(a + i);
+        acc0 = vfmaq_f32(acc0, x, vld1q_f32(b0 + i));
+        acc1 = vfmaq_f32(acc1, x, vld1q_f32(b1 + i));
+        acc2 = vfmaq_f32(acc2, x, vld1q_f32(b2 + i));
+        acc3 = vfmaq_f32(acc3, x, vld1q_f32(b3 + i));
+    }
+    float sum0 = vaddvq_f32(acc0), sum1 = vaddvq_f32(acc1), sum2 = vaddvq_f32(acc2), sum3 = vaddvq_f32(acc3);
+    for (; i < n; ++i) {
+        const float x = a[i];
+        sum0 += x * b0[i];
+        sum1 += x * b1[i];
+        sum2 += x * b2[i];
+        sum3 += x * b3[i];
+    }
+    out[0] = sum0;
+    out[1] = sum1;
+    out[2] = sum2;
+    out[3] = sum3;
+}
+
+inline void dot_1x4_f64(const double* a, const double* b, size_t ldb, size_t n, double* out) {
+    const double* b0 = b;
+    const double* b1 = b + ldb;
+    const double* b2 = b + 2 * ldb;
+    const double* b3 = b + 3 * ldb;
+    float64x2_t acc0 = vdupq_n_f64(0.0), acc1 = acc0, acc2 = acc0, acc3 = acc0;
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2) {
+        const float64x2_t x = vld1q_f64(a + i);
+        acc0 = vfmaq_f64(acc0, x, vld1q_f64(b0 + i));
+        acc1 = vfmaq_f64(acc1, x, vld1q_f64(b1 + i));
+        acc2 = vfmaq_f64(acc2, x, vld1q_f64(b2 + i));
+        acc3 = vfmaq_f64(acc3, x, vld1q_f64(b3 + i));
+    }
+    double sum0 = vaddvq_f64(acc0), sum1 = vaddvq_f64(acc1), sum2 = vaddvq_f64(acc2), sum3 = vaddvq_f64(acc3);
+    for (; i < n; ++i) {
+        const double x = a[i];
+        sum0 += x * b0[i];
+        sum1 += x * b1[i];
+        sum2 += x * b2[i];
+        sum3 += x * b3[i];
+    }
+    out[0] = sum0;
+    out[1] = sum1;
+    out[2] = sum2;
+    out[3] = sum3;
+}
+
+} // namespace neon
+#endif // RS_ARCH_ARM64
+
+// Kernel table for a level; levels this build has no kernels for fall back to scalar
+template <typename T>
+const Kernels<T>& kernels_for(SimdLevel level);
+
+template <>
+inline const Kernels<float>& kernels_for<float>(SimdLevel level) {
+    static const Kernels<float> scalar_kernels = {scalar::l2sq<float>, scalar::dot<float>, scalar::dot_norms<float>,
+                                                  scalar::dot_1x4<float>};
+#if defined(RS_ARCH_X86)
+    static const Kernels<float> sse2_kernels = {sse2::l2sq_f32, sse2::dot_f32, sse2::dot_norms_f32, sse2::dot_1x4_f32};
+    static const Kernels<float> avx2_kernels = {avx2::l2sq_f32, avx2::dot_f32, avx2::dot_norms_f32, avx2::dot_1x4_f32};
+    static const Kernels<float> avx512_kernels = {avx512::l2sq_f32, avx512::dot_f32, avx512::dot_norms_f32,
+                                                  avx512::dot_1x4_f32};
+    switch (level) {
+        case SimdLevel::SSE2: return sse2_kernels;
+        case SimdLevel::AVX2: return avx2_kernels;
+        case SimdLevel::AVX512: return avx512_kernels;
+        default: break;
+    }
+#elif defined(RS_ARCH_ARM64)
+    static const Kernels<float> neon_kernels = {neon::l2sq_f32, neon::dot_f32, neon::dot_norms_f32, neon::dot_1x4_f32};
+    if (level == SimdLevel::NEON) {
+        return neon_kernels;
+    }
+#endif
+    (void)level;
+    return scalar_kernels;
+}
+
+template <>
+inline const Kernels<double>& kernels_for<double>(SimdLevel level) {
+    static const Kernels<double> scalar_kernels = {scalar::l2sq<double>, scalar::dot<double>, scalar::dot_norms<double>,
+                                                   scalar::dot_1x4<double>};
+#if defined(RS_ARCH_X86)
+    static const Kernels<double> sse2_kernels = {sse2::l2sq_f64, sse2::dot_f64, sse2::dot_norms_f64, sse2::dot_1x4_f64};
+    static const Kernels<double> avx2_kernels = {avx2::l2sq_f64, avx2::dot_f64, avx2::dot_norms_f64, avx2::dot_1x4_f64};
+    static const Kernels<double> avx512_kernels = {avx512::l2sq_f64, avx512::dot_f64, avx512::dot_norms_f64,
+                                                   avx512::dot_1x4_f64};
+    switch (level) {
+        case SimdLevel::SSE2: return sse2_kernels;
+        case SimdLevel::AVX2: return avx2_kernels;
+        case SimdLevel::AVX512: return avx512_kernels;
+        default: break;
+    }
+#elif defined(RS_ARCH_ARM64)
+    static const Kernels<double> neon_kernels = {neon::l2sq_f64, neon::dot_f64, neon::dot_norms_f64, neon::dot_1x4_f64};
+    if (level == SimdLevel::NEON) {
+        return neon_kernels;
+    }
+#endif
+    (void)level;
+    return scalar_kernels;
+}
+
+namespace detail {
+
+// Best supported level, capped by RAPIDSIMILARITY_SIMD when it names a level this CPU can run
+inline SimdLevel select_level() {
+    const CpuFeatures features = detect_cpu_features();
+    const SimdLevel best = best_simd_level(features);
+    const char* requested = std::getenv("RAPIDSIMILARITY_SIMD");
+    if (requested != nullptr) {
+        const SimdLevel levels[] = {SimdLevel::Scalar, SimdLevel::SSE2, SimdLevel::AVX2, SimdLevel::AVX512,
+                                    SimdLevel::NEON};
+        for (SimdLevel level : levels) {
+            if (std::strcmp(requested, simd_level_name(level)) == 0 && simd_level_supported(level, features)) {
+                return level;
+            }
+        }
+    }
+    return best;
+}
+
+inline SimdLevel& selected_level() {
+    static SimdLevel level = select_level();
+    return level;
+}
+
+template <typename T>
+const Kernels<T>& active_kernels() {
+    static const Kernels<T>& kernels = kernels_for<T>(selected_level());
+    return kernels;
+}
+
+} // namespace detail
+
+// Select the kernels now rather than on the first distance call; returns the chosen level
+inline SimdLevel init() {
+    detail::active_kernels<float>();
+    detail::active_kernels<double>();
+    return detail::selected_level();
+}
+
+inline SimdLevel active_level() { return detail::selected_level(); }
+
+// Kernel table in use; hot loops fetch it once and call through it
+template <typename T>
+const Kernels<T>& kernels() {
+    return detail::active_kernels<T>();
+}
+
+template <typename T>
+T l2sq(const T* a, const T* b, size_t n) {
+    return kernels<T>().l2sq(a, b, n);
+}
+
+template <typename T>
+T dot(const T* a, const T* b, size_t n) {
+    return kernels<T>().dot(a, b, n);
+}
+
+template <typename T>
+T l2(const T* a, const T* b, size_t n) {
+    return std::sqrt(l2sq(a, b, n));
+}
+
+// Cosine similarity from one fused pass; 0 when either vector has zero norm
+template <typename T>
+T cosine(const T* a, const T* b, size_t n) {
+    const DotNorms<T> terms = kernels<T>().dot_norms(a, b, n);
+    if (terms.norm_a == T(0) || terms.norm_b == T(0)) {
+        return T(0);
+    }
+    return terms.dot / (std::sqrt(terms.norm_a) * std::sqrt(terms.norm_b));
+}
+
+// Cosine similarity against a vector whose norm is already known: one dot product per call
+template <typename T>
+T cosine_with_norms(const T* a, T norm_a, const T* b, T norm_b, size_t n) {
+    if (norm_a == T(0) || norm_b == T(0)) {
+        return T(0);
+    }
+    return kernels<T>().dot(a, b, n) / (norm_a * norm_b);
+}
+
+// Euclidean norm of each of the n rows of a row-major (n, dim) matrix
+template <typename T>
+void row_norms(const T* rows, size_t n, size_t dim, T* out) {
+    const auto dot_kernel = kernels<T>().dot;
+    for (size_t i = 0; i < n; ++i) {
+        const T* row = rows + i * dim;
+        out[i] = std::sqrt(dot_kernel(row, row, dim));
+    }
+}
+
+// Scale a vector to unit length in place; zero vectors are left unchanged. Returns the old norm.
+template <typename T>
+T normalize(T* vec, size_t n) {
+    const T norm = std::sqrt(kernels<T>().dot(vec, vec, n));
+    if (norm > T(0)) {
+        const T scale = T(1) / norm;
+        for (size_t i = 0; i < n; ++i) {
+            vec[i] *= scale;
+        }
+    }
+    return norm;
+}
+
+} // namespace simd
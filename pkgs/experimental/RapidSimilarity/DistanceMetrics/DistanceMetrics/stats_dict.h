@@ -0,0 +1,115 @@
+#pragma once
+
+#include <Python.h>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "query_stats.h"
+
+// Python views of the query counters (query_stats.h) behind the stats() and last_trace() methods
+// of the indexes. Both are flat dicts with the same keys: "latency_ns", one key per counter
+// ("distances", "visited", "candidates", "bytes") and one "<phase>_ns" key per phase ("hash_ns",
+// "probe_ns", "scan_ns", "select_ns"). In stats() each value summarises a histogram as
+// {"total", "mean", "p50", "p90", "p99", "max", "buckets"}, where buckets[b] counts the queries
+// whose value needs b bits; percentiles are bucket upper bounds. stats() also holds "enabled" and
+// "queries". last_trace() holds plain integers for one query.
+namespace stats_dict {
+
+// Store value under key and drop the reference to it; false with a Python exception set
+inline bool put(PyObject* dict, const char* key, PyObject* value) {
+    if (value == NULL) {
+        return false;
+    }
+    const int status = PyDict_SetItemString(dict, key, value);
+    Py_DECREF(value);
+    return status == 0;
+}
+
+inline PyObject* histogram(const stats::Histogram& histogram) {
+    size_t used = stats::Histogram::kBuckets;
+    while (used > 0 && histogram.bucket(used - 1) == 0) {
+        --used;
+    }
+    PyObject* buckets = PyList_New(static_cast<Py_ssize_t>(used));
+    if (buckets == NULL) {
+        return NULL;
+    }
+    for (size_t b = 0; b < used; ++b) {
+        PyObject* count = PyLong_FromUnsignedLongLong(histogram.bucket(b));
+        if (count == NULL) {
+            Py_DECREF(buckets);
+            return NULL;
+        }
+        PyList_SET_ITEM(buckets, static_cast<Py_ssize_t>(b), count);
+    }
+    const uint64_t total = histogram.count();
+    const double mean = total == 0 ? 0.0 : static_cast<double>(histogram.sum()) / static_cast<double>(total);
+    return Py_BuildValue("{s:K,s:d,s:K,s:K,s:K,s:K,s:N}", "total", static_cast<unsigned long long>(histogram.sum()),
+                         "mean", mean, "p50", static_cast<unsigned long long>(histogram.quantile(0.5)), "p90",
+                         static_cast<unsigned long long>(histogram.quantile(0.9)), "p99",
+                         static_cast<unsigned long long>(histogram.quantile(0.99)), "max",
+                         static_cast<unsigned long long>(histogram.max()), "buckets", buckets);
+}
+
+// The stats() dict of an index
+inline PyObject* summary(const stats::QueryStats& query_stats) {
+    PyObject* dict = PyDict_New();
+    if (dict == NULL) {
+        return NULL;
+    }
+    bool ok = put(dict, "enabled", PyBool_FromLong(stats::kEnabled)) &&
+              put(dict, "queries", PyLong_FromUnsignedLongLong(query_stats.queries())) &&
+              put(dict, "latency_ns", histogram(query_stats.latency()));
+    for (size_t c = 0; ok && c < stats::kCounters; ++c) {
+        ok = put(dict, stats::counter_name(c), histogram(query_stats.counter(c)));
+    }
+    for (size_t p = 0; ok && p < stats::kPhases; ++p) {
+        ok = put(dict, (std::string(stats::phase_name(p)) + "_ns").c_str(), histogram(query_stats.phase(p)));
+    }
+    if (!ok) {
+        Py_DECREF(dict);
+        return NULL;
+    }
+    return dict;
+}
+
+// The last_trace() dict of one query, or None without a kept trace
+inline PyObject* trace(const stats::Trace* trace) {
+    if (trace == nullptr) {
+        Py_RETURN_NONE;
+    }
+    PyObject* dict = PyDict_New();
+    if (dict == NULL) {
+        return NULL;
+    }
+    bool ok = put(dict, "latency_ns", PyLong_FromUnsignedLongLong(trace->total_ns));
+    for (size_t c = 0; ok && c < stats::kCounters; ++c) {
+        ok = put(dict, stats::counter_name(c), PyLong_FromUnsignedLongLong(trace->counters[c]));
+    }
+    for (size_t p = 0; ok && p < stats::kPhases; ++p) {
+        ok = put(dict, (std::string(stats::phase_name(p)) + "_ns").c_str(),
+                 PyLong_FromUnsignedLongLong(trace->phase_ns[p]));
+    }
+    if (!ok) {
+        Py_DECREF(dict);
+        return NULL;
+    }
+    return dict;
+}
+
+// Body of the stats(reset=False) methods: the summary, after which reset clears the counters
+inline PyObject* stats_method(stats::QueryStats& query_stats, PyObject* args, PyObject* kwds) {
+    static const char* kwlist[] = {"reset", NULL};
+    int reset = 0;
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|p", const_cast<char**>(kwlist), &reset)) {
+        return NULL;
+    }
+    PyObject* result = summary(query_stats);
+    if (result != NULL && reset) {
+        query_stats.reset();
+    }
+    return result;
+}
+
+} // namespace stats_dict
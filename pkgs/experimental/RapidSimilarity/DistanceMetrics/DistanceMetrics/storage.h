@@ -0,0 +1,755 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#include "index_io.h"
+#include "metrics.h"
+#include "query_stats.h"
+#include "simd_kernels.h"
+
+// Compact element types for stored vectors and the kernels that score a float32 query against
+// them. Queries always stay float32; a stored row is widened to float32 inside the registers of
+// the kernel, so a float16 row costs half and an int8 row a quarter of the memory traffic of a
+// float32 row. Kernels are specialised on the element type S and picked per SIMD level like the
+// float32/float64 tables in simd_kernels.h.
+namespace simd {
+
+// IEEE 754 binary16, kept as its bit pattern
+struct float16 {
+    uint16_t bits;
+};
+
+inline float to_float(float16 value) {
+    const uint32_t sign = static_cast<uint32_t>(value.bits & 0x8000u) << 16;
+    uint32_t exponent = (value.bits >> 10) & 0x1fu;
+    uint32_t mantissa = value.bits & 0x3ffu;
+    uint32_t bits;
+    if (exponent == 0x1f) {
+        bits = sign | 0x7f800000u | (mantissa << 13);  // Infinity or NaN
+    } else if (exponent != 0) {
+        bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+    } else if (mantissa == 0) {
+        bits = sign;
+    } else {
+        // Subnormal: shift the mantissa up to an implicit leading one
+        exponent = 113;
+        while ((mantissa & 0x400u) == 0) {
+            mantissa <<= 1;
+            --exponent;
+        }
+        bits = sign | (exponent << 23) | ((mantissa & 0x3ffu) << 13);
+    }
+    float result;
+    std::memcpy(&result, &bits, sizeof(result));
+    return result;
+}
+
+// Round to nearest even; magnitudes from 65520 up become infinity
+inline float16 to_float16(float value) {
+    uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    const uint16_t sign = static_cast<uint16_t>((bits >> 16) & 0x8000u);
+    const uint32_t magnitude = bits & 0x7fffffffu;
+    if (magnitude > 0x7f800000u) {
+        return float16{static_cast<uint16_t>(sign | 0x7e00u)};
+    }
+    if (magnitude >= 0x477ff000u) {
+        return float16{static_cast<uint16_t>(sign | 0x7c00u)};
+    }
+    if (magnitude < 0x38800000u) {
+        // Below the smallest normal half (2^-14): a subnormal in units of 2^-24, or zero
+        if (magnitude <= 0x33000000u) {
+            return float16{sign};
+        }
+        const uint32_t shift = 126 - (magnitude >> 23);
+        const uint32_t mantissa = (magnitude & 0x7fffffu) | 0x800000u;
+        uint32_t result = mantissa >> shift;
+        const uint32_t remainder = mantissa & ((1u << shift) - 1);
+        const uint32_t halfway = 1u << (shift - 1);
+        if (remainder > halfway || (remainder == halfway && (result & 1u))) {
+            ++result;
+        }
+        return float16{static_cast<uint16_t>(sign | result)};
+    }
+    // Rebias the exponent from 127 to 15; a rounding carry correctly bumps the exponent
+    uint32_t result = (magnitude - 0x38000000u) >> 13;
+    const uint32_t remainder = magnitude & 0x1fffu;
+    if (remainder > 0x1000u || (remainder == 0x1000u && (result & 1u))) {
+        ++result;
+    }
+    return float16{static_cast<uint16_t>(sign | result)};
+}
+
+// A float32 query against one stored row of n elements of type S
+template <typename S>
+struct StoredKernels {
+    float (*l2sq)(const float* query, const S* row, size_t n); // Squared Euclidean distance
+    float (*dot)(const float* query, const S* row, size_t n);  // Inner product
+};
+
+namespace scalar {
+
+inline float widen(float value) { return value; }
+inline float widen(float16 value) { return to_float(value); }
+inline float widen(int8_t value) { return static_cast<float>(value); }
+
+template <typename S>
+float stored_l2sq(const float* query, const S* row, size_t n) {
+    float acc[8] = {};
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        for (size_t j = 0; j < 8; ++j) {
+            const float diff = query[i + j] - widen(row[i + j]);
+            acc[j] += diff * diff;
+        }
+    }
+    float sum = ((acc[0] + acc[1]) + (acc[2] + acc[3])) + ((acc[4] + acc[5]) + (acc[6] + acc[7]));
+    for (; i < n; ++i) {
+        const float diff = query[i] - widen(row[i]);
+        sum += diff * diff;
+    }
+    return sum;
+}
+
+template <typename S>
+float stored_dot(const float* query, const S* row, size_t n) {
+    float acc[8] = {};
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        for (size_t j = 0; j < 8; ++j) {
+            acc[j] += query[i + j] * widen(row[i + j]);
+        }
+    }
+    float sum = ((acc[0] + acc[1]) + (acc[2] + acc[3])) + ((acc[4] + acc[5]) + (acc[6] + acc[7]));
+    for (; i < n; ++i) {
+        sum += query[i] * widen(row[i]);
+    }
+    return sum;
+}
+
+} // namespace scalar
+
+#if defined(RS_ARCH_X86)
+namespace avx2 {
+
+// Eight halves widened with F16C
+RS_TARGET("avx2,fma,f16c") inline __m256 load_f16(const float16* row) {
+    return _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(row)));
+}
+
+// Eight int8 codes sign-extended and converted
+RS_TARGET("avx2,fma") inline __m256 load_i8(const int8_t* row) {
+    return _mm256_cvtepi32_ps(_mm256_cvtepi8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(row))));
+}
+
+RS_TARGET("avx2,fma,f16c") inline float l2sq_f16(const float* query, const float16* row, size_t n) {
+    __m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        const __m256 d0 = _mm256_sub_ps(_mm256_loadu_ps(query + i), load_f16(row + i));
+        const __m256 d1 = _mm256_sub_ps(_mm256_loadu_ps(query + i + 8), load_f16(row + i + 8));
+        acc0 = _mm256_fmadd_ps(d0, d0, acc0);
+        acc1 = _mm256_fmadd_ps(d1, d1, acc1);
+    }
+    for (; i + 8 <= n; i += 8) {
+        const __m256 d = _mm256_sub_ps(_mm256_loadu_ps(query + i), load_f16(row + i));
+        acc0 = _mm256_fmadd_ps(d, d, acc0);
+    }
+    float sum = hsum(_mm256_add_ps(acc0, acc1));
+    for (; i < n; ++i) {
+        const float diff = query[i] - to_float(row[i]);
+        sum += diff * diff;
+    }
+    return sum;
+}
+
+RS_TARGET("avx2,fma,f16c") inline float dot_f16(const float* query, const float16* row, size_t n) {
+    __m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(query + i), load_f16(row + i), acc0);
+        acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(query + i + 8), load_f16(row + i + 8), acc1);
+    }
+    for (; i + 8 <= n; i += 8) {
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(query + i), load_f16(row + i), acc0);
+    }
+    float sum = hsum(_mm256_add_ps(acc0, acc1));
+    for (; i < n; ++i) {
+        sum += query[i] * to_float(row[i]);
+    }
+    return sum;
+}
+
+RS_TARGET("avx2,fma") inline float l2sq_i8(const float* query, const int8_t* row, size_t n) {
+    __m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        const __m256 d0 = _mm256_sub_ps(_mm256_loadu_ps(query + i), load_i8(row + i));
+        const __m256 d1 = _mm256_sub_ps(_mm256_loadu_ps(query + i + 8), load_i8(row + i + 8));
+        acc0 = _mm256_fmadd_ps(d0, d0, acc0);
+        acc1 = _mm256_fmadd_ps(d1, d1, acc1);
+    }
+    for (; i + 8 <= n; i += 8) {
+        const __m256 d = _mm256_sub_ps(_mm256_loadu_ps(query + i), load_i8(row + i));
+        acc0 = _mm256_fmadd_ps(d, d, acc0);
+    }
+    float sum = hsum(_mm256_add_ps(acc0, acc1));
+    for (; i < n; ++i) {
+        const float diff = query[i] - static_cast<float>(row[i]);
+        sum += diff * diff;
+    }
+    return sum;
+}
+
+RS_TARGET("avx2,fma") inline float dot_i8(const float* query, const int8_t* row, size_t n) {
+    __m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(query + i), load_i8(row + i), acc0);
+        acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(query + i + 8), load_i8(row + i + 8), acc1);
+    }
+    for (; i + 8 <= n; i += 8) {
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(query + i), load_i8(row + i), acc0);
+    }
+    float sum = hsum(_mm256_add_ps(acc0, acc1));
+    for (; i < n; ++i) {
+        sum += query[i] * static_cast<float>(row[i]);
+    }
+    return sum;
+}
+
+} // namespace avx2
+
+// The masked tail loads of 16-bit and 8-bit elements need AVX-512BW, so the last partial block
+// of a row is copied into a zero-padded register-sized buffer instead
+namespace avx512 {
+
+// The all-ones zero-masked conversions compile to the plain instructions; the unmasked
+// intrinsics trip -Wmaybe-uninitialized in GCC 12's headers
+RS_TARGET("avx512f") inline __m512 load_f16(const float16* row) {
+    return _mm512_maskz_cvtph_ps(0xffff, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(row)));
+}
+
+RS_TARGET("avx512f") inline __m512 load_i8(const int8_t* row) {
+    const __m512i codes = _mm512_maskz_cvtepi8_epi32(0xffff, _mm_loadu_si128(reinterpret_cast<const __m128i*>(row)));
+    return _mm512_maskz_cvtepi32_ps(0xffff, codes);
+}
+
+template <typename S>
+inline void copy_tail(const S* row, size_t count, S (&tail)[16]) {
+    std::memset(tail, 0, sizeof(tail));
+    std::memcpy(tail, row, count * sizeof(S));
+}
+
+RS_TARGET("avx512f") inline float l2sq_f16(const float* query, const float16* row, size_t n) {
+    __m512 acc0 = _mm512_setzero_ps(), acc1 = _mm512_setzero_ps();
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        const __m512 d0 = _mm512_sub_ps(_mm512_loadu_ps(query + i), load_f16(row + i));
+        const __m512 d1 = _mm512_sub_ps(_mm512_loadu_ps(query + i + 16), load_f16(row + i + 16));
+        acc0 = _mm512_fmadd_ps(d0, d0, acc0);
+        acc1 = _mm512_fmadd_ps(d1, d1, acc1);
+    }
+    for (; i + 16 <= n; i += 16) {
+        const __m512 d = _mm512_sub_ps(_mm512_loadu_ps(query + i), load_f16(row + i));
+        acc0 = _mm512_fmadd_ps(d, d, acc0);
+    }
+    if (i < n) {
+        float16 tail[16];
+        copy_tail(row + i, n - i, tail);
+        const __mmask16 mask = static_cast<__mmask16>((1u << (n - i)) - 1);
+        const __m512 d = _mm512_sub_ps(_mm512_maskz_loadu_ps(mask, query + i), load_f16(tail));
+        acc1 = _mm512_fmadd_ps(d, d, acc1);
+    }
+    return hsum(_mm512_add_ps(acc0, acc1));
+}
+
+RS_TARGET("avx512f") inline float dot_f16(const float* query, const float16* row, size_t n) {
+    __m512 acc0 = _mm512_setzero_ps(), acc1 = _mm512_setzero_ps();
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(query + i), load_f16(row + i), acc0);
+        acc1 = _mm512_fmadd_ps(_mm512_loadu_ps(query + i + 16), load_f16(row + i + 16), acc1);
+    }
+    for (; i + 16 <= n; i += 16) {
+        acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(query + i), load_f16(row + i), acc0);
+    }
+    if (i < n) {
+        float16 tail[16];
+        copy_tail(row + i, n - i, tail);
+        const __mmask16 mask = static_cast<__mmask16>((1u << (n - i)) - 1);
+        acc1 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(mask, query + i), load_f16(tail), acc1);
+    }
+    return hsum(_mm512_add_ps(acc0, acc1));
+}
+
+RS_TARGET("avx512f") inline float l2sq_i8(const float* query, const int8_t* row, size_t n) {
+    __m512 acc0 = _mm512_setzero_ps(), acc1 = _mm512_setzero_ps();
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        const __m512 d0 = _mm512_sub_ps(_mm512_loadu_ps(query + i), load_i8(row + i));
+        const __m512 d1 = _mm512_sub_ps(_mm512_loadu_ps(query + i + 16), load_i8(row + i + 16));
+        acc0 = _mm512_fmadd_ps(d0, d0, acc0);
+        acc1 = _mm512_fmadd_ps(d1, d1, acc1);
+    }
+    for (; i + 16 <= n; i += 16) {
+        const __m512 d = _mm512_sub_ps(_mm512_loadu_ps(query + i), load_i8(row + i));
+        acc0 = _mm512_fmadd_ps(d, d, acc0);
+    }
+    if (i < n) {
+        int8_t tail[16];
+        copy_tail(row + i, n - i, tail);
+        const __mmask16 mask = static_cast<__mmask16>((1u << (n - i)) - 1);
+        const __m512 d = _mm512_sub_ps(_mm512_maskz_loadu_ps(mask, query + i), load_i8(tail));
+        acc1 = _mm512_fmadd_ps(d, d, acc1);
+    }
+    return hsum(_mm512_add_ps(acc0, acc1));
+}
+
+RS_TARGET("avx512f") inline float dot_i8(const float* query, const int8_t* row, size_t n) {
+    __m512 acc0 = _mm512_setzero_ps(), acc1 = _mm512_setzero_ps();
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(query + i), load_i8(row + i), acc0);
+        acc1 = _mm512_fmadd_ps(_mm512_loadu_ps(query + i + 16), load_i8(row + i + 16), acc1);
+    }
+    for (; i + 16 <= n; i += 16) {
+        acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(query + i), load_i8(row + i), acc0);
+    }
+    if (i < n) {
+        int8_t tail[16];
+        copy_tail(row + i, n - i, tail);
+        const __mmask16 mask = static_cast<__mmask16>((1u << (n - i)) - 1);
+        acc1 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(mask, query + i), load_i8(tail), acc1);
+    }
+    return hsum(_mm512_add_ps(acc0, acc1));
+}
+
+} // namespace avx512
+#endif // RS_ARCH_X86
+
+// Kernel table for a level. float32 rows reuse the float32 table; float16 and int8 rows have
+// AVX2 (float16 also needs F16C) and AVX-512 kernels, and scalar loops everywhere else.
+template <typename S>
+const StoredKernels<S>& stored_kernels_for(SimdLevel level);
+
+template <>
+inline const StoredKernels<float>& stored_kernels_for<float>(SimdLevel level) {
+    static const StoredKernels<float> tables[] = {
+        {kernels_for<float>(SimdLevel::Scalar).l2sq, kernels_for<float>(SimdLevel::Scalar).dot},
+        {kernels_for<float>(SimdLevel::SSE2).l2sq, kernels_for<float>(SimdLevel::SSE2).dot},
+        {kernels_for<float>(SimdLevel::AVX2).l2sq, kernels_for<float>(SimdLevel::AVX2).dot},
+        {kernels_for<float>(SimdLevel::AVX512).l2sq, kernels_for<float>(SimdLevel::AVX512).dot},
+        {kernels_for<float>(SimdLevel::NEON).l2sq, kernels_for<float>(SimdLevel::NEON).dot}};
+    return tables[static_cast<size_t>(level)];
+}
+
+template <>
+inline const StoredKernels<float16>& stored_kernels_for<float16>(SimdLevel level) {
+    static const StoredKernels<float16> scalar_kernels = {scalar::stored_l2sq<float16>, scalar::stored_dot<float16>};
+#if defined(RS_ARCH_X86)
+    static const StoredKernels<float16> avx2_kernels = {avx2::l2sq_f16, avx2::dot_f16};
+    static const StoredKernels<float16> avx512_kernels = {avx512::l2sq_f16, avx512::dot_f16};
+    if (level == SimdLevel::AVX512) {
+        return avx512_kernels;
+    }
+    if (level == SimdLevel::AVX2 && detect_cpu_features().f16c) {
+        return avx2_kernels;
+    }
+#endif
+    (void)level;
+    return scalar_kernels;
+}
+
+template <>
+inline const StoredKernels<int8_t>& stored_kernels_for<int8_t>(SimdLevel level) {
+    static const StoredKernels<int8_t> scalar_kernels = {scalar::stored_l2sq<int8_t>, scalar::stored_dot<int8_t>};
+#if defined(RS_ARCH_X86)
+    static const StoredKernels<int8_t> avx2_kernels = {avx2::l2sq_i8, avx2::dot_i8};
+    static const StoredKernels<int8_t> avx512_kernels = {avx512::l2sq_i8, avx512::dot_i8};
+    switch (level) {
+        case SimdLevel::AVX2: return avx2_kernels;
+        case SimdLevel::AVX512: return avx512_kernels;
+        default: break;
+    }
+#endif
+    (void)level;
+    return scalar_kernels;
+}
+
+// Table for the level selected by simd::init()
+template <typename S>
+const StoredKernels<S>& stored_kernels() {
+    static const StoredKernels<S>& kernels = stored_kernels_for<S>(active_level());
+    return kernels;
+}
+
+} // namespace simd
+
+// Element type of a VectorStore
+enum class StorageType : uint32_t {
+    Float32 = 0,
+    Float16 = 1,
+    Int8 = 2  // One int8 code per element plus a per-row offset and scale
+};
+
+inline const char* storage_name(StorageType type) {
+    switch (type) {
+        case StorageType::Float16: return "float16";
+        case StorageType::Int8: return "int8";
+        default: return "float32";
+    }
+}
+
+inline StorageType parse_storage(const std::string& name) {
+    if (name == "float32") {
+        return StorageType::Float32;
+    }
+    if (name == "float16") {
+        return StorageType::Float16;
+    }
+    if (name == "int8") {
+        return StorageType::Int8;
+    }
+    throw std::invalid_argument("storage must be 'float32', 'float16' or 'int8'.");
+}
+
+// Row-major (size, dim) vectors kept as float32, float16 or int8, scored against float32
+// queries. int8 rows are quantized each on their own range, row ~= offset + scale * code, so
+// points can be appended at any time without training a quantizer first. A query is prepared
+// once and then scored against any number of rows; every score is one kernel pass over the row.
+//
+// Appends must not run concurrently with anything else; prepared queries are read-only.
+class VectorStore {
+public:
+    // Per-row int8 parameters; the code sums let a distance be read off one dot product
+    struct Int8Row {
+        float offset;
+        float scale;
+        float code_sum;     // sum of the codes
+        float code_square;  // sum of the squared codes
+    };
+
+    // A float32 query and the per-query terms of the int8 distance
+    class Query {
+    public:
+        const float* data() const { return values_; }
+
+    private:
+        friend class VectorStore;
+        const float* values_ = nullptr;
+        float sum_ = 0.0f;     // sum of the elements
+        float square_ = 0.0f;  // squared norm
+        mutable std::vector<float> scratch_;  // Decoded row for the metrics scored on rows
+    };
+
+    explicit VectorStore(StorageType type = StorageType::Float32) : type_(type) {}
+
+    StorageType type() const { return type_; }
+    size_t size() const { return size_; }
+    size_t dimension() const { return dim_; }
+    bool empty() const { return size_ == 0; }
+
+    // Bytes stored per row, including the int8 row parameters
+    size_t bytes_per_row() const { return bytes_per_row(type_, dim_); }
+
+    static size_t bytes_per_row(StorageType type, size_t dim) {
+        switch (type) {
+            case StorageType::Float16: return dim * sizeof(simd::float16);
+            case StorageType::Int8: return dim + sizeof(Int8Row);
+            default: return dim * sizeof(float);
+        }
+    }
+
+    // Room for rows vectors of dimension dim without reallocating
+    void reserve(size_t rows, size_t dim) {
+        switch (type_) {
+            case StorageType::Float16: f16_.edit().reserve(rows * dim); break;
+            case StorageType::Int8:
+                i8_.edit().reserve(rows * dim);
+                i8_rows_.edit().reserve(rows);
+                break;
+            default: f32_.edit().reserve(rows * dim); break;
+        }
+    }
+
+    // Append n row-major rows of dimension dim (float or double); the first append fixes dim
+    template <typename T>
+    void append(const T* rows, size_t n, size_t dim) {
+        if (dim == 0) {
+            throw std::invalid_argument("Vectors must have at least one dimension.");
+        }
+        if (size_ > 0 && dim != dim_) {
+            throw std::invalid_argument("Vector dimension does not match the store.");
+        }
+        dim_ = dim;
+        switch (type_) {
+            case StorageType::Float16: {
+                std::vector<simd::float16>& out = f16_.edit();
+                out.reserve(out.size() + n * dim);
+                for (size_t i = 0; i < n * dim; ++i) {
+                    out.push_back(simd::to_float16(static_cast<float>(rows[i])));
+                }
+                break;
+            }
+            case StorageType::Int8: {
+                std::vector<int8_t>& codes = i8_.edit();
+                std::vector<Int8Row>& params = i8_rows_.edit();
+                codes.resize(codes.size() + n * dim);
+                int8_t* out = codes.data() + size_ * dim;
+                for (size_t r = 0; r < n; ++r) {
+                    params.push_back(quantize(rows + r * dim, out + r * dim));
+                }
+                break;
+            }
+            default: {
+                std::vector<float>& out = f32_.edit();
+                out.insert(out.end(), rows, rows + n * dim);
+                break;
+            }
+        }
+        size_ += n;
+    }
+
+    // Append every row of other, a store of the same type, as it is encoded there
+    void append(const VectorStore& other) {
+        if (other.empty()) {
+            return;
+        }
+        if (other.type_ != type_ || (size_ > 0 && other.dim_ != dim_)) {
+            throw std::invalid_argument("Vector stores do not match.");
+        }
+        dim_ = other.dim_;
+        switch (type_) {
+            case StorageType::Float16: {
+                std::vector<simd::float16>& out = f16_.edit();
+                out.insert(out.end(), other.f16_.begin(), other.f16_.end());
+                break;
+            }
+            case StorageType::Int8: {
+                std::vector<int8_t>& codes = i8_.edit();
+                std::vector<Int8Row>& params = i8_rows_.edit();
+                codes.insert(codes.end(), other.i8_.begin(), other.i8_.end());
+                params.insert(params.end(), other.i8_rows_.begin(), other.i8_rows_.end());
+                break;
+            }
+            default: {
+                std::vector<float>& out = f32_.edit();
+                out.insert(out.end(), other.f32_.begin(), other.f32_.end());
+                break;
+            }
+        }
+        size_ += other.size_;
+    }
+
+    // Row id widened to float32
+    void decode(size_t id, float* out) const {
+        switch (type_) {
+            case StorageType::Float16: {
+                const simd::float16* row = f16_.data() + id * dim_;
+                for (size_t d = 0; d < dim_; ++d) {
+                    out[d] = simd::to_float(row[d]);
+                }
+                break;
+            }
+            case StorageType::Int8: {
+                const int8_t* row = i8_.data() + id * dim_;
+                const Int8Row& params = i8_rows_[id];
+                for (size_t d = 0; d < dim_; ++d) {
+                    out[d] = params.offset + params.scale * static_cast<float>(row[d]);
+                }
+                break;
+            }
+            default: std::copy(f32_.data() + id * dim_, f32_.data() + (id + 1) * dim_, out); break;
+        }
+    }
+
+    // Row id as float32: the stored row itself for float32 storage, otherwise decoded into scratch
+    const float* row(size_t id, std::vector<float>& scratch) const {
+        if (type_ == StorageType::Float32) {
+            return f32_.data() + id * dim_;
+        }
+        scratch.resize(dim_);
+        decode(id, scratch.data());
+        return scratch.data();
+    }
+
+    // Query of dim floats, which must outlive the returned object
+    Query prepare(const float* query) const {
+        Query prepared;
+        prepared.values_ = query;
+        if (type_ == StorageType::Int8) {
+            for (size_t d = 0; d < dim_; ++d) {
+                prepared.sum_ += query[d];
+                prepared.square_ += query[d] * query[d];
+            }
+        }
+        return prepared;
+    }
+
+    float l2sq(const Query& query, size_t id) const {
+        switch (type_) {
+            case StorageType::Float16:
+                return simd::stored_kernels<simd::float16>().l2sq(query.values_, f16_.data() + id * dim_, dim_);
+            case StorageType::Int8: {
+                // |q - o - s c|^2 = |q|^2 - 2 o sum(q) + dim o^2 - 2 s (q.c - o sum(c)) + s^2 |c|^2
+                const Int8Row& params = i8_rows_[id];
+                const float qc = simd::stored_kernels<int8_t>().dot(query.values_, i8_.data() + id * dim_, dim_);
+                const float o = params.offset;
+                const float s = params.scale;
+                const float distance = query.square_ - 2.0f * o * query.sum_ + static_cast<float>(dim_) * o * o -
+                                       2.0f * s * (qc - o * params.code_sum) + s * s * params.code_square;
+                return std::max(0.0f, distance);
+            }
+            default:
+                return simd::stored_kernels<float>().l2sq(query.values_, f32_.data() + id * dim_, dim_);
+        }
+    }
+
+    float dot(const Query& query, size_t id) const {
+        switch (type_) {
+            case StorageType::Float16:
+                return simd::stored_kernels<simd::float16>().dot(query.values_, f16_.data() + id * dim_, dim_);
+            case StorageType::Int8: {
+                const Int8Row& params = i8_rows_[id];
+                const float qc = simd::stored_kernels<int8_t>().dot(query.values_, i8_.data() + id * dim_, dim_);
+                return params.offset * query.sum_ + params.scale * qc;
+            }
+            default:
+                return simd::stored_kernels<float>().dot(query.values_, f32_.data() + id * dim_, dim_);
+        }
+    }
+
+    // Rank of row id under the metric trait M (smaller is nearer, see metrics.h). Euclidean and
+    // inner-product ranks are read off the stored encoding; the others score the decoded row.
+    // Counted as one distance of the running query (query_stats.h).
+    template <typename M>
+    float rank(const Query& query, size_t id) const {
+        stats::count(stats::Distances);
+        stats::count(stats::Bytes, bytes_per_row());
+        if constexpr (M::basis == metrics::Basis::SquaredL2) {
+            return l2sq(query, id);
+        } else if constexpr (M::basis == metrics::Basis::Dot) {
+            return -dot(query, id);
+        } else {
+            return M::rank(query.values_, row(id, query.scratch_), dim_);
+        }
+    }
+
+    // Ranks of the rows ids[i] - first under M, into out[i]. Rows are prefetched a few ids ahead,
+    // so the scattered rows of a candidate list load while the ones before them are scored.
+    template <typename M>
+    void rank_batch(const Query& query, const uint32_t* ids, size_t n, size_t first, float* out) const {
+        for (size_t i = 0; i < n; ++i) {
+            if (i + kPrefetchDistance < n) {
+                prefetch(ids[i + kPrefetchDistance] - first);
+            }
+            out[i] = rank<M>(query, ids[i] - first);
+        }
+    }
+
+    // Sections: parameters (type, dim, size), then the rows (and the int8 row parameters)
+    void save(index_io::Writer& writer) const {
+        writer.write(std::vector<uint64_t>{static_cast<uint64_t>(type_), dim_, size_});
+        switch (type_) {
+            case StorageType::Float16: writer.write(f16_); break;
+            case StorageType::Int8:
+                writer.write(i8_);
+                writer.write(i8_rows_);
+                break;
+            default: writer.write(f32_); break;
+        }
+    }
+
+    // Store read back from the sections written by save(); the rows stay mapped
+    explicit VectorStore(index_io::Reader& reader) {
+        const std::vector<uint64_t> params = reader.vector<uint64_t>(3);
+        if (params[0] > static_cast<uint64_t>(StorageType::Int8)) {
+            throw std::invalid_argument("Vector store section is inconsistent.");
+        }
+        type_ = static_cast<StorageType>(params[0]);
+        dim_ = static_cast<size_t>(params[1]);
+        size_ = static_cast<size_t>(params[2]);
+        size_t stored = 0;
+        switch (type_) {
+            case StorageType::Float16:
+                f16_ = reader.array<simd::float16>();
+                stored = f16_.size();
+                break;
+            case StorageType::Int8:
+                i8_ = reader.array<int8_t>();
+                i8_rows_ = reader.array<Int8Row>();
+                stored = i8_rows_.size() == size_ ? i8_.size() : size_t(-1);
+                break;
+            default:
+                f32_ = reader.array<float>();
+                stored = f32_.size();
+                break;
+        }
+        if (stored != size_ * dim_) {
+            throw std::invalid_argument("Vector store section is inconsistent.");
+        }
+    }
+
+private:
+    StorageType type_;
+    size_t dim_ = 0;
+    size_t size_ = 0;
+    index_io::Array<float> f32_;
+    index_io::Array<simd::float16> f16_;
+    index_io::Array<int8_t> i8_;
+    index_io::Array<Int8Row> i8_rows_;
+
+    static constexpr size_t kPrefetchDistance = 4; // Rows ahead of the one being scored
+    static constexpr size_t kPrefetchLines = 8;    // Leading cache lines of a row; the hardware streams the rest
+
+    void prefetch(size_t id) const {
+        const char* row;
+        size_t bytes;
+        switch (type_) {
+            case StorageType::Float16:
+                row = reinterpret_cast<const char*>(f16_.data() + id * dim_);
+                bytes = dim_ * sizeof(simd::float16);
+                break;
+            case StorageType::Int8:
+                row = reinterpret_cast<const char*>(i8_.data() + id * dim_);
+                bytes = dim_;
+                __builtin_prefetch(i8_rows_.data() + id);
+                break;
+            default:
+                row = reinterpret_cast<const char*>(f32_.data() + id * dim_);
+                bytes = dim_ * sizeof(float);
+                break;
+        }
+        for (size_t offset = 0; offset < bytes && offset < kPrefetchLines * 64; offset += 64) {
+            __builtin_prefetch(row + offset);
+        }
+    }
+
+    // Codes of one row on its own [min, max] range: 255 steps centred on the midpoint
+    template <typename T>
+    Int8Row quantize(const T* row, int8_t* codes) const {
+        float low = static_cast<float>(row[0]);
+        float high = low;
+        for (size_t d = 1; d < dim_; ++d) {
+            low = std::min(low, static_cast<float>(row[d]));
+            high = std::max(high, static_cast<float>(row[d]));
+        }
+        Int8Row params = {0.5f * (low + high), (high - low) / 255.0f, 0.0f, 0.0f};
+        const float inverse = params.scale > 0.0f ? 1.0f / params.scale : 0.0f;
+        for (size_t d = 0; d < dim_; ++d) {
+            const float code = std::nearbyint((static_cast<float>(row[d]) - params.offset) * inverse);
+            codes[d] = static_cast<int8_t>(std::min(127.0f, std::max(-128.0f, code)));
+            params.code_sum += codes[d];
+            params.code_square += static_cast<float>(codes[d]) * codes[d];
+        }
+        return params;
+    }
+};
@@ -0,0 +1,148 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include <thread>
+#include <algorithm>
+#include <cstddef>
+
+// Process-wide pool of worker threads used to fan batched queries out across cores.
+// parallel_for lets the calling thread take part in the work, so it is safe to call from
+// many threads at once and from inside another parallel_for without deadlocking.
+class ThreadPool {
+public:
+    // Shared pool with one worker per hardware thread (minus the caller). It is never
+    // destroyed so that interpreter shutdown does not have to join busy workers.
+    static ThreadPool& instance() {
+        static ThreadPool* pool = new ThreadPool(default_threads() - 1);
+        return *pool;
+    }
+
+    static size_t default_threads() {
+        return std::max<size_t>(1, std::thread::hardware_concurrency());
+    }
+
+    explicit ThreadPool(size_t num_workers) {
+        for (size_t i = 0; i < num_workers; ++i) {
+            workers.emplace_back([this] { work(); });
+        }
+    }
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (std::thread& worker : workers) {
+            worker.join();
+        }
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    size_t size() const { return workers.size() + 1; }
+
+    // Run fn(i) for every i in [0, n) using up to num_threads threads including the caller
+    // (0 means all of them). Indices are handed out in chunks of `grain`. The first exception
+    // thrown by fn is rethrown on the calling thread once every started call has finished.
+    template <typename F>
+    void parallel_for(size_t n, size_t num_threads, F&& fn, size_t grain = 1) {
+        if (n == 0) {
+            return;
+        }
+        grain = std::max<size_t>(1, grain);
+        const size_t chunks = (n + grain - 1) / grain;
+        size_t threads = num_threads == 0 ? size() : std::min(num_threads, size());
+        threads = std::min(threads, chunks);
+        if (threads <= 1) {
+            for (size_t i = 0; i < n; ++i) {
+                fn(i);
+            }
+            return;
+        }
+
+        auto state = std::make_shared<LoopState>();
+        std::function<void(size_t)> body = std::ref(fn);
+        // Helpers that start after the loop is finished see no work left and never touch body
+        auto run = [state, n, grain, &body] {
+            for (;;) {
+                const size_t begin = state->next.fetch_add(grain);
+                if (begin >= n) {
+                    break;
+                }
+                const size_t end = std::min(n, begin + grain);
+                if (!state->failed.load(std::memory_order_relaxed)) {
+                    try {
+                        for (size_t i = begin; i < end; ++i) {
+                            body(i);
+                        }
+                    } catch (...) {
+                        std::lock_guard<std::mutex> lock(state->mutex);
+                        if (!state->error) {
+                            state->error = std::current_exception();
+                        }
+                        state->failed.store(true, std::memory_order_relaxed);
+                    }
+                }
+                if (state->done.fetch_add(end - begin) + (end - begin) == n) {
+                    std::lock_guard<std::mutex> lock(state->mutex);
+                    state->finished.notify_all();
+                }
+            }
+        };
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (size_t i = 1; i < threads; ++i) {
+                tasks.emplace_back(run);
+            }
+        }
+        wake.notify_all();
+        run();
+
+        std::unique_lock<std::mutex> lock(state->mutex);
+        state->finished.wait(lock, [&] { return state->done.load() == n; });
+        if (state->error) {
+            std::rethrow_exception(state->error);
+        }
+    }
+
+private:
+    struct LoopState {
+        std::atomic<size_t> next{0};
+        std::atomic<size_t> done{0};
+        std::atomic<bool> failed{false};
+        std::mutex mutex;
+        std::condition_variable finished;
+        std::exception_ptr error;
+    };
+
+    std::vector<std::thread> workers;
+    std::deque<std::function<void()>> tasks;
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool stopping = false;
+
+    void work() {
+        for (;;) {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [this] { return stopping || !tasks.empty(); });
+                if (stopping && tasks.empty()) {
+                    return;
+                }
+                task = std::move(tasks.front());
+                tasks.pop_front();
+            }
+            task();
+        }
+    }
+};
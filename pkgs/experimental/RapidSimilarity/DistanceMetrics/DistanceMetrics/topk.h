@@ -0,0 +1,69 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <limits>
+#include <utility>
+#include <cstddef>
+
+// Bounded selection of the k smallest (distance, id) pairs seen so far.
+// Keeps a size-k max-heap so each rejected candidate costs one comparison against worst().
+// Ties on distance are broken towards the smaller id, which makes results deterministic.
+template <typename Distance, typename Id = size_t>
+class TopK {
+public:
+    typedef std::pair<Distance, Id> Entry;
+
+    explicit TopK(size_t k) : k(k) { heap.reserve(k); }
+
+    size_t capacity() const { return k; }
+    size_t size() const { return heap.size(); }
+    bool full() const { return heap.size() >= k; }
+
+    // Largest distance still able to enter the selection; +inf until k entries are held
+    Distance worst() const {
+        return full() && k > 0 ? heap.front().first : std::numeric_limits<Distance>::infinity();
+    }
+
+    // Offer a candidate; returns true when it was kept
+    bool push(Distance distance, Id id) {
+        if (k == 0) {
+            return false;
+        }
+        const Entry entry(distance, id);
+        if (!full()) {
+            heap.push_back(entry);
+            std::push_heap(heap.begin(), heap.end());
+            return true;
+        }
+        if (!(entry < heap.front())) {
+            return false;
+        }
+        std::pop_heap(heap.begin(), heap.end());
+        heap.back() = entry;
+        std::push_heap(heap.begin(), heap.end());
+        return true;
+    }
+
+    // Fold another selection into this one (e.g. per-thread or per-shard partial results)
+    void merge(const TopK& other) {
+        for (const Entry& entry : other.heap) {
+            push(entry.first, entry.second);
+        }
+    }
+
+    // Entries in ascending (distance, id) order; the selection is left empty
+    std::vector<Entry> take_sorted() {
+        std::sort_heap(heap.begin(), heap.end());
+        std::vector<Entry> sorted;
+        sorted.swap(heap);
+        heap.reserve(k);
+        return sorted;
+    }
+
+    void clear() { heap.clear(); }
+
+private:
+    size_t k;
+    std::vector<Entry> heap;
+};
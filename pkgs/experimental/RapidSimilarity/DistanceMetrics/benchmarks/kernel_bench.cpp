@@ -0,0 +1,277 @@
+// Distance kernel microbenchmark. Times every kernel of every SIMD level this CPU can run, over a
+// range of dimensions, and writes one JSON document with the best time per call of each:
+//
+//   kernel_bench [--dims 32,64,...] [--working-set KiB] [--min-time seconds] [--repeats n] [--output path]
+//
+// A kernel scores one query against rows laid out one after another in a block of --working-set
+// KiB (256 by default, so the rows stay in L2; pass a size well above the last-level cache to
+// measure the memory-bound case). Each repeat doubles the number of passes over the block until
+// it runs for --min-time seconds, and the fastest of --repeats repeats is reported, which keeps
+// results comparable across runs on a machine with other load.
+
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <type_traits>
+
+#include "DistanceMetrics/cpu_features.h"
+#include "DistanceMetrics/simd_kernels.h"
+#include "DistanceMetrics/storage.h"
+
+namespace {
+
+struct Options {
+    std::vector<size_t> dims = {32, 64, 96, 128, 256, 384, 512, 768, 1024, 1536, 2048, 4096};
+    size_t working_set = 256 * 1024;
+    double min_time = 0.05;
+    int repeats = 5;
+    const char* output = nullptr;
+};
+
+struct Result {
+    const char* kernel;
+    const char* element;
+    SimdLevel level;
+    size_t dim;
+    double ns_per_call;
+    double bytes_per_call; // Row bytes streamed by one call
+};
+
+// Results feed this so the compiler cannot drop the kernel calls
+volatile float sink_f32;
+volatile double sink_f64;
+
+void sink(float value) { sink_f32 = value; }
+void sink(double value) { sink_f64 = value; }
+
+// Best nanoseconds per call of pass(rows), which makes `rows` kernel calls
+template <typename Pass>
+double time_calls(const Pass& pass, size_t rows, const Options& options) {
+    using clock = std::chrono::steady_clock;
+    pass(); // Warm the block into the cache and the kernel into the branch predictors
+    double best = 1e300;
+    for (int repeat = 0; repeat < options.repeats; ++repeat) {
+        for (size_t passes = 1;; passes *= 2) {
+            const auto start = clock::now();
+            for (size_t i = 0; i < passes; ++i) {
+                pass();
+            }
+            const double seconds = std::chrono::duration<double>(clock::now() - start).count();
+            if (seconds >= options.min_time || passes >= (size_t(1) << 40)) {
+                best = std::min(best, seconds * 1e9 / static_cast<double>(passes * rows));
+                break;
+            }
+        }
+    }
+    return best;
+}
+
+// Rows of dim elements that fill the working set, a multiple of 4 of them for the 1x4 tile
+size_t block_rows(size_t dim, size_t element_size, const Options& options) {
+    return std::max<size_t>(4, options.working_set / (dim * element_size)) & ~size_t(3);
+}
+
+// count values uniform in [-1, 1), as T
+template <typename T>
+std::vector<T> random_values(size_t count, std::mt19937& rng) {
+    std::uniform_real_distribution<float> uniform(-1.0f, 1.0f);
+    std::vector<T> values(count);
+    for (T& value : values) {
+        if constexpr (std::is_same_v<T, simd::float16>) {
+            value = simd::to_float16(uniform(rng));
+        } else if constexpr (std::is_same_v<T, int8_t>) {
+            value = static_cast<int8_t>(uniform(rng) * 127.0f);
+        } else {
+            value = static_cast<T>(uniform(rng));
+        }
+    }
+    return values;
+}
+
+template <typename T>
+void bench_dense(SimdLevel level, size_t dim, const Options& options, std::mt19937& rng,
+                 std::vector<Result>& results) {
+    const char* element = sizeof(T) == 4 ? "float32" : "float64";
+    const simd::Kernels<T>& kernels = simd::kernels_for<T>(level);
+    const size_t rows = block_rows(dim, sizeof(T), options);
+    const std::vector<T> block = random_values<T>(rows * dim, rng);
+    const std::vector<T> query = random_values<T>(dim, rng);
+    const T* a = query.data();
+    const T* b = block.data();
+    const double row_bytes = static_cast<double>(dim * sizeof(T));
+
+    results.push_back({"l2sq", element, level, dim, time_calls([&] {
+        T sum = 0;
+        for (size_t r = 0; r < rows; ++r) {
+            sum += kernels.l2sq(a, b + r * dim, dim);
+        }
+        sink(sum);
+    }, rows, options), row_bytes});
+    results.push_back({"dot", element, level, dim, time_calls([&] {
+        T sum = 0;
+        for (size_t r = 0; r < rows; ++r) {
+            sum += kernels.dot(a, b + r * dim, dim);
+        }
+        sink(sum);
+    }, rows, options), row_bytes});
+    results.push_back({"dot_norms", element, level, dim, time_calls([&] {
+        T sum = 0;
+        for (size_t r = 0; r < rows; ++r) {
+            sum += kernels.dot_norms(a, b + r * dim, dim).dot;
+        }
+        sink(sum);
+    }, rows, options), row_bytes});
+    // One call scores four rows; reported per call, i.e. per tile
+    results.push_back({"dot_1x4", element, level, dim, time_calls([&] {
+        T out[4];
+        T sum = 0;
+        for (size_t r = 0; r < rows; r += 4) {
+            kernels.dot_1x4(a, b + r * dim, dim, dim, out);
+            sum += out[0] + out[3];
+        }
+        sink(sum);
+    }, rows / 4, options), 4 * row_bytes});
+}
+
+template <typename S>
+void bench_stored(SimdLevel level, size_t dim, const char* element, const Options& options, std::mt19937& rng,
+                  std::vector<Result>& results) {
+    const simd::StoredKernels<S>& kernels = simd::stored_kernels_for<S>(level);
+    const size_t rows = block_rows(dim, sizeof(S), options);
+    const std::vector<S> block = random_values<S>(rows * dim, rng);
+    const std::vector<float> query = random_values<float>(dim, rng);
+    const float* a = query.data();
+    const S* b = block.data();
+    const double row_bytes = static_cast<double>(dim * sizeof(S));
+
+    results.push_back({"stored_l2sq", element, level, dim, time_calls([&] {
+        float sum = 0;
+        for (size_t r = 0; r < rows; ++r) {
+            sum += kernels.l2sq(a, b + r * dim, dim);
+        }
+        sink(sum);
+    }, rows, options), row_bytes});
+    results.push_back({"stored_dot", element, level, dim, time_calls([&] {
+        float sum = 0;
+        for (size_t r = 0; r < rows; ++r) {
+            sum += kernels.dot(a, b + r * dim, dim);
+        }
+        sink(sum);
+    }, rows, options), row_bytes});
+}
+
+std::vector<size_t> parse_dims(const char* list) {
+    std::vector<size_t> dims;
+    for (const char* p = list; *p != '\0';) {
+        char* end;
+        const unsigned long long dim = std::strtoull(p, &end, 10);
+        if (end == p || dim == 0) {
+            return {};
+        }
+        dims.push_back(static_cast<size_t>(dim));
+        p = *end == ',' ? end + 1 : end;
+    }
+    return dims;
+}
+
+bool parse_options(int argc, char** argv, Options& options) {
+    for (int i = 1; i < argc; ++i) {
+        const char* flag = argv[i];
+        if (i + 1 >= argc) {
+            std::fprintf(stderr, "kernel_bench: %s needs a value\n", flag);
+            return false;
+        }
+        const char* value = argv[++i];
+        if (std::strcmp(flag, "--dims") == 0) {
+            options.dims = parse_dims(value);
+        } else if (std::strcmp(flag, "--working-set") == 0) {
+            options.working_set = static_cast<size_t>(std::strtoull(value, nullptr, 10)) * 1024;
+        } else if (std::strcmp(flag, "--min-time") == 0) {
+            options.min_time = std::strtod(value, nullptr);
+        } else if (std::strcmp(flag, "--repeats") == 0) {
+            options.repeats = std::atoi(value);
+        } else if (std::strcmp(flag, "--output") == 0) {
+            options.output = value;
+        } else {
+            std::fprintf(stderr, "kernel_bench: unknown option %s\n", flag);
+            return false;
+        }
+    }
+    if (options.dims.empty() || options.working_set == 0 || options.min_time <= 0 || options.repeats <= 0) {
+        std::fprintf(stderr, "kernel_bench: --dims, --working-set, --min-time and --repeats must be positive\n");
+        return false;
+    }
+    return true;
+}
+
+void write_json(std::FILE* out, const Options& options, const CpuFeatures& features,
+                const std::vector<SimdLevel>& levels, const std::vector<Result>& results) {
+    std::fprintf(out, "{\n  \"benchmark\": \"kernels\",\n  \"schema\": 1,\n");
+    std::fprintf(out,
+                 "  \"cpu\": {\"sse2\": %s, \"avx2\": %s, \"fma\": %s, \"f16c\": %s, \"avx512f\": %s, "
+                 "\"neon\": %s},\n",
+                 features.sse2 ? "true" : "false", features.avx2 ? "true" : "false", features.fma ? "true" : "false",
+                 features.f16c ? "true" : "false", features.avx512f ? "true" : "false",
+                 features.neon ? "true" : "false");
+    std::fprintf(out, "  \"best_level\": \"%s\",\n  \"levels\": [", simd_level_name(best_simd_level(features)));
+    for (size_t i = 0; i < levels.size(); ++i) {
+        std::fprintf(out, "%s\"%s\"", i == 0 ? "" : ", ", simd_level_name(levels[i]));
+    }
+    std::fprintf(out, "],\n  \"working_set_bytes\": %zu,\n  \"min_time\": %g,\n  \"repeats\": %d,\n",
+                 options.working_set, options.min_time, options.repeats);
+    std::fprintf(out, "  \"results\": [\n");
+    for (size_t i = 0; i < results.size(); ++i) {
+        const Result& r = results[i];
+        std::fprintf(out,
+                     "    {\"kernel\": \"%s\", \"element\": \"%s\", \"level\": \"%s\", \"dim\": %zu, "
+                     "\"ns_per_call\": %.3f, \"gb_per_s\": %.3f}%s\n",
+                     r.kernel, r.element, simd_level_name(r.level), r.dim, r.ns_per_call,
+                     r.bytes_per_call / r.ns_per_call, i + 1 == results.size() ? "" : ",");
+    }
+    std::fprintf(out, "  ]\n}\n");
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    Options options;
+    if (!parse_options(argc, argv, options)) {
+        return 2;
+    }
+    const CpuFeatures features = detect_cpu_features();
+    std::vector<SimdLevel> levels;
+    for (SimdLevel level : {SimdLevel::Scalar, SimdLevel::SSE2, SimdLevel::AVX2, SimdLevel::AVX512, SimdLevel::NEON}) {
+        if (simd_level_supported(level, features)) {
+            levels.push_back(level);
+        }
+    }
+
+    std::mt19937 rng(42);
+    std::vector<Result> results;
+    for (SimdLevel level : levels) {
+        for (size_t dim : options.dims) {
+            bench_dense<float>(level, dim, options, rng, results);
+            bench_dense<double>(level, dim, options, rng, results);
+            bench_stored<simd::float16>(level, dim, "float16", options, rng, results);
+            bench_stored<int8_t>(level, dim, "int8", options, rng, results);
+            std::fprintf(stderr, "kernel_bench: %s dim %zu done\n", simd_level_name(level), dim);
+        }
+    }
+
+    std::FILE* out = options.output != nullptr ? std::fopen(options.output, "w") : stdout;
+    if (out == nullptr) {
+        std::fprintf(stderr, "kernel_bench: cannot write %s\n", options.output);
+        return 1;
+    }
+    write_json(out, options, features, levels, results);
+    if (out != stdout) {
+        std::fclose(out);
+    }
+    return 0;
+}
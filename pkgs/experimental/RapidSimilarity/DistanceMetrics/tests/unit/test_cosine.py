@@ -59,3 +59,52 @@ def test_cosine_similarity_non_list_input():
     vec2 = 2.0
     with pytest.raises(TypeError, match="Expected lists for vectors."):
         cosine.cosine_similarity(vec1, vec2)
+
+
+@pytest.mark.unit
+def test_cosine_similarity_accepts_lists_and_buffers():
+    """Test that lists, float32 arrays and strided views give the same result."""
+    vec1 = np.array([1.0, 2.0, 3.0], dtype=np.float32)
+    vec2 = np.arange(6.0)[::2]
+    expected = np.dot(vec1, vec2) / (np.linalg.norm(vec1) * np.linalg.norm(vec2))
+
+    assert np.isclose(cosine.cosine_similarity(vec1, vec2), expected)
+    assert np.isclose(cosine.cosine_similarity(vec1.tolist(), vec2.tolist()), expected)
+    assert np.isclose(cosine.cosine_similarity(memoryview(vec1), memoryview(vec2)), expected)
+
+
+@pytest.mark.unit
+def test_norms_and_normalize():
+    """Test row norms and unit-length copies, keeping float32 inputs in float32."""
+    rows = np.array([[3.0, 4.0], [0.0, 0.0], [1.0, 1.0]], dtype=np.float32)
+    norms = cosine.norms(rows)
+    assert norms.dtype == np.float32
+    assert np.allclose(norms, np.linalg.norm(rows, axis=1))
+
+    unit = cosine.normalize(rows)
+    assert unit.dtype == np.float32
+    assert np.allclose(unit, [[0.6, 0.8], [0.0, 0.0], [np.sqrt(0.5), np.sqrt(0.5)]])
+    assert np.allclose(rows[0], [3.0, 4.0])  # the input is left untouched
+
+
+@pytest.mark.unit
+def test_cosine_similarities_modes_agree():
+    """Test the fused, cached-norm and pre-normalized paths against NumPy."""
+    rng = np.random.default_rng(0)
+    rows = rng.standard_normal((50, 37))
+    query = rng.standard_normal(37)
+    expected = rows @ query / (np.linalg.norm(rows, axis=1) * np.linalg.norm(query))
+
+    assert np.allclose(cosine.cosine_similarities(query, rows), expected)
+    assert np.allclose(cosine.cosine_similarities(query, rows, norms=cosine.norms(rows)), expected)
+    assert np.allclose(cosine.cosine_similarities(query, cosine.normalize(rows), normalized=True), expected)
+
+
+@pytest.mark.unit
+def test_cosine_similarities_validates_inputs():
+    """Test length checks on the query and the cached norms."""
+    rows = np.ones((3, 4))
+    with pytest.raises(ValueError, match="Vectors must be of the same length."):
+        cosine.cosine_similarities(np.ones(5), rows)
+    with pytest.raises(ValueError, match="Expected one norm per row."):
+        cosine.cosine_similarities(np.ones(4), rows, norms=np.ones(2))
@@ -40,3 +40,55 @@ def test_euclidean_distance_invalid_shape():
     b = np.array([1.0, 2.0, 3.0])
     with pytest.raises(ValueError, match="Input arrays must have the same size."):
         euclidean_distance(a, b)
+
+
+@pytest.mark.unit
+def test_euclidean_distance_strided_and_float32_inputs():
+    """Test Euclidean distance on float32, strided and memoryview inputs."""
+    a = np.array([1.0, 2.0, 3.0], dtype=np.float32)
+    b = np.arange(8.0).reshape(4, 2)[1:, 0]  # [2.0, 4.0, 6.0], non-contiguous
+    expected = np.sqrt(14)
+
+    assert np.isclose(euclidean_distance(a, b), expected)
+    assert np.isclose(euclidean_distance(memoryview(a), memoryview(b)), expected)
+    assert np.isclose(euclidean_distance([1, 2, 3], [2, 4, 6]), expected)
+
+
+@pytest.mark.unit
+def test_simd_level_and_long_vectors():
+    """Test the reported kernel level and the vector path past the SIMD tail."""
+    from DistanceMetrics import simd_level
+
+    assert simd_level() in {"scalar", "sse2", "avx2", "avx512", "neon"}
+
+    rng = np.random.default_rng(0)
+    for dtype in (np.float32, np.float64):
+        for n in (1, 7, 16, 33, 768):
+            a = rng.standard_normal(n).astype(dtype)
+            b = rng.standard_normal(n).astype(dtype)
+            expected = np.linalg.norm(a.astype(np.float64) - b.astype(np.float64))
+            assert np.isclose(euclidean_distance(a, b), expected, rtol=1e-5)
+
+
+@pytest.mark.unit
+def test_distance_supports_every_metric():
+    """Test the metric-generic distance against NumPy for each metric name."""
+    from DistanceMetrics import distance
+
+    a = np.array([1.0, -2.0, 3.0, 0.0, 5.0])
+    b = np.array([1.0, 2.0, -1.0, 0.0, 4.0])
+    expected = {
+        "euclidean": np.linalg.norm(a - b),
+        "sqeuclidean": np.sum((a - b) ** 2),
+        "ip": a @ b,
+        "cosine": a @ b / (np.linalg.norm(a) * np.linalg.norm(b)),
+        "manhattan": np.abs(a - b).sum(),
+        "hamming": 3.0,
+    }
+    for metric, value in expected.items():
+        assert np.isclose(distance(a, b, metric), value), metric
+        assert np.isclose(distance(a.astype(np.float32), b.astype(np.float32), metric=metric), value), metric
+    assert distance(a, b) == euclidean_distance(a, b)
+
+    with pytest.raises(ValueError, match="metric must be"):
+        distance(a, b, "chebyshev")
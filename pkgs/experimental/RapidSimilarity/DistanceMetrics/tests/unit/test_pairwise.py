@@ -0,0 +1,97 @@
+import pytest
+import numpy as np
+from DistanceMetrics import pairwise
+
+
+def reference(X, Y, metric):
+    """Distances computed directly with NumPy."""
+    diff = X[:, None, :] - Y[None, :, :]
+    if metric == "euclidean":
+        return np.sqrt((diff**2).sum(axis=2))
+    if metric == "sqeuclidean":
+        return (diff**2).sum(axis=2)
+    if metric == "manhattan":
+        return np.abs(diff).sum(axis=2)
+    if metric == "hamming":
+        return (diff != 0).sum(axis=2).astype(X.dtype)
+    dots = X @ Y.T
+    if metric == "ip":
+        return dots
+    return dots / np.outer(np.linalg.norm(X, axis=1), np.linalg.norm(Y, axis=1))
+
+
+@pytest.mark.unit
+@pytest.mark.parametrize("metric", ["euclidean", "sqeuclidean", "ip", "cosine", "manhattan", "hamming"])
+def test_cdist_matches_numpy(metric):
+    """Test every metric against NumPy, with shapes that leave partial tiles."""
+    rng = np.random.default_rng(0)
+    X = rng.standard_normal((70, 33))
+    Y = rng.standard_normal((301, 33))
+    if metric == "hamming":
+        X, Y = np.round(X), np.round(Y)  # Coordinates that can actually coincide
+    result = pairwise.cdist(X, Y, metric)
+    assert result.shape == (70, 301)
+    assert result.dtype == np.float64
+    assert np.allclose(result, reference(X, Y, metric))
+
+
+@pytest.mark.unit
+def test_cdist_float32_and_threads():
+    """Test that float32 inputs stay float32 and the thread count does not change results."""
+    rng = np.random.default_rng(1)
+    X = rng.standard_normal((40, 16)).astype(np.float32)
+    Y = rng.standard_normal((50, 16)).astype(np.float32)
+    single = pairwise.cdist(X, Y, num_threads=1)
+    assert single.dtype == np.float32
+    assert np.array_equal(single, pairwise.cdist(X, Y, num_threads=4))
+    assert np.allclose(single, reference(X.astype(np.float64), Y.astype(np.float64), "euclidean"), atol=1e-4)
+
+
+@pytest.mark.unit
+def test_cdist_identical_rows_are_zero():
+    """Test that the norm decomposition never yields negative or NaN distances."""
+    X = np.full((3, 8), 1e3)
+    result = pairwise.cdist(X, X)
+    assert np.all(result >= 0)
+    assert np.allclose(result, 0.0)
+
+
+@pytest.mark.unit
+def test_one_to_many_matches_cdist():
+    """Test one_to_many against the first row of cdist."""
+    rng = np.random.default_rng(2)
+    q = rng.standard_normal(24)
+    X = rng.standard_normal((1000, 24))
+    for metric in ["euclidean", "sqeuclidean", "ip", "cosine"]:
+        result = pairwise.one_to_many(q, X, metric=metric)
+        assert result.shape == (1000,)
+        assert np.allclose(result, pairwise.cdist(q[None, :], X, metric)[0])
+
+
+@pytest.mark.unit
+def test_pairwise_validates_inputs():
+    """Test errors for mismatched or zero dimensions, unknown metrics and wrong ranks."""
+    with pytest.raises(ValueError, match="same number of dimensions"):
+        pairwise.cdist(np.ones((2, 3)), np.ones((2, 4)))
+    with pytest.raises(ValueError, match="same number of dimensions"):
+        pairwise.one_to_many(np.ones(3), np.ones((2, 4)))
+    with pytest.raises(ValueError, match="at least one dimension"):
+        pairwise.cdist(np.zeros((3, 5)), np.empty((4, 0)))
+    with pytest.raises(ValueError, match="at least one dimension"):
+        pairwise.cdist(np.empty((3, 0)), np.ones((4, 5)))
+    with pytest.raises(ValueError, match="at least one dimension"):
+        pairwise.one_to_many(np.empty(0), np.ones((4, 5)))
+    with pytest.raises(ValueError, match="metric must be"):
+        pairwise.cdist(np.ones((2, 3)), np.ones((2, 3)), "chebyshev")
+    with pytest.raises(ValueError, match="Expected a 2-dimensional array."):
+        pairwise.cdist(np.ones(3), np.ones((2, 3)))
+    with pytest.raises(ValueError, match="Expected a 1-dimensional array."):
+        pairwise.one_to_many(np.ones((1, 3)), np.ones((2, 3)))
+
+
+@pytest.mark.unit
+def test_cdist_empty_operands():
+    """Test that operands without rows give empty results whatever their width."""
+    assert pairwise.cdist(np.empty((0, 5)), np.ones((4, 5))).shape == (0, 4)
+    assert pairwise.cdist(np.ones((3, 5)), np.empty((0, 7))).shape == (3, 0)
+    assert pairwise.one_to_many(np.ones(5), np.empty((0, 5))).shape == (0,)
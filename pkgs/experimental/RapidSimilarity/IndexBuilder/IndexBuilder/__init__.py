@@ -1,7 +1,9 @@
-from .tree_index import tree_index
-from .hash_index import hash_index
+from . import tree_index
+from . import hash_index
+from . import hnsw_index
+from . import sharded
 
-__all__ = ["tree_index", "hash_index"]
+__all__ = ["tree_index", "hash_index", "hnsw_index", "sharded"]
 
 try:
     # For Python 3.8 and newer
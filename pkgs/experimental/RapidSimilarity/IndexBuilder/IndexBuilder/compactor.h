@@ -0,0 +1,70 @@
+#pragma once
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+// Background thread that runs an index's compaction step whenever request() is called. The
+// thread starts with the first request, so indexes that are never modified never own one, and
+// requests made while a step is running are folded into one more run. The destructor waits for the
+// running step and joins; it must run before the index that the step reads is destroyed.
+class Compactor {
+public:
+    explicit Compactor(std::function<void()> step) : step_(std::move(step)) {}
+
+    ~Compactor() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        wake_.notify_one();
+        if (worker_.joinable()) {
+            worker_.join();
+        }
+    }
+
+    Compactor(const Compactor&) = delete;
+    Compactor& operator=(const Compactor&) = delete;
+
+    void request() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (stopping_) {
+                return;
+            }
+            pending_ = true;
+            if (!worker_.joinable()) {
+                worker_ = std::thread([this] { work(); });
+            }
+        }
+        wake_.notify_one();
+    }
+
+private:
+    std::function<void()> step_;
+    std::thread worker_;
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    bool pending_ = false;
+    bool stopping_ = false;
+
+    void work() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        for (;;) {
+            wake_.wait(lock, [this] { return stopping_ || pending_; });
+            if (stopping_) {
+                return;
+            }
+            pending_ = false;
+            lock.unlock();
+            // A failed step (e.g. out of memory) leaves the index as it was; the next request retries
+            try {
+                step_();
+            } catch (...) {
+            }
+            lock.lock();
+        }
+    }
+};
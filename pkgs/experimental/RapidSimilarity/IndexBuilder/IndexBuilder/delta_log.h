@@ -0,0 +1,55 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+
+// Append-only rows of `width` values for the delta buffers of the dynamic indexes. Rows live in
+// chunks of kChunkRows rows that are allocated whole and never move, and a copy of the log shares
+// its chunks, so a copy published in an index version is a snapshot: the writer appends to its own
+// copy past the end of every published one, and readers of an older snapshot never look at the rows
+// written since. Dropping rows from the front releases the chunks no snapshot still holds.
+template <typename T>
+class DeltaLog {
+public:
+    static constexpr size_t kChunkRows = 256;
+
+    explicit DeltaLog(size_t width = 0) : width_(width) {}
+
+    size_t size() const { return end_ - begin_; }
+    bool empty() const { return end_ == begin_; }
+    size_t width() const { return width_; }
+
+    const T* row(size_t i) const {
+        i += begin_;
+        return chunks_[i / kChunkRows].get() + (i % kChunkRows) * width_;
+    }
+
+    // Append n rows of width values each; only the copy the writer owns may be appended to
+    void append(const T* rows, size_t n) {
+        for (size_t i = 0; i < n; ++i) {
+            if (end_ / kChunkRows == chunks_.size()) {
+                chunks_.emplace_back(new T[kChunkRows * width_], std::default_delete<T[]>());
+            }
+            std::copy(rows + i * width_, rows + (i + 1) * width_,
+                      chunks_[end_ / kChunkRows].get() + (end_ % kChunkRows) * width_);
+            ++end_;
+        }
+    }
+
+    // Forget the first n rows
+    void drop_front(size_t n) {
+        begin_ += std::min(n, size());
+        const size_t unused = begin_ / kChunkRows;
+        chunks_.erase(chunks_.begin(), chunks_.begin() + unused);
+        begin_ -= unused * kChunkRows;
+        end_ -= unused * kChunkRows;
+    }
+
+private:
+    size_t width_;
+    size_t begin_ = 0; // First row, counted from the start of chunks_[0]
+    size_t end_ = 0;
+    std::vector<std::shared_ptr<T>> chunks_;
+};
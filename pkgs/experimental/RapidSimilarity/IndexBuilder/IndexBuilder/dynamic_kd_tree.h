@@ -0,0 +1,385 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+#include "compactor.h"
+#include "delta_log.h"
+#include "kd_tree.h"
+#include "DistanceMetrics/epoch.h"
+#include "DistanceMetrics/id_set.h"
+#include "DistanceMetrics/metrics.h"
+#include "DistanceMetrics/query_stats.h"
+#include "DistanceMetrics/topk.h"
+
+// kd-tree that accepts inserts and deletes after it is built. The points live in immutable
+// KDTree segments plus a small delta buffer:
+//
+//   - inserts append to the delta, which every query scans by brute force;
+//   - deletes set a tombstone bit that every scan tests before computing a distance;
+//   - compaction turns the delta into a new segment, merging in every segment no larger than
+//     the rows it already holds (so segment sizes grow geometrically and a query visits
+//     O(log n) trees) and every segment in which at least a quarter of the rows are tombstoned.
+//
+// Reads take no lock. The segment list and the extent of the delta form an immutable version
+// that writers replace with one atomic swap (Versioned, epoch.h): a query pins the version that
+// is current when it starts and sees exactly the points of that version, while inserts append
+// delta rows past its end and publish a new version, and compaction builds a segment from the
+// immutable inputs of its own snapshot and publishes the version that holds it. Tombstones are an
+// AtomicIdBitmap that queries test as they scan. Writers (inserts, deletes and the swap at the end
+// of a compaction) are serialized by one mutex that readers never touch.
+//
+// Compaction runs on a background thread once the delta holds delta_capacity rows or a quarter
+// of the stored rows are tombstoned.
+//
+// Ids are assigned in insertion order (the points of the constructor get 0 .. n-1) and are never
+// reused, so an id names the same point for the life of the index.
+template <typename T>
+class DynamicKDTree {
+public:
+    typedef T value_type;
+    typedef typename KDTree<T>::Neighbor Neighbor; // (metric distance, id)
+
+    DynamicKDTree(const T* data, size_t n, size_t dim, size_t leaf_size = 32, size_t num_threads = 0,
+                  size_t delta_capacity = kDefaultDeltaCapacity)
+        : dim(dim), leaf_size(leaf_size), num_threads(num_threads), delta_capacity(delta_capacity),
+          version(initial_version(data, n, dim, leaf_size, num_threads, delta_capacity)) {}
+
+    ~DynamicKDTree() {
+        compactor.reset(); // Join a running compaction before the segments go away
+    }
+
+    DynamicKDTree(const DynamicKDTree&) = delete;
+    DynamicKDTree& operator=(const DynamicKDTree&) = delete;
+
+    static constexpr size_t kDefaultDeltaCapacity = 1024;
+
+    // Add points as rows of the delta buffer; returns the id of the first one, the rest follow
+    uint32_t insert(const T* data, size_t n) {
+        std::lock_guard<std::mutex> lock(write_mutex);
+        const Version& current = version.latest();
+        if (current.id_bound() + n > static_cast<size_t>(std::numeric_limits<uint32_t>::max())) {
+            throw std::length_error("KDTree supports at most 2^32 - 1 points.");
+        }
+        const uint32_t first = static_cast<uint32_t>(current.id_bound());
+        std::unique_ptr<Version> next(new Version(current));
+        next->delta.append(data, n);
+        version.publish(std::move(next));
+        if (needs_compaction()) {
+            request_compaction();
+        }
+        return first;
+    }
+
+    // Tombstone id; returns false when it was never inserted or is already deleted
+    bool remove(uint32_t id) {
+        std::lock_guard<std::mutex> lock(write_mutex);
+        if (id >= version.latest().id_bound() || !dead.set(id)) {
+            return false;
+        }
+        if (needs_compaction()) {
+            request_compaction();
+        }
+        return true;
+    }
+
+    bool contains(uint32_t id) const { return id < version.read()->id_bound() && !dead.test(id); }
+
+    // The k nearest live points accepted by filter in ascending distance, over every segment and
+    // the delta
+    template <typename Metric = metrics::Euclidean, typename Filter = AcceptAll>
+    std::vector<Neighbor> knn(const T* target, size_t k, const Filter& filter = Filter()) const {
+        const auto snapshot = version.read();
+        stats::PhaseTimer phase(stats::Scan);
+        TopK<T, uint32_t> best(std::min(k, snapshot->stored_size()));
+        const auto live = [&](uint32_t id) { return !dead.test(id) && filter(id); };
+        for (const auto& segment : snapshot->segments) {
+            segment->template collect_knn<Metric>(target, best, live);
+        }
+        if (best.capacity() > 0) {
+            const DeltaLog<T>& delta = snapshot->delta;
+            size_t scored = 0;
+            for (size_t row = 0; row < delta.size(); ++row) {
+                const uint32_t id = static_cast<uint32_t>(snapshot->delta_first + row);
+                if (live(id)) {
+                    best.push(Metric::rank(delta.row(row), target, dim), id);
+                    ++scored;
+                }
+            }
+            count_scored(scored);
+        }
+        phase.next(stats::Select);
+        std::vector<Neighbor> result = best.take_sorted();
+        for (Neighbor& neighbor : result) {
+            neighbor.first = Metric::value(neighbor.first);
+        }
+        return result;
+    }
+
+    // Every live point accepted by filter within distance r of target, in ascending distance
+    template <typename Metric = metrics::Euclidean, typename Filter = AcceptAll>
+    std::vector<Neighbor> radius(const T* target, T r, const Filter& filter = Filter()) const {
+        std::vector<Neighbor> result;
+        if (!(r >= 0.0)) {
+            return result;
+        }
+        const T max_rank = Metric::rank_of(r);
+        stats::PhaseTimer phase(stats::Scan);
+        {
+            const auto snapshot = version.read();
+            const auto live = [&](uint32_t id) { return !dead.test(id) && filter(id); };
+            for (const auto& segment : snapshot->segments) {
+                segment->template collect_radius<Metric>(target, max_rank, result, live);
+            }
+            const DeltaLog<T>& delta = snapshot->delta;
+            size_t scored = 0;
+            for (size_t row = 0; row < delta.size(); ++row) {
+                const uint32_t id = static_cast<uint32_t>(snapshot->delta_first + row);
+                if (live(id)) {
+                    const T rank = Metric::rank(delta.row(row), target, dim);
+                    ++scored;
+                    if (rank <= max_rank) {
+                        result.emplace_back(rank, id);
+                    }
+                }
+            }
+            count_scored(scored);
+        }
+        phase.next(stats::Select);
+        std::sort(result.begin(), result.end());
+        for (Neighbor& neighbor : result) {
+            neighbor.first = Metric::value(neighbor.first);
+        }
+        return result;
+    }
+
+    // Number of live points
+    size_t size() const { return version.read()->id_bound() - dead.count(); }
+
+    size_t dimension() const { return dim; }
+
+    // Counters of the queries run under a stats::QueryScope on this tree (query_stats.h)
+    stats::QueryStats& query_stats() const { return query_stats_; }
+
+    // Rows waiting in the delta buffer and number of tree segments
+    size_t delta_size() const { return version.read()->delta.size(); }
+
+    size_t num_segments() const { return version.read()->segments.size(); }
+
+    // Merge the delta and every segment into one tree without tombstoned points, waiting for a
+    // background compaction that is already running
+    void compact() {
+        std::lock_guard<std::mutex> serial(compaction_mutex);
+        compact_step(true);
+    }
+
+    // Compacts fully and writes the single remaining tree; deleted ids stay deleted after load()
+    void save(const std::string& path) {
+        std::lock_guard<std::mutex> serial(compaction_mutex);
+        compact_step(true);
+        Version state;
+        IdBitmap tombstones;
+        size_t purged_ids;
+        {
+            std::lock_guard<std::mutex> lock(write_mutex);
+            state = version.latest();
+            tombstones = dead.snapshot(state.id_bound());
+            purged_ids = purged;
+        }
+        std::shared_ptr<const KDTree<T>> tree;
+        if (state.segments.size() <= 1 && state.delta.empty() && tombstones.count() == purged_ids) {
+            tree = state.segments.empty()
+                       ? std::make_shared<const KDTree<T>>(nullptr, 0, dim, leaf_size, 1, nullptr, state.id_bound())
+                       : state.segments[0];
+        } else {
+            // Inserted or deleted while compacting; fold those changes into the file only
+            tree = merged_tree(state.segments, state.delta, state.delta_first, state.id_bound(), &tombstones);
+        }
+        tree->save(path);
+    }
+
+    // Tree over a file written by save(); the loaded points are memory-mapped as its first segment
+    static std::unique_ptr<DynamicKDTree> load(const std::string& path, size_t num_threads = 0,
+                                               size_t delta_capacity = kDefaultDeltaCapacity) {
+        std::shared_ptr<const KDTree<T>> tree = KDTree<T>::load(path);
+        std::unique_ptr<DynamicKDTree> index(
+            new DynamicKDTree(nullptr, 0, tree->dimension(), tree->leaf_capacity(), num_threads, delta_capacity));
+        // Ids below the saved bound that the tree does not hold were deleted before saving
+        const size_t id_bound = tree->id_bound();
+        IdBitmap deleted(id_bound);
+        for (size_t id = 0; id < id_bound; ++id) {
+            deleted.set(id);
+        }
+        tree->for_each_point([&](uint32_t id, const T*) { deleted.reset(id); });
+        index->dead.assign(deleted);
+        index->purged = deleted.count();
+        std::unique_ptr<Version> loaded(new Version(index->dim));
+        loaded->delta_first = id_bound;
+        if (tree->size() > 0) {
+            loaded->segments.push_back(std::move(tree));
+        }
+        index->version.publish(std::move(loaded));
+        return index;
+    }
+
+private:
+    // What a query sees: the segments and the delta rows, which hold ids [delta_first, id_bound())
+    struct Version {
+        std::vector<std::shared_ptr<const KDTree<T>>> segments; // Largest first
+        DeltaLog<T> delta;
+        size_t delta_first = 0;
+
+        explicit Version(size_t dim = 0) : delta(dim) {}
+
+        size_t id_bound() const { return delta_first + delta.size(); }
+
+        // Rows a scan visits; an upper bound on its live points
+        size_t stored_size() const {
+            size_t rows = delta.size();
+            for (const auto& segment : segments) {
+                rows += segment->size();
+            }
+            return rows;
+        }
+    };
+
+    size_t dim;
+    size_t leaf_size;
+    size_t num_threads;
+    size_t delta_capacity;
+    size_t purged = 0;       // Tombstoned ids whose points no segment or delta row holds any more
+    AtomicIdBitmap dead;     // Tombstones over ids [0, id_bound())
+    Versioned<Version> version;
+    std::mutex write_mutex;      // Serializes inserts, deletes and version swaps; readers never take it
+    std::mutex compaction_mutex; // Serializes compaction steps
+    std::unique_ptr<Compactor> compactor;
+    mutable stats::QueryStats query_stats_;
+
+    // Counters of delta rows scored by brute force, as KDTree counts its leaves
+    void count_scored(size_t scored) const {
+        stats::count(stats::Candidates, scored);
+        stats::count(stats::Distances, scored);
+        stats::count(stats::Bytes, scored * dim * sizeof(T));
+    }
+
+    static std::unique_ptr<const Version> initial_version(const T* data, size_t n, size_t dim, size_t leaf_size,
+                                                          size_t num_threads, size_t delta_capacity) {
+        if (delta_capacity == 0) {
+            throw std::invalid_argument("Delta capacity must be greater than 0.");
+        }
+        auto tree = std::make_shared<const KDTree<T>>(data, n, dim, leaf_size, num_threads);
+        std::unique_ptr<Version> initial(new Version(dim));
+        initial->delta_first = n;
+        if (n > 0) {
+            initial->segments.push_back(std::move(tree));
+        }
+        return initial;
+    }
+
+    // Called with write_mutex held
+    bool needs_compaction() const {
+        const Version& current = version.latest();
+        const size_t stored_dead = dead.count() - purged;
+        const size_t stored = current.id_bound() - purged; // Rows still held by a segment or the delta
+        return current.delta.size() >= delta_capacity || (stored_dead > 0 && 4 * stored_dead >= stored);
+    }
+
+    void request_compaction() {
+        if (!compactor) {
+            compactor.reset(new Compactor([this] {
+                std::lock_guard<std::mutex> serial(compaction_mutex);
+                compact_step(false);
+            }));
+        }
+        compactor->request();
+    }
+
+    // One tree over the live points of `merged` and the delta rows `extra` (ids from extra_first),
+    // tested against `tombstones`
+    std::shared_ptr<const KDTree<T>> merged_tree(const std::vector<std::shared_ptr<const KDTree<T>>>& merged,
+                                                 const DeltaLog<T>& extra, size_t extra_first, size_t id_limit,
+                                                 const IdBitmap* tombstones = nullptr) const {
+        std::vector<uint32_t> labels;
+        std::vector<T> points;
+        auto keep = [&](uint32_t id, const T* row) {
+            if (tombstones == nullptr || !tombstones->test(id)) {
+                labels.push_back(id);
+                points.insert(points.end(), row, row + dim);
+            }
+        };
+        for (const auto& segment : merged) {
+            segment->for_each_point(keep);
+        }
+        for (size_t row = 0; row < extra.size(); ++row) {
+            keep(static_cast<uint32_t>(extra_first + row), extra.row(row));
+        }
+        return std::make_shared<const KDTree<T>>(points.data(), labels.size(), dim, leaf_size, num_threads,
+                                                 labels.data(), id_limit);
+    }
+
+    // One compaction; the caller holds compaction_mutex, so the segments and the delta start of
+    // the snapshot are changed by no one else until the swap. With full set every segment is merged.
+    void compact_step(bool full) {
+        const Version state = *version.read(); // Shares the segments and delta chunks
+        const IdBitmap tombstones = dead.snapshot(state.id_bound());
+        const std::vector<std::shared_ptr<const KDTree<T>>>& current = state.segments;
+        const DeltaLog<T>& frozen = state.delta;
+
+        // Tombstoned rows per segment, and the segments to merge into the new one
+        std::vector<bool> merge(current.size(), full);
+        size_t delta_live = 0;
+        for (size_t row = 0; row < frozen.size(); ++row) {
+            delta_live += !tombstones.test(state.delta_first + row);
+        }
+        size_t rows = delta_live;
+        std::vector<size_t> live(current.size(), 0);
+        for (size_t s = 0; s < current.size(); ++s) {
+            size_t deleted = 0;
+            current[s]->for_each_point([&](uint32_t id, const T*) { deleted += tombstones.test(id); });
+            live[s] = current[s]->size() - deleted;
+            merge[s] = merge[s] || 4 * deleted >= current[s]->size();
+        }
+        for (size_t s = current.size(); s-- > 0 && live[s] <= rows;) {
+            merge[s] = true; // Smallest segments first, while the new one is at least as large
+            rows += live[s];
+        }
+        std::vector<std::shared_ptr<const KDTree<T>>> merged, kept;
+        size_t dropped = frozen.size() - delta_live; // Tombstoned rows the new tree leaves out
+        for (size_t s = 0; s < current.size(); ++s) {
+            (merge[s] ? merged : kept).push_back(current[s]);
+            if (merge[s]) {
+                dropped += current[s]->size() - live[s];
+            }
+        }
+        const bool clean = current.size() <= 1 && frozen.empty() && dropped == 0;
+        if ((merged.empty() && frozen.empty()) || (full && clean)) {
+            return; // Nothing to merge, or already a single tree without tombstones
+        }
+
+        // The expensive part: built from immutable inputs while queries keep running
+        std::shared_ptr<const KDTree<T>> tree =
+            merged_tree(merged, frozen, state.delta_first, state.id_bound(), &tombstones);
+
+        std::lock_guard<std::mutex> lock(write_mutex);
+        if (tree->size() > 0) {
+            kept.push_back(std::move(tree));
+        }
+        std::stable_sort(kept.begin(), kept.end(),
+                         [](const auto& a, const auto& b) { return a->size() > b->size(); });
+        // Rows inserted while the tree was built stay in the delta
+        std::unique_ptr<Version> next(new Version(version.latest()));
+        next->segments = std::move(kept);
+        next->delta.drop_front(frozen.size());
+        next->delta_first += frozen.size();
+        version.publish(std::move(next));
+        purged += dropped;
+    }
+};
@@ -0,0 +1,176 @@
+#pragma once
+
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+  #include <emmintrin.h>
+  #define FLAT_HASH_MAP_SSE2 1
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+  #include <arm_neon.h>
+  #define FLAT_HASH_MAP_NEON 1
+#endif
+
+// Open-addressing hash table keyed on 64-bit codes, laid out Swiss-table style.
+// Every slot has a control byte that is either kEmpty or the low 7 bits of the key hash (H2).
+// Slots are probed in aligned groups of 16 control bytes, compared against H2 in one
+// SIMD instruction, so a lookup touches the control group and (on a match) one key line.
+// Entries are never erased; the table grows by doubling at 7/8 load.
+template <typename V>
+class FlatHashMap {
+public:
+    static constexpr size_t kGroupSize = 16;
+
+    FlatHashMap() { rehash(kGroupSize); }
+
+    size_t size() const { return count; }
+    size_t capacity() const { return keys.size(); }
+
+    // Pointer to the value stored for key, or nullptr when absent
+    const V* find(uint64_t key) const {
+        const size_t slot = find_slot(key);
+        return slot == kNotFound ? nullptr : &values[slot];
+    }
+
+    V* find(uint64_t key) {
+        const size_t slot = find_slot(key);
+        return slot == kNotFound ? nullptr : &values[slot];
+    }
+
+    // Insert key with value if it is absent; returns the stored value and whether it was inserted
+    std::pair<V*, bool> try_emplace(uint64_t key, const V& value) {
+        const size_t found = find_slot(key);
+        if (found != kNotFound) {
+            return {&values[found], false};
+        }
+        if ((count + 1) * 8 > capacity() * 7) {
+            rehash(capacity() * 2);
+        }
+        const size_t slot = insert_new(key, value);
+        return {&values[slot], true};
+    }
+
+    // Visit every (key, value) pair in slot order
+    template <typename F>
+    void for_each(F&& visit) const {
+        for (size_t i = 0; i < keys.size(); ++i) {
+            if (ctrl[i] != kEmpty) {
+                visit(keys[i], values[i]);
+            }
+        }
+    }
+
+private:
+    static constexpr uint8_t kEmpty = 0x80;
+    static constexpr size_t kNotFound = static_cast<size_t>(-1);
+
+    std::vector<uint8_t> ctrl;
+    std::vector<uint64_t> keys;
+    std::vector<V> values;
+    size_t count = 0;
+
+    // splitmix64 finalizer: packed SimHash codes are far from uniformly distributed
+    static uint64_t mix(uint64_t key) {
+        key ^= key >> 30;
+        key *= 0xBF58476D1CE4E5B9ULL;
+        key ^= key >> 27;
+        key *= 0x94D049BB133111EBULL;
+        key ^= key >> 31;
+        return key;
+    }
+
+    static uint8_t h2(uint64_t hash) { return static_cast<uint8_t>(hash & 0x7F); }
+    size_t h1(uint64_t hash) const { return static_cast<size_t>(hash >> 7) & (num_groups() - 1); }
+    size_t num_groups() const { return keys.size() / kGroupSize; }
+
+    // Bit i is set when control byte i of the group equals byte
+    static uint32_t match(const uint8_t* group, uint8_t byte) {
+#if defined(FLAT_HASH_MAP_SSE2)
+        const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(group));
+        return static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_set1_epi8(static_cast<char>(byte)))));
+#elif defined(FLAT_HASH_MAP_NEON)
+        static const uint8_t bit_weights[16] = {1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128};
+        const uint8x16_t eq = vceqq_u8(vld1q_u8(group), vdupq_n_u8(byte));
+        const uint8x16_t bits = vandq_u8(eq, vld1q_u8(bit_weights));
+        const uint32_t low = vaddv_u8(vget_low_u8(bits));
+        const uint32_t high = vaddv_u8(vget_high_u8(bits));
+        return low | (high << 8);
+#else
+        uint32_t mask = 0;
+        for (size_t i = 0; i < kGroupSize; ++i) {
+            mask |= static_cast<uint32_t>(group[i] == byte) << i;
+        }
+        return mask;
+#endif
+    }
+
+    static int lowest_bit(uint32_t mask) {
+#if defined(__GNUC__) || defined(__clang__)
+        return __builtin_ctz(mask);
+#else
+        int bit = 0;
+        while ((mask & 1u) == 0) {
+            mask >>= 1;
+            ++bit;
+        }
+        return bit;
+#endif
+    }
+
+    size_t find_slot(uint64_t key) const {
+        const uint64_t hash = mix(key);
+        const uint8_t tag = h2(hash);
+        const size_t group_mask = num_groups() - 1;
+        size_t group = h1(hash);
+        // Triangular probing visits every group once because the group count is a power of two
+        for (size_t step = 1; step <= num_groups(); ++step) {
+            const uint8_t* base = ctrl.data() + group * kGroupSize;
+            for (uint32_t mask = match(base, tag); mask != 0; mask &= mask - 1) {
+                const size_t slot = group * kGroupSize + lowest_bit(mask);
+                if (keys[slot] == key) {
+                    return slot;
+                }
+            }
+            if (match(base, kEmpty) != 0) {
+                return kNotFound; // An empty slot ends the probe sequence
+            }
+            group = (group + step) & group_mask;
+        }
+        return kNotFound;
+    }
+
+    size_t insert_new(uint64_t key, const V& value) {
+        const uint64_t hash = mix(key);
+        const size_t group_mask = num_groups() - 1;
+        size_t group = h1(hash);
+        for (size_t step = 1;; ++step) {
+            const uint32_t empty = match(ctrl.data() + group * kGroupSize, kEmpty);
+            if (empty != 0) {
+                const size_t slot = group * kGroupSize + lowest_bit(empty);
+                ctrl[slot] = h2(hash);
+                keys[slot] = key;
+                values[slot] = value;
+                ++count;
+                return slot;
+            }
+            group = (group + step) & group_mask;
+        }
+    }
+
+    void rehash(size_t new_capacity) {
+        std::vector<uint8_t> old_ctrl(new_capacity, kEmpty);
+        std::vector<uint64_t> old_keys(new_capacity);
+        std::vector<V> old_values(new_capacity);
+        old_ctrl.swap(ctrl);
+        old_keys.swap(keys);
+        old_values.swap(values);
+        count = 0;
+        for (size_t i = 0; i < old_keys.size(); ++i) {
+            if (old_ctrl[i] != kEmpty) {
+                insert_new(old_keys[i], old_values[i]);
+            }
+        }
+    }
+};
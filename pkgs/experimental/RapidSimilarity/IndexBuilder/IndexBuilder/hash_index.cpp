@@ -1,149 +1,601 @@
 #include <Python.h>
 #include <numpy/arrayobject.h>
 #include <vector>
-#include <unordered_map>
-#include <random>
-#include <cmath>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <string>
+#include <exception>
 #include <stdexcept>
 
-class LSHIndex {
-public:
-    LSHIndex(int num_hashes, int bucket_size) : num_hashes(num_hashes), bucket_size(bucket_size) {
-        if (bucket_size <= 0) {
-            throw std::invalid_argument("Bucket size must be greater than 0.");
-        }
-        // Initialize hash functions
-        for (int i = 0; i < num_hashes; ++i) {
-            hash_functions.emplace_back(generate_random_hash_function());
-        }
+#include "lsh_index.h"
+#include "DistanceMetrics/filter_arg.h"
+#include "DistanceMetrics/query_stats.h"
+#include "DistanceMetrics/stats_dict.h"
+#include "DistanceMetrics/thread_pool.h"
+
+// Python object owning one long-lived LSHIndex
+typedef struct {
+    PyObject_HEAD
+    LSHIndex* index;
+} PyLSHIndex;
+
+// View a numpy array or other buffer (memoryview, array.array) as a contiguous float32 array with
+// the expected rank; float32 C-contiguous input is used in place, anything else is converted once
+static PyArrayObject* as_float_array(PyObject* data, int ndim) {
+    if (!PyArray_Check(data) && !PyObject_CheckBuffer(data)) {
+        PyErr_SetString(PyExc_TypeError, "Input must be a numpy array or a buffer.");
+        return NULL;
     }
+    PyArrayObject* array = reinterpret_cast<PyArrayObject*>(
+        PyArray_FROM_OTF(data, NPY_FLOAT, NPY_ARRAY_IN_ARRAY));
+    if (array == NULL) {
+        return NULL;
+    }
+    if (PyArray_NDIM(array) != ndim) {
+        Py_DECREF(array);
+        PyErr_Format(PyExc_ValueError, "Input must be a %d-dimensional array.", ndim);
+        return NULL;
+    }
+    return array;
+}
 
-    void insert(const std::vector<float>& data_point) {
-        std::vector<int> hashes(num_hashes);
-        for (int i = 0; i < num_hashes; ++i) {
-            hashes[i] = hash_functions[i](data_point);
-        }
-        for (int i = 0; i < num_hashes; ++i) {
-            buckets[hashes[i]].push_back(data_point);
-            if (buckets[hashes[i]].size() > bucket_size) {
-                buckets[hashes[i]].pop_back(); // Maintain bucket size
-            }
-        }
+// Translate the active C++ exception into a Python exception
+static PyObject* set_python_error() {
+    try {
+        throw;
+    } catch (const std::invalid_argument& e) {
+        PyErr_SetString(PyExc_ValueError, e.what());
+    } catch (const std::bad_alloc&) {
+        PyErr_NoMemory();
+    } catch (const std::exception& e) {
+        PyErr_SetString(PyExc_RuntimeError, e.what());
     }
+    return NULL;
+}
 
-    std::vector<std::vector<float>> query(const std::vector<float>& data_point) {
-        std::unordered_map<int, std::vector<float>> result;
-        for (int i = 0; i < num_hashes; ++i) {
-            int hash_value = hash_functions[i](data_point);
-            result[hash_value] = buckets[hash_value];
-        }
-        std::vector<std::vector<float>> output;
-        for (const auto& entry : result) {
-            output.insert(output.end(), entry.second.begin(), entry.second.end());
-        }
-        return output;
+static bool check_initialized(PyLSHIndex* self) {
+    if (self->index == NULL) {
+        PyErr_SetString(PyExc_RuntimeError, "LSHIndex is not initialized.");
+        return false;
     }
+    return true;
+}
 
-private:
-    int num_hashes;
-    int bucket_size;
-    std::unordered_map<int, std::vector<std::vector<float>>> buckets;
-    std::vector<std::function<int(const std::vector<float>&)>> hash_functions;
+static int LSHIndex_init(PyLSHIndex* self, PyObject* args, PyObject* kwds) {
+    static const char* kwlist[] = {"num_hashes", "bucket_size", "num_tables", "family", "bucket_width", "seed",
+                                   "storage", "delta_capacity", NULL};
+    int num_hashes, bucket_size;
+    int num_tables = 1;
+    const char* family_name = "simhash";
+    float bucket_width = 4.0f;
+    unsigned long long seed = 0;
+    const char* storage = "float32";
+    Py_ssize_t delta_capacity = static_cast<Py_ssize_t>(LSHIndex::kDefaultDeltaCapacity);
 
-    std::function<int(const std::vector<float>&)> generate_random_hash_function() {
-        std::default_random_engine generator;
-        std::uniform_real_distribution<float> distribution(-1.0, 1.0);
-        std::vector<float> random_vector(2);
-        for (int i = 0; i < 2; ++i) {
-            random_vector[i] = distribution(generator);
-        }
-        return [random_vector](const std::vector<float>& point) {
-            float dot_product = random_vector[0] * point[0] + random_vector[1] * point[1];
-            return static_cast<int>(std::floor(dot_product));
-        };
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "ii|isfKsn", const_cast<char**>(kwlist), &num_hashes, &bucket_size,
+                                     &num_tables, &family_name, &bucket_width, &seed, &storage, &delta_capacity)) {
+        return -1;
+    }
+    if (delta_capacity <= 0) {
+        PyErr_SetString(PyExc_ValueError, "delta_capacity must be positive.");
+        return -1;
     }
-};
 
-static PyObject* LSHIndex_insert(PyObject* self, PyObject* args) {
+    LSHFamily family;
+    if (std::strcmp(family_name, "simhash") == 0) {
+        family = LSHFamily::SimHash;
+    } else if (std::strcmp(family_name, "e2lsh") == 0) {
+        family = LSHFamily::E2LSH;
+    } else {
+        PyErr_SetString(PyExc_ValueError, "family must be 'simhash' or 'e2lsh'.");
+        return -1;
+    }
+
+    try {
+        LSHIndex* index = new LSHIndex(num_hashes, bucket_size, num_tables, family, bucket_width, seed,
+                                       parse_storage(storage), static_cast<size_t>(delta_capacity));
+        delete self->index;
+        self->index = index;
+    } catch (...) {
+        set_python_error();
+        return -1;
+    }
+    return 0;
+}
+
+static void LSHIndex_dealloc(PyLSHIndex* self) {
+    PyTypeObject* type = Py_TYPE(self);
+    LSHIndex* index = self->index;
+    // Deleting waits for a running background compaction, which needs no Python state
+    Py_BEGIN_ALLOW_THREADS
+    delete index;
+    Py_END_ALLOW_THREADS
+    type->tp_free(reinterpret_cast<PyObject*>(self));
+    Py_DECREF(type);
+}
+
+static PyObject* LSHIndex_insert(PyLSHIndex* self, PyObject* args) {
     PyObject* data;
-    int num_hashes, bucket_size;
 
-    if (!PyArg_ParseTuple(args, "Oii", &data, &num_hashes, &bucket_size)) {
+    if (!PyArg_ParseTuple(args, "O", &data) || !check_initialized(self)) {
+        return NULL;
+    }
+
+    PyArrayObject* array = as_float_array(data, 1);
+    if (array == NULL) {
+        return NULL;
+    }
+
+    const float* values = static_cast<const float*>(PyArray_DATA(array));
+    try {
+        self->index->insert_batch(values, 1, static_cast<size_t>(PyArray_SIZE(array)));
+    } catch (...) {
+        Py_DECREF(array);
+        return set_python_error();
+    }
+    Py_DECREF(array);
+
+    Py_RETURN_NONE;
+}
+
+static PyObject* LSHIndex_insert_batch(PyLSHIndex* self, PyObject* args) {
+    PyObject* data;
+
+    if (!PyArg_ParseTuple(args, "O", &data) || !check_initialized(self)) {
         return NULL;
     }
 
-    if (!PyArray_Check(data)) {
-        PyErr_SetString(PyExc_TypeError, "Input must be a numpy array.");
+    PyArrayObject* array = as_float_array(data, 2);
+    if (array == NULL) {
         return NULL;
     }
 
-    int n = (int)PyArray_Size(data);
-    std::vector<float> data_point(n);
-    for (int i = 0; i < n; ++i) {
-        data_point[i] = static_cast<float>(*static_cast<float*>(PyArray_GETPTR1((PyArrayObject*)data, i)));
+    npy_intp rows = PyArray_DIMS(array)[0];
+    npy_intp cols = PyArray_DIMS(array)[1];
+    const float* values = static_cast<const float*>(PyArray_DATA(array));
+
+    LSHIndex* index = self->index;
+    std::exception_ptr error;
+    // Hashing, and merging a batch of delta_capacity points or more, runs while queries carry on
+    Py_BEGIN_ALLOW_THREADS
+    try {
+        index->insert_batch(values, static_cast<size_t>(rows), static_cast<size_t>(cols));
+    } catch (...) {
+        error = std::current_exception();
+    }
+    Py_END_ALLOW_THREADS
+    Py_DECREF(array);
+    if (error) {
+        try {
+            std::rethrow_exception(error);
+        } catch (...) {
+            return set_python_error();
+        }
     }
 
-    LSHIndex index(num_hashes, bucket_size);
-    index.insert(data_point);
-    
     Py_RETURN_NONE;
 }
 
-static PyObject* LSHIndex_query(PyObject* self, PyObject* args) {
+// Copy a contiguous buffer into a new 1-D numpy array of the given type
+static PyObject* new_array(const void* data, size_t count, int typenum, size_t item_size) {
+    npy_intp dims[1] = {static_cast<npy_intp>(count)};
+    PyObject* array = PyArray_SimpleNew(1, dims, typenum);
+    if (array != NULL && count > 0) {
+        std::memcpy(PyArray_DATA(reinterpret_cast<PyArrayObject*>(array)), data, count * item_size);
+    }
+    return array;
+}
+
+static PyObject* LSHIndex_query(PyLSHIndex* self, PyObject* args, PyObject* kwds) {
+    static const char* kwlist[] = {"data_point", "return_distances", "probes", "metric", "filter", NULL};
     PyObject* data;
+    int return_distances = 0;
+    int probes = 0;
+    const char* metric_name = "euclidean";
+    PyObject* filter_obj = Py_None;
+    metrics::Metric metric;
+    FilterArg filter;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|pisO", const_cast<char**>(kwlist), &data, &return_distances,
+                                     &probes, &metric_name, &filter_obj) ||
+        !check_initialized(self) || !filter.acquire(filter_obj)) {
+        return NULL;
+    }
+    if (probes < 0) {
+        PyErr_SetString(PyExc_ValueError, "probes must be non-negative.");
+        return NULL;
+    }
+    if (!metrics::parse_metric(metric_name, metric)) {
+        PyErr_SetString(PyExc_ValueError, metrics::kUnknownMetric);
+        return NULL;
+    }
+
+    PyArrayObject* array = as_float_array(data, 1);
+    if (array == NULL) {
+        return NULL;
+    }
+
+    LSHQueryResult result;
+    try {
+        stats::QueryScope scope(self->index->query_stats(), true);
+        result = metrics::visit(metric, [&](auto trait) {
+            return with_filter(filter.filter(), [&](const auto& accept) {
+                return self->index->query<decltype(trait)>(static_cast<const float*>(PyArray_DATA(array)),
+                                                           static_cast<size_t>(PyArray_SIZE(array)),
+                                                           return_distances != 0, probes, accept);
+            });
+        });
+    } catch (...) {
+        Py_DECREF(array);
+        return set_python_error();
+    }
+    Py_DECREF(array);
+
+    PyObject* ids = new_array(result.ids.data(), result.ids.size(), NPY_UINT32, sizeof(uint32_t));
+    if (ids == NULL || !return_distances) {
+        return ids;
+    }
+    PyObject* distances = new_array(result.distances.data(), result.distances.size(), NPY_FLOAT, sizeof(float));
+    if (distances == NULL) {
+        Py_DECREF(ids);
+        return NULL;
+    }
+    return Py_BuildValue("(NN)", ids, distances);
+}
+
+static PyObject* LSHIndex_query_batch(PyLSHIndex* self, PyObject* args, PyObject* kwds) {
+    static const char* kwlist[] = {"queries", "k", "probes", "num_threads", "metric", "filter", NULL};
+    PyObject* data;
+    Py_ssize_t k;
+    int probes = 0;
+    Py_ssize_t num_threads = 0;
+    const char* metric_name = "euclidean";
+    PyObject* filter_obj = Py_None;
+    metrics::Metric metric;
+    FilterArg filter;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "On|insO", const_cast<char**>(kwlist), &data, &k, &probes,
+                                     &num_threads, &metric_name, &filter_obj) ||
+        !check_initialized(self) || !filter.acquire(filter_obj)) {
+        return NULL;
+    }
+    if (k < 0 || probes < 0 || num_threads < 0) {
+        PyErr_SetString(PyExc_ValueError, "k, probes and num_threads must be non-negative.");
+        return NULL;
+    }
+    if (!metrics::parse_metric(metric_name, metric)) {
+        PyErr_SetString(PyExc_ValueError, metrics::kUnknownMetric);
+        return NULL;
+    }
+
+    PyArrayObject* array = as_float_array(data, 2);
+    if (array == NULL) {
+        return NULL;
+    }
+    const size_t rows = static_cast<size_t>(PyArray_DIMS(array)[0]);
+    const size_t cols = static_cast<size_t>(PyArray_DIMS(array)[1]);
+    npy_intp dims[2] = {static_cast<npy_intp>(rows), static_cast<npy_intp>(k)};
+    PyObject* ids = PyArray_SimpleNew(2, dims, NPY_INT64);
+    PyObject* distances = PyArray_SimpleNew(2, dims, NPY_FLOAT);
+    if (ids == NULL || distances == NULL) {
+        Py_XDECREF(ids);
+        Py_XDECREF(distances);
+        Py_DECREF(array);
+        return NULL;
+    }
 
-    if (!PyArg_ParseTuple(args, "O", &data)) {
+    const float* queries = static_cast<const float*>(PyArray_DATA(array));
+    int64_t* id_data = static_cast<int64_t*>(PyArray_DATA(reinterpret_cast<PyArrayObject*>(ids)));
+    float* distance_data = static_cast<float*>(PyArray_DATA(reinterpret_cast<PyArrayObject*>(distances)));
+    const LSHIndex* index = self->index;
+    std::exception_ptr error;
+
+    // Queries only read the index and the filter and write disjoint output rows
+    Py_BEGIN_ALLOW_THREADS
+    try {
+        metrics::visit(metric, [&](auto trait) {
+            typedef decltype(trait) Metric;
+            const float pad = Metric::ascending ? std::numeric_limits<float>::infinity()
+                                                : -std::numeric_limits<float>::infinity();
+            with_filter(filter.filter(), [&](const auto& accept) {
+                ThreadPool::instance().parallel_for(rows, static_cast<size_t>(num_threads), [&](size_t q) {
+                    stats::QueryScope scope(index->query_stats());
+                    auto neighbors =
+                        index->knn<Metric>(queries + q * cols, cols, static_cast<size_t>(k), probes, accept);
+                    for (size_t j = 0; j < static_cast<size_t>(k); ++j) {
+                        const bool found = j < neighbors.size();
+                        id_data[q * k + j] = found ? static_cast<int64_t>(neighbors[j].second) : -1;
+                        distance_data[q * k + j] = found ? neighbors[j].first : pad;
+                    }
+                });
+            });
+        });
+    } catch (...) {
+        error = std::current_exception();
+    }
+    Py_END_ALLOW_THREADS
+    Py_DECREF(array);
+
+    if (error) {
+        Py_DECREF(ids);
+        Py_DECREF(distances);
+        try {
+            std::rethrow_exception(error);
+        } catch (...) {
+            return set_python_error();
+        }
+    }
+    return Py_BuildValue("(NN)", ids, distances);
+}
+
+static PyObject* LSHIndex_get(PyLSHIndex* self, PyObject* args) {
+    unsigned int id;
+
+    if (!PyArg_ParseTuple(args, "I", &id) || !check_initialized(self)) {
+        return NULL;
+    }
+    if (!self->index->contains(id)) {
+        PyErr_SetString(PyExc_IndexError, "No live point has this id.");
+        return NULL;
+    }
+    npy_intp dims[1] = {static_cast<npy_intp>(self->index->dimension())};
+    PyObject* vector = PyArray_SimpleNew(1, dims, NPY_FLOAT);
+    if (vector == NULL) {
+        return NULL;
+    }
+    try {
+        self->index->vector(id, static_cast<float*>(PyArray_DATA(reinterpret_cast<PyArrayObject*>(vector))));
+    } catch (const std::out_of_range& e) { // Removed by another thread meanwhile
+        Py_DECREF(vector);
+        PyErr_SetString(PyExc_IndexError, e.what());
+        return NULL;
+    }
+    return vector;
+}
+
+static PyObject* LSHIndex_remove(PyLSHIndex* self, PyObject* args) {
+    unsigned long long id;
+
+    if (!PyArg_ParseTuple(args, "K", &id) || !check_initialized(self)) {
+        return NULL;
+    }
+    if (id > std::numeric_limits<uint32_t>::max()) {
+        Py_RETURN_FALSE;
+    }
+    return PyBool_FromLong(self->index->remove(static_cast<uint32_t>(id)));
+}
+
+static PyObject* LSHIndex_compact(PyLSHIndex* self, PyObject* args) {
+    if (!check_initialized(self)) {
+        return NULL;
+    }
+    LSHIndex* index = self->index;
+    std::exception_ptr error;
+    // Segments are built aside and swapped in atomically; queries from other threads carry on
+    Py_BEGIN_ALLOW_THREADS
+    try {
+        index->compact();
+    } catch (...) {
+        error = std::current_exception();
+    }
+    Py_END_ALLOW_THREADS
+    if (error) {
+        try {
+            std::rethrow_exception(error);
+        } catch (...) {
+            return set_python_error();
+        }
+    }
+    Py_RETURN_NONE;
+}
+
+static PyObject* LSHIndex_stats(PyLSHIndex* self, PyObject* args, PyObject* kwds) {
+    if (!check_initialized(self)) {
+        return NULL;
+    }
+    return stats_dict::stats_method(self->index->query_stats(), args, kwds);
+}
+
+static PyObject* LSHIndex_last_trace(PyLSHIndex* self, PyObject* args) {
+    if (!check_initialized(self)) {
+        return NULL;
+    }
+    return stats_dict::trace(stats::last_trace(self->index->query_stats()));
+}
+
+static PyObject* LSHIndex_get_storage(PyLSHIndex* self, void* closure) {
+    if (!check_initialized(self)) {
+        return NULL;
+    }
+    return PyUnicode_FromString(storage_name(self->index->storage()));
+}
+
+static PyObject* LSHIndex_get_bytes_per_vector(PyLSHIndex* self, void* closure) {
+    if (!check_initialized(self)) {
         return NULL;
     }
+    return PyLong_FromSize_t(self->index->bytes_per_vector());
+}
 
-    if (!PyArray_Check(data)) {
-        PyErr_SetString(PyExc_TypeError, "Input must be a numpy array.");
+static PyObject* LSHIndex_get_delta_size(PyLSHIndex* self, void* closure) {
+    if (!check_initialized(self)) {
         return NULL;
     }
+    return PyLong_FromSize_t(self->index->delta_size());
+}
+
+static PyObject* LSHIndex_save(PyLSHIndex* self, PyObject* args, PyObject* kwds) {
+    static const char* kwlist[] = {"path", NULL};
+    PyObject* path_obj;
 
-    int n = (int)PyArray_Size(data);
-    std::vector<float> data_point(n);
-    for (int i = 0; i < n; ++i) {
-        data_point[i] = static_cast<float>(*static_cast<float*>(PyArray_GETPTR1((PyArrayObject*)data, i)));
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "O&", const_cast<char**>(kwlist), PyUnicode_FSConverter, &path_obj)) {
+        return NULL;
+    }
+    const std::string path(PyBytes_AS_STRING(path_obj));
+    Py_DECREF(path_obj);
+    if (!check_initialized(self)) {
+        return NULL;
     }
 
-    // Assuming we have an instance of LSHIndex called `index`
-    std::vector<std::vector<float>> results = index.query(data_point);
-    
-    // Convert results to a Python list
-    PyObject* result_list = PyList_New(results.size());
-    for (size_t i = 0; i < results.size(); ++i) {
-        PyObject* result_array = PyArray_FromAny(
-            PyList_New(results[i].size()),
-            PyArray_DescrFromType(NPY_FLOAT),
-            1, 1,
-            NPY_ARRAY_DEFAULT,
-            NULL
-        );
-        for (size_t j = 0; j < results[i].size(); ++j) {
-            *static_cast<float*>(PyArray_GETPTR1((PyArrayObject*)result_array, j)) = results[i][j];
+    LSHIndex* index = self->index;
+    std::exception_ptr error;
+    Py_BEGIN_ALLOW_THREADS
+    try {
+        index->save(path);
+    } catch (...) {
+        error = std::current_exception();
+    }
+    Py_END_ALLOW_THREADS
+    if (error) {
+        try {
+            std::rethrow_exception(error);
+        } catch (...) {
+            return set_python_error();
         }
-        PyList_SetItem(result_list, i, result_array);
     }
-    
-    return result_list;
+    Py_RETURN_NONE;
 }
 
-static PyMethodDef LSHMethods[] = {
-    {"insert", LSHIndex_insert, METH_VARARGS, "Insert a data point into the LSH index."},
-    {"query", LSHIndex_query, METH_VARARGS, "Query the LSH index."},
+static PyObject* LSHIndex_load(PyObject* cls, PyObject* args, PyObject* kwds) {
+    static const char* kwlist[] = {"path", NULL};
+    PyObject* path_obj;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "O&", const_cast<char**>(kwlist), PyUnicode_FSConverter, &path_obj)) {
+        return NULL;
+    }
+    const std::string path(PyBytes_AS_STRING(path_obj));
+    Py_DECREF(path_obj);
+
+    std::unique_ptr<LSHIndex> index;
+    std::exception_ptr error;
+    // The bucket tables are rebuilt from the file, so other Python threads may run meanwhile
+    Py_BEGIN_ALLOW_THREADS
+    try {
+        index = LSHIndex::load(path);
+    } catch (...) {
+        error = std::current_exception();
+    }
+    Py_END_ALLOW_THREADS
+    if (error) {
+        try {
+            std::rethrow_exception(error);
+        } catch (...) {
+            return set_python_error();
+        }
+    }
+
+    PyTypeObject* type = reinterpret_cast<PyTypeObject*>(cls);
+    PyLSHIndex* self = reinterpret_cast<PyLSHIndex*>(type->tp_alloc(type, 0));
+    if (self == NULL) {
+        return NULL;
+    }
+    self->index = index.release();
+    return reinterpret_cast<PyObject*>(self);
+}
+
+static Py_ssize_t LSHIndex_len(PyLSHIndex* self) {
+    return self->index == NULL ? 0 : static_cast<Py_ssize_t>(self->index->size());
+}
+
+static PyMethodDef LSHIndexMethods[] = {
+    {"insert", (PyCFunction)LSHIndex_insert, METH_VARARGS, "Insert a data point into the LSH index."},
+    {"insert_batch", (PyCFunction)LSHIndex_insert_batch, METH_VARARGS, "Insert every row of a 2-D array into the LSH index."},
+    {"query", (PyCFunction)(void (*)(void))LSHIndex_query, METH_VARARGS | METH_KEYWORDS,
+     "Return the ids of points sharing a bucket with the query, optionally with their metric distances.\n\n"
+     "probes additionally visits that many neighbouring buckets, most likely first (multi-probe LSH).\n"
+     "metric is 'euclidean' (default), 'sqeuclidean', 'ip', 'cosine', 'manhattan' or 'hamming'.\n"
+     "filter restricts the result to some ids: a bool mask or an array of allowed ids, or a\n"
+     "(column, op, value) tuple comparing a per-id integer column, e.g. (tenant, '==', 7) or\n"
+     "(tenant, 'in', [1, 2]). Rejected candidates are dropped before any distance is computed."},
+    {"query_batch", (PyCFunction)(void (*)(void))LSHIndex_query_batch, METH_VARARGS | METH_KEYWORDS,
+     "Return (ids, distances) arrays of shape (M, k) with the exact k nearest candidates of every query row.\n\n"
+     "The GIL is released and queries run on num_threads threads (0 uses all). Candidates are ranked by metric,\n"
+     "as for query; 'ip' and 'cosine' give descending similarities. Missing neighbours are -1 / inf\n"
+     "(-inf for similarities). filter is as for query and applies to every query."},
+    {"get", (PyCFunction)LSHIndex_get, METH_VARARGS,
+     "Return the stored vector with the given id as float32 (decoded for float16 and int8 storage).\n\n"
+     "Raises IndexError for ids that were never inserted or have been removed."},
+    {"remove", (PyCFunction)LSHIndex_remove, METH_VARARGS,
+     "Delete the point with the given id; returns False when no live point has that id.\n\n"
+     "Deleted points are never returned by queries and are purged from the buckets in the background."},
+    {"compact", (PyCFunction)LSHIndex_compact, METH_NOARGS,
+     "Merge buffered inserts and every bucket segment into one and purge deleted points from it now."},
+    {"stats", (PyCFunction)(void (*)(void))LSHIndex_stats, METH_VARARGS | METH_KEYWORDS,
+     "Return histograms of the per-query counters of query and query_batch as a dict.\n\n"
+     "Queries are only counted by builds configured with -Dquery_stats=true; elsewhere 'enabled' is False\n"
+     "and every histogram is empty. Besides 'enabled' and 'queries' there is one histogram per counter:\n"
+     "'latency_ns', 'distances' (points scored), 'visited' (buckets looked up), 'candidates' (distinct\n"
+     "points scored for the result), 'bytes' (vector bytes read) and the phase times 'hash_ns',\n"
+     "'probe_ns', 'scan_ns' and 'select_ns'. Each is a dict of 'total', 'mean', 'p50', 'p90', 'p99',\n"
+     "'max' and 'buckets', where buckets[b] counts the queries whose value has b bits. reset=True\n"
+     "clears the counters once they are read."},
+    {"last_trace", (PyCFunction)LSHIndex_last_trace, METH_NOARGS,
+     "Return the counters of the last query() this thread ran on the index as a dict with the keys of\n"
+     "stats(), or None when there is none or queries are not counted."},
+    {"save", (PyCFunction)(void (*)(void))LSHIndex_save, METH_VARARGS | METH_KEYWORDS,
+     "Write the index, its hash functions and vectors to path in the versioned on-disk index format.\n\n"
+     "Buffered inserts are merged into the bucket tables first; deleted ids stay deleted on load."},
+    {"load", (PyCFunction)(void (*)(void))LSHIndex_load, METH_VARARGS | METH_KEYWORDS | METH_CLASS,
+     "Open an index written by save(). Vectors and projections are memory-mapped read-only; "
+     "the bucket tables are rebuilt in memory."},
     {NULL, NULL, 0, NULL}
 };
 
+static PyGetSetDef LSHIndexGetSet[] = {
+    {"storage", (getter)LSHIndex_get_storage, NULL, "Element type of the stored vectors.", NULL},
+    {"bytes_per_vector", (getter)LSHIndex_get_bytes_per_vector, NULL,
+     "Bytes stored per vector, 0 until the first insert.", NULL},
+    {"delta_size", (getter)LSHIndex_get_delta_size, NULL,
+     "Inserted points not yet merged into the bucket tables; queries scan them directly.", NULL},
+    {NULL, NULL, NULL, NULL, NULL}
+};
+
+static PyType_Slot LSHIndexSlots[] = {
+    {Py_tp_doc, (void*)"LSHIndex(num_hashes, bucket_size, num_tables=1, family='simhash', bucket_width=4.0, seed=0, "
+                        "storage='float32', delta_capacity=1024)\n\n"
+                        "Persistent locality-sensitive hash index with num_tables tables of num_hashes concatenated hashes.\n"
+                        "storage keeps the vectors as 'float32', 'float16' or 'int8'; hashing uses the float32 input.\n"
+                        "Inserts wait in a buffer of up to delta_capacity points that queries scan directly until a\n"
+                        "background thread merges them into the tables; removed points are purged the same way."},
+    {Py_tp_new, (void*)PyType_GenericNew},
+    {Py_tp_init, (void*)LSHIndex_init},
+    {Py_tp_dealloc, (void*)LSHIndex_dealloc},
+    {Py_tp_methods, LSHIndexMethods},
+    {Py_tp_getset, LSHIndexGetSet},
+    {Py_sq_length, (void*)LSHIndex_len},
+    {0, NULL}
+};
+
+static PyType_Spec LSHIndexSpec = {
+    "hash_index.LSHIndex",
+    sizeof(PyLSHIndex),
+    0,
+    Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE,
+    LSHIndexSlots
+};
+
 static struct PyModuleDef lshmodule = {
     PyModuleDef_HEAD_INIT,
-    "lsh",   // name of module
+    "hash_index",   // name of module
     NULL, // module documentation, may be NULL
     -1,       // size of per-interpreter state of the module,
-    LSHMethods
+    NULL
 };
 
-PyMODINIT_FUNC PyInit_lsh(void) {
+PyMODINIT_FUNC PyInit_hash_index(void) {
     import_array();  // Necessary for initializing NumPy API
-    return PyModule_Create(&lshmodule);
-}
\ No newline at end of file
+    simd::init();    // Pick the distance kernels for this CPU once
+
+    PyObject* module = PyModule_Create(&lshmodule);
+    if (module == NULL) {
+        return NULL;
+    }
+    PyObject* type = PyType_FromSpec(&LSHIndexSpec);
+    if (type == NULL || PyModule_AddObject(module, "LSHIndex", type) < 0) {
+        Py_XDECREF(type);
+        Py_DECREF(module);
+        return NULL;
+    }
+    return module;
+}
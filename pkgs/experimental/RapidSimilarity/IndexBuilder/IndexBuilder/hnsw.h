@@ -0,0 +1,554 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <random>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <functional>
+#include <utility>
+#include <stdexcept>
+
+#include "DistanceMetrics/index_io.h"
+#include "DistanceMetrics/metrics.h"
+#include "DistanceMetrics/query_stats.h"
+#include "DistanceMetrics/simd_kernels.h"
+#include "DistanceMetrics/storage.h"
+#include "DistanceMetrics/thread_pool.h"
+
+// Hierarchical navigable small-world graph (Malkov & Yashunin) over vectors stored as float32,
+// float16 or int8 (see storage.h); queries stay float32. Metric is one of the traits of metrics.h
+// and is fixed when the graph is built, since the links are chosen by it. Every point
+// lives on layer 0 and, with geometrically falling probability, on the layers above it; a query
+// descends greedily from the single top-level entry point and then runs a best-first search of
+// width ef on layer 0.
+//
+// Layer 0, where nearly all search time goes, is one flat array with a fixed stride of 1 + M0
+// uint32 slots per point ([count, id, id, ...]), next to a row-major vector store. Upper layers,
+// which hold about 1/M of the points, keep a small per-point array of the same layout.
+//
+// Queries may run concurrently with each other but not with inserts; the Python binding
+// (hnsw_index.cpp) enforces this per object.
+template <typename Metric = metrics::Euclidean>
+class HNSWIndex {
+public:
+    typedef std::pair<float, uint32_t> Neighbor;  // (rank while searching, metric value in results; id)
+
+    // M: links per point on the upper layers (2 M on layer 0). ef_construction: search width used
+    // to pick the links of a new point. ef_search: default search width of queries. storage:
+    // element type of the stored vectors.
+    explicit HNSWIndex(size_t M = 16, size_t ef_construction = 200, size_t ef_search = 50, uint64_t seed = 0,
+                       StorageType storage = StorageType::Float32)
+        : M(M), M0(2 * M), ef_construction(ef_construction), ef_search(ef_search), generator(seed),
+          vectors(storage) {
+        if (M < 2) {
+            throw std::invalid_argument("M must be at least 2.");
+        }
+        if (ef_construction == 0 || ef_search == 0) {
+            throw std::invalid_argument("ef_construction and ef_search must be positive.");
+        }
+        level_multiplier = 1.0 / std::log(static_cast<double>(M));
+    }
+
+    HNSWIndex(const HNSWIndex&) = delete;
+    HNSWIndex& operator=(const HNSWIndex&) = delete;
+
+    size_t size() const { return num_points; }
+    size_t dimension() const { return dim; }
+    size_t max_links() const { return M; }
+    size_t construction_width() const { return ef_construction; }
+    size_t search_width() const { return ef_search; }
+    int top_level() const { return max_level; }
+    metrics::Metric metric() const { return Metric::kind; }
+    StorageType storage() const { return vectors.type(); }
+    size_t bytes_per_vector() const { return vectors.bytes_per_row(); }
+
+    // Counters of the queries run under a stats::QueryScope on this index (query_stats.h)
+    stats::QueryStats& query_stats() const { return query_stats_; }
+
+    void set_search_width(size_t ef) {
+        if (ef == 0) {
+            throw std::invalid_argument("ef_search must be positive.");
+        }
+        ef_search = ef;
+    }
+
+    // Add one point; returns its id (ids are consecutive in insertion order)
+    uint32_t insert(const float* point, size_t point_dim) {
+        insert_batch(point, 1, point_dim, 1);
+        return static_cast<uint32_t>(num_points - 1);
+    }
+
+    // Add n row-major points. Storage and levels are assigned up front; the points are then linked
+    // into the graph on up to num_threads threads (0 means all), each locking the lists it edits.
+    // With one thread the graph depends only on the seed and the insertion order.
+    void insert_batch(const float* data, size_t n, size_t point_dim, size_t num_threads = 0) {
+        check_dimension(point_dim);
+        if (n == 0) {
+            return;
+        }
+        if (num_points + n > static_cast<size_t>(std::numeric_limits<uint32_t>::max())) {
+            throw std::length_error("HNSWIndex supports at most 2^32 - 1 points.");
+        }
+        const size_t first = num_points;
+        reserve(first + n);
+        vectors.append(data, n, dim);
+        level0.edit().resize((first + n) * level0_stride(), 0);
+        levels.resize(first + n);
+        upper.resize(first + n);
+        for (size_t i = first; i < first + n; ++i) {
+            levels[i] = random_level();
+            upper[i].assign(static_cast<size_t>(levels[i]) * upper_stride(), 0);
+        }
+        num_points = first + n;
+
+        // The first point of an empty index becomes the entry point without any linking
+        size_t begin = first;
+        if (entry_point == kNone) {
+            entry_point = static_cast<uint32_t>(first);
+            max_level = levels[first];
+            ++begin;
+        }
+        ThreadPool::instance().parallel_for(first + n - begin, num_threads, [&](size_t i) {
+            link(static_cast<uint32_t>(begin + i));
+        });
+    }
+
+    // k nearest points of the query as (metric value, id), nearest first (ascending distances or
+    // descending similarities); ef = 0 uses the index's ef_search. The search width is never below k.
+    std::vector<Neighbor> knn(const float* query, size_t query_dim, size_t k, size_t ef = 0) const {
+        if (query_dim == 0) {
+            throw std::invalid_argument("Query point must not be empty.");
+        }
+        std::vector<Neighbor> result;
+        if (num_points == 0 || k == 0) {
+            return result;
+        }
+        if (query_dim != dim) {
+            throw std::invalid_argument("Query point dimension does not match the index.");
+        }
+        stats::PhaseTimer phase(stats::Hash);
+        const VectorStore::Query prepared = vectors.prepare(query);
+        phase.next(stats::Probe);
+        uint32_t nearest = greedy_descent<false>(prepared, entry_point, max_level, 0);
+        phase.next(stats::Scan);
+        result = search_layer<false>(prepared, nearest, std::max(k, ef == 0 ? ef_search : ef), 0);
+        stats::count(stats::Candidates, result.size());
+        phase.next(stats::Select);
+        if (result.size() > k) {
+            result.resize(k);
+        }
+        for (Neighbor& neighbor : result) {
+            neighbor.first = Metric::value(neighbor.first);
+        }
+        return result;
+    }
+
+    // Stored vector of the given id as float32 into out (dim values)
+    void vector(uint32_t id, float* out) const {
+        if (id >= num_points) {
+            throw std::out_of_range("Point id is out of range.");
+        }
+        vectors.decode(id, out);
+    }
+
+    // Layer-0 neighbours of a point (for inspection and tests)
+    std::vector<uint32_t> neighbors(uint32_t id, int layer = 0) const {
+        if (id >= num_points) {
+            throw std::out_of_range("Point id is out of range.");
+        }
+        if (layer < 0 || layer > levels[id]) {
+            return {};
+        }
+        const uint32_t* list = links(id, layer);
+        return std::vector<uint32_t>(list + 1, list + 1 + list[0]);
+    }
+
+    // Sections: parameters (with the metric), generator state, vector store, layer 0, point levels, then the
+    // upper-layer lists in CSR form (offsets into one flat array)
+    void save(const std::string& path) const {
+        index_io::Writer writer(path, index_io::Kind::HNSW);
+        writer.write(std::vector<uint64_t>{M, ef_construction, ef_search, dim, num_points, entry_point,
+                                           static_cast<uint64_t>(max_level + 1), static_cast<uint64_t>(Metric::kind)});
+        writer.write_text(index_io::engine_state(generator));
+        vectors.save(writer);
+        writer.write(level0);
+        std::vector<int32_t> point_levels(levels.begin(), levels.end());
+        std::vector<uint64_t> upper_offsets(1, 0);
+        std::vector<uint32_t> upper_links;
+        for (const std::vector<uint32_t>& lists : upper) {
+            upper_links.insert(upper_links.end(), lists.begin(), lists.end());
+            upper_offsets.push_back(upper_links.size());
+        }
+        writer.write(point_levels);
+        writer.write(upper_offsets);
+        writer.write(upper_links);
+        writer.commit();
+    }
+
+    // Map a saved graph. Vectors and layer 0 are used straight from the mapping until the next
+    // insert; only the small upper layers are copied into memory.
+    static std::unique_ptr<HNSWIndex> load(const std::string& path) {
+        index_io::Reader reader(path, index_io::Kind::HNSW);
+        return std::unique_ptr<HNSWIndex>(new HNSWIndex(reader));
+    }
+
+private:
+    static constexpr uint32_t kNone = std::numeric_limits<uint32_t>::max();
+
+    size_t M;
+    size_t M0;
+    size_t ef_construction;
+    size_t ef_search;
+    double level_multiplier;
+    std::mt19937_64 generator;
+    size_t dim = 0;  // Fixed by the first inserted point
+    size_t num_points = 0;
+    uint32_t entry_point = kNone;
+    int max_level = -1;
+
+    VectorStore vectors;                     // Row-major num_points x dim
+    index_io::Array<uint32_t> level0;        // num_points x (1 + M0): [count, ids...]
+    std::vector<int> levels;                 // Top layer of each point
+    std::vector<std::vector<uint32_t>> upper;  // Layers 1..level, (1 + M) slots per layer
+    std::unique_ptr<std::mutex[]> locks;     // One per point, guarding its link lists
+    size_t lock_capacity = 0;
+    std::mutex entry_lock;                   // Guards entry_point and max_level while linking
+
+    // Epoch-tagged visited marks, pooled so concurrent searches never clear an O(n) array
+    struct VisitedList {
+        std::vector<uint32_t> marks;
+        uint32_t epoch = 0;
+
+        void reset(size_t n) {
+            if (marks.size() < n) {
+                marks.resize(n, 0);
+            }
+            if (++epoch == 0) {
+                std::fill(marks.begin(), marks.end(), 0);
+                epoch = 1;
+            }
+        }
+        bool visit(uint32_t id) {
+            if (marks[id] == epoch) {
+                return false;
+            }
+            marks[id] = epoch;
+            return true;
+        }
+    };
+    mutable std::mutex pool_lock;
+    mutable std::vector<std::unique_ptr<VisitedList>> visited_pool;
+    mutable stats::QueryStats query_stats_;
+
+    std::unique_ptr<VisitedList> acquire_visited() const {
+        std::unique_ptr<VisitedList> visited;
+        {
+            std::lock_guard<std::mutex> lock(pool_lock);
+            if (!visited_pool.empty()) {
+                visited = std::move(visited_pool.back());
+                visited_pool.pop_back();
+            }
+        }
+        if (!visited) {
+            visited.reset(new VisitedList());
+        }
+        visited->reset(num_points);
+        return visited;
+    }
+
+    void release_visited(std::unique_ptr<VisitedList> visited) const {
+        std::lock_guard<std::mutex> lock(pool_lock);
+        visited_pool.push_back(std::move(visited));
+    }
+
+    explicit HNSWIndex(index_io::Reader& reader) {
+        const std::vector<uint64_t> params = reader.vector<uint64_t>(8);
+        if (metrics::metric_from_id(params[7]) != Metric::kind) {
+            throw std::invalid_argument("HNSW index file was built for another metric.");
+        }
+        M = static_cast<size_t>(params[0]);
+        M0 = 2 * M;
+        ef_construction = static_cast<size_t>(params[1]);
+        ef_search = static_cast<size_t>(params[2]);
+        dim = static_cast<size_t>(params[3]);
+        num_points = static_cast<size_t>(params[4]);
+        entry_point = static_cast<uint32_t>(params[5]);
+        max_level = static_cast<int>(params[6]) - 1;
+        if (M < 2 || ef_construction == 0 || ef_search == 0 ||
+            num_points > static_cast<size_t>(std::numeric_limits<uint32_t>::max()) ||
+            (num_points == 0) != (entry_point == kNone) || (num_points > 0 && entry_point >= num_points)) {
+            throw std::invalid_argument("HNSW index file is inconsistent.");
+        }
+        level_multiplier = 1.0 / std::log(static_cast<double>(M));
+        index_io::restore_engine(generator, reader.text());
+        vectors = VectorStore(reader);
+        level0 = reader.array<uint32_t>();
+        if (vectors.size() != num_points || (num_points > 0 && vectors.dimension() != dim) ||
+            level0.size() != num_points * level0_stride()) {
+            throw std::invalid_argument("HNSW index file is inconsistent.");
+        }
+
+        const std::vector<int32_t> point_levels = reader.vector<int32_t>(num_points);
+        const std::vector<uint64_t> upper_offsets = reader.vector<uint64_t>(num_points + 1);
+        const std::vector<uint32_t> upper_links = reader.vector<uint32_t>(upper_offsets.back());
+        levels.assign(point_levels.begin(), point_levels.end());
+        upper.resize(num_points);
+        for (size_t i = 0; i < num_points; ++i) {
+            const size_t slots = static_cast<size_t>(std::max(levels[i], 0)) * upper_stride();
+            if (levels[i] < 0 || levels[i] > max_level || upper_offsets[i + 1] - upper_offsets[i] != slots ||
+                upper_offsets[i + 1] > upper_links.size()) {
+                throw std::invalid_argument("HNSW index file is inconsistent.");
+            }
+            upper[i].assign(upper_links.begin() + upper_offsets[i], upper_links.begin() + upper_offsets[i + 1]);
+        }
+        if (num_points > 0 && levels[entry_point] != max_level) {
+            throw std::invalid_argument("HNSW index file is inconsistent.");
+        }
+        // Searches follow the links without bounds checks, so every list must fit its layer
+        const HNSWIndex& loaded = *this;
+        for (uint32_t id = 0; id < num_points; ++id) {
+            for (int layer = 0; layer <= levels[id]; ++layer) {
+                const uint32_t* list = loaded.links(id, layer);
+                if (list[0] > capacity(layer)) {
+                    throw std::invalid_argument("HNSW index file is inconsistent.");
+                }
+                for (uint32_t j = 1; j <= list[0]; ++j) {
+                    if (list[j] >= num_points || levels[list[j]] < layer) {
+                        throw std::invalid_argument("HNSW index file is inconsistent.");
+                    }
+                }
+            }
+        }
+        locks.reset(new std::mutex[num_points]);
+        lock_capacity = num_points;
+    }
+
+    size_t level0_stride() const { return 1 + M0; }
+    size_t upper_stride() const { return 1 + M; }
+    size_t capacity(int layer) const { return layer == 0 ? M0 : M; }
+
+    // insert_batch makes level0 owned before linking, so edit() only reads here
+    uint32_t* links(uint32_t id, int layer) {
+        return layer == 0 ? level0.edit().data() + static_cast<size_t>(id) * level0_stride()
+                          : upper[id].data() + static_cast<size_t>(layer - 1) * upper_stride();
+    }
+    const uint32_t* links(uint32_t id, int layer) const {
+        return layer == 0 ? level0.data() + static_cast<size_t>(id) * level0_stride()
+                          : upper[id].data() + static_cast<size_t>(layer - 1) * upper_stride();
+    }
+
+    float distance(const VectorStore::Query& query, uint32_t id) const {
+        return vectors.rank<Metric>(query, id);
+    }
+
+    void check_dimension(size_t n) {
+        if (n == 0) {
+            throw std::invalid_argument("Data point must not be empty.");
+        }
+        if (dim == 0) {
+            dim = n;
+        } else if (n != dim) {
+            throw std::invalid_argument("Data point dimension does not match the index.");
+        }
+    }
+
+    // Locks are only reallocated between batches, when no thread holds one
+    void reserve(size_t n) {
+        if (n <= lock_capacity) {
+            return;
+        }
+        const size_t grown = std::max(n, lock_capacity * 2);
+        locks.reset(new std::mutex[grown]);
+        lock_capacity = grown;
+        vectors.reserve(grown, dim);
+        level0.edit().reserve(grown * level0_stride());
+    }
+
+    // Layer drawn from the exponential distribution floor(-ln(U) / ln(M))
+    int random_level() {
+        std::uniform_real_distribution<double> uniform(0.0, 1.0);
+        const double u = std::max(uniform(generator), std::numeric_limits<double>::min());
+        return static_cast<int>(-std::log(u) * level_multiplier);
+    }
+
+    // Copy of a point's list on one layer, taken under its lock while inserts are running
+    template <bool Locked>
+    void read_links(uint32_t id, int layer, std::vector<uint32_t>& out) const {
+        const uint32_t* list = links(id, layer);
+        if (Locked) {
+            std::lock_guard<std::mutex> lock(locks[id]);
+            out.assign(list + 1, list + 1 + list[0]);
+        } else {
+            out.assign(list + 1, list + 1 + list[0]);
+        }
+    }
+
+    // Greedy walk from `start` on layers top .. bottom + 1; returns the closest point found
+    template <bool Locked>
+    uint32_t greedy_descent(const VectorStore::Query& query, uint32_t start, int top, int bottom) const {
+        uint32_t current = start;
+        float current_distance = distance(query, current);
+        std::vector<uint32_t> adjacent;
+        for (int layer = top; layer > bottom; --layer) {
+            bool improved = true;
+            while (improved) {
+                improved = false;
+                stats::count(stats::Visited);
+                read_links<Locked>(current, layer, adjacent);
+                for (uint32_t next : adjacent) {
+                    const float d = distance(query, next);
+                    if (d < current_distance) {
+                        current_distance = d;
+                        current = next;
+                        improved = true;
+                    }
+                }
+            }
+        }
+        return current;
+    }
+
+    // Best-first search of width ef on one layer; returns up to ef (rank, id) pairs in ascending
+    // order
+    template <bool Locked>
+    std::vector<Neighbor> search_layer(const VectorStore::Query& query, uint32_t start, size_t ef, int layer) const {
+        std::unique_ptr<VisitedList> visited = acquire_visited();
+        std::priority_queue<Neighbor, std::vector<Neighbor>, std::greater<Neighbor>> candidates;  // nearest on top
+        std::priority_queue<Neighbor> found;  // farthest on top, at most ef entries
+        const float start_distance = distance(query, start);
+        visited->visit(start);
+        candidates.emplace(start_distance, start);
+        found.emplace(start_distance, start);
+
+        std::vector<uint32_t> adjacent;
+        while (!candidates.empty()) {
+            const Neighbor current = candidates.top();
+            if (current.first > found.top().first && found.size() >= ef) {
+                break;
+            }
+            candidates.pop();
+            stats::count(stats::Visited);
+            read_links<Locked>(current.second, layer, adjacent);
+            for (uint32_t next : adjacent) {
+                if (!visited->visit(next)) {
+                    continue;
+                }
+                const float d = distance(query, next);
+                if (found.size() < ef || d < found.top().first) {
+                    candidates.emplace(d, next);
+                    found.emplace(d, next);
+                    if (found.size() > ef) {
+                        found.pop();
+                    }
+                }
+            }
+        }
+        release_visited(std::move(visited));
+
+        std::vector<Neighbor> result(found.size());
+        for (size_t i = result.size(); i-- > 0;) {
+            result[i] = found.top();
+            found.pop();
+        }
+        return result;
+    }
+
+    // Neighbour selection heuristic: walk the candidates nearest first and keep one only if it is
+    // closer to the new point than to every neighbour already kept, which spreads the links out
+    std::vector<uint32_t> select_neighbors(const std::vector<Neighbor>& candidates, size_t max_count) const {
+        std::vector<uint32_t> selected;
+        std::vector<float> scratch;
+        for (const Neighbor& candidate : candidates) {
+            if (selected.size() >= max_count) {
+                break;
+            }
+            const VectorStore::Query vec = vectors.prepare(vectors.row(candidate.second, scratch));
+            bool keep = true;
+            for (uint32_t other : selected) {
+                if (distance(vec, other) < candidate.first) {
+                    keep = false;
+                    break;
+                }
+            }
+            if (keep) {
+                selected.push_back(candidate.second);
+            }
+        }
+        return selected;
+    }
+
+    // Add `id` to the list of `target` on one layer, re-running the heuristic when it is full.
+    // The caller holds target's lock.
+    void add_link(uint32_t target, uint32_t id, int layer) {
+        uint32_t* list = links(target, layer);
+        const size_t limit = capacity(layer);
+        if (list[0] < limit) {
+            list[1 + list[0]] = id;
+            ++list[0];
+            return;
+        }
+        std::vector<float> scratch;
+        const VectorStore::Query vec = vectors.prepare(vectors.row(target, scratch));
+        std::vector<Neighbor> candidates;
+        candidates.reserve(limit + 1);
+        candidates.emplace_back(distance(vec, id), id);
+        for (uint32_t i = 1; i <= list[0]; ++i) {
+            candidates.emplace_back(distance(vec, list[i]), list[i]);
+        }
+        std::sort(candidates.begin(), candidates.end());
+        const std::vector<uint32_t> kept = select_neighbors(candidates, limit);
+        list[0] = static_cast<uint32_t>(kept.size());
+        std::copy(kept.begin(), kept.end(), list + 1);
+    }
+
+    // Connect a stored point into every layer up to its level
+    void link(uint32_t id) {
+        std::vector<float> scratch;
+        const VectorStore::Query query = vectors.prepare(vectors.row(id, scratch));
+        const int level = levels[id];
+
+        // A point that will raise the top level keeps the entry lock until it is the new entry point
+        std::unique_lock<std::mutex> top_lock(entry_lock);
+        const uint32_t entry = entry_point;
+        const int top = max_level;
+        if (level <= top) {
+            top_lock.unlock();
+        }
+
+        uint32_t nearest = greedy_descent<true>(query, entry, top, level);
+        for (int layer = std::min(level, top); layer >= 0; --layer) {
+            const std::vector<Neighbor> candidates = search_layer<true>(query, nearest, ef_construction, layer);
+            const std::vector<uint32_t> selected = select_neighbors(candidates, M);
+            {
+                std::lock_guard<std::mutex> lock(locks[id]);
+                uint32_t* list = links(id, layer);
+                list[0] = static_cast<uint32_t>(selected.size());
+                std::copy(selected.begin(), selected.end(), list + 1);
+            }
+            for (uint32_t neighbor : selected) {
+                std::lock_guard<std::mutex> lock(locks[neighbor]);
+                add_link(neighbor, id, layer);
+            }
+            nearest = candidates.front().second;
+        }
+
+        if (level > top) {
+            entry_point = id;
+            max_level = level;
+        }
+    }
+};
+
+// Metric a saved graph was built with, which picks the HNSWIndex<Metric> instantiation that can
+// load it
+inline metrics::Metric hnsw_metric(const std::string& path) {
+    index_io::Reader reader(path, index_io::Kind::HNSW);
+    return metrics::metric_from_id(reader.vector<uint64_t>(8)[7]);
+}
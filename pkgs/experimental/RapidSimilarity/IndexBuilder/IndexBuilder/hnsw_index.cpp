@@ -0,0 +1,655 @@
+#include <Python.h>
+#include <numpy/arrayobject.h>
+#include <vector>
+#include <limits>
+#include <memory>
+#include <string>
+#include <exception>
+#include <stdexcept>
+
+#include "hnsw.h"
+#include "DistanceMetrics/query_stats.h"
+#include "DistanceMetrics/stats_dict.h"
+#include "DistanceMetrics/thread_pool.h"
+
+// Python object owning one long-lived HNSWIndex<Metric>; metric names the instantiation.
+// The graph allows concurrent queries but no query during an insert (hnsw.h), and the batch calls
+// run with the GIL released, so every call that touches the graph first claims it through
+// begin_use(): any number of readers or one writer. Both fields are only read and written with
+// the GIL held.
+typedef struct {
+    PyObject_HEAD
+    void* index;
+    metrics::Metric metric;
+    Py_ssize_t readers; // Queries and saves running with the GIL released
+    int writing;        // An insert is running with the GIL released
+} PyHNSWIndex;
+
+typedef std::pair<float, uint32_t> Neighbor;  // Same for every metric
+
+// Call f with the index cast to its HNSWIndex<Metric> type
+template <typename F>
+static auto with_index(PyHNSWIndex* self, F&& f) -> decltype(f(static_cast<HNSWIndex<>*>(nullptr))) {
+    return metrics::visit(self->metric, [&](auto trait) {
+        return f(static_cast<HNSWIndex<decltype(trait)>*>(self->index));
+    });
+}
+
+static void destroy_index(PyHNSWIndex* self) {
+    if (self->index != NULL) {
+        with_index(self, [](auto* index) { delete index; });
+        self->index = NULL;
+    }
+}
+
+// View a numpy array or other buffer (memoryview, array.array) as a contiguous float32 array with
+// the expected rank; float32 C-contiguous input is used in place, anything else is converted once
+static PyArrayObject* as_float_array(PyObject* data, int ndim) {
+    if (!PyArray_Check(data) && !PyObject_CheckBuffer(data)) {
+        PyErr_SetString(PyExc_TypeError, "Input must be a numpy array or a buffer.");
+        return NULL;
+    }
+    PyArrayObject* array = reinterpret_cast<PyArrayObject*>(
+        PyArray_FROM_OTF(data, NPY_FLOAT, NPY_ARRAY_IN_ARRAY));
+    if (array == NULL) {
+        return NULL;
+    }
+    if (PyArray_NDIM(array) != ndim) {
+        Py_DECREF(array);
+        PyErr_Format(PyExc_ValueError, "Input must be a %d-dimensional array.", ndim);
+        return NULL;
+    }
+    return array;
+}
+
+// Translate the active C++ exception into a Python exception
+static PyObject* set_python_error() {
+    try {
+        throw;
+    } catch (const std::invalid_argument& e) {
+        PyErr_SetString(PyExc_ValueError, e.what());
+    } catch (const std::bad_alloc&) {
+        PyErr_NoMemory();
+    } catch (const std::exception& e) {
+        PyErr_SetString(PyExc_RuntimeError, e.what());
+    }
+    return NULL;
+}
+
+static bool check_initialized(PyHNSWIndex* self) {
+    if (self->index == NULL) {
+        PyErr_SetString(PyExc_RuntimeError, "HNSWIndex is not initialized.");
+        return false;
+    }
+    return true;
+}
+
+// Claim the graph for a call that reads it (write = false) or modifies it; raises RuntimeError
+// instead of waiting when another thread holds it in a conflicting way. Calls that keep the GIL
+// and finish before returning to Python pass hold = false and only check.
+static bool begin_use(PyHNSWIndex* self, bool write, bool hold = true) {
+    if (self->writing || (write && self->readers > 0)) {
+        PyErr_SetString(PyExc_RuntimeError, write ? "HNSWIndex is in use by another thread; inserts cannot "
+                                                    "run alongside queries, saves or other inserts."
+                                                  : "HNSWIndex is being modified by another thread; queries "
+                                                    "cannot run alongside inserts.");
+        return false;
+    }
+    if (hold) {
+        if (write) {
+            self->writing = 1;
+        } else {
+            ++self->readers;
+        }
+    }
+    return true;
+}
+
+static void end_use(PyHNSWIndex* self, bool write) {
+    if (write) {
+        self->writing = 0;
+    } else {
+        --self->readers;
+    }
+}
+
+static int HNSWIndex_init(PyHNSWIndex* self, PyObject* args, PyObject* kwds) {
+    static const char* kwlist[] = {"M", "ef_construction", "ef_search", "seed", "storage", "metric", NULL};
+    Py_ssize_t M = 16;
+    Py_ssize_t ef_construction = 200;
+    Py_ssize_t ef_search = 50;
+    unsigned long long seed = 0;
+    const char* storage = "float32";
+    const char* metric_name = "euclidean";
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|nnnKss", const_cast<char**>(kwlist), &M, &ef_construction,
+                                     &ef_search, &seed, &storage, &metric_name)) {
+        return -1;
+    }
+    if (M < 0 || ef_construction < 0 || ef_search < 0) {
+        PyErr_SetString(PyExc_ValueError, "M, ef_construction and ef_search must be non-negative.");
+        return -1;
+    }
+    metrics::Metric metric;
+    if (!metrics::parse_metric(metric_name, metric)) {
+        PyErr_SetString(PyExc_ValueError, metrics::kUnknownMetric);
+        return -1;
+    }
+    if (!begin_use(self, true, false)) { // Re-initializing deletes the graph
+        return -1;
+    }
+
+    try {
+        void* index = metrics::visit(metric, [&](auto trait) -> void* {
+            return new HNSWIndex<decltype(trait)>(static_cast<size_t>(M), static_cast<size_t>(ef_construction),
+                                                  static_cast<size_t>(ef_search), seed, parse_storage(storage));
+        });
+        destroy_index(self);
+        self->index = index;
+        self->metric = metric;
+    } catch (...) {
+        set_python_error();
+        return -1;
+    }
+    return 0;
+}
+
+static void HNSWIndex_dealloc(PyHNSWIndex* self) {
+    PyTypeObject* type = Py_TYPE(self);
+    destroy_index(self);
+    type->tp_free(reinterpret_cast<PyObject*>(self));
+    Py_DECREF(type);
+}
+
+static PyObject* HNSWIndex_insert(PyHNSWIndex* self, PyObject* args) {
+    PyObject* data;
+
+    if (!PyArg_ParseTuple(args, "O", &data) || !check_initialized(self) || !begin_use(self, true, false)) {
+        return NULL;
+    }
+
+    PyArrayObject* array = as_float_array(data, 1);
+    if (array == NULL) {
+        return NULL;
+    }
+
+    uint32_t id;
+    try {
+        id = with_index(self, [&](auto* index) {
+            return index->insert(static_cast<const float*>(PyArray_DATA(array)),
+                                 static_cast<size_t>(PyArray_SIZE(array)));
+        });
+    } catch (...) {
+        Py_DECREF(array);
+        return set_python_error();
+    }
+    Py_DECREF(array);
+
+    return PyLong_FromUnsignedLong(id);
+}
+
+static PyObject* HNSWIndex_insert_batch(PyHNSWIndex* self, PyObject* args, PyObject* kwds) {
+    static const char* kwlist[] = {"data_points", "num_threads", NULL};
+    PyObject* data;
+    Py_ssize_t num_threads = 0;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|n", const_cast<char**>(kwlist), &data, &num_threads) ||
+        !check_initialized(self)) {
+        return NULL;
+    }
+    if (num_threads < 0) {
+        PyErr_SetString(PyExc_ValueError, "num_threads must be non-negative.");
+        return NULL;
+    }
+
+    PyArrayObject* array = as_float_array(data, 2);
+    if (array == NULL) {
+        return NULL;
+    }
+    if (!begin_use(self, true)) {
+        Py_DECREF(array);
+        return NULL;
+    }
+
+    const size_t rows = static_cast<size_t>(PyArray_DIMS(array)[0]);
+    const size_t cols = static_cast<size_t>(PyArray_DIMS(array)[1]);
+    const float* values = static_cast<const float*>(PyArray_DATA(array));
+    std::exception_ptr error;
+
+    // Linking is the slow part of a build; other Python threads keep running meanwhile
+    Py_BEGIN_ALLOW_THREADS
+    try {
+        with_index(self, [&](auto* index) {
+            index->insert_batch(values, rows, cols, static_cast<size_t>(num_threads));
+        });
+    } catch (...) {
+        error = std::current_exception();
+    }
+    Py_END_ALLOW_THREADS
+    end_use(self, true);
+    Py_DECREF(array);
+
+    if (error) {
+        try {
+            std::rethrow_exception(error);
+        } catch (...) {
+            return set_python_error();
+        }
+    }
+    Py_RETURN_NONE;
+}
+
+// Write up to k neighbours into one output row, padding with -1 / inf (-inf for similarities)
+static void write_row(const std::vector<Neighbor>& neighbors, size_t k, metrics::Metric metric, int64_t* ids,
+                      float* distances) {
+    const float pad = metrics::ascending(metric) ? std::numeric_limits<float>::infinity()
+                                                 : -std::numeric_limits<float>::infinity();
+    for (size_t j = 0; j < k; ++j) {
+        const bool found = j < neighbors.size();
+        ids[j] = found ? static_cast<int64_t>(neighbors[j].second) : -1;
+        distances[j] = found ? neighbors[j].first : pad;
+    }
+}
+
+static PyObject* HNSWIndex_knn(PyHNSWIndex* self, PyObject* args, PyObject* kwds) {
+    static const char* kwlist[] = {"query", "k", "ef_search", NULL};
+    PyObject* data;
+    Py_ssize_t k = 1;
+    Py_ssize_t ef_search = 0;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|nn", const_cast<char**>(kwlist), &data, &k, &ef_search) ||
+        !check_initialized(self) || !begin_use(self, false, false)) {
+        return NULL;
+    }
+    if (k < 0 || ef_search < 0) {
+        PyErr_SetString(PyExc_ValueError, "k and ef_search must be non-negative.");
+        return NULL;
+    }
+
+    PyArrayObject* array = as_float_array(data, 1);
+    if (array == NULL) {
+        return NULL;
+    }
+
+    std::vector<Neighbor> neighbors;
+    try {
+        neighbors = with_index(self, [&](auto* index) {
+            stats::QueryScope scope(index->query_stats(), true);
+            return index->knn(static_cast<const float*>(PyArray_DATA(array)), static_cast<size_t>(PyArray_SIZE(array)),
+                              static_cast<size_t>(k), static_cast<size_t>(ef_search));
+        });
+    } catch (...) {
+        Py_DECREF(array);
+        return set_python_error();
+    }
+    Py_DECREF(array);
+
+    npy_intp dims[1] = {static_cast<npy_intp>(neighbors.size())};
+    PyObject* ids = PyArray_SimpleNew(1, dims, NPY_INT64);
+    PyObject* distances = PyArray_SimpleNew(1, dims, NPY_FLOAT);
+    if (ids == NULL || distances == NULL) {
+        Py_XDECREF(ids);
+        Py_XDECREF(distances);
+        return NULL;
+    }
+    write_row(neighbors, neighbors.size(), self->metric,
+              static_cast<int64_t*>(PyArray_DATA(reinterpret_cast<PyArrayObject*>(ids))),
+              static_cast<float*>(PyArray_DATA(reinterpret_cast<PyArrayObject*>(distances))));
+    return Py_BuildValue("(NN)", ids, distances);
+}
+
+static PyObject* HNSWIndex_knn_batch(PyHNSWIndex* self, PyObject* args, PyObject* kwds) {
+    static const char* kwlist[] = {"queries", "k", "ef_search", "num_threads", NULL};
+    PyObject* data;
+    Py_ssize_t k;
+    Py_ssize_t ef_search = 0;
+    Py_ssize_t num_threads = 0;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "On|nn", const_cast<char**>(kwlist), &data, &k, &ef_search,
+                                     &num_threads) ||
+        !check_initialized(self)) {
+        return NULL;
+    }
+    if (k < 0 || ef_search < 0 || num_threads < 0) {
+        PyErr_SetString(PyExc_ValueError, "k, ef_search and num_threads must be non-negative.");
+        return NULL;
+    }
+
+    PyArrayObject* array = as_float_array(data, 2);
+    if (array == NULL) {
+        return NULL;
+    }
+    const size_t rows = static_cast<size_t>(PyArray_DIMS(array)[0]);
+    const size_t cols = static_cast<size_t>(PyArray_DIMS(array)[1]);
+    npy_intp dims[2] = {static_cast<npy_intp>(rows), static_cast<npy_intp>(k)};
+    PyObject* ids = PyArray_SimpleNew(2, dims, NPY_INT64);
+    PyObject* distances = PyArray_SimpleNew(2, dims, NPY_FLOAT);
+    if (ids == NULL || distances == NULL || !begin_use(self, false)) {
+        Py_XDECREF(ids);
+        Py_XDECREF(distances);
+        Py_DECREF(array);
+        return NULL;
+    }
+
+    const float* queries = static_cast<const float*>(PyArray_DATA(array));
+    int64_t* id_data = static_cast<int64_t*>(PyArray_DATA(reinterpret_cast<PyArrayObject*>(ids)));
+    float* distance_data = static_cast<float*>(PyArray_DATA(reinterpret_cast<PyArrayObject*>(distances)));
+    const size_t count = static_cast<size_t>(k);
+    std::exception_ptr error;
+
+    // Queries only read the graph and write disjoint output rows
+    Py_BEGIN_ALLOW_THREADS
+    try {
+        with_index(self, [&](const auto* index) {
+            ThreadPool::instance().parallel_for(rows, static_cast<size_t>(num_threads), [&](size_t q) {
+                stats::QueryScope scope(index->query_stats());
+                write_row(index->knn(queries + q * cols, cols, count, static_cast<size_t>(ef_search)), count,
+                          index->metric(), id_data + q * count, distance_data + q * count);
+            });
+        });
+    } catch (...) {
+        error = std::current_exception();
+    }
+    Py_END_ALLOW_THREADS
+    end_use(self, false);
+    Py_DECREF(array);
+
+    if (error) {
+        Py_DECREF(ids);
+        Py_DECREF(distances);
+        try {
+            std::rethrow_exception(error);
+        } catch (...) {
+            return set_python_error();
+        }
+    }
+    return Py_BuildValue("(NN)", ids, distances);
+}
+
+static PyObject* HNSWIndex_get(PyHNSWIndex* self, PyObject* args) {
+    unsigned int id;
+
+    if (!PyArg_ParseTuple(args, "I", &id) || !check_initialized(self) || !begin_use(self, false, false)) {
+        return NULL;
+    }
+    return with_index(self, [&](const auto* index) -> PyObject* {
+        if (id >= index->size()) {
+            PyErr_SetString(PyExc_IndexError, "Point id is out of range.");
+            return NULL;
+        }
+        npy_intp dims[1] = {static_cast<npy_intp>(index->dimension())};
+        PyObject* vector = PyArray_SimpleNew(1, dims, NPY_FLOAT);
+        if (vector != NULL) {
+            index->vector(id, static_cast<float*>(PyArray_DATA(reinterpret_cast<PyArrayObject*>(vector))));
+        }
+        return vector;
+    });
+}
+
+static PyObject* HNSWIndex_stats(PyHNSWIndex* self, PyObject* args, PyObject* kwds) {
+    if (!check_initialized(self)) {
+        return NULL;
+    }
+    return with_index(self, [&](const auto* index) {
+        return stats_dict::stats_method(index->query_stats(), args, kwds);
+    });
+}
+
+static PyObject* HNSWIndex_last_trace(PyHNSWIndex* self, PyObject* args) {
+    if (!check_initialized(self)) {
+        return NULL;
+    }
+    return with_index(self, [](const auto* index) {
+        return stats_dict::trace(stats::last_trace(index->query_stats()));
+    });
+}
+
+static PyObject* HNSWIndex_get_ef_search(PyHNSWIndex* self, void* closure) {
+    if (!check_initialized(self)) {
+        return NULL;
+    }
+    return PyLong_FromSize_t(with_index(self, [](const auto* index) { return index->search_width(); }));
+}
+
+static int HNSWIndex_set_ef_search(PyHNSWIndex* self, PyObject* value, void* closure) {
+    if (value == NULL) {
+        PyErr_SetString(PyExc_AttributeError, "ef_search cannot be deleted.");
+        return -1;
+    }
+    if (!check_initialized(self)) {
+        return -1;
+    }
+    const Py_ssize_t ef = PyLong_AsSsize_t(value);
+    if (ef == -1 && PyErr_Occurred()) {
+        return -1;
+    }
+    if (ef <= 0) {
+        PyErr_SetString(PyExc_ValueError, "ef_search must be positive.");
+        return -1;
+    }
+    if (!begin_use(self, true, false)) { // Batch queries read it
+        return -1;
+    }
+    with_index(self, [&](auto* index) { index->set_search_width(static_cast<size_t>(ef)); });
+    return 0;
+}
+
+static PyObject* HNSWIndex_get_M(PyHNSWIndex* self, void* closure) {
+    if (!check_initialized(self)) {
+        return NULL;
+    }
+    return PyLong_FromSize_t(with_index(self, [](const auto* index) { return index->max_links(); }));
+}
+
+static PyObject* HNSWIndex_get_ef_construction(PyHNSWIndex* self, void* closure) {
+    if (!check_initialized(self)) {
+        return NULL;
+    }
+    return PyLong_FromSize_t(with_index(self, [](const auto* index) { return index->construction_width(); }));
+}
+
+static PyObject* HNSWIndex_get_storage(PyHNSWIndex* self, void* closure) {
+    if (!check_initialized(self)) {
+        return NULL;
+    }
+    return PyUnicode_FromString(storage_name(with_index(self, [](const auto* index) { return index->storage(); })));
+}
+
+static PyObject* HNSWIndex_get_bytes_per_vector(PyHNSWIndex* self, void* closure) {
+    if (!check_initialized(self)) {
+        return NULL;
+    }
+    return PyLong_FromSize_t(with_index(self, [](const auto* index) { return index->bytes_per_vector(); }));
+}
+
+static PyObject* HNSWIndex_get_metric(PyHNSWIndex* self, void* closure) {
+    if (!check_initialized(self)) {
+        return NULL;
+    }
+    return PyUnicode_FromString(metrics::metric_name(self->metric));
+}
+
+static PyObject* HNSWIndex_save(PyHNSWIndex* self, PyObject* args, PyObject* kwds) {
+    static const char* kwlist[] = {"path", NULL};
+    PyObject* path_obj;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "O&", const_cast<char**>(kwlist), PyUnicode_FSConverter, &path_obj)) {
+        return NULL;
+    }
+    const std::string path(PyBytes_AS_STRING(path_obj));
+    Py_DECREF(path_obj);
+    if (!check_initialized(self) || !begin_use(self, false)) {
+        return NULL;
+    }
+
+    std::exception_ptr error;
+    Py_BEGIN_ALLOW_THREADS
+    try {
+        with_index(self, [&](const auto* index) { index->save(path); });
+    } catch (...) {
+        error = std::current_exception();
+    }
+    Py_END_ALLOW_THREADS
+    end_use(self, false);
+    if (error) {
+        try {
+            std::rethrow_exception(error);
+        } catch (...) {
+            return set_python_error();
+        }
+    }
+    Py_RETURN_NONE;
+}
+
+static PyObject* HNSWIndex_load(PyObject* cls, PyObject* args, PyObject* kwds) {
+    static const char* kwlist[] = {"path", NULL};
+    PyObject* path_obj;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "O&", const_cast<char**>(kwlist), PyUnicode_FSConverter, &path_obj)) {
+        return NULL;
+    }
+    const std::string path(PyBytes_AS_STRING(path_obj));
+    Py_DECREF(path_obj);
+
+    void* index = NULL;
+    metrics::Metric metric = metrics::Metric::Euclidean;
+    std::exception_ptr error;
+    // The upper layers are copied out of the file, so other Python threads may run meanwhile
+    Py_BEGIN_ALLOW_THREADS
+    try {
+        metric = hnsw_metric(path);
+        index = metrics::visit(metric, [&](auto trait) -> void* {
+            return HNSWIndex<decltype(trait)>::load(path).release();
+        });
+    } catch (...) {
+        error = std::current_exception();
+    }
+    Py_END_ALLOW_THREADS
+    if (error) {
+        try {
+            std::rethrow_exception(error);
+        } catch (...) {
+            return set_python_error();
+        }
+    }
+
+    PyTypeObject* type = reinterpret_cast<PyTypeObject*>(cls);
+    PyHNSWIndex* self = reinterpret_cast<PyHNSWIndex*>(type->tp_alloc(type, 0));
+    if (self == NULL) {
+        metrics::visit(metric, [&](auto trait) { delete static_cast<HNSWIndex<decltype(trait)>*>(index); });
+        return NULL;
+    }
+    self->index = index;
+    self->metric = metric;
+    return reinterpret_cast<PyObject*>(self);
+}
+
+static Py_ssize_t HNSWIndex_len(PyHNSWIndex* self) {
+    if (self->index == NULL) {
+        return 0;
+    }
+    if (!begin_use(self, false, false)) {
+        return -1;
+    }
+    return with_index(self, [](const auto* index) { return static_cast<Py_ssize_t>(index->size()); });
+}
+
+static PyMethodDef HNSWIndexMethods[] = {
+    {"insert", (PyCFunction)HNSWIndex_insert, METH_VARARGS, "Insert a data point into the graph and return its id."},
+    {"insert_batch", (PyCFunction)(void (*)(void))HNSWIndex_insert_batch, METH_VARARGS | METH_KEYWORDS,
+     "Insert every row of a 2-D array; ids continue in row order.\n\n"
+     "The GIL is released and rows are linked on num_threads threads (0 uses all). With one thread the\n"
+     "graph depends only on the seed and the insertion order. Other threads may not use the index\n"
+     "meanwhile: their calls raise RuntimeError, as does insert_batch while a knn_batch or save runs."},
+    {"knn", (PyCFunction)(void (*)(void))HNSWIndex_knn, METH_VARARGS | METH_KEYWORDS,
+     "Return (ids, distances) of the approximate k nearest points under the index's metric, nearest first.\n\n"
+     "ef_search overrides the index's search width for this query (0 keeps it); it is never below k."},
+    {"knn_batch", (PyCFunction)(void (*)(void))HNSWIndex_knn_batch, METH_VARARGS | METH_KEYWORDS,
+     "Return (ids, distances) arrays of shape (M, k) for every query row.\n\n"
+     "The GIL is released and queries run on num_threads threads (0 uses all). Missing neighbours are -1 / inf\n"
+     "(-inf for similarity metrics). Queries from several threads may overlap; inserts raise RuntimeError\n"
+     "until they finish."},
+    {"get", (PyCFunction)HNSWIndex_get, METH_VARARGS,
+     "Return the stored vector with the given id as float32 (decoded for float16 and int8 storage)."},
+    {"stats", (PyCFunction)(void (*)(void))HNSWIndex_stats, METH_VARARGS | METH_KEYWORDS,
+     "Return histograms of the per-query counters of knn and knn_batch as a dict.\n\n"
+     "Queries are only counted by builds configured with -Dquery_stats=true; elsewhere 'enabled' is False\n"
+     "and every histogram is empty. Besides 'enabled' and 'queries' there is one histogram per counter:\n"
+     "'latency_ns', 'distances' (points scored), 'visited' (graph nodes expanded), 'candidates' (points\n"
+     "left in the layer-0 search), 'bytes' (vector bytes read) and the phase times 'hash_ns' (preparing\n"
+     "the query), 'probe_ns' (upper layers), 'scan_ns' (layer 0) and 'select_ns'. Each is a dict of\n"
+     "'total', 'mean', 'p50', 'p90', 'p99', 'max' and 'buckets', where buckets[b] counts the queries\n"
+     "whose value has b bits. reset=True clears the counters once they are read."},
+    {"last_trace", (PyCFunction)HNSWIndex_last_trace, METH_NOARGS,
+     "Return the counters of the last knn() this thread ran on the index as a dict with the keys of\n"
+     "stats(), or None when there is none or queries are not counted."},
+    {"save", (PyCFunction)(void (*)(void))HNSWIndex_save, METH_VARARGS | METH_KEYWORDS,
+     "Write the graph and its vectors to path in the versioned on-disk index format."},
+    {"load", (PyCFunction)(void (*)(void))HNSWIndex_load, METH_VARARGS | METH_KEYWORDS | METH_CLASS,
+     "Open a graph written by save(). Vectors and layer 0 are memory-mapped read-only; "
+     "the upper layers are copied into memory."},
+    {NULL, NULL, 0, NULL}
+};
+
+static PyGetSetDef HNSWIndexGetSet[] = {
+    {"ef_search", (getter)HNSWIndex_get_ef_search, (setter)HNSWIndex_set_ef_search,
+     "Default search width of queries; larger is slower and more accurate.", NULL},
+    {"M", (getter)HNSWIndex_get_M, NULL, "Links per point on the upper layers (twice as many on layer 0).", NULL},
+    {"ef_construction", (getter)HNSWIndex_get_ef_construction, NULL, "Search width used while inserting.", NULL},
+    {"storage", (getter)HNSWIndex_get_storage, NULL, "Element type of the stored vectors.", NULL},
+    {"bytes_per_vector", (getter)HNSWIndex_get_bytes_per_vector, NULL,
+     "Bytes stored per vector, 0 until the first insert.", NULL},
+    {"metric", (getter)HNSWIndex_get_metric, NULL, "Metric the graph is built and searched with.", NULL},
+    {NULL, NULL, NULL, NULL, NULL}
+};
+
+static PyType_Slot HNSWIndexSlots[] = {
+    {Py_tp_doc, (void*)"HNSWIndex(M=16, ef_construction=200, ef_search=50, seed=0, storage='float32', "
+                        "metric='euclidean')\n\n"
+                        "Hierarchical navigable small-world graph for approximate nearest neighbours.\n"
+                        "Points are inserted incrementally; the dimension is fixed by the first one. storage\n"
+                        "keeps the vectors as 'float32', 'float16' or 'int8' (one byte per value plus a\n"
+                        "per-vector scale and offset); queries are always scored in float32. metric is\n"
+                        "'euclidean', 'sqeuclidean', 'manhattan' or 'hamming' (ascending distances), or 'ip'\n"
+                        "or 'cosine' (descending similarities); the graph is linked by it."},
+    {Py_tp_new, (void*)PyType_GenericNew},
+    {Py_tp_init, (void*)HNSWIndex_init},
+    {Py_tp_dealloc, (void*)HNSWIndex_dealloc},
+    {Py_tp_methods, HNSWIndexMethods},
+    {Py_tp_getset, HNSWIndexGetSet},
+    {Py_sq_length, (void*)HNSWIndex_len},
+    {0, NULL}
+};
+
+static PyType_Spec HNSWIndexSpec = {
+    "hnsw_index.HNSWIndex",
+    sizeof(PyHNSWIndex),
+    0,
+    Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE,
+    HNSWIndexSlots
+};
+
+static struct PyModuleDef hnswmodule = {
+    PyModuleDef_HEAD_INIT,
+    "hnsw_index",   // name of module
+    NULL, // module documentation, may be NULL
+    -1,       // size of per-interpreter state of the module,
+    NULL
+};
+
+PyMODINIT_FUNC PyInit_hnsw_index(void) {
+    import_array();  // Necessary for initializing NumPy API
+    simd::init();    // Pick the distance kernels for this CPU once
+
+    PyObject* module = PyModule_Create(&hnswmodule);
+    if (module == NULL) {
+        return NULL;
+    }
+    PyObject* type = PyType_FromSpec(&HNSWIndexSpec);
+    if (type == NULL || PyModule_AddObject(module, "HNSWIndex", type) < 0) {
+        Py_XDECREF(type);
+        Py_DECREF(module);
+        return NULL;
+    }
+    return module;
+}
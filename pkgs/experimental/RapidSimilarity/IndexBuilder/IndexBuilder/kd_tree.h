@@ -0,0 +1,380 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#include <limits>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <utility>
+#include <future>
+#include <memory>
+#include <string>
+#include <thread>
+
+#include "DistanceMetrics/id_set.h"
+#include "DistanceMetrics/index_io.h"
+#include "DistanceMetrics/metrics.h"
+#include "DistanceMetrics/query_stats.h"
+#include "DistanceMetrics/topk.h"
+#include "DistanceMetrics/simd_kernels.h"
+
+// kd-tree stored as one contiguous array of nodes in implicit (heap) layout: the children of
+// node i are 2i + 1 and 2i + 2. Points are permuted into a single row-major N x D buffer in
+// leaf order, so every leaf is a contiguous bucket of at most leaf_size rows. The three arrays are
+// saved as sections of an index file and viewed in place by load().
+//
+// T is the element type of the points and queries: float halves the memory and bandwidth of the
+// leaf scans, double keeps full precision. The splits do not depend on a metric, so each query
+// picks one of the separable traits of metrics.h (Euclidean, SqEuclidean, Manhattan, Hamming).
+// A tree is immutable once built; DynamicKDTree (dynamic_kd_tree.h) adds inserts and deletes on top
+// of a set of them.
+template <typename T>
+class KDTree {
+public:
+    typedef T value_type;
+    static constexpr size_t npos = static_cast<size_t>(-1);
+
+    // Build from n row-major points of dimension dim. Subtrees near the root are built as
+    // parallel tasks on up to num_threads threads (0 uses every hardware thread). Point i is
+    // reported as labels[i], or as i without labels; id_limit is one past the largest id the
+    // points' owner has handed out (at least the largest label plus one), and is saved with the tree.
+    KDTree(const T* data, size_t n, size_t dim, size_t leaf_size = 32, size_t num_threads = 0,
+           const uint32_t* labels = nullptr, size_t id_limit = 0)
+        : num_points(n), dim(dim), leaf_size(leaf_size), id_limit(std::max(id_limit, labels == nullptr ? n : 0)) {
+        if (leaf_size == 0) {
+            throw std::invalid_argument("Leaf size must be greater than 0.");
+        }
+        if (n > 0 && dim == 0) {
+            throw std::invalid_argument("Points must not be empty.");
+        }
+        if (n > static_cast<size_t>(std::numeric_limits<uint32_t>::max())) {
+            throw std::length_error("KDTree supports at most 2^32 - 1 points.");
+        }
+        if (num_threads == 0) {
+            num_threads = std::max<size_t>(1, std::thread::hardware_concurrency());
+        }
+        build(data, num_threads);
+        if (labels != nullptr) {
+            std::vector<uint32_t>& relabelled = ids.edit();
+            for (uint32_t& id : relabelled) {
+                id = labels[id];
+                this->id_limit = std::max(this->id_limit, static_cast<size_t>(id) + 1);
+            }
+        }
+    }
+
+    typedef std::pair<T, uint32_t> Neighbor; // (metric distance, original index or label)
+
+    // Original index of the point nearest to target, or npos for an empty tree.
+    // Ties are broken towards the smaller original index.
+    size_t nearestNeighbor(const T* target) const {
+        std::vector<Neighbor> nearest = knn(target, 1);
+        return nearest.empty() ? npos : nearest[0].second;
+    }
+
+    // The k nearest points in ascending distance, selected with a bounded max-heap of metric ranks.
+    // Points whose id the filter rejects are skipped before their distance is computed.
+    template <typename Metric = metrics::Euclidean, typename Filter = AcceptAll>
+    std::vector<Neighbor> knn(const T* target, size_t k, const Filter& filter = Filter()) const {
+        TopK<T, uint32_t> best(std::min(k, num_points));
+        collect_knn<Metric>(target, best, filter);
+        std::vector<Neighbor> result = best.take_sorted();
+        for (Neighbor& neighbor : result) {
+            neighbor.first = Metric::value(neighbor.first);
+        }
+        return result;
+    }
+
+    // Every point within distance r of target, in ascending distance
+    template <typename Metric = metrics::Euclidean, typename Filter = AcceptAll>
+    std::vector<Neighbor> radius(const T* target, T r, const Filter& filter = Filter()) const {
+        std::vector<Neighbor> result;
+        if (r >= 0.0) {
+            collect_radius<Metric>(target, Metric::rank_of(r), result, filter);
+        }
+        std::sort(result.begin(), result.end());
+        for (Neighbor& neighbor : result) {
+            neighbor.first = Metric::value(neighbor.first);
+        }
+        return result;
+    }
+
+    // Offer every accepted point to best by metric rank, pruning with best.worst(); lets several
+    // trees fill one selection
+    template <typename Metric, typename Filter = AcceptAll>
+    void collect_knn(const T* target, TopK<T, uint32_t>& best, const Filter& filter = Filter()) const {
+        static_assert(Metric::separable, "kd-tree pruning needs a metric bounded by one coordinate");
+        if (num_points > 0 && best.capacity() > 0) {
+            search_knn<Metric>(0, target, best, filter);
+        }
+    }
+
+    // Append the (rank, id) of every accepted point with rank <= max_rank, unsorted
+    template <typename Metric, typename Filter = AcceptAll>
+    void collect_radius(const T* target, T max_rank, std::vector<Neighbor>& result,
+                        const Filter& filter = Filter()) const {
+        static_assert(Metric::separable, "kd-tree pruning needs a metric bounded by one coordinate");
+        if (num_points > 0) {
+            search_radius<Metric>(0, target, max_rank, result, filter);
+        }
+    }
+
+    // Calls f(id, row) for every point, in leaf order
+    template <typename F>
+    void for_each_point(F&& f) const {
+        for (size_t row = 0; row < num_points; ++row) {
+            f(ids[row], points.data() + row * dim);
+        }
+    }
+
+    size_t size() const { return num_points; }
+    size_t dimension() const { return dim; }
+    size_t leaf_capacity() const { return leaf_size; }
+    size_t id_bound() const { return id_limit; }
+
+    void save(const std::string& path) const {
+        index_io::Writer writer(path, index_io::Kind::KDTree);
+        writer.write(std::vector<uint64_t>{num_points, dim, leaf_size, levels, sizeof(T), id_limit});
+        writer.write(nodes);
+        writer.write(points);
+        writer.write(ids);
+        writer.commit();
+    }
+
+    // Map a saved tree read-only; its nodes, points and ids are used straight from the mapping
+    static std::unique_ptr<KDTree> load(const std::string& path) {
+        index_io::Reader reader(path, index_io::Kind::KDTree);
+        return std::unique_ptr<KDTree>(new KDTree(reader));
+    }
+
+private:
+    struct Node {
+        uint32_t begin;     // First row of the node's range in leaf order
+        uint32_t end;       // One past the last row
+        uint32_t split_dim; // Unused for leaves
+        T split_value; // Rows [begin, mid) are <= split_value and rows [mid, end) are >= split_value
+    };
+    static_assert(sizeof(Node) == 3 * sizeof(uint32_t) + sizeof(T) + (sizeof(T) == 8 ? 4 : 0),
+                  "KDTree nodes are saved in their in-memory layout");
+
+    size_t num_points;
+    size_t dim;
+    size_t leaf_size;
+    size_t levels = 0;        // Depth of the leaf level
+    size_t id_limit = 0;      // One past the largest id handed out by the tree's owner
+    index_io::Array<Node> nodes;  // (2^(levels + 1) - 1) nodes in implicit layout
+    index_io::Array<T> points;      // Row-major, permuted into leaf order
+    index_io::Array<uint32_t> ids;  // Original index of every row in points
+
+    explicit KDTree(index_io::Reader& reader) {
+        const std::vector<uint64_t> params = reader.vector<uint64_t>(6);
+        if (params[4] != sizeof(T)) {
+            throw std::invalid_argument("KDTree index file holds points of another element type.");
+        }
+        num_points = static_cast<size_t>(params[0]);
+        dim = static_cast<size_t>(params[1]);
+        leaf_size = static_cast<size_t>(params[2]);
+        levels = static_cast<size_t>(params[3]);
+        id_limit = static_cast<size_t>(params[5]);
+        nodes = reader.array<Node>();
+        points = reader.array<T>();
+        ids = reader.array<uint32_t>();
+        if (levels >= 8 * sizeof(size_t) - 1 || nodes.size() != (size_t(2) << levels) - 1 ||
+            points.size() != num_points * dim || ids.size() != num_points ||
+            id_limit > static_cast<size_t>(std::numeric_limits<uint32_t>::max()) + 1) {
+            throw std::invalid_argument("KDTree index file is inconsistent.");
+        }
+        for (uint32_t id : ids) {
+            if (id >= id_limit) {
+                throw std::invalid_argument("KDTree index file is inconsistent.");
+            }
+        }
+        for (size_t node = 0; node < nodes.size(); ++node) {
+            const Node& current = nodes[node];
+            if (current.begin > current.end || current.end > num_points || (!is_leaf(node) && current.split_dim >= dim)) {
+                throw std::invalid_argument("KDTree index file is inconsistent.");
+            }
+        }
+    }
+
+    bool is_leaf(size_t node) const { return node >= (size_t(1) << levels) - 1; }
+
+    // Subtrees smaller than this are always built on the calling thread
+    static constexpr size_t kParallelGrain = 1 << 14;
+
+    void build(const T* data, size_t num_threads) {
+        // Pick the smallest depth whose leaves hold at most leaf_size points
+        levels = 0;
+        while (((num_points + (size_t(1) << levels) - 1) >> levels) > leaf_size) {
+            ++levels;
+        }
+        nodes = std::vector<Node>((size_t(2) << levels) - 1, Node{0, 0, 0, T(0)});
+
+        std::vector<uint32_t> order(num_points);
+        std::iota(order.begin(), order.end(), 0u);
+        // Fork one task per subtree down to the depth that gives every thread a subtree
+        size_t parallel_depth = 0;
+        while ((size_t(1) << parallel_depth) < num_threads) {
+            ++parallel_depth;
+        }
+        if (num_points > 0) {
+            std::vector<std::pair<T, uint32_t>> keys(num_points);
+            build_node(data, order, keys, 0, 0, num_points, parallel_depth);
+        }
+
+        // Gather the points into leaf order so every leaf scan is sequential
+        std::vector<T> rows(num_points * dim);
+        T* out = rows.data();
+        const size_t chunks = std::min(num_threads, std::max<size_t>(1, num_points / kParallelGrain));
+        std::vector<std::future<void>> gathers;
+        for (size_t chunk = 1; chunk < chunks; ++chunk) {
+            gathers.push_back(std::async(std::launch::async, [this, data, out, &order, chunk, chunks] {
+                gather(data, order, num_points * chunk / chunks, num_points * (chunk + 1) / chunks, out);
+            }));
+        }
+        gather(data, order, 0, num_points / chunks, out);
+        for (auto& task : gathers) {
+            task.get();
+        }
+        points = std::move(rows);
+        ids = std::move(order);
+    }
+
+    void gather(const T* data, const std::vector<uint32_t>& order, size_t begin, size_t end, T* out) const {
+        for (size_t row = begin; row < end; ++row) {
+            std::copy(data + static_cast<size_t>(order[row]) * dim, data + (static_cast<size_t>(order[row]) + 1) * dim,
+                      out + row * dim);
+        }
+    }
+
+    // Split axis with the largest spread (max - min) over the node's rows
+    size_t widest_axis(const T* data, const std::vector<uint32_t>& order, size_t begin, size_t end) const {
+        std::vector<T> low(data + static_cast<size_t>(order[begin]) * dim, data + (static_cast<size_t>(order[begin]) + 1) * dim);
+        std::vector<T> high(low);
+        for (size_t i = begin + 1; i < end; ++i) {
+            const T* point = data + static_cast<size_t>(order[i]) * dim;
+            for (size_t d = 0; d < dim; ++d) {
+                low[d] = std::min(low[d], point[d]);
+                high[d] = std::max(high[d], point[d]);
+            }
+        }
+        size_t axis = 0;
+        for (size_t d = 1; d < dim; ++d) {
+            if (high[d] - low[d] > high[axis] - low[axis]) {
+                axis = d;
+            }
+        }
+        return axis;
+    }
+
+    // Partition order[begin, end) in place around its median; keys holds (coordinate, id) scratch
+    // so the selection runs over a contiguous array instead of strided point rows.
+    // Children are built concurrently while parallel_depth > 0; they own disjoint row ranges and nodes.
+    void build_node(const T* data, std::vector<uint32_t>& order, std::vector<std::pair<T, uint32_t>>& keys,
+                    size_t node, size_t begin, size_t end, size_t parallel_depth) {
+        Node& current = nodes.edit()[node];
+        current.begin = static_cast<uint32_t>(begin);
+        current.end = static_cast<uint32_t>(end);
+        if (is_leaf(node)) {
+            return;
+        }
+
+        const size_t axis = widest_axis(data, order, begin, end);
+        for (size_t i = begin; i < end; ++i) {
+            keys[i] = {data[static_cast<size_t>(order[i]) * dim + axis], order[i]};
+        }
+        const size_t mid = begin + (end - begin) / 2;
+        std::nth_element(keys.begin() + begin, keys.begin() + mid, keys.begin() + end);
+        for (size_t i = begin; i < end; ++i) {
+            order[i] = keys[i].second;
+        }
+
+        current.split_dim = static_cast<uint32_t>(axis);
+        current.split_value = keys[mid].first;
+        const size_t child_depth = parallel_depth > 0 ? parallel_depth - 1 : 0;
+        if (parallel_depth > 0 && end - begin >= kParallelGrain) {
+            auto left = std::async(std::launch::async, [&, node, begin, mid, child_depth] {
+                build_node(data, order, keys, 2 * node + 1, begin, mid, child_depth);
+            });
+            build_node(data, order, keys, 2 * node + 2, mid, end, child_depth);
+            left.get(); // Rethrows anything the task threw
+        } else {
+            build_node(data, order, keys, 2 * node + 1, begin, mid, 0);
+            build_node(data, order, keys, 2 * node + 2, mid, end, 0);
+        }
+    }
+
+    // Counters of a leaf whose accepted points were scored (query_stats.h)
+    void count_scored(size_t scored) const {
+        stats::count(stats::Candidates, scored);
+        stats::count(stats::Distances, scored);
+        stats::count(stats::Bytes, scored * dim * sizeof(T));
+    }
+
+    template <typename Metric, typename Filter>
+    void search_knn(size_t node, const T* target, TopK<T, uint32_t>& best, const Filter& filter) const {
+        const Node& current = nodes[node];
+        stats::count(stats::Visited);
+        if (is_leaf(node)) {
+            size_t scored = 0;
+            for (size_t row = current.begin; row < current.end; ++row) {
+                if (filter(ids[row])) {
+                    best.push(Metric::rank(points.data() + row * dim, target, dim), ids[row]);
+                    ++scored;
+                }
+            }
+            count_scored(scored);
+            return;
+        }
+
+        // Search the half that is more likely to contain the target first
+        const T diff = target[current.split_dim] - current.split_value;
+        const size_t near = diff < 0 ? 2 * node + 1 : 2 * node + 2;
+        const size_t far = diff < 0 ? 2 * node + 2 : 2 * node + 1;
+        search_knn<Metric>(near, target, best, filter);
+        // If the metric ball reaches the splitting plane, search the other side
+        if (Metric::axis_rank(diff) <= best.worst()) {
+            search_knn<Metric>(far, target, best, filter);
+        }
+    }
+
+    template <typename Metric, typename Filter>
+    void search_radius(size_t node, const T* target, T max_rank, std::vector<Neighbor>& result,
+                       const Filter& filter) const {
+        const Node& current = nodes[node];
+        stats::count(stats::Visited);
+        if (is_leaf(node)) {
+            size_t scored = 0;
+            for (size_t row = current.begin; row < current.end; ++row) {
+                if (!filter(ids[row])) {
+                    continue;
+                }
+                T d = Metric::rank(points.data() + row * dim, target, dim);
+                ++scored;
+                if (d <= max_rank) {
+                    result.emplace_back(d, ids[row]);
+                }
+            }
+            count_scored(scored);
+            return;
+        }
+
+        const T diff = target[current.split_dim] - current.split_value;
+        const size_t near = diff < 0 ? 2 * node + 1 : 2 * node + 2;
+        const size_t far = diff < 0 ? 2 * node + 2 : 2 * node + 1;
+        search_radius<Metric>(near, target, max_rank, result, filter);
+        if (Metric::axis_rank(diff) <= max_rank) {
+            search_radius<Metric>(far, target, max_rank, result, filter);
+        }
+    }
+};
+
+// Element size in bytes (4 for float, 8 for double) of a saved tree's points, which picks the
+// KDTree<T> instantiation that can load it
+inline size_t kd_tree_element_size(const std::string& path) {
+    index_io::Reader reader(path, index_io::Kind::KDTree);
+    return static_cast<size_t>(reader.vector<uint64_t>(6)[4]);
+}
@@ -0,0 +1,896 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <random>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <string>
+#include <queue>
+#include <functional>
+#include <mutex>
+#include <utility>
+#include <stdexcept>
+
+#include "compactor.h"
+#include "delta_log.h"
+#include "flat_hash_map.h"
+#include "DistanceMetrics/epoch.h"
+#include "DistanceMetrics/id_set.h"
+#include "DistanceMetrics/index_io.h"
+#include "DistanceMetrics/metrics.h"
+#include "DistanceMetrics/query_stats.h"
+#include "DistanceMetrics/topk.h"
+#include "DistanceMetrics/simd_kernels.h"
+#include "DistanceMetrics/storage.h"
+
+// Hash families supported by LSHIndex
+enum class LSHFamily {
+    SimHash, // Sign of a random Gaussian projection (angular / cosine distance)
+    E2LSH    // Quantized p-stable projection floor((a.x + b) / w) (Euclidean distance)
+};
+
+// Candidates returned by LSHIndex::query; distances are filled only when requested
+struct LSHQueryResult {
+    std::vector<uint32_t> ids;
+    std::vector<float> distances; // Euclidean distance of each id to the query
+};
+
+// Locality-sensitive hash index that keeps its buckets for the lifetime of the object.
+// Points are hashed into num_tables tables; each table key concatenates num_hashes hashes.
+// Vectors are stored in row-major stores (float32, float16 or int8, see storage.h) and buckets
+// hold 32-bit ids; hashing always uses the float32 input.
+//
+// The points live in immutable segments over consecutive ids, each with its own vector store and
+// bucket tables, plus a delta of up to delta_capacity points whose bucket keys are computed at
+// insert time and that queries scan by brute force. A bucket is the concatenation of its lists in
+// the segments and the delta, in id order, cut at bucket_size ids. A background thread turns the
+// delta into a new segment, merged with the trailing segments no larger than the rows it already
+// holds so that a query visits O(log n) segments, and rebuilds the tables of the segments that
+// list deleted ids once a delta's worth of them has accumulated. Deleted ids are tombstoned and
+// skipped before any distance is computed.
+//
+// Reads take no lock: the segment list and the extent of the delta form an immutable version that
+// writers replace with one atomic swap (Versioned, epoch.h), so a query sees exactly the points of
+// the version current when it starts. Inserts, deletes and the swap that ends a compaction are
+// serialized by one mutex that readers never touch; segments are built outside it.
+class LSHIndex {
+public:
+    static constexpr size_t kDefaultDeltaCapacity = 1024;
+
+    LSHIndex(int num_hashes, int bucket_size, int num_tables = 1,
+             LSHFamily family = LSHFamily::SimHash, float bucket_width = 4.0f, uint64_t seed = 0,
+             StorageType storage = StorageType::Float32, size_t delta_capacity = kDefaultDeltaCapacity)
+        : num_hashes(num_hashes), bucket_size(bucket_size), num_tables(num_tables),
+          family(family), bucket_width(bucket_width), generator(seed), storage_type(storage),
+          delta_capacity(delta_capacity), version(empty_version(num_tables)) {
+        if (num_hashes <= 0) {
+            throw std::invalid_argument("Number of hashes must be greater than 0.");
+        }
+        if (num_hashes > kMaxHashes) {
+            throw std::invalid_argument("Number of hashes per table must be at most 64.");
+        }
+        if (bucket_size <= 0) {
+            throw std::invalid_argument("Bucket size must be greater than 0.");
+        }
+        if (num_tables <= 0) {
+            throw std::invalid_argument("Number of tables must be greater than 0.");
+        }
+        if (!(bucket_width > 0.0f)) {
+            throw std::invalid_argument("Bucket width must be greater than 0.");
+        }
+        if (delta_capacity == 0) {
+            throw std::invalid_argument("Delta capacity must be greater than 0.");
+        }
+    }
+
+    ~LSHIndex() {
+        compactor.reset(); // Join a running compaction before the segments go away
+    }
+
+    LSHIndex(const LSHIndex&) = delete;
+    LSHIndex& operator=(const LSHIndex&) = delete;
+
+    void insert(const std::vector<float>& data_point) {
+        insert_batch(data_point.data(), 1, data_point.size());
+    }
+
+    // Insert n row-major points of the given dimension, hashing them in one matrix product.
+    // Points receive consecutive ids in insertion order. Batches of at least delta_capacity
+    // points are turned into a segment before returning instead of waiting for the background.
+    void insert_batch(const float* data, size_t n, size_t point_dim) {
+        {
+            std::lock_guard<std::mutex> lock(write_mutex);
+            check_dimension(point_dim);
+            const Version& current = version.latest();
+            if (current.id_bound() + n > static_cast<size_t>(std::numeric_limits<uint32_t>::max())) {
+                throw std::length_error("LSHIndex supports at most 2^32 - 1 points.");
+            }
+            const size_t num_rows = projection_rows();
+            std::vector<float> projected(n * num_rows);
+            project_batch(data, n, projected.data());
+            std::vector<uint64_t> keys(n * num_tables);
+            for (size_t p = 0; p < n; ++p) {
+                for (int t = 0; t < num_tables; ++t) {
+                    keys[p * num_tables + t] = table_key(t, projected.data() + p * num_rows);
+                }
+            }
+            std::unique_ptr<Version> next(new Version(current));
+            if (next->dim == 0) {
+                next->dim = dim;
+                next->rows = DeltaLog<float>(dim);
+            }
+            next->rows.append(data, n);
+            next->keys.append(keys.data(), n);
+            const size_t pending = next->keys.size();
+            version.publish(std::move(next));
+            if (n < delta_capacity) {
+                if (pending >= delta_capacity) {
+                    request_compaction();
+                }
+                return;
+            }
+        }
+        std::lock_guard<std::mutex> serial(compaction_mutex);
+        compact_step(false, std::numeric_limits<size_t>::max());
+    }
+
+    // Tombstone id; returns false when it was never inserted or is already deleted
+    bool remove(uint32_t id) {
+        std::lock_guard<std::mutex> lock(write_mutex);
+        const Version& current = version.latest();
+        if (id >= current.id_bound() || !dead.set(id)) {
+            return false;
+        }
+        if (id < current.delta_first && ++stale >= delta_capacity) {
+            request_compaction();
+        }
+        return true;
+    }
+
+    bool contains(uint32_t id) const { return id < version.read()->id_bound() && !dead.test(id); }
+
+    // Merge the delta and every segment into one segment whose buckets list no deleted id,
+    // waiting for a background compaction that is already running
+    void compact() {
+        std::lock_guard<std::mutex> serial(compaction_mutex);
+        compact_step(true, 1);
+    }
+
+    // Return the distinct ids sharing a bucket with the query in any table, in ascending order.
+    // With probes > 0 the `probes` most likely neighbouring buckets are visited as well. Distances
+    // are values of the metric trait Metric (metrics.h); the buckets do not depend on it.
+    // Deleted ids, and ids that filter rejects (see IdFilter in id_set.h), are never returned.
+    template <typename Metric = metrics::Euclidean, typename Filter = AcceptAll>
+    LSHQueryResult query(const float* point, size_t point_dim, bool with_distances = false, int probes = 0,
+                         const Filter& filter = Filter()) const {
+        const auto snapshot = version.read();
+        LSHQueryResult result;
+        result.ids = candidates(*snapshot, point, point_dim, probes, filter);
+        if (with_distances && !result.ids.empty()) {
+            stats::PhaseTimer phase(stats::Scan);
+            stats::count(stats::Candidates, result.ids.size());
+            result.distances.resize(result.ids.size());
+            Scorer(*snapshot, point).rank<Metric>(result.ids, result.distances.data());
+            for (float& distance : result.distances) {
+                distance = Metric::value(distance);
+            }
+        }
+        return result;
+    }
+
+    template <typename Metric = metrics::Euclidean>
+    LSHQueryResult query(const std::vector<float>& data_point, bool with_distances = false, int probes = 0) const {
+        return query<Metric>(data_point.data(), data_point.size(), with_distances, probes);
+    }
+
+    // The k candidates accepted by filter nearest to the query by the exact metric, nearest first
+    // (ascending distances or descending similarities)
+    template <typename Metric = metrics::Euclidean, typename Filter = AcceptAll>
+    std::vector<std::pair<float, uint32_t>> knn(const float* point, size_t point_dim, size_t k, int probes = 0,
+                                                const Filter& filter = Filter()) const {
+        const auto snapshot = version.read();
+        const std::vector<uint32_t> ids = candidates(*snapshot, point, point_dim, probes, filter);
+        TopK<float, uint32_t> best(k);
+        if (ids.empty()) {
+            return best.take_sorted();
+        }
+        stats::PhaseTimer phase(stats::Scan);
+        stats::count(stats::Candidates, ids.size());
+        std::vector<float> ranks(ids.size());
+        Scorer(*snapshot, point).rank<Metric>(ids, ranks.data());
+        phase.next(stats::Select);
+        for (size_t i = 0; i < ids.size(); ++i) {
+            best.push(ranks[i], ids[i]);
+        }
+        std::vector<std::pair<float, uint32_t>> result = best.take_sorted();
+        for (auto& neighbor : result) {
+            neighbor.first = Metric::value(neighbor.first);
+        }
+        return result;
+    }
+
+    // Stored vector of the given live id as float32 into out (dim values)
+    void vector(uint32_t id, float* out) const {
+        const auto snapshot = version.read();
+        if (id >= snapshot->id_bound() || dead.test(id)) {
+            throw std::out_of_range("No live point has this id.");
+        }
+        if (id >= snapshot->delta_first) {
+            const float* row = snapshot->rows.row(id - snapshot->delta_first);
+            std::copy(row, row + snapshot->dim, out);
+        } else {
+            const Segment& segment = snapshot->segment_of(id);
+            segment.vectors->decode(id - segment.first, out);
+        }
+    }
+
+    // Number of live points; ids run up to id_bound(), deleted ones included
+    size_t size() const { return version.read()->id_bound() - dead.count(); }
+
+    size_t id_bound() const { return version.read()->id_bound(); }
+
+    size_t dimension() const { return version.read()->dim; }
+
+    StorageType storage() const { return storage_type; }
+
+    size_t bytes_per_vector() const { return VectorStore::bytes_per_row(storage_type, dimension()); }
+
+    // Points inserted but not yet merged into a segment
+    size_t delta_size() const { return version.read()->keys.size(); }
+
+    // Counters of the queries run under a stats::QueryScope on this index (query_stats.h)
+    stats::QueryStats& query_stats() const { return query_stats_; }
+
+    // Sections: parameters, generator state, projections, offsets, vector store, tombstones, then
+    // per table its bucket keys, their posting-list numbers and the posting lists in CSR form. The
+    // index is compacted into one segment first.
+    void save(const std::string& path) {
+        std::lock_guard<std::mutex> serial(compaction_mutex);
+        compact_step(true, 1);
+        std::lock_guard<std::mutex> lock(write_mutex);
+        const Version& current = version.latest();
+        const IdBitmap tombstones = dead.snapshot(current.id_bound());
+        std::shared_ptr<const Segment> segment;
+        if (current.segments.size() > 1 || !current.keys.empty()) { // Inserted since the compaction
+            segment = build_segment(current.segments, current, current.keys.size(), tombstones);
+        } else if (!current.segments.empty()) {
+            segment = current.segments[0];
+        }
+        index_io::Writer writer(path, index_io::Kind::LSH);
+        writer.write(std::vector<uint64_t>{static_cast<uint64_t>(num_hashes), static_cast<uint64_t>(bucket_size),
+                                           static_cast<uint64_t>(num_tables), static_cast<uint64_t>(family), dim,
+                                           current.id_bound()});
+        writer.write(std::vector<float>{bucket_width});
+        writer.write_text(index_io::engine_state(generator));
+        writer.write(projections);
+        writer.write(offsets);
+        (segment ? *segment->vectors : VectorStore(storage_type)).save(writer);
+        writer.write(tombstones.words());
+        for (int t = 0; t < num_tables; ++t) {
+            std::vector<uint64_t> keys;
+            std::vector<uint32_t> lists;
+            std::vector<uint64_t> list_offsets(1, 0);
+            std::vector<uint32_t> list_ids;
+            if (segment) {
+                const Table& table = segment->tables[t];
+                table.buckets.for_each([&](uint64_t key, uint32_t list) {
+                    keys.push_back(key);
+                    lists.push_back(list);
+                });
+                for (const auto& bucket : table.postings) {
+                    list_ids.insert(list_ids.end(), bucket.begin(), bucket.end());
+                    list_offsets.push_back(list_ids.size());
+                }
+            }
+            writer.write(keys);
+            writer.write(lists);
+            writer.write(list_offsets);
+            writer.write(list_ids);
+        }
+        writer.commit();
+    }
+
+    // Map a saved index. The stored vectors and projections are used straight from the mapping
+    // until a compaction copies them into a new segment; the bucket tables are rebuilt in memory.
+    static std::unique_ptr<LSHIndex> load(const std::string& path, size_t delta_capacity = kDefaultDeltaCapacity) {
+        index_io::Reader reader(path, index_io::Kind::LSH);
+        return std::unique_ptr<LSHIndex>(new LSHIndex(reader, delta_capacity));
+    }
+
+private:
+    // Packed bucket key -> index of the bucket's posting list of ids
+    struct Table {
+        FlatHashMap<uint32_t> buckets;
+        std::vector<std::vector<uint32_t>> postings;
+    };
+
+    // Immutable run of the ids [first, first + vectors->size()); tables list them in id order
+    struct Segment {
+        size_t first = 0;
+        std::shared_ptr<const VectorStore> vectors; // Shared with the segment this one purged
+        std::vector<Table> tables;
+    };
+
+    // What a query sees: the segments in id order, then the delta, which holds ids
+    // [delta_first, id_bound()) as float32 rows and num_tables bucket keys per row
+    struct Version {
+        std::vector<std::shared_ptr<const Segment>> segments;
+        DeltaLog<float> rows;
+        DeltaLog<uint64_t> keys;
+        size_t delta_first = 0;
+        size_t dim = 0;
+
+        explicit Version(size_t num_tables = 0) : keys(num_tables) {}
+
+        size_t id_bound() const { return delta_first + keys.size(); }
+
+        // Segment holding id, which must be below delta_first
+        const Segment& segment_of(size_t id) const {
+            auto it = std::upper_bound(segments.begin(), segments.end(), id,
+                                       [](size_t value, const auto& segment) { return value < segment->first; });
+            return **(it - 1);
+        }
+    };
+
+    // Exact ranks of one query against the ids of a version. The ids of each segment are scored
+    // in one batch that prefetches the rows ahead (VectorStore::rank_batch).
+    class Scorer {
+    public:
+        Scorer(const Version& state, const float* point)
+            : state_(state), point_(point),
+              prepared_(state.segments.empty() ? VectorStore::Query()
+                                               : state.segments[0]->vectors->prepare(point)) {}
+
+        // Ranks of the ascending ids into out
+        template <typename Metric>
+        void rank(const std::vector<uint32_t>& ids, float* out) const {
+            size_t i = 0;
+            for (const auto& segment : state_.segments) {
+                const size_t end = segment->first + segment->vectors->size();
+                const size_t begin = i;
+                while (i < ids.size() && ids[i] < end) {
+                    ++i;
+                }
+                if (i > begin) {
+                    segment->vectors->template rank_batch<Metric>(prepared_, ids.data() + begin, i - begin,
+                                                                  segment->first, out + begin);
+                }
+            }
+            stats::count(stats::Distances, ids.size() - i); // The stores count their own
+            stats::count(stats::Bytes, (ids.size() - i) * state_.dim * sizeof(float));
+            for (; i < ids.size(); ++i) {
+                out[i] = Metric::rank(point_, state_.rows.row(ids[i] - state_.delta_first), state_.dim);
+            }
+        }
+
+    private:
+        const Version& state_;
+        const float* point_;
+        VectorStore::Query prepared_;
+    };
+
+    int num_hashes;
+    int bucket_size;
+    int num_tables;
+    LSHFamily family;
+    float bucket_width;
+    std::mt19937_64 generator; // Shared by every hash function so each one is distinct
+    // Fixed by the first inserted point before any version holds it, and read only after that
+    size_t dim = 0;
+    StorageType storage_type;
+    // Row-major (num_tables * num_hashes) x dim projection matrix; row t * num_hashes + i is hash i of table t
+    index_io::Array<float> projections;
+    index_io::Array<float> offsets; // Per-row E2LSH offsets b in [0, bucket_width)
+    size_t delta_capacity;
+    AtomicIdBitmap dead;          // Tombstones over ids [0, id_bound())
+    size_t stale = 0;             // Tombstoned ids still listed in some bucket; guarded by write_mutex
+    Versioned<Version> version;
+    std::mutex write_mutex;       // Serializes inserts, deletes and version swaps; readers never take it
+    std::mutex compaction_mutex;  // Serializes compaction steps
+    std::unique_ptr<Compactor> compactor;
+    mutable stats::QueryStats query_stats_;
+
+    // Projection rows kept hot in L1 while a block of points streams past them
+    static constexpr size_t kRowBlock = 16;
+    static constexpr size_t kPointBlock = 4;
+    static constexpr int kMaxHashes = 64; // Hashes per table; one bucket key holds 64 SimHash bits
+
+    size_t projection_rows() const { return static_cast<size_t>(num_tables) * num_hashes; }
+
+    static std::unique_ptr<const Version> empty_version(int num_tables) {
+        return std::unique_ptr<const Version>(new Version(num_tables > 0 ? static_cast<size_t>(num_tables) : 0));
+    }
+
+    LSHIndex(index_io::Reader& reader, size_t delta_capacity)
+        : delta_capacity(delta_capacity), version(empty_version(0)) {
+        if (delta_capacity == 0) {
+            throw std::invalid_argument("Delta capacity must be greater than 0.");
+        }
+        const std::vector<uint64_t> params = reader.vector<uint64_t>(6);
+        num_hashes = static_cast<int>(params[0]);
+        bucket_size = static_cast<int>(params[1]);
+        num_tables = static_cast<int>(params[2]);
+        family = static_cast<LSHFamily>(params[3]);
+        dim = static_cast<size_t>(params[4]);
+        const size_t num_points = static_cast<size_t>(params[5]);
+        bucket_width = reader.vector<float>(1)[0];
+        index_io::restore_engine(generator, reader.text());
+        if (num_hashes <= 0 || num_hashes > kMaxHashes || bucket_size <= 0 || num_tables <= 0 ||
+            (family != LSHFamily::SimHash && family != LSHFamily::E2LSH) || !(bucket_width > 0.0f)) {
+            throw std::invalid_argument("LSH index file is inconsistent.");
+        }
+        projections = reader.array<float>();
+        offsets = reader.array<float>();
+        auto segment = std::make_shared<Segment>();
+        auto vectors = std::make_shared<VectorStore>(reader);
+        storage_type = vectors->type();
+        const IdBitmap tombstones =
+            IdBitmap::from_words(reader.vector<uint64_t>((num_points + 63) / 64), num_points);
+        const size_t rows = dim == 0 ? 0 : projection_rows();
+        if (projections.size() != rows * dim || offsets.size() != rows || vectors->size() != num_points ||
+            (num_points > 0 && vectors->dimension() != dim)) {
+            throw std::invalid_argument("LSH index file is inconsistent.");
+        }
+        segment->vectors = std::move(vectors);
+
+        segment->tables.resize(static_cast<size_t>(num_tables));
+        for (Table& table : segment->tables) {
+            const std::vector<uint64_t> keys = reader.vector<uint64_t>();
+            const std::vector<uint32_t> lists = reader.vector<uint32_t>(keys.size());
+            const std::vector<uint64_t> list_offsets = reader.vector<uint64_t>(keys.size() + 1);
+            const std::vector<uint32_t> list_ids = reader.vector<uint32_t>(list_offsets.back());
+            table.postings.resize(keys.size());
+            for (size_t l = 0; l < keys.size(); ++l) {
+                if (lists[l] >= keys.size() || list_offsets[l] > list_offsets[l + 1] ||
+                    !table.buckets.try_emplace(keys[l], lists[l]).second) {
+                    throw std::invalid_argument("LSH index file is inconsistent.");
+                }
+            }
+            for (size_t list = 0; list < keys.size(); ++list) {
+                table.postings[list].assign(list_ids.begin() + list_offsets[list], list_ids.begin() + list_offsets[list + 1]);
+            }
+        }
+        IdBitmap listed;
+        for (const Table& table : segment->tables) {
+            for (const auto& bucket : table.postings) {
+                for (uint32_t id : bucket) {
+                    if (id >= num_points) {
+                        throw std::invalid_argument("LSH index file is inconsistent.");
+                    }
+                    if (tombstones.test(id) && listed.set(id)) {
+                        ++stale;
+                    }
+                }
+            }
+        }
+        dead.assign(tombstones);
+
+        std::unique_ptr<Version> loaded(new Version(static_cast<size_t>(num_tables)));
+        loaded->rows = DeltaLog<float>(dim);
+        loaded->delta_first = num_points;
+        loaded->dim = dim;
+        if (num_points > 0) {
+            loaded->segments.push_back(std::move(segment));
+        }
+        version.publish(std::move(loaded));
+    }
+
+    // Called with write_mutex held
+    void request_compaction() {
+        if (!compactor) {
+            compactor.reset(new Compactor([this] {
+                std::lock_guard<std::mutex> serial(compaction_mutex);
+                compact_step(false, delta_capacity);
+            }));
+        }
+        compactor->request();
+    }
+
+    // Distinct live ids accepted by filter sharing a bucket with the query, ascending. Rejected
+    // ids still take their place in the bucket, and so do the tombstoned ids a segment lists.
+    // A point usually sits in the probed bucket of several tables; the thread's VisitedSet keeps
+    // one copy, and a point it already holds is not tested against the tombstones or filter again.
+    template <typename Filter>
+    std::vector<uint32_t> candidates(const Version& state, const float* point, size_t point_dim, int probes,
+                                     const Filter& filter) const {
+        if (point_dim == 0) {
+            throw std::invalid_argument("Query point must not be empty.");
+        }
+        if (state.dim == 0) {
+            return {};
+        }
+        if (point_dim != state.dim) {
+            throw std::invalid_argument("Query point dimension does not match the index.");
+        }
+        stats::PhaseTimer phase(stats::Hash);
+        std::vector<float> projected(projection_rows());
+        project(point, projected.data());
+        phase.next(stats::Probe);
+        const size_t pending = state.keys.size();
+        VisitedSet& visited = VisitedSet::local();
+        visited.reset(state.id_bound());
+        const auto collect = [&](uint32_t id) {
+            if (!visited.contains(id) && !dead.test(id) && filter(id)) {
+                visited.insert(id);
+            }
+        };
+        for (const auto& probe : probe_sequence(projected.data(), probes)) {
+            stats::count(stats::Visited); // One bucket, split over the segments and the delta
+            size_t room = static_cast<size_t>(bucket_size);
+            for (size_t s = 0; s < state.segments.size() && room > 0; ++s) {
+                const Table& table = state.segments[s]->tables[probe.first];
+                const uint32_t* list = table.buckets.find(probe.second);
+                if (list != nullptr) {
+                    const auto& bucket = table.postings[*list];
+                    const size_t taken = std::min(room, bucket.size());
+                    for (size_t i = 0; i < taken; ++i) {
+                        collect(bucket[i]);
+                    }
+                    room -= taken;
+                }
+            }
+            // Delta points this bucket will take when they are merged, in id order
+            for (size_t p = 0; p < pending && room > 0; ++p) {
+                const uint32_t id = static_cast<uint32_t>(state.delta_first + p);
+                if (state.keys.row(p)[probe.first] == probe.second && !dead.test(id)) {
+                    collect(id);
+                    --room;
+                }
+            }
+        }
+        return visited.sorted();
+    }
+
+    // Segment over the rows of `sources` (consecutive segments of state) followed by the first
+    // delta_rows rows of the delta, listing the ids that tombstones leaves out in id order up to
+    // bucket_size per bucket. A segment rebuilt on its own shares its vector store.
+    std::shared_ptr<const Segment> build_segment(const std::vector<std::shared_ptr<const Segment>>& sources,
+                                                 const Version& state, size_t delta_rows,
+                                                 const IdBitmap& tombstones) const {
+        auto segment = std::make_shared<Segment>();
+        segment->first = sources.empty() ? state.delta_first : sources[0]->first;
+        if (sources.size() == 1 && delta_rows == 0) {
+            segment->vectors = sources[0]->vectors;
+        } else {
+            auto vectors = std::make_shared<VectorStore>(storage_type);
+            size_t rows = delta_rows;
+            for (const auto& source : sources) {
+                rows += source->vectors->size();
+            }
+            vectors->reserve(rows, state.dim);
+            for (const auto& source : sources) {
+                vectors->append(*source->vectors);
+            }
+            for (size_t r = 0; r < delta_rows; ++r) {
+                vectors->append(state.rows.row(r), 1, state.dim);
+            }
+            segment->vectors = std::move(vectors);
+        }
+        segment->tables.resize(static_cast<size_t>(num_tables));
+        for (int t = 0; t < num_tables; ++t) {
+            Table& table = segment->tables[t];
+            const auto add = [&](uint64_t key, uint32_t id) {
+                const uint32_t next_list = static_cast<uint32_t>(table.postings.size());
+                const uint32_t list = *table.buckets.try_emplace(key, next_list).first;
+                if (list == next_list) {
+                    table.postings.emplace_back();
+                }
+                auto& bucket = table.postings[list];
+                if (bucket.size() < static_cast<size_t>(bucket_size)) { // Maintain bucket size
+                    bucket.push_back(id);
+                }
+            };
+            for (const auto& source : sources) {
+                const Table& from = source->tables[t];
+                from.buckets.for_each([&](uint64_t key, uint32_t list) {
+                    for (uint32_t id : from.postings[list]) {
+                        if (!tombstones.test(id)) {
+                            add(key, id);
+                        }
+                    }
+                });
+            }
+            for (size_t r = 0; r < delta_rows; ++r) {
+                const uint32_t id = static_cast<uint32_t>(state.delta_first + r);
+                if (!tombstones.test(id)) {
+                    add(state.keys.row(r)[t], id);
+                }
+            }
+        }
+        return segment;
+    }
+
+    static bool lists_any(const Segment& segment, const IdBitmap& tombstones) {
+        for (const Table& table : segment.tables) {
+            for (const auto& bucket : table.postings) {
+                for (uint32_t id : bucket) {
+                    if (tombstones.test(id)) {
+                        return true;
+                    }
+                }
+            }
+        }
+        return false;
+    }
+
+    // One compaction; the caller holds compaction_mutex, so the segments and the delta start of
+    // the snapshot are changed by no one else until the swap. The delta becomes a new segment,
+    // merged with the trailing segments no larger than the rows gathered so far, or with every
+    // segment when full is set; once at least min_stale listed ids are tombstoned, every other
+    // segment that lists one is rebuilt as well.
+    void compact_step(bool full, size_t min_stale) {
+        Version state;
+        IdBitmap tombstones;
+        size_t purging;
+        {
+            std::lock_guard<std::mutex> lock(write_mutex);
+            state = version.latest(); // Shares the segments and delta chunks
+            tombstones = dead.snapshot(state.id_bound());
+            purging = stale;
+        }
+        const std::vector<std::shared_ptr<const Segment>>& current = state.segments;
+        const size_t frozen = state.keys.size();
+        const bool purge = purging > 0 && purging >= min_stale;
+        size_t merge_from = full ? 0 : current.size();
+        for (size_t rows = frozen; rows > 0 && merge_from > 0 && current[merge_from - 1]->vectors->size() <= rows;) {
+            rows += current[--merge_from]->vectors->size();
+        }
+        if (full ? current.size() <= 1 && frozen == 0 && !purge : frozen == 0 && !purge) {
+            return; // Nothing to merge, or already one segment without stale ids
+        }
+
+        // The expensive part: built from immutable inputs while queries keep running
+        std::vector<std::shared_ptr<const Segment>> segments;
+        for (size_t s = 0; s < merge_from; ++s) {
+            segments.push_back(purge && lists_any(*current[s], tombstones)
+                                   ? build_segment({current[s]}, state, 0, tombstones)
+                                   : current[s]);
+        }
+        if (merge_from < current.size() || frozen > 0) {
+            const std::vector<std::shared_ptr<const Segment>> merged(current.begin() + merge_from, current.end());
+            segments.push_back(build_segment(merged, state, frozen, tombstones));
+        }
+
+        std::lock_guard<std::mutex> lock(write_mutex);
+        // Points inserted while the segments were built stay in the delta
+        std::unique_ptr<Version> next(new Version(version.latest()));
+        next->segments = std::move(segments);
+        next->rows.drop_front(frozen);
+        next->keys.drop_front(frozen);
+        next->delta_first += frozen;
+        version.publish(std::move(next));
+        if (purge || full) {
+            stale -= purging; // Ids deleted since the snapshot are still listed
+        }
+    }
+
+    void check_dimension(size_t n) {
+        if (n == 0) {
+            throw std::invalid_argument("Data point must not be empty.");
+        }
+        if (dim == 0) {
+            dim = n;
+            generate_projections();
+        } else if (n != dim) {
+            throw std::invalid_argument("Data point dimension does not match the index.");
+        }
+    }
+
+    // Dot product with independent lanes so the loop vectorizes without reassociation flags.
+    // Projections keep this fixed lane order rather than the dispatched kernels so that
+    // project() and project_batch() (dot_1x4) produce bit-identical hash codes.
+    static float dot(const float* a, const float* b, size_t n) {
+        float acc[8] = {0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f};
+        size_t i = 0;
+        for (; i + 8 <= n; i += 8) {
+            for (size_t j = 0; j < 8; ++j) {
+                acc[j] += a[i + j] * b[i + j];
+            }
+        }
+        float sum = ((acc[0] + acc[1]) + (acc[2] + acc[3])) + ((acc[4] + acc[5]) + (acc[6] + acc[7]));
+        for (; i < n; ++i) {
+            sum += a[i] * b[i];
+        }
+        return sum;
+    }
+
+    // One projection row against four points, sharing every load of the row
+    static void dot_1x4(const float* row, const float* const points[kPointBlock], size_t n, float out[kPointBlock]) {
+        float acc[kPointBlock][8] = {};
+        size_t i = 0;
+        for (; i + 8 <= n; i += 8) {
+            for (size_t p = 0; p < kPointBlock; ++p) {
+                for (size_t j = 0; j < 8; ++j) {
+                    acc[p][j] += row[i + j] * points[p][i + j];
+                }
+            }
+        }
+        for (size_t p = 0; p < kPointBlock; ++p) {
+            float sum = ((acc[p][0] + acc[p][1]) + (acc[p][2] + acc[p][3])) +
+                        ((acc[p][4] + acc[p][5]) + (acc[p][6] + acc[p][7]));
+            for (size_t k = i; k < n; ++k) {
+                sum += row[k] * points[p][k];
+            }
+            out[p] = sum;
+        }
+    }
+
+    // Matrix-vector product: out[r] = projections[r] . point
+    void project(const float* point, float* out) const {
+        const size_t num_rows = projection_rows();
+        for (size_t r = 0; r < num_rows; ++r) {
+            out[r] = dot(projections.data() + r * dim, point, dim);
+        }
+    }
+
+    // Matrix-matrix product: out[p * rows + r] = projections[r] . points[p]
+    void project_batch(const float* points, size_t n, float* out) const {
+        const size_t num_rows = projection_rows();
+        for (size_t r0 = 0; r0 < num_rows; r0 += kRowBlock) {
+            const size_t r1 = std::min(num_rows, r0 + kRowBlock);
+            size_t p = 0;
+            for (; p + kPointBlock <= n; p += kPointBlock) {
+                const float* block[kPointBlock];
+                for (size_t b = 0; b < kPointBlock; ++b) {
+                    block[b] = points + (p + b) * dim;
+                }
+                for (size_t r = r0; r < r1; ++r) {
+                    float values[kPointBlock];
+                    dot_1x4(projections.data() + r * dim, block, dim, values);
+                    for (size_t b = 0; b < kPointBlock; ++b) {
+                        out[(p + b) * num_rows + r] = values[b];
+                    }
+                }
+            }
+            for (; p < n; ++p) {
+                for (size_t r = r0; r < r1; ++r) {
+                    out[p * num_rows + r] = dot(projections.data() + r * dim, points + p * dim, dim);
+                }
+            }
+        }
+    }
+
+    // Integer hash of one projection row: a sign bit for SimHash, a quantized slot for E2LSH
+    int hash_value(size_t row, float value) const {
+        if (family == LSHFamily::SimHash) {
+            return value >= 0.0f ? 1 : 0;
+        }
+        return static_cast<int>(std::floor((value + offsets[row]) / bucket_width));
+    }
+
+    // Concatenate the num_hashes hashes of one table into a single 64-bit bucket key
+    uint64_t combine(const int* hashes) const {
+        uint64_t key = 0;
+        for (int i = 0; i < num_hashes; ++i) {
+            if (family == LSHFamily::SimHash) {
+                key |= static_cast<uint64_t>(hashes[i]) << i;
+            } else {
+                key ^= static_cast<uint64_t>(static_cast<uint32_t>(hashes[i])) + 0x9E3779B97F4A7C15ULL + (key << 6) + (key >> 2);
+            }
+        }
+        return key;
+    }
+
+    uint64_t table_key(int table, const float* projected) const {
+        const size_t base = static_cast<size_t>(table) * num_hashes;
+        int hashes[kMaxHashes];
+        for (int i = 0; i < num_hashes; ++i) {
+            hashes[i] = hash_value(base + i, projected[base + i]);
+        }
+        return combine(hashes);
+    }
+
+    // One way to move a hash into a neighbouring bucket, scored by the query's distance to that boundary
+    struct Perturbation {
+        float score;
+        int hash;
+        int delta;
+        bool operator<(const Perturbation& other) const { return score < other.score; }
+    };
+
+    // Set of perturbations (indices into a table's sorted list) waiting to be probed
+    struct ProbeSet {
+        float score;
+        int table;
+        std::vector<uint16_t> members; // Ascending; the last member is the largest index
+        bool operator>(const ProbeSet& other) const { return score > other.score; }
+    };
+
+    // Bucket keys to visit: the home bucket of every table, then up to `probes` neighbouring
+    // buckets across all tables in increasing order of perturbation score (Lv et al., 2007).
+    std::vector<std::pair<int, uint64_t>> probe_sequence(const float* projected, int probes) const {
+        std::vector<std::pair<int, uint64_t>> keys;
+        keys.reserve(num_tables + std::max(probes, 0));
+        std::vector<int> hashes(projection_rows());
+        for (size_t r = 0; r < projection_rows(); ++r) {
+            hashes[r] = hash_value(r, projected[r]);
+        }
+        for (int t = 0; t < num_tables; ++t) {
+            keys.emplace_back(t, combine(hashes.data() + static_cast<size_t>(t) * num_hashes));
+        }
+        if (probes <= 0) {
+            return keys;
+        }
+
+        std::vector<std::vector<Perturbation>> perturbations(num_tables);
+        std::priority_queue<ProbeSet, std::vector<ProbeSet>, std::greater<ProbeSet>> heap;
+        for (int t = 0; t < num_tables; ++t) {
+            auto& candidates = perturbations[t];
+            const size_t base = static_cast<size_t>(t) * num_hashes;
+            for (int i = 0; i < num_hashes; ++i) {
+                const float value = projected[base + i];
+                if (family == LSHFamily::SimHash) {
+                    // Flipping a sign bit costs the squared projection margin
+                    candidates.push_back({value * value, i, hashes[base + i] == 1 ? -1 : 1});
+                } else {
+                    const float position = (value + offsets[base + i]) / bucket_width;
+                    const float below = position - std::floor(position);
+                    candidates.push_back({below * below, i, -1});
+                    candidates.push_back({(1.0f - below) * (1.0f - below), i, 1});
+                }
+            }
+            std::sort(candidates.begin(), candidates.end());
+            heap.push({candidates[0].score, t, {0}});
+        }
+
+        int emitted = 0;
+        int table_hashes[kMaxHashes];
+        while (emitted < probes && !heap.empty()) {
+            ProbeSet set = heap.top();
+            heap.pop();
+            const auto& candidates = perturbations[set.table];
+            const size_t next = static_cast<size_t>(set.members.back()) + 1;
+            if (next < candidates.size()) {
+                ProbeSet shifted = set;
+                shifted.members.back() = static_cast<uint16_t>(next);
+                shifted.score += candidates[next].score - candidates[next - 1].score;
+                ProbeSet expanded = set;
+                expanded.members.push_back(static_cast<uint16_t>(next));
+                expanded.score += candidates[next].score;
+                heap.push(std::move(shifted));
+                heap.push(std::move(expanded));
+            }
+
+            // A set that moves the same hash both ways does not name a bucket
+            const size_t base = static_cast<size_t>(set.table) * num_hashes;
+            std::copy(hashes.begin() + base, hashes.begin() + base + num_hashes, table_hashes);
+            bool valid = true;
+            for (uint16_t member : set.members) {
+                const Perturbation& p = candidates[member];
+                if (table_hashes[p.hash] != hashes[base + p.hash]) {
+                    valid = false;
+                    break;
+                }
+                table_hashes[p.hash] += p.delta;
+            }
+            if (valid) {
+                keys.emplace_back(set.table, combine(table_hashes));
+                ++emitted;
+            }
+        }
+        return keys;
+    }
+
+    void generate_projections() {
+        // Gaussian projections are 2-stable, which is what both families rely on
+        const size_t num_rows = projection_rows();
+        std::normal_distribution<float> distribution(0.0f, 1.0f);
+        std::uniform_real_distribution<float> offset_distribution(0.0f, bucket_width);
+        std::vector<float> matrix(num_rows * dim);
+        std::vector<float> row_offsets(num_rows, 0.0f);
+        for (size_t r = 0; r < num_rows; ++r) {
+            for (size_t i = 0; i < dim; ++i) {
+                matrix[r * dim + i] = distribution(generator);
+            }
+            if (family == LSHFamily::E2LSH) {
+                row_offsets[r] = offset_distribution(generator);
+            }
+        }
+        projections = std::move(matrix);
+        offsets = std::move(row_offsets);
+    }
+};
@@ -0,0 +1,175 @@
+"""Scatter-gather search over an index partitioned into shards.
+
+A ``ShardedIndex`` holds N sub-indexes and answers every query by running it on all of
+them in parallel and merging their top-k lists. A shard is anything with a
+``knn_batch(queries, k, **kwargs)`` method (or ``query_batch``, as ``LSHIndex`` names it)
+that returns ``(ids, distances)`` arrays of shape (M, k) with missing neighbours as -1 and
+inf (-inf for similarities): the in-process ``KDTree``, ``LSHIndex`` and ``HNSWIndex``, or
+a client object that forwards the call to an index on another machine. The built-in
+indexes release the GIL while they search, so in-process shards run on all cores at once.
+"""
+
+import threading
+import time
+from concurrent.futures import ThreadPoolExecutor
+
+import numpy as np
+
+__all__ = ["ShardedIndex"]
+
+_SIMILARITIES = ("ip", "cosine")
+
+_OPS = {
+    "==": np.equal,
+    "!=": np.not_equal,
+    "<": np.less,
+    "<=": np.less_equal,
+    ">": np.greater,
+    ">=": np.greater_equal,
+    "in": np.isin,
+}
+
+
+class ShardedIndex:
+    """Index over shards queried in parallel, with global ids and per-shard latencies.
+
+    ``id_maps[s][i]`` is the global id of local id ``i`` of shard ``s``; without id maps the
+    shards' own ids are returned, which must then be distinct across shards. Queries run on
+    a pool of ``max_workers`` threads (one per shard by default) and keyword arguments are
+    passed through to every shard, e.g. ``metric`` or ``num_threads``; with several
+    in-process shards, ``num_threads`` around ``os.cpu_count() // len(shards)`` avoids
+    running more search threads than cores. A ``filter`` (see the index docs) names global
+    ids and is translated into one bool mask over the local ids of each shard.
+    """
+
+    def __init__(self, shards, id_maps=None, max_workers=None):
+        self.shards = list(shards)
+        if not self.shards:
+            raise ValueError("ShardedIndex needs at least one shard.")
+        if id_maps is not None:
+            id_maps = [np.asarray(ids, dtype=np.int64) for ids in id_maps]
+            if len(id_maps) != len(self.shards):
+                raise ValueError("id_maps needs one id array per shard.")
+        self._id_maps = id_maps
+        self._searches = [
+            getattr(shard, "knn_batch", None) or getattr(shard, "query_batch") for shard in self.shards
+        ]
+        self._pool = ThreadPoolExecutor(max_workers=max_workers or len(self.shards))
+        self._lock = threading.Lock()
+        self._last = np.zeros(len(self.shards))
+        self._total = np.zeros(len(self.shards))
+        self._max = np.zeros(len(self.shards))
+        self._calls = 0
+
+    @classmethod
+    def partition(cls, points, num_shards, factory, max_workers=None):
+        """Split the rows of points round-robin over num_shards shards built by factory(rows).
+
+        Row i gets global id i. factory must return an index whose local ids are the row
+        numbers of the rows it was given, as the built-in indexes do. Shards are built in
+        parallel.
+        """
+        if num_shards <= 0:
+            raise ValueError("Number of shards must be greater than 0.")
+        points = np.asarray(points)
+        id_maps = [np.arange(s, len(points), num_shards, dtype=np.int64) for s in range(num_shards)]
+        with ThreadPoolExecutor(max_workers=max_workers or num_shards) as pool:
+            shards = list(pool.map(lambda ids: factory(points[ids]), id_maps))
+        return cls(shards, id_maps, max_workers)
+
+    def knn_batch(self, queries, k, **kwargs):
+        """Return (ids, distances) arrays of shape (M, k) merged from the k best of every shard.
+
+        Results are nearest first: ascending distances, or descending similarities for
+        metric 'ip' and 'cosine'. Missing neighbours are -1 / inf (-inf for similarities).
+        The wall time of each shard's search is recorded, see shard_latencies().
+        """
+        queries = np.atleast_2d(np.asarray(queries))
+        futures = [
+            self._pool.submit(self._search_shard, s, queries, k, kwargs) for s in range(len(self.shards))
+        ]
+        results = [future.result() for future in futures]
+        latencies = np.array([seconds for _, _, seconds in results])
+        with self._lock:
+            self._last = latencies
+            self._total += latencies
+            self._max = np.maximum(self._max, latencies)
+            self._calls += 1
+
+        ids = np.concatenate([shard_ids for shard_ids, _, _ in results], axis=1)
+        distances = np.concatenate([shard_distances for _, shard_distances, _ in results], axis=1)
+        descending = self._descending(kwargs)
+        # Missing entries are +-inf, so they sort behind every real neighbour
+        order = np.argsort(-distances if descending else distances, axis=1, kind="stable")[:, :k]
+        ids = np.take_along_axis(ids, order, axis=1)
+        distances = np.take_along_axis(distances, order, axis=1)
+        if ids.shape[1] < k:  # Fewer than k slots across all shards
+            missing = k - ids.shape[1]
+            ids = np.pad(ids, ((0, 0), (0, missing)), constant_values=-1)
+            distances = np.pad(distances, ((0, 0), (0, missing)), constant_values=-np.inf if descending else np.inf)
+        return ids, distances
+
+    def knn(self, query, k=1, **kwargs):
+        """Return (ids, distances) of the k nearest points of one query, found points only."""
+        ids, distances = self.knn_batch(np.asarray(query)[None, :], k, **kwargs)
+        found = ids[0] >= 0
+        return ids[0][found], distances[0][found]
+
+    def shard_latencies(self):
+        """Per-shard search wall times in seconds: last, mean and max over every query batch."""
+        with self._lock:
+            calls = max(self._calls, 1)
+            return {"last": self._last.copy(), "mean": self._total / calls, "max": self._max.copy()}
+
+    def close(self):
+        """Stop the query threads; the shards themselves stay usable."""
+        self._pool.shutdown(wait=True)
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *exc):
+        self.close()
+
+    def __len__(self):
+        return sum(len(shard) for shard in self.shards)
+
+    @property
+    def num_shards(self):
+        return len(self.shards)
+
+    def _descending(self, kwargs):
+        metric = kwargs.get("metric", getattr(self.shards[0], "metric", "euclidean"))
+        return metric in _SIMILARITIES
+
+    def _shard_filter(self, s, accept):
+        """Bool mask over the local ids of shard s for a filter over global ids."""
+        id_map = self._id_maps[s]
+        if isinstance(accept, tuple):
+            column, op, value = accept
+            if op not in _OPS:
+                raise ValueError("filter op must be '==', '!=', '<', '<=', '>', '>=' or 'in'.")
+            accept = _OPS[op](np.asarray(column), np.asarray(value) if op == "in" else value)
+        else:
+            accept = np.asarray(accept)
+            if accept.dtype != np.bool_:
+                return np.isin(id_map, accept)
+        mask = np.zeros(len(id_map), dtype=bool)
+        within = id_map < len(accept)  # Ids beyond a mask or column are rejected
+        mask[within] = accept[id_map[within]]
+        return mask
+
+    def _search_shard(self, s, queries, k, kwargs):
+        if self._id_maps is not None and kwargs.get("filter") is not None:
+            kwargs = dict(kwargs, filter=self._shard_filter(s, kwargs["filter"]))
+        start = time.perf_counter()
+        ids, distances = self._searches[s](queries, k, **kwargs)
+        seconds = time.perf_counter() - start
+        ids = np.asarray(ids, dtype=np.int64)
+        distances = np.asarray(distances, dtype=np.float64)
+        if self._id_maps is not None:
+            found = ids >= 0
+            global_ids = np.full_like(ids, -1)
+            global_ids[found] = self._id_maps[s][ids[found]]
+            ids = global_ids
+        return ids, distances, seconds
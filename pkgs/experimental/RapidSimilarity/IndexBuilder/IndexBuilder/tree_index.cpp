@@ -1,148 +1,756 @@
 #include <Python.h>
 #include <numpy/arrayobject.h>
 #include <vector>
-#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <limits>
 #include <memory>
-#include <cmath>
+#include <string>
+#include <exception>
+#include <stdexcept>
+#include <type_traits>
 
-// Class representing a node in the kd-tree
-class KDTreeNode {
-public:
-    std::vector<double> point; // Point in the kd-tree
-    std::unique_ptr<KDTreeNode> left; // Left child
-    std::unique_ptr<KDTreeNode> right; // Right child
+#include "dynamic_kd_tree.h"
+#include "DistanceMetrics/buffer_view.h"
+#include "DistanceMetrics/filter_arg.h"
+#include "DistanceMetrics/query_stats.h"
+#include "DistanceMetrics/stats_dict.h"
+#include "DistanceMetrics/thread_pool.h"
 
-    KDTreeNode(std::vector<double> pt) : point(std::move(pt)), left(nullptr), right(nullptr) {}
-};
+// Python wrapper for KDTree
+static PyObject* py_nearestNeighbor(PyObject* self, PyObject* args) {
+    PyObject* pointsObj;
+    PyObject* targetObj;
 
-// Class for constructing the kd-tree
-class KDTree {
-public:
-    KDTree(std::vector<std::vector<double>> points) : root(buildTree(points, 0)) {}
+    // Parse input
+    if (!PyArg_ParseTuple(args, "OO", &pointsObj, &targetObj)) {
+        return nullptr;
+    }
 
-    // Function to find the nearest neighbor
-    std::vector<double> nearestNeighbor(const std::vector<double>& target) {
-        return nearestNeighborHelper(root.get(), target, 0);
+    // View points and target in place; lists are converted once into a row-major buffer
+    BufferView points;
+    if (!points.acquire(pointsObj, 2, "Points must be a list of lists.")) {
+        return nullptr;
+    }
+    BufferView target;
+    if (!target.acquire(targetObj, 1, "Target must be a list.")) {
+        return nullptr;
+    }
+    const size_t numPoints = points.rows();
+    const size_t numDims = points.cols();
+    if (numPoints > 0 && target.size() != numDims) {
+        PyErr_SetString(PyExc_ValueError, "Target dimension does not match the points.");
+        return nullptr;
     }
 
-private:
-    std::unique_ptr<KDTreeNode> root;
+    // Build the KDTree and find the nearest neighbor
+    std::vector<double> nearest;
+    try {
+        std::vector<double> pointScratch, targetScratch;
+        const double* data = points.data(pointScratch);
+        KDTree<double> tree(data, numPoints, numDims);
+        size_t index = tree.nearestNeighbor(target.data(targetScratch));
+        if (index != KDTree<double>::npos) {
+            nearest.assign(data + index * numDims, data + (index + 1) * numDims);
+        }
+    } catch (const std::exception& e) {
+        PyErr_SetString(PyExc_ValueError, e.what());
+        return nullptr;
+    }
 
-    // Recursive function to build the kd-tree
-    std::unique_ptr<KDTreeNode> buildTree(std::vector<std::vector<double>>& points, int depth) {
-        if (points.empty()) return nullptr;
+    // Convert result back to Python list
+    PyObject* result = PyList_New(nearest.size());
+    for (size_t i = 0; i < nearest.size(); ++i) {
+        PyList_SetItem(result, i, PyFloat_FromDouble(nearest[i]));
+    }
 
-        // Select axis based on depth so that we cycle through all dimensions
-        size_t axis = depth % points[0].size();
+    return result;
+}
 
-        // Sort points by the selected axis
-        std::sort(points.begin(), points.end(), [axis](const std::vector<double>& a, const std::vector<double>& b) {
-            return a[axis] < b[axis];
-        });
+// Python object owning one DynamicKDTree built at construction time; exactly one of the two trees is set
+typedef struct {
+    PyObject_HEAD
+    DynamicKDTree<double>* tree;   // float64 storage
+    DynamicKDTree<float>* tree32;  // float32 storage
+} PyKDTree;
 
-        // Choose median as root
-        size_t median = points.size() / 2;
-        auto node = std::make_unique<KDTreeNode>(points[median]);
+// Calls f with whichever typed tree the object holds
+template <typename F>
+static auto with_tree(PyKDTree* self, F&& f) -> decltype(f(self->tree)) {
+    return self->tree32 != nullptr ? f(self->tree32) : f(self->tree);
+}
 
-        // Recursively build the left and right subtrees
-        std::vector<std::vector<double>> leftPoints(points.begin(), points.begin() + median);
-        std::vector<std::vector<double>> rightPoints(points.begin() + median + 1, points.end());
-        node->left = buildTree(leftPoints, depth + 1);
-        node->right = buildTree(rightPoints, depth + 1);
+static bool check_initialized(PyKDTree* self) {
+    if (self->tree == nullptr && self->tree32 == nullptr) {
+        PyErr_SetString(PyExc_RuntimeError, "KDTree is not initialized.");
+        return false;
+    }
+    return true;
+}
 
-        return node;
+// Parse a query metric, accepting only those a kd-tree can prune on; sets ValueError otherwise
+static bool parse_tree_metric(const char* name, metrics::Metric& metric) {
+    if (!metrics::parse_metric(name, metric) || !metrics::separable(metric)) {
+        PyErr_SetString(PyExc_ValueError, "metric must be 'euclidean', 'sqeuclidean', 'manhattan' or 'hamming'.");
+        return false;
     }
+    return true;
+}
 
-    // Recursive function to find the nearest neighbor
-    std::vector<double> nearestNeighborHelper(KDTreeNode* node, const std::vector<double>& target, int depth) {
-        if (node == nullptr) return {};
+// Calls f with the trait of a metric accepted by parse_tree_metric
+template <typename F>
+static auto with_metric(metrics::Metric metric, F&& f) -> decltype(f(metrics::Euclidean())) {
+    switch (metric) {
+        case metrics::Metric::SqEuclidean: return f(metrics::SqEuclidean());
+        case metrics::Metric::Manhattan: return f(metrics::Manhattan());
+        case metrics::Metric::Hamming: return f(metrics::Hamming());
+        default: return f(metrics::Euclidean());
+    }
+}
 
-        size_t axis = depth % target.size();
-        std::vector<double> bestPoint = node->point;
-        double bestDist = distance(bestPoint, target);
+// numpy type of the tree's elements
+static int element_type(const DynamicKDTree<double>*) { return NPY_DOUBLE; }
+static int element_type(const DynamicKDTree<float>*) { return NPY_FLOAT; }
 
-        // Search the corresponding subtree
-        KDTreeNode* nextNode = (target[axis] < node->point[axis]) ? node->left.get() : node->right.get();
-        std::vector<double> candidate = nearestNeighborHelper(nextNode, target, depth + 1);
-        if (!candidate.empty()) {
-            double candidateDist = distance(candidate, target);
-            if (candidateDist < bestDist) {
-                bestPoint = candidate;
-                bestDist = candidateDist;
-            }
+// Convert any array-like into a contiguous array of the given type and rank
+static PyArrayObject* as_typed_array(PyObject* data, int ndim, int typenum) {
+    PyArrayObject* array = reinterpret_cast<PyArrayObject*>(
+        PyArray_FROM_OTF(data, typenum, NPY_ARRAY_IN_ARRAY));
+    if (array == nullptr) {
+        return nullptr;
+    }
+    if (PyArray_NDIM(array) != ndim) {
+        Py_DECREF(array);
+        PyErr_Format(PyExc_ValueError, "Input must be a %d-dimensional array.", ndim);
+        return nullptr;
+    }
+    return array;
+}
+
+// Translate the active C++ exception into a Python exception
+static PyObject* set_python_error() {
+    try {
+        throw;
+    } catch (const std::invalid_argument& e) {
+        PyErr_SetString(PyExc_ValueError, e.what());
+    } catch (const std::bad_alloc&) {
+        PyErr_NoMemory();
+    } catch (const std::exception& e) {
+        PyErr_SetString(PyExc_RuntimeError, e.what());
+    }
+    return nullptr;
+}
+
+// Convert neighbors into an (indices int64 array, distances float64 array) tuple
+template <typename Neighbor>
+static PyObject* neighbors_to_python(const std::vector<Neighbor>& neighbors) {
+    npy_intp dims[1] = {static_cast<npy_intp>(neighbors.size())};
+    PyObject* indices = PyArray_SimpleNew(1, dims, NPY_INT64);
+    PyObject* distances = PyArray_SimpleNew(1, dims, NPY_DOUBLE);
+    if (indices == nullptr || distances == nullptr) {
+        Py_XDECREF(indices);
+        Py_XDECREF(distances);
+        return nullptr;
+    }
+    int64_t* index_data = static_cast<int64_t*>(PyArray_DATA(reinterpret_cast<PyArrayObject*>(indices)));
+    double* distance_data = static_cast<double*>(PyArray_DATA(reinterpret_cast<PyArrayObject*>(distances)));
+    for (size_t i = 0; i < neighbors.size(); ++i) {
+        distance_data[i] = neighbors[i].first;
+        index_data[i] = neighbors[i].second;
+    }
+    return Py_BuildValue("(NN)", indices, distances);
+}
+
+// Whether queries of cols values can search the tree. Checked against the dimension, not the
+// live points: the segments keep their rows after every point is removed until compaction.
+// Only a tree created without a dimension holds no rows a query could read.
+template <typename T>
+static bool query_fits(const DynamicKDTree<T>* tree, size_t cols) {
+    return cols == tree->dimension() || tree->dimension() == 0;
+}
+
+// Parse a query point in the tree's element type and check it against the tree dimension
+template <typename T>
+static PyArrayObject* query_array(const DynamicKDTree<T>* tree, PyObject* queryObj) {
+    PyArrayObject* query = as_typed_array(queryObj, 1, element_type(tree));
+    if (query != nullptr && !query_fits(tree, static_cast<size_t>(PyArray_SIZE(query)))) {
+        Py_DECREF(query);
+        PyErr_SetString(PyExc_ValueError, "Query dimension does not match the tree.");
+        return nullptr;
+    }
+    return query;
+}
+
+// Build a tree over the (n, dim) array with the GIL released
+template <typename T>
+static DynamicKDTree<T>* build_tree(PyArrayObject* points, size_t leafSize, size_t numThreads, size_t deltaCapacity) {
+    const T* data = static_cast<const T*>(PyArray_DATA(points));
+    const size_t n = static_cast<size_t>(PyArray_DIMS(points)[0]);
+    const size_t dim = static_cast<size_t>(PyArray_DIMS(points)[1]);
+    DynamicKDTree<T>* tree = nullptr;
+    std::exception_ptr error;
+    // The build only reads the converted array, so other Python threads may run meanwhile
+    Py_BEGIN_ALLOW_THREADS
+    try {
+        tree = new DynamicKDTree<T>(data, n, dim, leafSize, numThreads, deltaCapacity);
+    } catch (...) {
+        error = std::current_exception();
+    }
+    Py_END_ALLOW_THREADS
+    if (error) {
+        try {
+            std::rethrow_exception(error);
+        } catch (...) {
+            set_python_error();
         }
+    }
+    return tree;
+}
 
-        // Check if we need to search the other subtree
-        KDTreeNode* otherNode = (nextNode == node->left.get()) ? node->right.get() : node->left.get();
-        if (otherNode != nullptr) {
-            double axisDist = std::abs(target[axis] - node->point[axis]);
-            if (axisDist < bestDist) {
-                candidate = nearestNeighborHelper(otherNode, target, depth + 1);
-                if (!candidate.empty()) {
-                    double candidateDist = distance(candidate, target);
-                    if (candidateDist < bestDist) {
-                        bestPoint = candidate;
-                    }
-                }
-            }
+static int KDTree_init(PyKDTree* self, PyObject* args, PyObject* kwds) {
+    static const char* kwlist[] = {"points", "leaf_size", "num_threads", "storage", "delta_capacity", nullptr};
+    PyObject* pointsObj;
+    Py_ssize_t leafSize = 32;
+    Py_ssize_t numThreads = 0;
+    const char* storage = "float64";
+    Py_ssize_t deltaCapacity = static_cast<Py_ssize_t>(DynamicKDTree<double>::kDefaultDeltaCapacity);
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|nnsn", const_cast<char**>(kwlist), &pointsObj, &leafSize,
+                                     &numThreads, &storage, &deltaCapacity)) {
+        return -1;
+    }
+    if (leafSize <= 0 || numThreads < 0 || deltaCapacity <= 0) {
+        PyErr_SetString(PyExc_ValueError,
+                        "leaf_size and delta_capacity must be positive and num_threads non-negative.");
+        return -1;
+    }
+    const bool single = std::strcmp(storage, "float32") == 0;
+    if (!single && std::strcmp(storage, "float64") != 0) {
+        PyErr_SetString(PyExc_ValueError, "storage must be 'float64' or 'float32'.");
+        return -1;
+    }
+
+    PyArrayObject* points = as_typed_array(pointsObj, 2, single ? NPY_FLOAT : NPY_DOUBLE);
+    if (points == nullptr) {
+        return -1;
+    }
+    DynamicKDTree<double>* tree = nullptr;
+    DynamicKDTree<float>* tree32 = nullptr;
+    if (single) {
+        tree32 = build_tree<float>(points, static_cast<size_t>(leafSize), static_cast<size_t>(numThreads),
+                                   static_cast<size_t>(deltaCapacity));
+    } else {
+        tree = build_tree<double>(points, static_cast<size_t>(leafSize), static_cast<size_t>(numThreads),
+                                  static_cast<size_t>(deltaCapacity));
+    }
+    Py_DECREF(points);
+    if (tree == nullptr && tree32 == nullptr) {
+        return -1;
+    }
+
+    delete self->tree;
+    delete self->tree32;
+    self->tree = tree;
+    self->tree32 = tree32;
+    return 0;
+}
+
+static void KDTree_dealloc(PyKDTree* self) {
+    PyTypeObject* type = Py_TYPE(self);
+    DynamicKDTree<double>* tree = self->tree;
+    DynamicKDTree<float>* tree32 = self->tree32;
+    // Deleting waits for a running background compaction, which needs no Python state
+    Py_BEGIN_ALLOW_THREADS
+    delete tree;
+    delete tree32;
+    Py_END_ALLOW_THREADS
+    type->tp_free(reinterpret_cast<PyObject*>(self));
+    Py_DECREF(type);
+}
+
+static PyObject* KDTree_knn(PyKDTree* self, PyObject* args, PyObject* kwds) {
+    static const char* kwlist[] = {"query", "k", "metric", "filter", nullptr};
+    PyObject* queryObj;
+    Py_ssize_t k = 1;
+    const char* metricName = "euclidean";
+    PyObject* filterObj = Py_None;
+    metrics::Metric metric;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|nsO", const_cast<char**>(kwlist), &queryObj, &k, &metricName,
+                                     &filterObj)) {
+        return nullptr;
+    }
+    if (k < 0) {
+        PyErr_SetString(PyExc_ValueError, "k must be non-negative.");
+        return nullptr;
+    }
+    FilterArg filter;
+    if (!parse_tree_metric(metricName, metric) || !check_initialized(self) || !filter.acquire(filterObj)) {
+        return nullptr;
+    }
+    return with_tree(self, [&](auto* tree) -> PyObject* {
+        typedef typename std::remove_pointer<decltype(tree)>::type Tree;
+        typedef typename Tree::Neighbor Neighbor;
+        typedef typename Tree::value_type T;
+        PyArrayObject* query = query_array(tree, queryObj);
+        if (query == nullptr) {
+            return nullptr;
         }
+        std::vector<Neighbor> neighbors;
+        try {
+            stats::QueryScope scope(tree->query_stats(), true);
+            neighbors = with_metric(metric, [&](auto trait) {
+                return with_filter(filter.filter(), [&](const auto& accept) {
+                    return tree->template knn<decltype(trait)>(static_cast<const T*>(PyArray_DATA(query)),
+                                                               static_cast<size_t>(k), accept);
+                });
+            });
+        } catch (...) {
+            Py_DECREF(query);
+            return set_python_error();
+        }
+        Py_DECREF(query);
+        return neighbors_to_python(neighbors);
+    });
+}
+
+static PyObject* KDTree_knn_batch(PyKDTree* self, PyObject* args, PyObject* kwds) {
+    static const char* kwlist[] = {"queries", "k", "num_threads", "metric", "filter", nullptr};
+    PyObject* queriesObj;
+    Py_ssize_t k;
+    Py_ssize_t numThreads = 0;
+    const char* metricName = "euclidean";
+    PyObject* filterObj = Py_None;
+    metrics::Metric metric;
 
-        return bestPoint;
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "On|nsO", const_cast<char**>(kwlist), &queriesObj, &k, &numThreads,
+                                     &metricName, &filterObj)) {
+        return nullptr;
+    }
+    if (k < 0 || numThreads < 0) {
+        PyErr_SetString(PyExc_ValueError, "k and num_threads must be non-negative.");
+        return nullptr;
     }
+    FilterArg filter;
+    if (!parse_tree_metric(metricName, metric) || !check_initialized(self) || !filter.acquire(filterObj)) {
+        return nullptr;
+    }
+    return with_tree(self, [&](auto* tree) -> PyObject* {
+        typedef typename std::remove_pointer<decltype(tree)>::type Tree;
+        typedef typename Tree::Neighbor Neighbor;
+        typedef typename Tree::value_type T;
+        PyArrayObject* queries = as_typed_array(queriesObj, 2, element_type(tree));
+        if (queries == nullptr) {
+            return nullptr;
+        }
+        const size_t rows = static_cast<size_t>(PyArray_DIMS(queries)[0]);
+        const size_t cols = static_cast<size_t>(PyArray_DIMS(queries)[1]);
+        if (!query_fits(tree, cols)) {
+            Py_DECREF(queries);
+            PyErr_SetString(PyExc_ValueError, "Query dimension does not match the tree.");
+            return nullptr;
+        }
+
+        npy_intp dims[2] = {static_cast<npy_intp>(rows), static_cast<npy_intp>(k)};
+        PyObject* indices = PyArray_SimpleNew(2, dims, NPY_INT64);
+        PyObject* distances = PyArray_SimpleNew(2, dims, NPY_DOUBLE);
+        if (indices == nullptr || distances == nullptr) {
+            Py_XDECREF(indices);
+            Py_XDECREF(distances);
+            Py_DECREF(queries);
+            return nullptr;
+        }
+
+        const T* queryData = static_cast<const T*>(PyArray_DATA(queries));
+        int64_t* indexData = static_cast<int64_t*>(PyArray_DATA(reinterpret_cast<PyArrayObject*>(indices)));
+        double* distanceData = static_cast<double*>(PyArray_DATA(reinterpret_cast<PyArrayObject*>(distances)));
+        const Tree* shared = tree;
+        std::exception_ptr error;
+
+        // Queries only read the tree and the filter and write disjoint output rows
+        Py_BEGIN_ALLOW_THREADS
+        try {
+            with_metric(metric, [&](auto trait) {
+                with_filter(filter.filter(), [&](const auto& accept) {
+                    ThreadPool::instance().parallel_for(rows, static_cast<size_t>(numThreads), [&](size_t q) {
+                        stats::QueryScope scope(shared->query_stats());
+                        std::vector<Neighbor> neighbors =
+                            shared->template knn<decltype(trait)>(queryData + q * cols, static_cast<size_t>(k), accept);
+                        for (size_t j = 0; j < static_cast<size_t>(k); ++j) {
+                            const bool found = j < neighbors.size();
+                            indexData[q * k + j] = found ? static_cast<int64_t>(neighbors[j].second) : -1;
+                            distanceData[q * k + j] =
+                                found ? neighbors[j].first : std::numeric_limits<double>::infinity();
+                        }
+                    });
+                });
+            });
+        } catch (...) {
+            error = std::current_exception();
+        }
+        Py_END_ALLOW_THREADS
+        Py_DECREF(queries);
 
-    // Utility function to calculate Euclidean distance
-    double distance(const std::vector<double>& a, const std::vector<double>& b) {
-        double dist = 0.0;
-        for (size_t i = 0; i < a.size(); ++i) {
-            dist += (a[i] - b[i]) * (a[i] - b[i]);
+        if (error) {
+            Py_DECREF(indices);
+            Py_DECREF(distances);
+            try {
+                std::rethrow_exception(error);
+            } catch (...) {
+                return set_python_error();
+            }
         }
-        return std::sqrt(dist);
+        return Py_BuildValue("(NN)", indices, distances);
+    });
+}
+
+static PyObject* KDTree_radius(PyKDTree* self, PyObject* args, PyObject* kwds) {
+    static const char* kwlist[] = {"query", "r", "metric", "filter", nullptr};
+    PyObject* queryObj;
+    double r;
+    const char* metricName = "euclidean";
+    PyObject* filterObj = Py_None;
+    metrics::Metric metric;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "Od|sO", const_cast<char**>(kwlist), &queryObj, &r, &metricName,
+                                     &filterObj)) {
+        return nullptr;
     }
-};
+    FilterArg filter;
+    if (!parse_tree_metric(metricName, metric) || !check_initialized(self) || !filter.acquire(filterObj)) {
+        return nullptr;
+    }
+    return with_tree(self, [&](auto* tree) -> PyObject* {
+        typedef typename std::remove_pointer<decltype(tree)>::type Tree;
+        typedef typename Tree::Neighbor Neighbor;
+        typedef typename Tree::value_type T;
+        PyArrayObject* query = query_array(tree, queryObj);
+        if (query == nullptr) {
+            return nullptr;
+        }
+        std::vector<Neighbor> neighbors;
+        try {
+            stats::QueryScope scope(tree->query_stats(), true);
+            neighbors = with_metric(metric, [&](auto trait) {
+                return with_filter(filter.filter(), [&](const auto& accept) {
+                    return tree->template radius<decltype(trait)>(static_cast<const T*>(PyArray_DATA(query)),
+                                                                  static_cast<T>(r), accept);
+                });
+            });
+        } catch (...) {
+            Py_DECREF(query);
+            return set_python_error();
+        }
+        Py_DECREF(query);
+        return neighbors_to_python(neighbors);
+    });
+}
 
-// Python wrapper for KDTree
-static PyObject* py_nearestNeighbor(PyObject* self, PyObject* args) {
+// Parse points in the tree's element type and check them against the tree dimension
+template <typename T>
+static PyArrayObject* points_array(const DynamicKDTree<T>* tree, PyObject* pointsObj, int ndim) {
+    PyArrayObject* points = as_typed_array(pointsObj, ndim, element_type(tree));
+    if (points == nullptr) {
+        return nullptr;
+    }
+    const size_t cols = static_cast<size_t>(PyArray_DIMS(points)[ndim - 1]);
+    if (cols != tree->dimension() || tree->dimension() == 0) {
+        Py_DECREF(points);
+        PyErr_SetString(PyExc_ValueError, "Point dimension does not match the tree.");
+        return nullptr;
+    }
+    return points;
+}
+
+static PyObject* KDTree_insert(PyKDTree* self, PyObject* args) {
+    PyObject* pointObj;
+
+    if (!PyArg_ParseTuple(args, "O", &pointObj) || !check_initialized(self)) {
+        return nullptr;
+    }
+    return with_tree(self, [&](auto* tree) -> PyObject* {
+        typedef typename std::remove_pointer<decltype(tree)>::type Tree;
+        typedef typename Tree::value_type T;
+        PyArrayObject* point = points_array(tree, pointObj, 1);
+        if (point == nullptr) {
+            return nullptr;
+        }
+        uint32_t id;
+        try {
+            id = tree->insert(static_cast<const T*>(PyArray_DATA(point)), 1);
+        } catch (...) {
+            Py_DECREF(point);
+            return set_python_error();
+        }
+        Py_DECREF(point);
+        return PyLong_FromUnsignedLong(id);
+    });
+}
+
+static PyObject* KDTree_insert_batch(PyKDTree* self, PyObject* args) {
     PyObject* pointsObj;
-    PyObject* targetObj;
 
-    // Parse input
-    if (!PyArg_ParseTuple(args, "OO", &pointsObj, &targetObj)) {
+    if (!PyArg_ParseTuple(args, "O", &pointsObj) || !check_initialized(self)) {
         return nullptr;
     }
+    return with_tree(self, [&](auto* tree) -> PyObject* {
+        typedef typename std::remove_pointer<decltype(tree)>::type Tree;
+        typedef typename Tree::value_type T;
+        PyArrayObject* points = points_array(tree, pointsObj, 2);
+        if (points == nullptr) {
+            return nullptr;
+        }
+        const size_t rows = static_cast<size_t>(PyArray_DIMS(points)[0]);
+        npy_intp dims[1] = {static_cast<npy_intp>(rows)};
+        PyObject* ids = PyArray_SimpleNew(1, dims, NPY_INT64);
+        if (ids == nullptr) {
+            Py_DECREF(points);
+            return nullptr;
+        }
+        uint32_t first;
+        try {
+            first = tree->insert(static_cast<const T*>(PyArray_DATA(points)), rows);
+        } catch (...) {
+            Py_DECREF(points);
+            Py_DECREF(ids);
+            return set_python_error();
+        }
+        Py_DECREF(points);
+        int64_t* idData = static_cast<int64_t*>(PyArray_DATA(reinterpret_cast<PyArrayObject*>(ids)));
+        for (size_t i = 0; i < rows; ++i) {
+            idData[i] = static_cast<int64_t>(first) + static_cast<int64_t>(i);
+        }
+        return ids;
+    });
+}
+
+static PyObject* KDTree_remove(PyKDTree* self, PyObject* args) {
+    unsigned long long id;
+
+    if (!PyArg_ParseTuple(args, "K", &id) || !check_initialized(self)) {
+        return nullptr;
+    }
+    if (id > std::numeric_limits<uint32_t>::max()) {
+        Py_RETURN_FALSE;
+    }
+    const bool removed = with_tree(self, [&](auto* tree) { return tree->remove(static_cast<uint32_t>(id)); });
+    return PyBool_FromLong(removed);
+}
 
-    // Convert Python list to std::vector<std::vector<double>>
-    std::vector<std::vector<double>> points;
-    Py_ssize_t numPoints = PyList_Size(pointsObj);
-    for (Py_ssize_t i = 0; i < numPoints; ++i) {
-        PyObject* pointObj = PyList_GetItem(pointsObj, i);
-        std::vector<double> point;
-        Py_ssize_t numDims = PyList_Size(pointObj);
-        for (Py_ssize_t j = 0; j < numDims; ++j) {
-            point.push_back(PyFloat_AsDouble(PyList_GetItem(pointObj, j)));
+static PyObject* KDTree_compact(PyKDTree* self, PyObject* args) {
+    if (!check_initialized(self)) {
+        return nullptr;
+    }
+    DynamicKDTree<double>* tree = self->tree;
+    DynamicKDTree<float>* tree32 = self->tree32;
+    std::exception_ptr error;
+    // Rebuilds run on immutable segments; queries from other threads carry on meanwhile
+    Py_BEGIN_ALLOW_THREADS
+    try {
+        if (tree32 != nullptr) {
+            tree32->compact();
+        } else {
+            tree->compact();
+        }
+    } catch (...) {
+        error = std::current_exception();
+    }
+    Py_END_ALLOW_THREADS
+    if (error) {
+        try {
+            std::rethrow_exception(error);
+        } catch (...) {
+            return set_python_error();
         }
-        points.push_back(point);
     }
+    Py_RETURN_NONE;
+}
 
-    // Convert target to std::vector<double>
-    std::vector<double> target;
-    Py_ssize_t targetDims = PyList_Size(targetObj);
-    for (Py_ssize_t i = 0; i < targetDims; ++i) {
-        target.push_back(PyFloat_AsDouble(PyList_GetItem(targetObj, i)));
+static PyObject* KDTree_stats(PyKDTree* self, PyObject* args, PyObject* kwds) {
+    if (!check_initialized(self)) {
+        return nullptr;
     }
+    return with_tree(self, [&](auto* tree) { return stats_dict::stats_method(tree->query_stats(), args, kwds); });
+}
 
-    // Build the KDTree and find the nearest neighbor
-    KDTree tree(points);
-    std::vector<double> nearest = tree.nearestNeighbor(target);
+static PyObject* KDTree_last_trace(PyKDTree* self, PyObject* args) {
+    if (!check_initialized(self)) {
+        return nullptr;
+    }
+    return with_tree(self, [](auto* tree) { return stats_dict::trace(stats::last_trace(tree->query_stats())); });
+}
 
-    // Convert result back to Python list
-    PyObject* result = PyList_New(nearest.size());
-    for (size_t i = 0; i < nearest.size(); ++i) {
-        PyList_SetItem(result, i, PyFloat_FromDouble(nearest[i]));
+static PyObject* KDTree_get_delta_size(PyKDTree* self, void* closure) {
+    if (!check_initialized(self)) {
+        return nullptr;
     }
+    return PyLong_FromSize_t(with_tree(self, [](auto* tree) { return tree->delta_size(); }));
+}
 
-    return result;
+static PyObject* KDTree_get_num_segments(PyKDTree* self, void* closure) {
+    if (!check_initialized(self)) {
+        return nullptr;
+    }
+    return PyLong_FromSize_t(with_tree(self, [](auto* tree) { return tree->num_segments(); }));
+}
+
+static PyObject* KDTree_get_storage(PyKDTree* self, void* closure) {
+    if (!check_initialized(self)) {
+        return nullptr;
+    }
+    return PyUnicode_FromString(self->tree32 != nullptr ? "float32" : "float64");
+}
+
+static PyObject* KDTree_save(PyKDTree* self, PyObject* args, PyObject* kwds) {
+    static const char* kwlist[] = {"path", nullptr};
+    PyObject* pathObj;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "O&", const_cast<char**>(kwlist), PyUnicode_FSConverter, &pathObj)) {
+        return nullptr;
+    }
+    if (!check_initialized(self)) {
+        Py_DECREF(pathObj);
+        return nullptr;
+    }
+    const std::string path(PyBytes_AS_STRING(pathObj));
+    Py_DECREF(pathObj);
+    DynamicKDTree<double>* tree = self->tree;
+    DynamicKDTree<float>* tree32 = self->tree32;
+    std::exception_ptr error;
+    Py_BEGIN_ALLOW_THREADS
+    try {
+        if (tree32 != nullptr) {
+            tree32->save(path);
+        } else {
+            tree->save(path);
+        }
+    } catch (...) {
+        error = std::current_exception();
+    }
+    Py_END_ALLOW_THREADS
+    if (error) {
+        try {
+            std::rethrow_exception(error);
+        } catch (...) {
+            return set_python_error();
+        }
+    }
+    Py_RETURN_NONE;
+}
+
+static PyObject* KDTree_load(PyObject* cls, PyObject* args, PyObject* kwds) {
+    static const char* kwlist[] = {"path", nullptr};
+    PyObject* pathObj;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "O&", const_cast<char**>(kwlist), PyUnicode_FSConverter, &pathObj)) {
+        return nullptr;
+    }
+    const std::string path(PyBytes_AS_STRING(pathObj));
+    Py_DECREF(pathObj);
+    std::unique_ptr<DynamicKDTree<double>> tree;
+    std::unique_ptr<DynamicKDTree<float>> tree32;
+    try {
+        if (kd_tree_element_size(path) == sizeof(float)) {
+            tree32 = DynamicKDTree<float>::load(path);
+        } else {
+            tree = DynamicKDTree<double>::load(path);
+        }
+    } catch (...) {
+        return set_python_error();
+    }
+
+    PyTypeObject* type = reinterpret_cast<PyTypeObject*>(cls);
+    PyKDTree* self = reinterpret_cast<PyKDTree*>(type->tp_alloc(type, 0));
+    if (self == nullptr) {
+        return nullptr;
+    }
+    self->tree = tree.release();
+    self->tree32 = tree32.release();
+    return reinterpret_cast<PyObject*>(self);
 }
 
+static Py_ssize_t KDTree_len(PyKDTree* self) {
+    if (self->tree == nullptr && self->tree32 == nullptr) {
+        return 0;
+    }
+    return with_tree(self, [](auto* tree) { return static_cast<Py_ssize_t>(tree->size()); });
+}
+
+static PyMethodDef KDTreeTypeMethods[] = {
+    {"knn", (PyCFunction)(void (*)(void))KDTree_knn, METH_VARARGS | METH_KEYWORDS,
+     "Return (indices, distances) of the k nearest points in ascending distance.\n\n"
+     "metric is 'euclidean' (default), 'sqeuclidean', 'manhattan' or 'hamming'; the tree serves all of them.\n"
+     "filter restricts the search to some points: a bool mask or an array of allowed ids, or a\n"
+     "(column, op, value) tuple comparing a per-point integer column, e.g. (tenant, '==', 7) or\n"
+     "(tenant, 'in', [1, 2]). Rejected points are skipped before any distance is computed."},
+    {"knn_batch", (PyCFunction)(void (*)(void))KDTree_knn_batch, METH_VARARGS | METH_KEYWORDS,
+     "Return (indices, distances) arrays of shape (M, k) for an (M, D) query matrix.\n\n"
+     "The GIL is released and queries run on num_threads threads (0 uses all). Missing neighbours are -1 / inf.\n"
+     "metric and filter are as for knn; one filter applies to every query."},
+    {"radius", (PyCFunction)(void (*)(void))KDTree_radius, METH_VARARGS | METH_KEYWORDS,
+     "Return (indices, distances) of every point within distance r, in ascending distance; metric and filter\n"
+     "as for knn."},
+    {"insert", (PyCFunction)KDTree_insert, METH_VARARGS,
+     "Add a point and return its id; it is searchable at once and merged into the tree in the background."},
+    {"insert_batch", (PyCFunction)KDTree_insert_batch, METH_VARARGS,
+     "Add every row of an (M, D) array and return their ids, which are consecutive."},
+    {"remove", (PyCFunction)KDTree_remove, METH_VARARGS,
+     "Delete the point with the given id; returns False when no live point has that id.\n\n"
+     "Deleted points are skipped by every query and dropped from the tree by the next compaction."},
+    {"compact", (PyCFunction)KDTree_compact, METH_NOARGS,
+     "Merge buffered inserts and drop deleted points now, leaving a single tree."},
+    {"stats", (PyCFunction)(void (*)(void))KDTree_stats, METH_VARARGS | METH_KEYWORDS,
+     "Return histograms of the per-query counters of knn, knn_batch and radius as a dict.\n\n"
+     "Queries are only counted by builds configured with -Dquery_stats=true; elsewhere 'enabled' is False\n"
+     "and every histogram is empty. Besides 'enabled' and 'queries' there is one histogram per counter:\n"
+     "'latency_ns', 'distances' (points scored), 'visited' (tree nodes entered), 'candidates' (points\n"
+     "scored in the leaves reached and the delta), 'bytes' (point bytes read) and the phase times\n"
+     "'scan_ns' and 'select_ns'. Each is a dict of 'total', 'mean', 'p50', 'p90', 'p99', 'max' and\n"
+     "'buckets', where buckets[b] counts the queries whose value has b bits. reset=True clears the\n"
+     "counters once they are read."},
+    {"last_trace", (PyCFunction)KDTree_last_trace, METH_NOARGS,
+     "Return the counters of the last knn() or radius() this thread ran on the tree as a dict with the\n"
+     "keys of stats(), or None when there is none or queries are not counted."},
+    {"save", (PyCFunction)(void (*)(void))KDTree_save, METH_VARARGS | METH_KEYWORDS,
+     "Write the tree to path in the versioned on-disk index format."},
+    {"load", (PyCFunction)(void (*)(void))KDTree_load, METH_VARARGS | METH_KEYWORDS | METH_CLASS,
+     "Open a tree written by save(); the arrays are memory-mapped read-only, so loading is instant."},
+    {nullptr, nullptr, 0, nullptr}
+};
+
+static PyGetSetDef KDTreeGetSet[] = {
+    {"storage", (getter)KDTree_get_storage, nullptr, "Element type of the stored points and of the search.", nullptr},
+    {"delta_size", (getter)KDTree_get_delta_size, nullptr,
+     "Inserted points not yet merged into a tree; queries scan them directly.", nullptr},
+    {"num_segments", (getter)KDTree_get_num_segments, nullptr,
+     "Number of immutable trees the points are spread over (a single one after compact()).", nullptr},
+    {nullptr, nullptr, nullptr, nullptr, nullptr}
+};
+
+static PyType_Slot KDTreeSlots[] = {
+    {Py_tp_doc, (void*)"KDTree(points, leaf_size=32, num_threads=0, storage='float64', delta_capacity=1024)\n\n"
+                        "kd-tree built over an (N, D) array and queried many times. storage='float32' keeps\n"
+                        "the points and runs the search in single precision, halving memory and bandwidth.\n"
+                        "Points can be inserted and removed afterwards: inserts collect in a buffer of up to\n"
+                        "delta_capacity points that queries scan directly, and a background thread merges them\n"
+                        "and drops deleted points by rebuilding the affected trees."},
+    {Py_tp_new, (void*)PyType_GenericNew},
+    {Py_tp_init, (void*)KDTree_init},
+    {Py_tp_dealloc, (void*)KDTree_dealloc},
+    {Py_tp_methods, KDTreeTypeMethods},
+    {Py_tp_getset, KDTreeGetSet},
+    {Py_sq_length, (void*)KDTree_len},
+    {0, nullptr}
+};
+
+static PyType_Spec KDTreeSpec = {
+    "tree_index.KDTree",
+    sizeof(PyKDTree),
+    0,
+    Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE,
+    KDTreeSlots
+};
+
 // Module method definitions
 static PyMethodDef KDTreeMethods[] = {
     {"nearestNeighbor", py_nearestNeighbor, METH_VARARGS, "Find the nearest neighbor."},
@@ -152,14 +760,26 @@ static PyMethodDef KDTreeMethods[] = {
 // Module definition
 static struct PyModuleDef kdtree_module = {
     PyModuleDef_HEAD_INIT,
-    "kdtree",
+    "tree_index",
     nullptr,
     -1,
     KDTreeMethods
 };
 
 // Module initialization
-PyMODINIT_FUNC PyInit_kdtree(void) {
+PyMODINIT_FUNC PyInit_tree_index(void) {
     import_array(); // Initialize NumPy API
-    return PyModule_Create(&kdtree_module);
-}
\ No newline at end of file
+    simd::init(); // Pick the distance kernels for this CPU once
+
+    PyObject* module = PyModule_Create(&kdtree_module);
+    if (module == nullptr) {
+        return nullptr;
+    }
+    PyObject* type = PyType_FromSpec(&KDTreeSpec);
+    if (type == nullptr || PyModule_AddObject(module, "KDTree", type) < 0) {
+        Py_XDECREF(type);
+        Py_DECREF(module);
+        return nullptr;
+    }
+    return module;
+}
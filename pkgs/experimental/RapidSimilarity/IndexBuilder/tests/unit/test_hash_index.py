@@ -1,3 +1,5 @@
+import array
+
 import pytest
 import numpy as np
 from IndexBuilder.hash_index import LSHIndex
@@ -18,8 +20,9 @@ def test_lsh_index_insert_and_query():
     results = lsh_index.query(data_point)
 
     assert len(results) > 0, "Query should return results after insertion."
-    assert all(np.array_equal(result, data_point) for result in results), (
-        "Returned results should match the inserted data point."
+    assert list(results) == [0], "The only inserted point should have id 0."
+    assert np.array_equal(lsh_index.get(0), data_point), (
+        "The stored vector should match the inserted data point."
     )
 
 
@@ -44,9 +47,7 @@ def test_lsh_index_bulk_insert_and_query(data_points):
     results = lsh_index.query(data_points[0])
 
     assert len(results) > 0, "Query should return results after bulk insertion."
-    assert any(np.array_equal(result, data_points[0]) for result in results), (
-        "Returned results should contain the queried data point."
-    )
+    assert 0 in results, "Returned results should contain the queried data point."
 
 
 @pytest.mark.unit
@@ -65,6 +66,18 @@ def test_invalid_insert():
         )  # Should raise ValueError for empty input
 
 
+@pytest.mark.unit
+def test_lsh_index_accepts_buffers():
+    """Test that memoryview and array.array inputs are read like ndarrays."""
+    data_points = np.random.default_rng(3).random((20, 4)).astype(np.float32)
+    lsh_index = LSHIndex(5, 10, seed=1)
+    lsh_index.insert_batch(memoryview(data_points[:19]))
+    lsh_index.insert(array.array("f", data_points[19].tolist()))
+
+    assert np.array_equal(lsh_index.get(19), data_points[19])
+    assert lsh_index.query(memoryview(data_points[19])).tolist() == lsh_index.query(data_points[19]).tolist()
+    assert 19 in lsh_index.query(array.array("d", data_points[19].tolist()))
+
 @pytest.mark.unit
 def test_query_empty_index():
     """Test querying an empty LSHIndex returns no results."""
@@ -76,3 +89,291 @@ def test_query_empty_index():
     results = lsh_index.query(data_point)
 
     assert len(results) == 0, "Querying an empty index should return no results."
+
+
+@pytest.mark.unit
+def test_lsh_index_insert_batch_persists():
+    """Test that batch inserts are retained across queries on the same index."""
+    lsh_index = LSHIndex(5, 10)
+    data_points = np.array([[0.0, 0.0], [1.0, 1.0], [2.0, 2.0]], dtype=np.float32)
+    lsh_index.insert_batch(data_points)
+
+    assert len(lsh_index) == len(data_points)
+    for point_id, point in enumerate(data_points):
+        results = lsh_index.query(point)
+        assert point_id in results
+
+
+@pytest.mark.unit
+def test_lsh_index_dimension_mismatch():
+    """Test that points with a different dimension than the index are rejected."""
+    lsh_index = LSHIndex(5, 10)
+    lsh_index.insert(np.array([0.5, 0.7], dtype=np.float32))
+
+    with pytest.raises(ValueError):
+        lsh_index.insert(np.array([0.5, 0.7, 0.9], dtype=np.float32))
+
+    with pytest.raises(ValueError):
+        lsh_index.insert_batch(np.array([0.5, 0.7], dtype=np.float32))
+
+
+@pytest.mark.unit
+@pytest.mark.parametrize("family", ["simhash", "e2lsh"])
+def test_lsh_index_high_dimensional_families(family):
+    """Test that every hash family indexes high-dimensional points."""
+    rng = np.random.default_rng(0)
+    data_points = rng.standard_normal((200, 768)).astype(np.float32)
+    lsh_index = LSHIndex(8, 256, num_tables=4, family=family, seed=7)
+    lsh_index.insert_batch(data_points)
+
+    results = lsh_index.query(data_points[3])
+
+    assert len(results) < len(data_points), "Buckets should not collapse to one."
+    assert 3 in results
+
+
+@pytest.mark.unit
+def test_lsh_index_invalid_family():
+    """Test that unknown hash families are rejected."""
+    with pytest.raises(ValueError):
+        LSHIndex(5, 10, family="unknown")
+
+
+@pytest.mark.unit
+def test_lsh_index_query_returns_unique_ids_and_distances():
+    """Test that query returns each id once along with its Euclidean distance."""
+    lsh_index = LSHIndex(4, 10, num_tables=8)
+    data_points = np.array([[1.0, 2.0], [1.0, 2.0], [3.0, 5.0]], dtype=np.float32)
+    lsh_index.insert_batch(data_points)
+
+    ids, distances = lsh_index.query(data_points[0], return_distances=True)
+
+    assert ids.dtype == np.uint32
+    assert len(set(ids.tolist())) == len(ids)
+    assert {0, 1} <= set(ids.tolist())
+    expected = np.linalg.norm(data_points[ids] - data_points[0], axis=1)
+    assert np.allclose(distances, expected)
+
+    with pytest.raises(IndexError):
+        lsh_index.get(len(data_points))
+
+
+@pytest.mark.unit
+@pytest.mark.parametrize("family", ["simhash", "e2lsh"])
+def test_lsh_index_multi_probe_extends_candidates(family):
+    """Test that multi-probe queries visit the home buckets plus neighbouring ones."""
+    rng = np.random.default_rng(1)
+    data_points = rng.standard_normal((500, 32)).astype(np.float32)
+    lsh_index = LSHIndex(10, 500, num_tables=2, family=family, seed=3)
+    lsh_index.insert_batch(data_points)
+
+    query = data_points[0] + 0.1 * rng.standard_normal(32).astype(np.float32)
+    single = set(lsh_index.query(query).tolist())
+    probed = set(lsh_index.query(query, probes=16).tolist())
+
+    assert single <= probed
+    assert len(probed) >= len(single)
+
+    with pytest.raises(ValueError):
+        lsh_index.query(query, probes=-1)
+
+
+@pytest.mark.unit
+def test_lsh_index_query_batch_matches_single_queries():
+    """Test that batched k-NN queries agree with the candidates of single queries."""
+    rng = np.random.default_rng(2)
+    data_points = rng.standard_normal((300, 16)).astype(np.float32)
+    lsh_index = LSHIndex(8, 300, num_tables=4, seed=5)
+    lsh_index.insert_batch(data_points)
+
+    ids, distances = lsh_index.query_batch(data_points[:20], 3, num_threads=2)
+
+    assert ids.shape == (20, 3) and ids.dtype == np.int64
+    assert distances.shape == (20, 3) and distances.dtype == np.float32
+    for row in range(20):
+        candidates = lsh_index.query(data_points[row]).tolist()
+        found = [i for i in ids[row].tolist() if i >= 0]
+        assert ids[row, 0] == row
+        assert set(found) <= set(candidates)
+        assert np.all(np.diff(distances[row][: len(found)]) >= 0)
+        assert np.all(np.isinf(distances[row][len(found):]))
+
+
+@pytest.mark.unit
+def test_lsh_index_save_and_load(tmp_path):
+    """A loaded index keeps its hash functions, buckets and vectors, and accepts new points."""
+    rng = np.random.default_rng(4)
+    data_points = rng.standard_normal((300, 8)).astype(np.float32)
+    lsh_index = LSHIndex(6, 10, num_tables=3, family="e2lsh", seed=5)
+    lsh_index.insert_batch(data_points)
+    path = tmp_path / "lsh.idx"
+    lsh_index.save(path)
+
+    loaded = LSHIndex.load(path)
+
+    assert len(loaded) == len(lsh_index)
+    assert np.array_equal(loaded.get(7), data_points[7])
+    ids, distances = lsh_index.query_batch(data_points[:20], 3)
+    loaded_ids, loaded_distances = loaded.query_batch(data_points[:20], 3)
+    assert np.array_equal(loaded_ids, ids)
+    assert np.array_equal(loaded_distances, distances)
+
+    loaded.insert(data_points[0])
+    assert len(loaded) == 301
+    assert np.array_equal(loaded.get(300), data_points[0])
+
+
+@pytest.mark.unit
+@pytest.mark.parametrize("storage, bytes_per_vector", [("float32", 64), ("float16", 32), ("int8", 32)])
+def test_lsh_index_storage_modes(storage, bytes_per_vector):
+    """Compact storage only changes the stored vectors: buckets match and distances stay close."""
+    rng = np.random.default_rng(8)
+    data = rng.standard_normal((500, 16)).astype(np.float32)
+    reference = LSHIndex(6, 500, num_tables=4, seed=2)
+    reference.insert_batch(data)
+    lsh_index = LSHIndex(6, 500, num_tables=4, seed=2, storage=storage)
+    lsh_index.insert_batch(data)
+
+    assert lsh_index.storage == storage
+    assert lsh_index.bytes_per_vector == bytes_per_vector
+    ids, distances = lsh_index.query(data[3], return_distances=True)
+    expected_ids, expected_distances = reference.query(data[3], return_distances=True)
+    assert np.array_equal(ids, expected_ids)
+    assert np.allclose(distances, expected_distances, rtol=0.02, atol=0.05)
+    assert np.allclose(lsh_index.get(3), data[3], atol=0.02)
+
+    with pytest.raises(ValueError):
+        LSHIndex(6, 10, storage="bfloat16")
+
+
+@pytest.mark.unit
+@pytest.mark.parametrize("metric", ["ip", "manhattan"])
+def test_lsh_index_query_metrics(metric):
+    """Test that candidates are ranked and reported by the requested metric."""
+    rng = np.random.default_rng(9)
+    data_points = rng.standard_normal((300, 8)).astype(np.float32)
+    lsh_index = LSHIndex(6, 300, num_tables=4, seed=5)
+    lsh_index.insert_batch(data_points)
+    query = data_points[4]
+
+    ids, values = lsh_index.query(query, return_distances=True, metric=metric)
+    if metric == "ip":
+        expected = data_points[ids] @ query
+    else:
+        expected = np.abs(data_points[ids] - query).sum(axis=1)
+    assert np.allclose(values, expected, rtol=1e-5, atol=1e-5)
+
+    batch_ids, batch_values = lsh_index.query_batch(data_points[:10], 3, metric=metric)
+    for row in range(10):
+        found = int(np.sum(batch_ids[row] >= 0))
+        order = np.diff(batch_values[row][:found])
+        assert np.all(order <= 0) if metric == "ip" else np.all(order >= 0)
+        assert np.all(batch_values[row][found:] == (-np.inf if metric == "ip" else np.inf))
+    if metric == "manhattan":
+        assert batch_ids[:, 0].tolist() == list(range(10))
+
+    with pytest.raises(ValueError):
+        lsh_index.query(query, metric="chebyshev")
+
+
+@pytest.mark.unit
+def test_lsh_index_remove_and_compact(tmp_path):
+    """Removed ids are never returned and stay removed after compaction and a save/load round trip."""
+    rng = np.random.default_rng(11)
+    data_points = rng.standard_normal((400, 8)).astype(np.float32)
+    lsh_index = LSHIndex(4, 400, num_tables=3, seed=2, delta_capacity=1000)
+    lsh_index.insert_batch(data_points)
+    assert lsh_index.delta_size == 400
+
+    removed = set(range(0, 400, 5))
+    assert all(lsh_index.remove(i) for i in removed)
+    assert not lsh_index.remove(0) and not lsh_index.remove(400)
+    assert len(lsh_index) == 320
+    with pytest.raises(IndexError):
+        lsh_index.get(5)
+
+    before = [lsh_index.query(point).tolist() for point in data_points[:20]]
+    assert all(removed.isdisjoint(ids) for ids in before)
+    lsh_index.compact()
+    assert lsh_index.delta_size == 0
+    assert [lsh_index.query(point).tolist() for point in data_points[:20]] == before
+
+    path = tmp_path / "lsh.idx"
+    lsh_index.save(path)
+    loaded = LSHIndex.load(path)
+    assert len(loaded) == 320
+    assert [loaded.query(point).tolist() for point in data_points[:20]] == before
+    with pytest.raises(IndexError):
+        loaded.get(10)
+    assert np.array_equal(loaded.get(11), data_points[11])
+
+
+@pytest.mark.unit
+def test_lsh_index_filter():
+    """A filtered query returns exactly the unfiltered candidates that the filter accepts."""
+    rng = np.random.default_rng(12)
+    data_points = rng.standard_normal((500, 8)).astype(np.float32)
+    tenant = rng.integers(0, 5, size=500)
+    lsh_index = LSHIndex(4, 100, num_tables=3, seed=4)
+    lsh_index.insert_batch(data_points)
+
+    for filter, accepted in [((tenant, "==", 1), tenant == 1), (tenant != 1, tenant != 1), ([0, 1, 2], None)]:
+        for point in data_points[:10]:
+            ids = lsh_index.query(point)
+            keep = accepted[ids] if accepted is not None else np.isin(ids, [0, 1, 2])
+            assert lsh_index.query(point, filter=filter).tolist() == ids[keep].tolist()
+        batch_ids, _ = lsh_index.query_batch(data_points[:10], 3, filter=filter)
+        found = batch_ids[batch_ids >= 0]
+        assert np.all(accepted[found]) if accepted is not None else np.all(found <= 2)
+
+
+@pytest.mark.unit
+@pytest.mark.parametrize("storage", ["float32", "float16", "int8"])
+def test_lsh_index_ranks_candidates_across_segments(storage):
+    """Candidates from several segments and the delta come back once each, ascending, scored exactly."""
+    rng = np.random.default_rng(13)
+    data_points = rng.standard_normal((700, 24)).astype(np.float32)
+    lsh_index = LSHIndex(3, 1000, num_tables=4, seed=6, storage=storage, delta_capacity=256)
+    for start in range(0, 600, 200):
+        lsh_index.insert_batch(data_points[start : start + 200])
+        lsh_index.compact()
+    lsh_index.insert_batch(data_points[600:])
+    assert lsh_index.delta_size == 100
+
+    for point in data_points[::70]:
+        ids, distances = lsh_index.query(point, probes=4, return_distances=True)
+        assert np.all(np.diff(ids.astype(np.int64)) > 0)
+        stored = np.array([lsh_index.get(int(i)) for i in ids])
+        assert np.allclose(distances, np.linalg.norm(stored - point, axis=1), rtol=1e-4, atol=1e-4)
+
+        found, nearest = lsh_index.query_batch(point[None, :], 5, probes=4)
+        assert found[0].tolist() == ids[np.argsort(distances, kind="stable")[:5]].tolist()
+        assert np.allclose(nearest[0], np.sort(distances)[:5])
+
+
+@pytest.mark.unit
+def test_lsh_index_query_stats():
+    """stats() summarises every counted query and last_trace() the last single one."""
+    rng = np.random.default_rng(14)
+    data_points = rng.standard_normal((300, 8)).astype(np.float32)
+    lsh_index = LSHIndex(4, 1000, num_tables=3, seed=2)
+    lsh_index.insert_batch(data_points)
+    counters = ["latency_ns", "distances", "visited", "candidates", "bytes", "hash_ns", "probe_ns", "scan_ns",
+                "select_ns"]
+
+    lsh_index.query_batch(data_points[:4], 5, probes=2)
+    lsh_index.query(data_points[0], return_distances=True, probes=2)
+    stats = lsh_index.stats()
+    assert set(stats) == {"enabled", "queries", *counters}
+    assert set(stats["distances"]) == {"total", "mean", "p50", "p90", "p99", "max", "buckets"}
+    if not stats["enabled"]:
+        assert stats["queries"] == 0 and lsh_index.last_trace() is None
+        return
+
+    trace = lsh_index.last_trace()
+    assert stats["queries"] == 5 and set(trace) == set(counters)
+    assert trace["visited"] == 3 + 2 and trace["candidates"] == trace["distances"] > 0
+    assert trace["bytes"] == trace["distances"] * 8 * 4
+    assert stats["visited"]["total"] == 5 * 5 and sum(stats["visited"]["buckets"]) == 5
+    assert lsh_index.stats(reset=True)["queries"] == 5
+    assert lsh_index.stats()["queries"] == 0
@@ -0,0 +1,327 @@
+import array
+import struct
+import threading
+
+import pytest
+import numpy as np
+from IndexBuilder.hash_index import LSHIndex
+from IndexBuilder.hnsw_index import HNSWIndex
+
+
+def brute_force_knn(data, query, k):
+    distances = np.linalg.norm(data - query, axis=1)
+    return np.argsort(distances, kind="stable")[:k]
+
+
+@pytest.mark.unit
+def test_hnsw_index_insert_and_knn():
+    """A single inserted point is its own nearest neighbour."""
+    index = HNSWIndex()
+    point = np.array([0.5, 0.7], dtype=np.float32)
+
+    assert index.insert(point) == 0
+    ids, distances = index.knn(point, k=1)
+
+    assert list(ids) == [0]
+    assert distances[0] == pytest.approx(0.0)
+    assert len(index) == 1
+    assert np.array_equal(index.get(0), point)
+
+
+@pytest.mark.unit
+def test_hnsw_index_recall_against_brute_force():
+    """With a generous ef_search the graph finds almost every true neighbour."""
+    rng = np.random.default_rng(0)
+    data = rng.standard_normal((2000, 32)).astype(np.float32)
+    queries = rng.standard_normal((50, 32)).astype(np.float32)
+    index = HNSWIndex(M=16, ef_construction=100, ef_search=100, seed=1)
+    index.insert_batch(data, num_threads=1)
+
+    ids, distances = index.knn_batch(queries, 10)
+
+    assert ids.shape == (50, 10) and distances.shape == (50, 10)
+    hits = sum(len(set(ids[q]) & set(brute_force_knn(data, queries[q], 10))) for q in range(len(queries)))
+    assert hits / (10 * len(queries)) > 0.9
+    assert np.all(np.diff(distances, axis=1) >= 0)
+    expected = np.linalg.norm(data[ids[0]] - queries[0], axis=1)
+    assert np.allclose(distances[0], expected, rtol=1e-4, atol=1e-5)
+
+
+@pytest.mark.unit
+def test_hnsw_index_incremental_insert():
+    """Points inserted after a batch are searchable and keep consecutive ids."""
+    rng = np.random.default_rng(1)
+    data = rng.standard_normal((300, 8)).astype(np.float32)
+    index = HNSWIndex(M=8, ef_construction=64, seed=2)
+    index.insert_batch(data[:200])
+    for i, point in enumerate(data[200:]):
+        assert index.insert(point) == 200 + i
+
+    assert len(index) == 300
+    for i in (0, 150, 250, 299):
+        ids, _ = index.knn(data[i], k=1, ef_search=64)
+        assert ids[0] == i
+
+
+@pytest.mark.unit
+def test_hnsw_index_batch_pads_missing_neighbours():
+    """k larger than the index pads the missing entries with -1 / inf."""
+    index = HNSWIndex()
+    index.insert_batch(np.array([[0.0, 0.0], [1.0, 1.0]], dtype=np.float32))
+
+    ids, distances = index.knn_batch(np.array([[0.0, 0.0]], dtype=np.float32), 4)
+
+    assert list(ids[0]) == [0, 1, -1, -1]
+    assert np.isinf(distances[0, 2:]).all()
+
+
+@pytest.mark.unit
+def test_hnsw_index_parameters():
+    """ef_search is adjustable; M and ef_construction are fixed at construction."""
+    index = HNSWIndex(M=12, ef_construction=80, ef_search=20)
+
+    assert index.M == 12
+    assert index.ef_construction == 80
+    index.ef_search = 40
+    assert index.ef_search == 40
+    with pytest.raises(ValueError):
+        index.ef_search = 0
+    with pytest.raises(AttributeError):
+        index.M = 4
+
+
+@pytest.mark.unit
+def test_hnsw_index_invalid_input():
+    """Bad parameters and mismatched dimensions raise errors."""
+    with pytest.raises(ValueError):
+        HNSWIndex(M=1)
+    with pytest.raises(ValueError):
+        HNSWIndex(ef_construction=0)
+
+    index = HNSWIndex()
+    index.insert(np.array([1.0, 2.0], dtype=np.float32))
+    with pytest.raises(TypeError):
+        index.insert("invalid_data")
+    with pytest.raises(ValueError):
+        index.insert(np.array([1.0, 2.0, 3.0], dtype=np.float32))
+    with pytest.raises(ValueError):
+        index.knn(np.array([1.0], dtype=np.float32), k=1)
+    with pytest.raises(IndexError):
+        index.get(5)
+
+
+@pytest.mark.unit
+def test_hnsw_index_accepts_buffers():
+    """memoryview and array.array inputs give the same graph and neighbours as ndarrays."""
+    rng = np.random.default_rng(8)
+    data = rng.standard_normal((200, 8)).astype(np.float32)
+    index = HNSWIndex(M=8, seed=2)
+    index.insert_batch(memoryview(data[:199]), num_threads=1)
+    assert index.insert(array.array("f", data[199].tolist())) == 199
+
+    ids, _ = index.knn(memoryview(data[199]), k=1)
+    assert ids[0] == 199
+    assert np.array_equal(index.knn_batch(memoryview(data[:5]), 3)[0], index.knn_batch(data[:5], 3)[0])
+
+@pytest.mark.unit
+def test_hnsw_index_save_and_load(tmp_path):
+    """A loaded graph returns the same neighbours and can keep growing; other index kinds are refused."""
+    rng = np.random.default_rng(5)
+    data = rng.standard_normal((500, 16)).astype(np.float32)
+    index = HNSWIndex(M=8, ef_construction=64, ef_search=32, seed=3)
+    index.insert_batch(data, num_threads=1)
+    path = tmp_path / "hnsw.idx"
+    index.save(path)
+
+    loaded = HNSWIndex.load(path)
+
+    assert len(loaded) == 500
+    assert loaded.M == 8 and loaded.ef_construction == 64 and loaded.ef_search == 32
+    ids, distances = index.knn_batch(data[:20], 5)
+    loaded_ids, loaded_distances = loaded.knn_batch(data[:20], 5)
+    assert np.array_equal(loaded_ids, ids)
+    assert np.array_equal(loaded_distances, distances)
+
+    assert loaded.insert(data[0] + 0.5) == 500
+    with pytest.raises(ValueError):
+        LSHIndex.load(path)
+
+
+def level0_offset(raw, num_points, M):
+    """Byte offset of the layer-0 link lists, found through the file's section directory."""
+    num_sections, directory_offset = struct.unpack_from("<12xI Q", raw, 8)
+    for i in range(num_sections):
+        offset, count, element_size = struct.unpack_from("<QQI", raw, directory_offset + 24 * i)
+        if element_size == 4 and count == num_points * (1 + 2 * M):
+            return offset
+    raise AssertionError("no layer-0 section")
+
+
+@pytest.mark.unit
+def test_hnsw_index_load_rejects_corrupt_links(tmp_path):
+    """Link lists that overflow their layer or name missing points are refused at load time."""
+    rng = np.random.default_rng(7)
+    index = HNSWIndex(M=8, seed=3)
+    index.insert_batch(rng.standard_normal((500, 8)).astype(np.float32), num_threads=1)
+    path = tmp_path / "hnsw.idx"
+    index.save(path)
+    raw = path.read_bytes()
+    level0 = level0_offset(raw, 500, 8)
+
+    for position, value in [(level0, 17), (level0 + 4, 500)]:
+        corrupt = bytearray(raw)
+        struct.pack_into("<I", corrupt, position, value)
+        corrupt_path = tmp_path / "corrupt.idx"
+        corrupt_path.write_bytes(bytes(corrupt))
+        with pytest.raises(ValueError, match="inconsistent"):
+            HNSWIndex.load(corrupt_path)
+
+@pytest.mark.unit
+def test_save_over_the_file_an_index_was_loaded_from(tmp_path):
+    """Saving a loaded index back to its own file replaces the file without breaking the mapping."""
+    rng = np.random.default_rng(6)
+    data = rng.standard_normal((2000, 32)).astype(np.float32)
+    graph = HNSWIndex(M=8, ef_construction=64, seed=4)
+    graph.insert_batch(data, num_threads=1)
+    lsh_index = LSHIndex(4, 1000, num_tables=2, seed=4)
+    lsh_index.insert_batch(data)
+    graph_path, lsh_path = tmp_path / "graph.idx", tmp_path / "lsh.idx"
+    graph.save(graph_path)
+    lsh_index.save(lsh_path)
+    ids, distances = graph.knn_batch(data[:10], 5)
+    found = lsh_index.query_batch(data[:10], 5)[0]
+
+    graph = HNSWIndex.load(graph_path)
+    graph.ef_search = 40
+    graph.save(graph_path)
+    assert np.array_equal(graph.knn_batch(data[:10], 5)[0], ids)
+    reloaded = HNSWIndex.load(graph_path)
+    assert reloaded.ef_search == 40
+    assert np.array_equal(reloaded.knn_batch(data[:10], 5)[1], distances)
+
+    lsh_index = LSHIndex.load(lsh_path)
+    assert lsh_index.remove(int(np.setdiff1d(np.arange(2000), found)[-1]))
+    lsh_index.save(lsh_path)
+    assert np.array_equal(lsh_index.query_batch(data[:10], 5)[0], found)
+    assert len(LSHIndex.load(lsh_path)) == 1999
+    assert sorted(p.name for p in tmp_path.iterdir()) == ["graph.idx", "lsh.idx"]
+
+
+@pytest.mark.unit
+@pytest.mark.parametrize("storage, bytes_per_vector, min_recall", [("float32", 128, 0.9), ("float16", 64, 0.9),
+                                                                    ("int8", 48, 0.85)])
+def test_hnsw_index_storage_modes(tmp_path, storage, bytes_per_vector, min_recall):
+    """Compact storage shrinks every vector and keeps recall; the storage survives save and load."""
+    rng = np.random.default_rng(6)
+    data = rng.standard_normal((2000, 32)).astype(np.float32)
+    queries = rng.standard_normal((50, 32)).astype(np.float32)
+    index = HNSWIndex(M=16, ef_construction=100, ef_search=100, seed=1, storage=storage)
+    index.insert_batch(data, num_threads=1)
+
+    assert index.storage == storage
+    assert index.bytes_per_vector == bytes_per_vector
+    ids, distances = index.knn_batch(queries, 10)
+    hits = sum(len(set(ids[q]) & set(brute_force_knn(data, queries[q], 10))) for q in range(len(queries)))
+    assert hits / (10 * len(queries)) > min_recall
+    assert np.allclose(index.get(7), data[7], atol=0.02)
+    expected = np.linalg.norm(data[ids[0]] - queries[0], axis=1)
+    assert np.allclose(distances[0], expected, rtol=0.02)
+
+    path = tmp_path / "hnsw.idx"
+    index.save(path)
+    loaded = HNSWIndex.load(path)
+    assert loaded.storage == storage
+    assert np.array_equal(loaded.knn_batch(queries, 10)[0], ids)
+
+    with pytest.raises(ValueError):
+        HNSWIndex(storage="float64")
+
+
+@pytest.mark.unit
+@pytest.mark.parametrize("metric", ["ip", "cosine", "manhattan"])
+def test_hnsw_index_metrics(tmp_path, metric):
+    """A graph built for a metric ranks by it, reports its values and keeps it across save and load."""
+    rng = np.random.default_rng(9)
+    data = rng.standard_normal((1000, 16)).astype(np.float32)
+    queries = rng.standard_normal((30, 16)).astype(np.float32)
+    index = HNSWIndex(M=16, ef_construction=100, ef_search=100, seed=2, metric=metric)
+    index.insert_batch(data, num_threads=1)
+
+    if metric == "ip":
+        values = queries @ data.T
+    elif metric == "cosine":
+        values = (queries @ data.T) / np.outer(np.linalg.norm(queries, axis=1), np.linalg.norm(data, axis=1))
+    else:
+        values = -np.abs(queries[:, None, :] - data[None, :, :]).sum(axis=2)
+    assert index.metric == metric
+    ids, distances = index.knn_batch(queries, 10)
+    truth = np.argsort(-values, axis=1, kind="stable")[:, :10]
+    hits = sum(len(set(ids[q]) & set(truth[q])) for q in range(len(queries)))
+    assert hits / (10 * len(queries)) > 0.9
+    reported = np.take_along_axis(values, ids, axis=1)
+    assert np.allclose(distances, reported if metric != "manhattan" else -reported, rtol=1e-4, atol=1e-4)
+
+    path = tmp_path / "hnsw.idx"
+    index.save(path)
+    loaded = HNSWIndex.load(path)
+    assert loaded.metric == metric
+    assert np.array_equal(loaded.knn_batch(queries, 10)[0], ids)
+
+    with pytest.raises(ValueError):
+        HNSWIndex(metric="chebyshev")
+
+
+@pytest.mark.unit
+def test_hnsw_index_query_stats():
+    """stats() summarises every counted query and last_trace() the last single one."""
+    rng = np.random.default_rng(8)
+    data = rng.standard_normal((500, 16)).astype(np.float32)
+    index = HNSWIndex(M=8, ef_construction=50, ef_search=20, seed=3)
+    index.insert_batch(data, num_threads=1)
+    counters = ["latency_ns", "distances", "visited", "candidates", "bytes", "hash_ns", "probe_ns", "scan_ns",
+                "select_ns"]
+    assert index.stats()["queries"] == 0  # Inserts are not counted
+
+    index.knn_batch(data[:3], 5)
+    index.knn(data[0], k=5)
+    stats = index.stats()
+    assert set(stats) == {"enabled", "queries", *counters}
+    if not stats["enabled"]:
+        assert stats["queries"] == 0 and index.last_trace() is None
+        return
+
+    trace = index.last_trace()
+    assert stats["queries"] == 4 and set(trace) == set(counters)
+    assert trace["candidates"] == 20 and trace["distances"] >= trace["visited"] > 0
+    assert trace["bytes"] == trace["distances"] * 16 * 4
+    assert index.stats(reset=True)["queries"] == 4
+    assert index.stats()["queries"] == 0
+
+
+@pytest.mark.unit
+def test_hnsw_index_refuses_queries_during_insert_batch():
+    """A query or insert from another thread while insert_batch runs raises instead of reading freed memory."""
+    rng = np.random.default_rng(10)
+    data = rng.standard_normal((20000, 32)).astype(np.float32)
+    index = HNSWIndex(M=8, ef_construction=100, seed=5)
+    index.insert_batch(data[:100], num_threads=1)
+    writer = threading.Thread(target=index.insert_batch, args=(data[100:],), kwargs={"num_threads": 1})
+
+    refused = inserted = 0
+    writer.start()
+    while writer.is_alive():
+        for call in (lambda: index.knn(data[0], k=5), lambda: index.knn_batch(data[:2], 5)):
+            try:
+                call()
+            except RuntimeError:
+                refused += 1
+        try:
+            index.insert(data[0])
+            inserted += 1
+        except RuntimeError:
+            refused += 1
+    writer.join()
+
+    assert refused > 0
+    assert len(index) == 20000 + inserted
+    assert index.knn(data[0], k=1)[0].tolist() == [0]
@@ -0,0 +1,65 @@
+import numpy as np
+import pytest
+from IndexBuilder.hash_index import LSHIndex
+from IndexBuilder.sharded import ShardedIndex
+from IndexBuilder.tree_index import KDTree
+
+
+@pytest.mark.unit
+def test_sharded_kdtree_matches_single_tree():
+    """Merged top-k of the shards equals the top-k of one tree over every point, in global ids."""
+    rng = np.random.default_rng(3)
+    points = rng.standard_normal((1000, 4))
+    queries = rng.standard_normal((20, 4))
+    tree = KDTree(points, leaf_size=8)
+    with ShardedIndex.partition(points, 4, lambda rows: KDTree(rows, leaf_size=8)) as sharded:
+        assert sharded.num_shards == 4 and len(sharded) == 1000
+        ids, distances = sharded.knn_batch(queries, 5)
+        expected_ids, expected_distances = tree.knn_batch(queries, 5)
+        assert np.array_equal(ids, expected_ids)
+        assert np.allclose(distances, expected_distances)
+
+        found, _ = sharded.knn(queries[0], k=3, metric="manhattan")
+        assert found.tolist() == tree.knn(queries[0], k=3, metric="manhattan")[0].tolist()
+
+        latencies = sharded.shard_latencies()
+        assert latencies["last"].shape == (4,) and np.all(latencies["max"] >= latencies["last"])
+
+
+@pytest.mark.unit
+def test_sharded_filter_uses_global_ids():
+    """Filters name global ids and are translated for every shard."""
+    rng = np.random.default_rng(4)
+    points = rng.standard_normal((600, 3))
+    tenant = rng.integers(0, 5, size=600)
+    query = rng.standard_normal(3)
+    with ShardedIndex.partition(points, 3, lambda rows: KDTree(rows)) as sharded:
+        for filter, accepted in [
+            ((tenant, "==", 2), tenant == 2),
+            ((tenant, "in", [1, 4]), np.isin(tenant, [1, 4])),
+            (tenant < 2, tenant < 2),
+            (np.flatnonzero(tenant == 3), tenant == 3),
+        ]:
+            rows = np.flatnonzero(accepted)
+            expected = rows[np.argsort(np.linalg.norm(points[rows] - query, axis=1), kind="stable")[:4]]
+            assert sharded.knn(query, k=4, filter=filter)[0].tolist() == expected.tolist()
+
+
+@pytest.mark.unit
+def test_sharded_lsh_pads_missing_neighbours():
+    """LSH shards are queried through query_batch, and unfilled slots stay -1 / inf."""
+    rng = np.random.default_rng(5)
+    points = rng.standard_normal((30, 8)).astype(np.float32)
+
+    def build(rows):
+        index = LSHIndex(4, 100, num_tables=2, seed=1)
+        index.insert_batch(rows)
+        return index
+
+    with ShardedIndex.partition(points, 2, build) as sharded:
+        ids, distances = sharded.knn_batch(points[:3], 50)
+        assert ids.shape == (3, 50)
+        rows = np.arange(3)
+        assert np.array_equal(ids[:, 0], rows) and np.allclose(distances[:, 0], 0.0)
+        assert np.all(np.diff(distances, axis=1)[np.isfinite(distances[:, 1:])] >= 0)
+        assert np.all((ids == -1) == np.isinf(distances))
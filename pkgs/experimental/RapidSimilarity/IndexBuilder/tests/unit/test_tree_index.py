@@ -1,3 +1,7 @@
+import random
+import threading
+
+import numpy as np
 import pytest
 from IndexBuilder import tree_index
 
@@ -39,3 +43,304 @@ def test_nearest_neighbor_parametrized(points, target, expected):
     nearest = tree_index.nearestNeighbor(points, target)
 
     assert nearest == expected, f"Expected {expected}, got {nearest}"
+
+
+@pytest.mark.unit
+def test_nearest_neighbor_matches_brute_force():
+    """Test nearest neighbor on a set spanning many leaf buckets against brute force."""
+    rng = random.Random(0)
+    points = [[rng.uniform(-10, 10) for _ in range(4)] for _ in range(500)]
+
+    for _ in range(20):
+        target = [rng.uniform(-10, 10) for _ in range(4)]
+        expected = min(
+            points, key=lambda p: sum((a - b) ** 2 for a, b in zip(p, target))
+        )
+
+        nearest = tree_index.nearestNeighbor(points, target)
+
+        assert nearest == expected, f"Expected {expected}, got {nearest}"
+
+
+@pytest.mark.unit
+def test_kdtree_knn_returns_sorted_indices_and_distances():
+    """Test that a persistent KDTree answers repeated k-NN queries."""
+    points = np.array([[1.0, 2.0], [3.0, 4.0], [5.0, 6.0], [7.0, 8.0]])
+    tree = tree_index.KDTree(points, leaf_size=1)
+
+    indices, distances = tree.knn(np.array([4.0, 5.0]), k=3)
+
+    assert list(indices) == [1, 2, 0]
+    assert np.allclose(distances, [np.sqrt(2), np.sqrt(2), np.sqrt(18)])
+    assert len(tree) == len(points)
+
+    indices, _ = tree.knn(np.array([7.0, 8.0]), k=10)
+    assert list(indices) == [3, 2, 1, 0]
+
+
+@pytest.mark.unit
+def test_kdtree_radius_matches_brute_force():
+    """Test radius search against a brute-force scan."""
+    rng = np.random.default_rng(0)
+    points = rng.uniform(-1, 1, size=(300, 3))
+    tree = tree_index.KDTree(points, leaf_size=8)
+    query = np.zeros(3)
+
+    indices, distances = tree.radius(query, 0.5)
+
+    expected = np.flatnonzero(np.linalg.norm(points, axis=1) <= 0.5)
+    assert sorted(indices.tolist()) == sorted(expected.tolist())
+    assert np.all(np.diff(distances) >= 0)
+
+
+@pytest.mark.unit
+def test_kdtree_rejects_mismatched_query():
+    """Test that queries with the wrong dimension raise ValueError."""
+    tree = tree_index.KDTree(np.zeros((4, 2)))
+
+    with pytest.raises(ValueError):
+        tree.knn(np.zeros(3), k=1)
+
+
+@pytest.mark.unit
+def test_kdtree_rejects_short_query_after_removing_every_point():
+    """Removed points may stay in the segments until compaction, so the dimension check still applies."""
+    tree = tree_index.KDTree(np.random.default_rng(2).standard_normal((64, 8)), leaf_size=4)
+    for i in range(64):
+        assert tree.remove(i)
+    assert len(tree) == 0
+
+    with pytest.raises(ValueError):
+        tree.knn(np.zeros(2), k=1)
+    with pytest.raises(ValueError):
+        tree.knn_batch(np.zeros((3, 2)), 1)
+    with pytest.raises(ValueError):
+        tree.radius(np.zeros(2), 1.0)
+    assert tree.knn(np.zeros(8), k=1)[0].size == 0
+
+
+@pytest.mark.unit
+def test_kdtree_knn_batch_matches_knn():
+    """Test that batched k-NN returns the same rows as one knn call per query."""
+    rng = np.random.default_rng(1)
+    points = rng.standard_normal((400, 4))
+    queries = rng.standard_normal((25, 4))
+    tree = tree_index.KDTree(points, leaf_size=16)
+
+    indices, distances = tree.knn_batch(queries, 5, num_threads=2)
+
+    assert indices.shape == (25, 5)
+    for row, query in enumerate(queries):
+        expected_indices, expected_distances = tree.knn(query, k=5)
+        assert indices[row].tolist() == expected_indices.tolist()
+        assert np.allclose(distances[row], expected_distances)
+
+
+@pytest.mark.unit
+@pytest.mark.parametrize("metric", ["sqeuclidean", "manhattan"])
+def test_kdtree_metrics_match_brute_force(metric):
+    """Test that k-NN and radius search rank and report by the requested metric."""
+    rng = np.random.default_rng(2)
+    points = rng.standard_normal((400, 3))
+    tree = tree_index.KDTree(points, leaf_size=8)
+    query = np.zeros(3)
+    if metric == "manhattan":
+        exact = np.abs(points).sum(axis=1)
+    else:
+        exact = (points ** 2).sum(axis=1)
+
+    indices, distances = tree.knn(query, k=5, metric=metric)
+
+    assert indices.tolist() == np.argsort(exact, kind="stable")[:5].tolist()
+    assert np.allclose(distances, np.sort(exact)[:5])
+    batch_indices, _ = tree.knn_batch(points[:10], 3, metric=metric)
+    assert batch_indices[:, 0].tolist() == list(range(10))
+    indices, _ = tree.radius(query, 0.8, metric=metric)
+    assert sorted(indices.tolist()) == np.flatnonzero(exact <= 0.8).tolist()
+
+    with pytest.raises(ValueError):
+        tree.knn(query, k=5, metric="cosine")  # no per-coordinate bound to prune with
+
+
+@pytest.mark.unit
+def test_nearest_neighbor_accepts_arrays():
+    """Test that nearestNeighbor reads NumPy arrays as well as lists."""
+    points = np.array([[1.0, 2.0], [3.0, 4.0], [5.0, 6.0]], dtype=np.float32)
+
+    assert tree_index.nearestNeighbor(points, np.array([4.9, 6.1])) == [5.0, 6.0]
+    assert tree_index.nearestNeighbor(points.tolist(), [3.1, 3.9]) == [3.0, 4.0]
+
+    with pytest.raises(ValueError):
+        tree_index.nearestNeighbor([[1.0, 2.0], [3.0]], [1.0, 2.0])
+
+
+@pytest.mark.unit
+def test_kdtree_save_and_load(tmp_path):
+    """A tree loaded from disk answers queries exactly like the one that was saved."""
+    rng = np.random.default_rng(3)
+    points = rng.standard_normal((500, 4))
+    tree = tree_index.KDTree(points, leaf_size=8)
+    path = tmp_path / "tree.idx"
+    tree.save(path)
+
+    loaded = tree_index.KDTree.load(str(path))
+
+    assert len(loaded) == len(tree)
+    for query in rng.standard_normal((10, 4)):
+        expected = tree.knn(query, k=5)
+        actual = loaded.knn(query, k=5)
+        assert np.array_equal(actual[0], expected[0])
+        assert np.allclose(actual[1], expected[1])
+
+    truncated = tmp_path / "truncated.idx"
+    truncated.write_bytes(path.read_bytes()[:100])
+    with pytest.raises(ValueError):
+        tree_index.KDTree.load(truncated)
+
+
+@pytest.mark.unit
+def test_kdtree_float32_storage(tmp_path):
+    """A float32 tree finds the same neighbours as the float64 one and reloads as float32."""
+    rng = np.random.default_rng(4)
+    points = rng.standard_normal((1000, 6))
+    queries = rng.standard_normal((20, 6))
+    tree = tree_index.KDTree(points, leaf_size=8)
+    tree32 = tree_index.KDTree(points.astype(np.float32), leaf_size=8, storage="float32")
+
+    assert tree.storage == "float64" and tree32.storage == "float32"
+    indices, distances = tree.knn_batch(queries, 5)
+    indices32, distances32 = tree32.knn_batch(queries, 5)
+    assert np.array_equal(indices32, indices)
+    assert np.allclose(distances32, distances, rtol=1e-5)
+
+    path = tmp_path / "tree32.idx"
+    tree32.save(path)
+    loaded = tree_index.KDTree.load(path)
+    assert loaded.storage == "float32"
+    assert np.array_equal(loaded.knn_batch(queries, 5)[0], indices32)
+
+    with pytest.raises(ValueError):
+        tree_index.KDTree(points, storage="int8")
+
+
+@pytest.mark.unit
+def test_kdtree_insert_and_remove(tmp_path):
+    """Inserted points are found at once and removed ones never again, before and after compaction."""
+    rng = np.random.default_rng(5)
+    points = rng.standard_normal((300, 3))
+    tree = tree_index.KDTree(points, leaf_size=8, delta_capacity=16)
+
+    added = rng.standard_normal((100, 3))
+    assert tree.insert(added[0]) == 300
+    assert np.array_equal(tree.insert_batch(added[1:]), np.arange(301, 400))
+    removed = list(range(0, 400, 4))
+    assert all(tree.remove(i) for i in removed)
+    assert not tree.remove(0) and not tree.remove(400)
+    assert len(tree) == 300
+
+    everything = np.vstack([points, added])
+    live = np.setdiff1d(np.arange(400), removed)
+
+    def check(index):
+        for query in rng.standard_normal((10, 3)):
+            order = np.argsort(np.linalg.norm(everything[live] - query, axis=1), kind="stable")
+            indices, _ = index.knn(query, k=5)
+            assert np.array_equal(indices, live[order[:5]])
+
+    check(tree)
+    tree.compact()
+    assert tree.delta_size == 0 and tree.num_segments == 1
+    check(tree)
+
+    path = tmp_path / "dynamic.idx"
+    tree.save(path)
+    loaded = tree_index.KDTree.load(path)
+    assert len(loaded) == 300
+    check(loaded)
+    assert not loaded.remove(4)
+    assert loaded.insert(added[0]) == 400
+
+
+@pytest.mark.unit
+def test_kdtree_filter():
+    """Filtered knn and radius searches only consider the points the filter accepts."""
+    rng = np.random.default_rng(6)
+    points = rng.standard_normal((1000, 3))
+    tenant = rng.integers(0, 10, size=1000).astype(np.int32)
+    tree = tree_index.KDTree(points, leaf_size=8)
+    queries = rng.standard_normal((10, 3))
+
+    for filter, accepted in [
+        ((tenant, "==", 2), tenant == 2),
+        ((tenant, "in", [0, 9]), np.isin(tenant, [0, 9])),
+        (tenant < 3, tenant < 3),
+        (np.flatnonzero(tenant == 5), tenant == 5),
+    ]:
+        rows = np.flatnonzero(accepted)
+        indices, _ = tree.knn_batch(queries, 4, filter=filter)
+        for row, query in enumerate(queries):
+            distances = np.linalg.norm(points[rows] - query, axis=1)
+            expected = rows[np.argsort(distances, kind="stable")[:4]]
+            assert indices[row].tolist() == expected.tolist()
+            assert tree.knn(query, k=4, filter=filter)[0].tolist() == expected.tolist()
+            found, _ = tree.radius(query, 1.0, filter=filter)
+            assert sorted(found.tolist()) == sorted(rows[distances <= 1.0].tolist())
+
+
+@pytest.mark.unit
+def test_kdtree_queries_during_updates():
+    """Queries from other threads see consistent points while inserts, removes and compactions run."""
+    rng = np.random.default_rng(7)
+    points = rng.standard_normal((2000, 3))
+    tree = tree_index.KDTree(points[:100], leaf_size=8, delta_capacity=32)
+    errors = []
+
+    def query(seed):
+        for query in np.random.default_rng(seed).standard_normal((200, 3)):
+            indices, distances = tree.knn_batch(query[None, :], 5)
+            expected = np.linalg.norm(points[indices[0]] - query, axis=1)
+            if not np.allclose(distances[0], expected) or 0 in indices[0]:
+                errors.append(indices[0])
+
+    tree.remove(0)
+    readers = [threading.Thread(target=query, args=(seed,)) for seed in range(2)]
+    for reader in readers:
+        reader.start()
+    for start in range(100, 2000, 50):
+        tree.insert_batch(points[start : start + 50])
+        tree.remove(start)
+    for reader in readers:
+        reader.join()
+    assert not errors
+    tree.compact()
+    assert len(tree) == 2000 - 39
+
+
+
+@pytest.mark.unit
+@pytest.mark.parametrize("storage, item_size", [("float64", 8), ("float32", 4)])
+def test_kdtree_query_stats(storage, item_size):
+    """stats() summarises every counted query and last_trace() the last single one."""
+    rng = np.random.default_rng(9)
+    points = rng.standard_normal((500, 4))
+    tree = tree_index.KDTree(points, leaf_size=8, storage=storage)
+    tree.insert_batch(rng.standard_normal((20, 4)))
+    counters = ["latency_ns", "distances", "visited", "candidates", "bytes", "hash_ns", "probe_ns", "scan_ns",
+                "select_ns"]
+
+    tree.knn_batch(points[:3], 5)
+    tree.radius(points[0], 0.5)
+    tree.knn(points[0], k=len(tree))
+    stats = tree.stats()
+    assert set(stats) == {"enabled", "queries", *counters}
+    if not stats["enabled"]:
+        assert stats["queries"] == 0 and tree.last_trace() is None
+        return
+
+    trace = tree.last_trace()
+    assert stats["queries"] == 5 and set(trace) == set(counters)
+    assert trace["candidates"] == trace["distances"] == 520 and trace["visited"] > 0
+    assert trace["bytes"] == 520 * 4 * item_size
+    assert stats["distances"]["max"] == 520 and stats["distances"]["total"] < 5 * 520
+    assert tree.stats(reset=True)["queries"] == 5
+    assert tree.stats()["queries"] == 0
@@ -2,105 +2,745 @@
 #include <numpy/arrayobject.h>
 #include <vector>
 #include <algorithm>
+#include <atomic>
 #include <random>
 #include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <exception>
+#include <utility>
+#include <memory>
+#include <optional>
+#include <string>
+#include <stdexcept>
 
-// Function to compute the Euclidean distance between two points
-double euclidean_distance(const std::vector<double>& a, const std::vector<double>& b) {
-    double sum = 0.0;
-    for (size_t i = 0; i < a.size(); ++i) {
-        double diff = a[i] - b[i];
-        sum += diff * diff;
-    }
-    return std::sqrt(sum);
-}
+#include "ivf_index.h"
+#include "DistanceMetrics/buffer_view.h"
+#include "DistanceMetrics/filter_arg.h"
+#include "DistanceMetrics/metrics.h"
+#include "DistanceMetrics/query_stats.h"
+#include "DistanceMetrics/simd_kernels.h"
+#include "DistanceMetrics/stats_dict.h"
+#include "DistanceMetrics/thread_pool.h"
+#include "DistanceMetrics/topk.h"
 
-// Class for approximate nearest neighbor search
+// Class for approximate nearest neighbor search. build() trains an inverted-file index over a
+// dataset; search() then scans only the nprobe() lists nearest to the query, where nprobe grows
+// with accuracy from one list (accuracy 0) to all of them (accuracy 1, an exact search). With
+// pq_m > 0 the lists hold product-quantization codes instead of the rows and distances are estimates;
+// nlist = 1 then gives an exhaustive scan over the compressed dataset. Uncompressed rows can also be
+// kept as float32, float16 or int8 instead of float64. Every search takes a metric trait from
+// metrics.h; Euclidean distance is the default.
 class ApproximateQueryEngine {
 public:
+    typedef std::pair<double, size_t> Neighbor;  // (metric value, row index)
+
     ApproximateQueryEngine(size_t num_neighbors, double accuracy)
         : num_neighbors_(num_neighbors), accuracy_(accuracy) {}
 
-    // Method to perform the approximate nearest neighbor search
-    std::vector<size_t> query(const std::vector<std::vector<double>>& dataset, const std::vector<double>& query_point) {
-        std::vector<std::pair<double, size_t>> distances;
-        
-        // Calculate distances
-        for (size_t i = 0; i < dataset.size(); ++i) {
-            double dist = euclidean_distance(dataset[i], query_point);
-            distances.emplace_back(dist, i);
+    // Train the index on the row-major (n, dim) dataset, which is copied (or encoded) into the lists
+    void build(const double* dataset, size_t n, size_t dim, size_t nlist = 0, size_t pq_m = 0, uint64_t seed = 0,
+               size_t num_threads = 0, std::optional<StorageType> storage = std::nullopt) {
+        index_.reset(new IVFIndex(dataset, n, dim, nlist, pq_m, seed, num_threads, 10, storage));
+    }
+
+    // The engine settings followed by the IVF index sections, in one on-disk index file
+    void save(const std::string& path) const {
+        if (!index_) {
+            throw std::logic_error("ApproximateQueryEngine has no index; call build() first.");
+        }
+        index_io::Writer writer(path, index_io::Kind::IVF);
+        writer.write(std::vector<uint64_t>{num_neighbors_});
+        writer.write(std::vector<double>{accuracy()});
+        index_->save(writer);
+        writer.commit();
+    }
+
+    // Engine over a saved index; the lists are memory-mapped rather than read
+    static std::unique_ptr<ApproximateQueryEngine> load(const std::string& path) {
+        index_io::Reader reader(path, index_io::Kind::IVF);
+        const size_t num_neighbors = static_cast<size_t>(reader.vector<uint64_t>(1)[0]);
+        const double accuracy = reader.vector<double>(1)[0];
+        if (!(accuracy >= 0.0 && accuracy <= 1.0)) {
+            throw std::invalid_argument("IVF index file is inconsistent.");
+        }
+        std::unique_ptr<ApproximateQueryEngine> engine(new ApproximateQueryEngine(num_neighbors, accuracy));
+        engine->index_.reset(new IVFIndex(reader));
+        return engine;
+    }
+
+    const IVFIndex* index() const { return index_.get(); }
+    size_t num_neighbors() const { return num_neighbors_; }
+    double accuracy() const { return accuracy_.load(std::memory_order_relaxed); }
+    void set_accuracy(double accuracy) { accuracy_.store(accuracy, std::memory_order_relaxed); }
+    size_t nprobe() const { return index_ ? IVFIndex::nprobe_for_accuracy(accuracy(), index_->nlist()) : 0; }
+
+    // Counters of the queries run under a stats::QueryScope on this engine (query_stats.h)
+    stats::QueryStats& query_stats() const { return query_stats_; }
+
+    // k nearest indexed rows of query_point accepted by filter as (metric value, index), nearest
+    // first; requires build()
+    template <typename Metric = metrics::Euclidean, typename Filter = AcceptAll>
+    std::vector<Neighbor> search(const double* query_point, size_t k, const Filter& filter = Filter()) const {
+        return search<Metric>(query_point, k, nprobe(), filter);
+    }
+
+    // The same over nprobe lists, which a batch reads once so that every query probes as many
+    template <typename Metric = metrics::Euclidean, typename Filter = AcceptAll>
+    std::vector<Neighbor> search(const double* query_point, size_t k, size_t nprobe,
+                                 const Filter& filter = Filter()) const {
+        if (!index_) {
+            throw std::logic_error("ApproximateQueryEngine has no index; call build() first.");
         }
+        return index_->search<Metric>(query_point, k, nprobe, filter);
+    }
+
+    template <typename Metric = metrics::Euclidean>
+    std::vector<Neighbor> search(const double* query_point) const {
+        return search<Metric>(query_point, num_neighbors_);
+    }
 
-        // Sort distances and retrieve nearest neighbors
-        std::sort(distances.begin(), distances.end());
-        std::vector<size_t> neighbors;
-        for (size_t i = 0; i < num_neighbors_ && i < distances.size(); ++i) {
-            neighbors.push_back(distances[i].second);
+    // Exhaustive search of a row-major (n, dim) dataset that has no index; returns (metric value,
+    // index) pairs, nearest first. Candidates are ranked in a size-k heap, so nothing proportional
+    // to n is allocated or sorted and ranks are turned into values (roots, for Euclidean) for the k
+    // survivors only.
+    template <typename Metric = metrics::Euclidean>
+    std::vector<Neighbor> query(const double* dataset, size_t n, size_t dim, const double* query_point) const {
+        TopK<double> best(std::min(num_neighbors_, n));
+        for (size_t i = 0; i < n; ++i) {
+            best.push(Metric::rank(dataset + i * dim, query_point, dim), i);
+        }
+        std::vector<Neighbor> neighbors = best.take_sorted();
+        for (auto& neighbor : neighbors) {
+            neighbor.first = Metric::value(neighbor.first);
         }
-        
         return neighbors;
     }
 
 private:
     size_t num_neighbors_;
-    double accuracy_;
+    // Set under the GIL while query_batch threads read it without; each query reads it once
+    std::atomic<double> accuracy_;
+    std::unique_ptr<IVFIndex> index_;
+    mutable stats::QueryStats query_stats_;
 };
 
 // Python interface for the ApproximateQueryEngine
 static PyObject* approx_query(PyObject* self, PyObject* args) {
     PyObject* dataset_obj;
     PyObject* query_point_obj;
-    size_t num_neighbors;
+    Py_ssize_t num_neighbors;
     double accuracy;
 
-    if (!PyArg_ParseTuple(args, "OOd", &dataset_obj, &query_point_obj, &num_neighbors, &accuracy)) {
+    if (!PyArg_ParseTuple(args, "OOnd", &dataset_obj, &query_point_obj, &num_neighbors, &accuracy)) {
         return NULL;
     }
-
-    // Convert dataset from Python list to C++ vector
-    std::vector<std::vector<double>> dataset;
-    if (!PyList_Check(dataset_obj)) {
+    if (num_neighbors < 0) {
+        PyErr_SetString(PyExc_ValueError, "num_neighbors must be non-negative.");
         return NULL;
     }
-    for (Py_ssize_t i = 0; i < PyList_Size(dataset_obj); ++i) {
-        PyObject* item = PyList_GetItem(dataset_obj, i);
-        if (!PyList_Check(item)) {
-            return NULL;
-        }
-        std::vector<double> point;
-        for (Py_ssize_t j = 0; j < PyList_Size(item); ++j) {
-            PyObject* coord = PyList_GetItem(item, j);
-            point.push_back(PyFloat_AsDouble(coord));
-        }
-        dataset.push_back(point);
-    }
 
-    // Convert query point from Python list to C++ vector
-    std::vector<double> query_point;
-    if (!PyList_Check(query_point_obj)) {
+    // View the dataset and query point in place; lists are converted once
+    BufferView dataset;
+    if (!dataset.acquire(dataset_obj, 2, "Dataset must be a list of lists.")) {
         return NULL;
     }
-    for (Py_ssize_t i = 0; i < PyList_Size(query_point_obj); ++i) {
-        PyObject* coord = PyList_GetItem(query_point_obj, i);
-        query_point.push_back(PyFloat_AsDouble(coord));
+    BufferView query_point;
+    if (!query_point.acquire(query_point_obj, 1, "Query point must be a list.")) {
+        return NULL;
+    }
+    if (dataset.rows() > 0 && query_point.size() != dataset.cols()) {
+        PyErr_SetString(PyExc_ValueError, "Query point must have the same dimension as the dataset.");
+        return NULL;
     }
 
     // Create query engine and perform search
-    ApproximateQueryEngine engine(num_neighbors, accuracy);
-    std::vector<size_t> result = engine.query(dataset, query_point);
+    std::vector<double> dataset_scratch, query_scratch;
+    ApproximateQueryEngine engine(static_cast<size_t>(num_neighbors), accuracy);
+    std::vector<std::pair<double, size_t>> result = engine.query(
+        dataset.data(dataset_scratch), dataset.rows(), dataset.cols(), query_point.data(query_scratch));
 
     // Convert result to Python list
     PyObject* result_list = PyList_New(result.size());
     for (size_t i = 0; i < result.size(); ++i) {
-        PyList_SetItem(result_list, i, PyLong_FromSize_t(result[i]));
+        PyList_SetItem(result_list, i, PyLong_FromSize_t(result[i].second));
     }
 
     return result_list;
 }
 
+// Value that pads missing neighbours: +inf after distances, -inf after similarities
+static double missing_value(metrics::Metric metric) {
+    return metrics::ascending(metric) ? std::numeric_limits<double>::infinity()
+                                      : -std::numeric_limits<double>::infinity();
+}
+
+// Parse a metric keyword, setting ValueError for unknown names
+static bool parse_metric_arg(const char* name, metrics::Metric& metric) {
+    if (!metrics::parse_metric(name, metric)) {
+        PyErr_SetString(PyExc_ValueError, metrics::kUnknownMetric);
+        return false;
+    }
+    return true;
+}
+
+// Batched Python interface: (M, D) queries in, (M, k) indices and distances out
+static PyObject* approx_query_batch(PyObject* self, PyObject* args, PyObject* kwds) {
+    static const char* kwlist[] = {"dataset", "queries", "num_neighbors", "accuracy", "num_threads", "metric", NULL};
+    PyObject* dataset_obj;
+    PyObject* queries_obj;
+    Py_ssize_t num_neighbors;
+    double accuracy;
+    Py_ssize_t num_threads = 0;
+    const char* metric_name = "euclidean";
+    metrics::Metric metric;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "OOnd|ns", const_cast<char**>(kwlist), &dataset_obj, &queries_obj,
+                                     &num_neighbors, &accuracy, &num_threads, &metric_name)) {
+        return NULL;
+    }
+    if (num_neighbors < 0 || num_threads < 0) {
+        PyErr_SetString(PyExc_ValueError, "num_neighbors and num_threads must be non-negative.");
+        return NULL;
+    }
+    if (!parse_metric_arg(metric_name, metric)) {
+        return NULL;
+    }
+
+    BufferView dataset, queries;
+    if (!dataset.acquire(dataset_obj, 2) || !queries.acquire(queries_obj, 2)) {
+        return NULL;
+    }
+    const size_t n = dataset.rows();
+    const size_t dim = dataset.cols();
+    const size_t m = queries.rows();
+    if (n > 0 && m > 0 && queries.cols() != dim) {
+        PyErr_SetString(PyExc_ValueError, "Queries and dataset must have the same dimension.");
+        return NULL;
+    }
+
+    const size_t k = static_cast<size_t>(num_neighbors);
+    npy_intp dims[2] = {static_cast<npy_intp>(m), static_cast<npy_intp>(k)};
+    PyObject* indices = PyArray_SimpleNew(2, dims, NPY_INT64);
+    PyObject* distances = PyArray_SimpleNew(2, dims, NPY_DOUBLE);
+    if (indices == NULL || distances == NULL) {
+        Py_XDECREF(indices);
+        Py_XDECREF(distances);
+        return NULL;
+    }
+
+    // float64 buffers are searched in place; other inputs are widened once before the search
+    std::vector<double> dataset_scratch, query_scratch;
+    const double* data = dataset.data(dataset_scratch);
+    const double* query_data = queries.data(query_scratch);
+    int64_t* index_data = static_cast<int64_t*>(PyArray_DATA(reinterpret_cast<PyArrayObject*>(indices)));
+    double* distance_data = static_cast<double*>(PyArray_DATA(reinterpret_cast<PyArrayObject*>(distances)));
+    const ApproximateQueryEngine engine(k, accuracy);
+    std::exception_ptr error;
+
+    Py_BEGIN_ALLOW_THREADS
+    try {
+        metrics::visit(metric, [&](auto trait) {
+            typedef decltype(trait) Metric;
+            const double pad = missing_value(metric);
+            ThreadPool::instance().parallel_for(m, static_cast<size_t>(num_threads), [&](size_t q) {
+                auto neighbors = engine.query<Metric>(data, n, dim, query_data + q * dim);
+                for (size_t j = 0; j < k; ++j) {
+                    const bool found = j < neighbors.size();
+                    index_data[q * k + j] = found ? static_cast<int64_t>(neighbors[j].second) : -1;
+                    distance_data[q * k + j] = found ? neighbors[j].first : pad;
+                }
+            });
+        });
+    } catch (...) {
+        error = std::current_exception();
+    }
+    Py_END_ALLOW_THREADS
+
+    if (error) {
+        Py_DECREF(indices);
+        Py_DECREF(distances);
+        try {
+            std::rethrow_exception(error);
+        } catch (const std::bad_alloc&) {
+            return PyErr_NoMemory();
+        } catch (const std::exception& e) {
+            PyErr_SetString(PyExc_RuntimeError, e.what());
+            return NULL;
+        }
+    }
+    return Py_BuildValue("(NN)", indices, distances);
+}
+
+// Translate the active C++ exception into a Python exception
+static PyObject* set_python_error() {
+    try {
+        throw;
+    } catch (const std::invalid_argument& e) {
+        PyErr_SetString(PyExc_ValueError, e.what());
+    } catch (const std::bad_alloc&) {
+        PyErr_NoMemory();
+    } catch (const std::exception& e) {
+        PyErr_SetString(PyExc_RuntimeError, e.what());
+    }
+    return NULL;
+}
+
+// Python object owning an ApproximateQueryEngine whose index is built at construction time
+typedef struct {
+    PyObject_HEAD
+    ApproximateQueryEngine* engine;
+} PyApproximateQueryEngine;
+
+static bool check_accuracy(double accuracy) {
+    if (!(accuracy >= 0.0 && accuracy <= 1.0)) {
+        PyErr_SetString(PyExc_ValueError, "accuracy must be between 0 and 1.");
+        return false;
+    }
+    return true;
+}
+
+static bool check_engine(PyApproximateQueryEngine* self) {
+    if (self->engine == NULL) {
+        PyErr_SetString(PyExc_RuntimeError, "ApproximateQueryEngine is not initialized.");
+        return false;
+    }
+    return true;
+}
+
+// num_neighbors argument of a query method; negative means the engine's default
+static size_t neighbors_or_default(PyApproximateQueryEngine* self, Py_ssize_t num_neighbors) {
+    return num_neighbors < 0 ? self->engine->num_neighbors() : static_cast<size_t>(num_neighbors);
+}
+
+static int ApproximateQueryEngine_init(PyApproximateQueryEngine* self, PyObject* args, PyObject* kwds) {
+    static const char* kwlist[] = {"dataset", "num_neighbors", "accuracy", "nlist", "seed", "num_threads", "pq_m",
+                                   "storage", NULL};
+    PyObject* dataset_obj;
+    Py_ssize_t num_neighbors = 10;
+    double accuracy = 0.5;
+    Py_ssize_t nlist = 0;
+    unsigned long long seed = 0;
+    Py_ssize_t num_threads = 0;
+    Py_ssize_t pq_m = 0;
+    const char* storage_name_arg = "float64";
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|ndnKnns", const_cast<char**>(kwlist), &dataset_obj,
+                                     &num_neighbors, &accuracy, &nlist, &seed, &num_threads, &pq_m,
+                                     &storage_name_arg)) {
+        return -1;
+    }
+    // float64 keeps the rows as given; the compact types go through a vector store
+    std::optional<StorageType> storage;
+    if (std::strcmp(storage_name_arg, "float64") != 0) {
+        try {
+            storage = parse_storage(storage_name_arg);
+        } catch (const std::invalid_argument&) {
+            PyErr_SetString(PyExc_ValueError, "storage must be 'float64', 'float32', 'float16' or 'int8'.");
+            return -1;
+        }
+    }
+    if (num_neighbors < 0 || nlist < 0 || num_threads < 0 || pq_m < 0) {
+        PyErr_SetString(PyExc_ValueError, "num_neighbors, nlist, num_threads and pq_m must be non-negative.");
+        return -1;
+    }
+    if (!check_accuracy(accuracy)) {
+        return -1;
+    }
+
+    BufferView dataset;
+    if (!dataset.acquire(dataset_obj, 2, "Dataset must be a list of lists.")) {
+        return -1;
+    }
+    std::vector<double> scratch;
+    const double* data = dataset.data(scratch);
+    ApproximateQueryEngine* engine = NULL;
+    std::exception_ptr error;
+    // Training only reads the dataset buffer, so other Python threads may run meanwhile
+    Py_BEGIN_ALLOW_THREADS
+    try {
+        engine = new ApproximateQueryEngine(static_cast<size_t>(num_neighbors), accuracy);
+        engine->build(data, dataset.rows(), dataset.cols(), static_cast<size_t>(nlist), static_cast<size_t>(pq_m),
+                      seed, static_cast<size_t>(num_threads), storage);
+    } catch (...) {
+        delete engine;
+        engine = NULL;
+        error = std::current_exception();
+    }
+    Py_END_ALLOW_THREADS
+    if (error) {
+        try {
+            std::rethrow_exception(error);
+        } catch (...) {
+            set_python_error();
+            return -1;
+        }
+    }
+
+    delete self->engine;
+    self->engine = engine;
+    return 0;
+}
+
+static void ApproximateQueryEngine_dealloc(PyApproximateQueryEngine* self) {
+    PyTypeObject* type = Py_TYPE(self);
+    delete self->engine;
+    type->tp_free(reinterpret_cast<PyObject*>(self));
+    Py_DECREF(type);
+}
+
+static PyObject* ApproximateQueryEngine_query(PyApproximateQueryEngine* self, PyObject* args, PyObject* kwds) {
+    static const char* kwlist[] = {"query_point", "num_neighbors", "metric", "filter", NULL};
+    PyObject* query_obj;
+    Py_ssize_t num_neighbors = -1;
+    const char* metric_name = "euclidean";
+    PyObject* filter_obj = Py_None;
+    metrics::Metric metric;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|nsO", const_cast<char**>(kwlist), &query_obj, &num_neighbors,
+                                     &metric_name, &filter_obj)) {
+        return NULL;
+    }
+    if (!parse_metric_arg(metric_name, metric) || !check_engine(self)) {
+        return NULL;
+    }
+    FilterArg filter;
+    if (!filter.acquire(filter_obj)) {
+        return NULL;
+    }
+    BufferView query_point;
+    if (!query_point.acquire(query_obj, 1, "Query point must be a list.")) {
+        return NULL;
+    }
+    const IVFIndex* index = self->engine->index();
+    if (index->size() > 0 && query_point.size() != index->dimension()) {
+        PyErr_SetString(PyExc_ValueError, "Query point must have the same dimension as the dataset.");
+        return NULL;
+    }
+
+    std::vector<ApproximateQueryEngine::Neighbor> neighbors;
+    try {
+        std::vector<double> scratch;
+        const double* query_data = query_point.data(scratch);
+        const size_t k = neighbors_or_default(self, num_neighbors);
+        stats::QueryScope scope(self->engine->query_stats(), true);
+        neighbors = metrics::visit(metric, [&](auto trait) {
+            return with_filter(filter.filter(), [&](const auto& accept) {
+                return self->engine->search<decltype(trait)>(query_data, k, accept);
+            });
+        });
+    } catch (...) {
+        return set_python_error();
+    }
+
+    npy_intp dims[1] = {static_cast<npy_intp>(neighbors.size())};
+    PyObject* indices = PyArray_SimpleNew(1, dims, NPY_INT64);
+    PyObject* distances = PyArray_SimpleNew(1, dims, NPY_DOUBLE);
+    if (indices == NULL || distances == NULL) {
+        Py_XDECREF(indices);
+        Py_XDECREF(distances);
+        return NULL;
+    }
+    int64_t* index_data = static_cast<int64_t*>(PyArray_DATA(reinterpret_cast<PyArrayObject*>(indices)));
+    double* distance_data = static_cast<double*>(PyArray_DATA(reinterpret_cast<PyArrayObject*>(distances)));
+    for (size_t i = 0; i < neighbors.size(); ++i) {
+        index_data[i] = static_cast<int64_t>(neighbors[i].second);
+        distance_data[i] = neighbors[i].first;
+    }
+    return Py_BuildValue("(NN)", indices, distances);
+}
+
+static PyObject* ApproximateQueryEngine_query_batch(PyApproximateQueryEngine* self, PyObject* args, PyObject* kwds) {
+    static const char* kwlist[] = {"queries", "num_neighbors", "num_threads", "metric", "filter", NULL};
+    PyObject* queries_obj;
+    Py_ssize_t num_neighbors = -1;
+    Py_ssize_t num_threads = 0;
+    const char* metric_name = "euclidean";
+    PyObject* filter_obj = Py_None;
+    metrics::Metric metric;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|nnsO", const_cast<char**>(kwlist), &queries_obj, &num_neighbors,
+                                     &num_threads, &metric_name, &filter_obj)) {
+        return NULL;
+    }
+    if (num_threads < 0) {
+        PyErr_SetString(PyExc_ValueError, "num_threads must be non-negative.");
+        return NULL;
+    }
+    if (!parse_metric_arg(metric_name, metric) || !check_engine(self)) {
+        return NULL;
+    }
+    BufferView queries;
+    FilterArg filter;
+    if (!queries.acquire(queries_obj, 2) || !filter.acquire(filter_obj)) {
+        return NULL;
+    }
+    const IVFIndex* index = self->engine->index();
+    const size_t m = queries.rows();
+    const size_t dim = queries.cols();
+    if (index->size() > 0 && m > 0 && dim != index->dimension()) {
+        PyErr_SetString(PyExc_ValueError, "Queries and dataset must have the same dimension.");
+        return NULL;
+    }
+
+    const size_t k = neighbors_or_default(self, num_neighbors);
+    npy_intp dims[2] = {static_cast<npy_intp>(m), static_cast<npy_intp>(k)};
+    PyObject* indices = PyArray_SimpleNew(2, dims, NPY_INT64);
+    PyObject* distances = PyArray_SimpleNew(2, dims, NPY_DOUBLE);
+    if (indices == NULL || distances == NULL) {
+        Py_XDECREF(indices);
+        Py_XDECREF(distances);
+        return NULL;
+    }
+
+    std::vector<double> query_scratch;
+    const double* query_data = queries.data(query_scratch);
+    int64_t* index_data = static_cast<int64_t*>(PyArray_DATA(reinterpret_cast<PyArrayObject*>(indices)));
+    double* distance_data = static_cast<double*>(PyArray_DATA(reinterpret_cast<PyArrayObject*>(distances)));
+    const ApproximateQueryEngine* engine = self->engine;
+    std::exception_ptr error;
+
+    // Queries only read the index and the filter and write disjoint output rows
+    Py_BEGIN_ALLOW_THREADS
+    try {
+        metrics::visit(metric, [&](auto trait) {
+            typedef decltype(trait) Metric;
+            const double pad = missing_value(metric);
+            const size_t nprobe = engine->nprobe();
+            with_filter(filter.filter(), [&](const auto& accept) {
+                ThreadPool::instance().parallel_for(m, static_cast<size_t>(num_threads), [&](size_t q) {
+                    stats::QueryScope scope(engine->query_stats());
+                    auto neighbors = engine->search<Metric>(query_data + q * dim, k, nprobe, accept);
+                    for (size_t j = 0; j < k; ++j) {
+                        const bool found = j < neighbors.size();
+                        index_data[q * k + j] = found ? static_cast<int64_t>(neighbors[j].second) : -1;
+                        distance_data[q * k + j] = found ? neighbors[j].first : pad;
+                    }
+                });
+            });
+        });
+    } catch (...) {
+        error = std::current_exception();
+    }
+    Py_END_ALLOW_THREADS
+
+    if (error) {
+        Py_DECREF(indices);
+        Py_DECREF(distances);
+        try {
+            std::rethrow_exception(error);
+        } catch (...) {
+            return set_python_error();
+        }
+    }
+    return Py_BuildValue("(NN)", indices, distances);
+}
+
+static PyObject* ApproximateQueryEngine_get_accuracy(PyApproximateQueryEngine* self, void*) {
+    return check_engine(self) ? PyFloat_FromDouble(self->engine->accuracy()) : NULL;
+}
+
+static int ApproximateQueryEngine_set_accuracy(PyApproximateQueryEngine* self, PyObject* value, void*) {
+    if (value == NULL) {
+        PyErr_SetString(PyExc_AttributeError, "accuracy cannot be deleted.");
+        return -1;
+    }
+    const double accuracy = PyFloat_AsDouble(value);
+    if ((accuracy == -1.0 && PyErr_Occurred()) || !check_accuracy(accuracy) || !check_engine(self)) {
+        return -1;
+    }
+    self->engine->set_accuracy(accuracy);
+    return 0;
+}
+
+static PyObject* ApproximateQueryEngine_get_nprobe(PyApproximateQueryEngine* self, void*) {
+    return check_engine(self) ? PyLong_FromSize_t(self->engine->nprobe()) : NULL;
+}
+
+static PyObject* ApproximateQueryEngine_get_nlist(PyApproximateQueryEngine* self, void*) {
+    return check_engine(self) ? PyLong_FromSize_t(self->engine->index()->nlist()) : NULL;
+}
+
+static PyObject* ApproximateQueryEngine_get_pq_m(PyApproximateQueryEngine* self, void*) {
+    return check_engine(self) ? PyLong_FromSize_t(self->engine->index()->quantizer().num_subspaces()) : NULL;
+}
+
+static PyObject* ApproximateQueryEngine_get_code_size(PyApproximateQueryEngine* self, void*) {
+    return check_engine(self) ? PyLong_FromSize_t(self->engine->index()->code_size()) : NULL;
+}
+
+static PyObject* ApproximateQueryEngine_get_storage(PyApproximateQueryEngine* self, void*) {
+    if (!check_engine(self)) {
+        return NULL;
+    }
+    const IVFIndex* index = self->engine->index();
+    if (index->compressed()) {
+        return PyUnicode_FromString("pq");
+    }
+    const std::optional<StorageType> storage = index->storage();
+    return PyUnicode_FromString(storage ? storage_name(*storage) : "float64");
+}
+
+static PyObject* ApproximateQueryEngine_stats(PyApproximateQueryEngine* self, PyObject* args, PyObject* kwds) {
+    if (!check_engine(self)) {
+        return NULL;
+    }
+    return stats_dict::stats_method(self->engine->query_stats(), args, kwds);
+}
+
+static PyObject* ApproximateQueryEngine_last_trace(PyApproximateQueryEngine* self, PyObject* args) {
+    if (!check_engine(self)) {
+        return NULL;
+    }
+    return stats_dict::trace(stats::last_trace(self->engine->query_stats()));
+}
+
+static PyObject* ApproximateQueryEngine_save(PyApproximateQueryEngine* self, PyObject* args, PyObject* kwds) {
+    static const char* kwlist[] = {"path", NULL};
+    PyObject* path_obj;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "O&", const_cast<char**>(kwlist), PyUnicode_FSConverter, &path_obj)) {
+        return NULL;
+    }
+    const std::string path(PyBytes_AS_STRING(path_obj));
+    Py_DECREF(path_obj);
+    if (!check_engine(self)) {
+        return NULL;
+    }
+
+    const ApproximateQueryEngine* engine = self->engine;
+    std::exception_ptr error;
+    Py_BEGIN_ALLOW_THREADS
+    try {
+        engine->save(path);
+    } catch (...) {
+        error = std::current_exception();
+    }
+    Py_END_ALLOW_THREADS
+    if (error) {
+        try {
+            std::rethrow_exception(error);
+        } catch (...) {
+            return set_python_error();
+        }
+    }
+    Py_RETURN_NONE;
+}
+
+static PyObject* ApproximateQueryEngine_load(PyObject* cls, PyObject* args, PyObject* kwds) {
+    static const char* kwlist[] = {"path", NULL};
+    PyObject* path_obj;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "O&", const_cast<char**>(kwlist), PyUnicode_FSConverter, &path_obj)) {
+        return NULL;
+    }
+    const std::string path(PyBytes_AS_STRING(path_obj));
+    Py_DECREF(path_obj);
+
+    std::unique_ptr<ApproximateQueryEngine> engine;
+    try {
+        engine = ApproximateQueryEngine::load(path);
+    } catch (...) {
+        return set_python_error();
+    }
+
+    PyTypeObject* type = reinterpret_cast<PyTypeObject*>(cls);
+    PyApproximateQueryEngine* self = reinterpret_cast<PyApproximateQueryEngine*>(type->tp_alloc(type, 0));
+    if (self == NULL) {
+        return NULL;
+    }
+    self->engine = engine.release();
+    return reinterpret_cast<PyObject*>(self);
+}
+
+static Py_ssize_t ApproximateQueryEngine_len(PyApproximateQueryEngine* self) {
+    return self->engine == NULL ? 0 : static_cast<Py_ssize_t>(self->engine->index()->size());
+}
+
+static PyMethodDef ApproximateQueryEngineTypeMethods[] = {
+    {"query", (PyCFunction)(void (*)(void))ApproximateQueryEngine_query, METH_VARARGS | METH_KEYWORDS,
+     "Return (indices, distances) of the approximate nearest rows, nearest first.\n\n"
+     "metric is 'euclidean' (default), 'sqeuclidean', 'manhattan' or 'hamming' (ascending distances), or\n"
+     "'ip' or 'cosine' (descending similarities). Lists are always probed by Euclidean distance to their\n"
+     "centroids, and engines built with pq_m > 0 only support the Euclidean metrics.\n\n"
+     "filter restricts the result to some rows: a bool mask or an array of allowed row indices, or a\n"
+     "(column, op, value) tuple comparing a per-row integer column, e.g. (tenant, '==', 7) or\n"
+     "(tenant, 'in', [1, 2]). Rejected rows are skipped before they are scored, so fewer than\n"
+     "num_neighbors results come back when the probed lists hold too few accepted rows."},
+    {"query_batch", (PyCFunction)(void (*)(void))ApproximateQueryEngine_query_batch, METH_VARARGS | METH_KEYWORDS,
+     "Return (indices, distances) arrays of shape (M, num_neighbors) for an (M, D) query matrix.\n\n"
+     "The GIL is released and queries run on num_threads threads (0 uses all). metric and filter are as\n"
+     "for query; one filter applies to every query.\n"
+     "Missing neighbours are -1 / inf (-inf for similarities)."},
+    {"stats", (PyCFunction)(void (*)(void))ApproximateQueryEngine_stats, METH_VARARGS | METH_KEYWORDS,
+     "Return histograms of the per-query counters of query and query_batch as a dict.\n\n"
+     "Queries are only counted by builds configured with -Dquery_stats=true; elsewhere 'enabled' is False\n"
+     "and every histogram is empty. Besides 'enabled' and 'queries' there is one histogram per counter:\n"
+     "'latency_ns', 'distances' (centroids and rows scored), 'visited' (lists probed), 'candidates'\n"
+     "(rows scored for the result), 'bytes' (vector bytes read) and the phase times 'probe_ns',\n"
+     "'scan_ns' and 'select_ns'. Each is a dict of 'total', 'mean', 'p50', 'p90', 'p99', 'max' and\n"
+     "'buckets', where buckets[b] counts the queries whose value has b bits. reset=True clears the\n"
+     "counters once they are read."},
+    {"last_trace", (PyCFunction)ApproximateQueryEngine_last_trace, METH_NOARGS,
+     "Return the counters of the last query() this thread ran on the engine as a dict with the keys of\n"
+     "stats(), or None when there is none or queries are not counted."},
+    {"save", (PyCFunction)(void (*)(void))ApproximateQueryEngine_save, METH_VARARGS | METH_KEYWORDS,
+     "Write the engine settings and its index to path in the versioned on-disk index format."},
+    {"load", (PyCFunction)(void (*)(void))ApproximateQueryEngine_load, METH_VARARGS | METH_KEYWORDS | METH_CLASS,
+     "Open an engine written by save(); the lists are memory-mapped read-only, so loading is instant."},
+    {NULL, NULL, 0, NULL}
+};
+
+static PyGetSetDef ApproximateQueryEngineGetSet[] = {
+    {"accuracy", (getter)ApproximateQueryEngine_get_accuracy, (setter)ApproximateQueryEngine_set_accuracy,
+     "Recall/latency dial in [0, 1]; queries probe nlist ** accuracy lists.", NULL},
+    {"nprobe", (getter)ApproximateQueryEngine_get_nprobe, NULL, "Number of lists each query scans.", NULL},
+    {"nlist", (getter)ApproximateQueryEngine_get_nlist, NULL, "Number of inverted lists in the index.", NULL},
+    {"pq_m", (getter)ApproximateQueryEngine_get_pq_m, NULL, "Product-quantization sub-vectors per row (0: uncompressed).",
+     NULL},
+    {"code_size", (getter)ApproximateQueryEngine_get_code_size, NULL, "Bytes stored per indexed row.", NULL},
+    {"storage", (getter)ApproximateQueryEngine_get_storage, NULL,
+     "Element type of the indexed rows: 'float64', 'float32', 'float16', 'int8', or 'pq' for codes.", NULL},
+    {NULL, NULL, NULL, NULL, NULL}
+};
+
+static PyType_Slot ApproximateQueryEngineSlots[] = {
+    {Py_tp_doc, (void*)"ApproximateQueryEngine(dataset, num_neighbors=10, accuracy=0.5, nlist=0, seed=0, num_threads=0, pq_m=0, "
+                       "storage='float64')\n\n"
+                       "Inverted-file index trained once over an (N, D) dataset. Queries scan the nprobe lists\n"
+                       "nearest to them; accuracy=1 scans every list and is exact. nlist=0 picks about sqrt(N).\n"
+                       "pq_m > 0 (a divisor of D) stores every row as pq_m one-byte product-quantization codes and\n"
+                       "returns estimated distances; nlist=1 then scans the whole compressed dataset. Without pq_m,\n"
+                       "storage='float32', 'float16' or 'int8' keeps the rows in that type (int8 with a per-row\n"
+                       "scale and offset) and scores them against a float32 copy of each query."},
+    {Py_tp_new, (void*)PyType_GenericNew},
+    {Py_tp_init, (void*)ApproximateQueryEngine_init},
+    {Py_tp_dealloc, (void*)ApproximateQueryEngine_dealloc},
+    {Py_tp_methods, ApproximateQueryEngineTypeMethods},
+    {Py_tp_getset, ApproximateQueryEngineGetSet},
+    {Py_sq_length, (void*)ApproximateQueryEngine_len},
+    {0, NULL}
+};
+
+static PyType_Spec ApproximateQueryEngineSpec = {
+    "approx_query.ApproximateQueryEngine",
+    sizeof(PyApproximateQueryEngine),
+    0,
+    Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE,
+    ApproximateQueryEngineSlots
+};
+
 // Module definition
 static PyMethodDef ApproxQueryMethods[] = {
-    {"approx_query", approx_query, METH_VARARGS, "Execute an approximate similarity query."},
+    {"approx_query", approx_query, METH_VARARGS,
+     "Execute an approximate similarity query.\n\n"
+     "There is no index to probe for a one-off call, so the whole dataset is scanned and the result is\n"
+     "exact; build an ApproximateQueryEngine to trade recall for latency with accuracy."},
+    {"approx_query_batch", (PyCFunction)(void (*)(void))approx_query_batch, METH_VARARGS | METH_KEYWORDS,
+     "Run approximate queries for every row of an (M, D) matrix without holding the GIL.\n\n"
+     "Returns (indices, distances) arrays of shape (M, num_neighbors); missing neighbours are -1 / inf\n"
+     "(-inf for the similarity metrics 'ip' and 'cosine'). metric is any of the names exact_knn accepts."},
     {NULL, NULL, 0, NULL}
 };
 
@@ -114,5 +754,17 @@ static struct PyModuleDef approxquerymodule = {
 
 PyMODINIT_FUNC PyInit_approx_query(void) {
     import_array(); // Initialize NumPy API
-    return PyModule_Create(&approxquerymodule);
+    simd::init(); // Pick the distance kernels for this CPU once
+
+    PyObject* module = PyModule_Create(&approxquerymodule);
+    if (module == NULL) {
+        return NULL;
+    }
+    PyObject* type = PyType_FromSpec(&ApproximateQueryEngineSpec);
+    if (type == NULL || PyModule_AddObject(module, "ApproximateQueryEngine", type) < 0) {
+        Py_XDECREF(type);
+        Py_DECREF(module);
+        return NULL;
+    }
+    return module;
 }
\ No newline at end of file
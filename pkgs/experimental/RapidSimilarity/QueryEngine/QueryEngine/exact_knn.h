@@ -0,0 +1,123 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+
+#include "DistanceMetrics/pairwise.h"
+#include "DistanceMetrics/thread_pool.h"
+#include "DistanceMetrics/topk.h"
+
+// Exact k nearest neighbours of many queries in an (n, dim) row-major database. The work is cut
+// into the same cache-sized tiles as pairwise::cdist (a block of queries against a block of
+// database rows, scored four rows at a time by the SIMD kernels) and every tile is folded into
+// per-query top-k heaps straight away, so no (m, n) distance matrix is ever materialised.
+namespace exact_knn {
+
+// ids[q * k + j] / values[q * k + j] = j-th nearest database row of query q and its metric value:
+// ascending distances for the Euclidean, Manhattan and Hamming metrics, descending similarities
+// for inner product and cosine. Rows with fewer than k results are padded with -1 and +inf
+// (distances) or -inf (similarities); ties go to the lower row id.
+//
+// Query blocks are spread over up to num_threads pool threads (0 means all). When there are fewer
+// query blocks than threads, the database is also split into ranges scanned in parallel, each
+// with its own heaps, and the partial heaps of a query are merged at the end.
+template <typename T>
+void search(const T* data, size_t n, const T* queries, size_t m, size_t dim, size_t k, pairwise::Metric metric,
+            int64_t* ids, T* values, size_t num_threads = 0) {
+    const bool smaller_is_nearer = metrics::ascending(metric);
+    const T pad = smaller_is_nearer ? std::numeric_limits<T>::infinity() : -std::numeric_limits<T>::infinity();
+    if (m == 0 || k == 0) {
+        return;
+    }
+    if (n == 0) {
+        std::fill(ids, ids + m * k, int64_t(-1));
+        std::fill(values, values + m * k, pad);
+        return;
+    }
+
+    // Euclidean ranking uses squared distances; roots are taken for the k results only
+    const pairwise::Metric scored = metric == pairwise::Metric::Euclidean ? pairwise::Metric::SqEuclidean : metric;
+    const std::vector<T> query_norms = pairwise::metric_norms(queries, m, dim, scored);
+    const std::vector<T> data_norms = pairwise::metric_norms(data, n, dim, scored);
+
+    const size_t rows_per_block = std::min(pairwise::kRowBlock, m);
+    const size_t cols_per_block = pairwise::col_block<T>(dim);
+    const size_t query_blocks = (m + rows_per_block - 1) / rows_per_block;
+    const size_t data_blocks = (n + cols_per_block - 1) / cols_per_block;
+    const size_t pool_threads = num_threads == 0 ? ThreadPool::instance().size()
+                                                 : std::min(num_threads, ThreadPool::instance().size());
+    const size_t splits = std::max<size_t>(1, std::min(data_blocks, pool_threads / query_blocks));
+    const size_t blocks_per_split = (data_blocks + splits - 1) / splits;
+
+    // Writes the sorted selection of query q; similarities are negated inside the heaps so that
+    // every metric keeps its smallest values
+    auto write = [&](TopK<T>& heap, size_t q) {
+        const std::vector<typename TopK<T>::Entry> nearest = heap.take_sorted();
+        for (size_t j = 0; j < k; ++j) {
+            const bool found = j < nearest.size();
+            ids[q * k + j] = found ? static_cast<int64_t>(nearest[j].second) : -1;
+            T value = pad;
+            if (found) {
+                value = smaller_is_nearer ? nearest[j].first : -nearest[j].first;
+                if (metric == pairwise::Metric::Euclidean) {
+                    value = std::sqrt(value);
+                }
+            }
+            values[q * k + j] = value;
+        }
+    };
+
+    // Scores one query block against database rows [d_begin, d_end) into its heaps
+    auto scan = [&](size_t q_begin, size_t rows, size_t d_begin, size_t d_end, TopK<T>* block_heaps) {
+        std::vector<T> tile(rows * cols_per_block);
+        for (; d_begin < d_end; d_begin += cols_per_block) {
+            const size_t cols = std::min(cols_per_block, d_end - d_begin);
+            pairwise::tile(queries + q_begin * dim, data + d_begin * dim, dim, cols, scored,
+                           query_norms.empty() ? nullptr : query_norms.data() + q_begin,
+                           data_norms.empty() ? nullptr : data_norms.data() + d_begin, 0, rows, 0, cols, tile.data());
+            for (size_t r = 0; r < rows; ++r) {
+                const T* scores = tile.data() + r * cols;
+                for (size_t c = 0; c < cols; ++c) {
+                    block_heaps[r].push(smaller_is_nearer ? scores[c] : -scores[c], d_begin + c);
+                }
+            }
+        }
+    };
+
+    if (splits == 1) {
+        // Enough query blocks for every thread: each task owns the heaps of its block only
+        ThreadPool::instance().parallel_for(query_blocks, num_threads, [&](size_t block) {
+            const size_t q_begin = block * rows_per_block;
+            const size_t rows = std::min(rows_per_block, m - q_begin);
+            std::vector<TopK<T>> block_heaps(rows, TopK<T>(std::min(k, n)));
+            scan(q_begin, rows, 0, n, block_heaps.data());
+            for (size_t r = 0; r < rows; ++r) {
+                write(block_heaps[r], q_begin + r);
+            }
+        });
+        return;
+    }
+
+    // Few queries: heaps[split * m + q] holds query q's selection over one database range
+    std::vector<TopK<T>> heaps(splits * m, TopK<T>(std::min(k, n)));
+    ThreadPool::instance().parallel_for(query_blocks * splits, num_threads, [&](size_t task) {
+        const size_t block = task / splits;
+        const size_t split = task % splits;
+        const size_t q_begin = block * rows_per_block;
+        const size_t d_begin = std::min(n, split * blocks_per_split * cols_per_block);
+        const size_t d_end = std::min(n, (split + 1) * blocks_per_split * cols_per_block);
+        scan(q_begin, std::min(rows_per_block, m - q_begin), d_begin, d_end, heaps.data() + split * m + q_begin);
+    });
+    ThreadPool::instance().parallel_for(m, num_threads, [&](size_t q) {
+        for (size_t split = 1; split < splits; ++split) {
+            heaps[q].merge(heaps[split * m + q]);
+        }
+        write(heaps[q], q);
+    });
+}
+
+} // namespace exact_knn
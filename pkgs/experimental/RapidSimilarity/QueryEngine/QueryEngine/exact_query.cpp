@@ -2,69 +2,267 @@
 #include <numpy/arrayobject.h>
 #include <vector>
 #include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <exception>
+#include <utility>
+#include <new>
+#include <stdexcept>
 
-// Function to find exact nearest neighbors
-std::vector<int> exact_nearest_neighbors(const std::vector<float>& dataset, float query, size_t k) {
-    std::vector<std::pair<float, int>> distances;
-    for (size_t i = 0; i < dataset.size(); ++i) {
-        distances.emplace_back(std::abs(dataset[i] - query), i);
-    }
-    std::sort(distances.begin(), distances.end());
-    
-    std::vector<int> neighbors;
-    for (size_t i = 0; i < k && i < distances.size(); ++i) {
-        neighbors.push_back(distances[i].second);
+#include "exact_knn.h"
+#include "DistanceMetrics/buffer_view.h"
+#include "DistanceMetrics/pairwise.h"
+#include "DistanceMetrics/simd_kernels.h"
+#include "DistanceMetrics/thread_pool.h"
+#include "DistanceMetrics/topk.h"
+
+// k nearest (distance, index) pairs of query in a 1-D dataset of n values, in ascending order.
+// A size-k heap keeps the selection, so a query costs O(n log k) and allocates only k entries.
+std::vector<std::pair<float, int>> exact_neighbors(const float* dataset, size_t n, float query, size_t k) {
+    TopK<float, int> best(std::min(k, n));
+    for (size_t i = 0; i < n; ++i) {
+        best.push(std::abs(dataset[i] - query), static_cast<int>(i));
     }
-    return neighbors;
+    return best.take_sorted();
 }
 
 // Python wrapper for exact_nearest_neighbors
 static PyObject* py_exact_nearest_neighbors(PyObject* self, PyObject* args) {
     PyObject* py_dataset;
     float query;
-    size_t k;
+    Py_ssize_t k;
 
     // Parse the input tuple
     if (!PyArg_ParseTuple(args, "Ofn", &py_dataset, &query, &k)) {
         return NULL;
     }
 
-    // Convert input NumPy array to std::vector<float>
-    PyArrayObject* dataset_array = reinterpret_cast<PyArrayObject*>(py_dataset);
-    if (!PyArray_Check(dataset_array)) {
-        PyErr_SetString(PyExc_TypeError, "Input must be a NumPy array");
+    if (k < 0) {
+        PyErr_SetString(PyExc_ValueError, "k must be non-negative");
         return NULL;
     }
 
-    npy_intp* shape = PyArray_DIMS(dataset_array);
-    size_t size = shape[0];
-    std::vector<float> dataset(size);
-    for (size_t i = 0; i < size; ++i) {
-        dataset[i] = static_cast<float>(*reinterpret_cast<float*>(PyArray_GETPTR1(dataset_array, i)));
+    // View the dataset in place; float32 buffers are not copied
+    BufferView dataset;
+    if (!dataset.acquire(py_dataset, 1, "Dataset must be an array or a sequence of numbers")) {
+        return NULL;
+    }
+    if (dataset.size() == 0) {
+        PyErr_SetString(PyExc_IndexError, "Dataset must not be empty");
+        return NULL;
     }
 
     // Call the exact nearest neighbors function
-    std::vector<int> neighbors = exact_nearest_neighbors(dataset, query, k);
+    std::vector<float> scratch;
+    std::vector<std::pair<float, int>> neighbors =
+        exact_neighbors(dataset.data(scratch), dataset.size(), query, static_cast<size_t>(k));
 
     // Create a new Python list to return the results
     PyObject* py_neighbors = PyList_New(neighbors.size());
     for (size_t i = 0; i < neighbors.size(); ++i) {
-        PyList_SetItem(py_neighbors, i, PyLong_FromSize_t(neighbors[i]));
+        PyList_SetItem(py_neighbors, i, PyLong_FromLong(neighbors[i].second));
     }
 
     return py_neighbors;
 }
 
+// Batched wrapper: every query of a 1-D array is answered on the thread pool without the GIL
+static PyObject* py_exact_nearest_neighbors_batch(PyObject* self, PyObject* args, PyObject* kwds) {
+    static const char* kwlist[] = {"dataset", "queries", "k", "num_threads", NULL};
+    PyObject* py_dataset;
+    PyObject* py_queries;
+    Py_ssize_t k;
+    Py_ssize_t num_threads = 0;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "OOn|n", const_cast<char**>(kwlist), &py_dataset, &py_queries, &k,
+                                     &num_threads)) {
+        return NULL;
+    }
+    if (k < 0 || num_threads < 0) {
+        PyErr_SetString(PyExc_ValueError, "k and num_threads must be non-negative");
+        return NULL;
+    }
+
+    BufferView dataset, queries;
+    if (!dataset.acquire(py_dataset, 1) || !queries.acquire(py_queries, 1)) {
+        return NULL;
+    }
+    const size_t n = dataset.size();
+    const size_t m = queries.size();
+    if (n == 0) {
+        PyErr_SetString(PyExc_IndexError, "Dataset must not be empty");
+        return NULL;
+    }
+
+    const size_t width = static_cast<size_t>(k);
+    npy_intp dims[2] = {static_cast<npy_intp>(m), static_cast<npy_intp>(width)};
+    PyObject* indices = PyArray_SimpleNew(2, dims, NPY_INT64);
+    PyObject* distances = PyArray_SimpleNew(2, dims, NPY_FLOAT);
+    if (indices == NULL || distances == NULL) {
+        Py_XDECREF(indices);
+        Py_XDECREF(distances);
+        return NULL;
+    }
+
+    std::vector<float> dataset_scratch, query_scratch;
+    const float* data = dataset.data(dataset_scratch);
+    const float* query_data = queries.data(query_scratch);
+    int64_t* index_data = static_cast<int64_t*>(PyArray_DATA(reinterpret_cast<PyArrayObject*>(indices)));
+    float* distance_data = static_cast<float*>(PyArray_DATA(reinterpret_cast<PyArrayObject*>(distances)));
+    std::exception_ptr error;
+
+    Py_BEGIN_ALLOW_THREADS
+    try {
+        ThreadPool::instance().parallel_for(m, static_cast<size_t>(num_threads), [&](size_t q) {
+            auto neighbors = exact_neighbors(data, n, query_data[q], width);
+            for (size_t j = 0; j < width; ++j) {
+                const bool found = j < neighbors.size();
+                index_data[q * width + j] = found ? neighbors[j].second : -1;
+                distance_data[q * width + j] = found ? neighbors[j].first : std::numeric_limits<float>::infinity();
+            }
+        });
+    } catch (...) {
+        error = std::current_exception();
+    }
+    Py_END_ALLOW_THREADS
+
+    if (error) {
+        Py_DECREF(indices);
+        Py_DECREF(distances);
+        try {
+            std::rethrow_exception(error);
+        } catch (const std::bad_alloc&) {
+            return PyErr_NoMemory();
+        } catch (const std::exception& e) {
+            PyErr_SetString(PyExc_RuntimeError, e.what());
+            return NULL;
+        }
+    }
+    return Py_BuildValue("(NN)", indices, distances);
+}
+
+// Translate the active C++ exception into a Python exception
+static PyObject* set_python_error() {
+    try {
+        throw;
+    } catch (const std::invalid_argument& e) {
+        PyErr_SetString(PyExc_ValueError, e.what());
+    } catch (const std::bad_alloc&) {
+        PyErr_NoMemory();
+    } catch (const std::exception& e) {
+        PyErr_SetString(PyExc_RuntimeError, e.what());
+    }
+    return NULL;
+}
+
+// (M, k) indices and metric values of the k nearest dataset rows of every query row
+template <typename T>
+static PyObject* exact_knn_matrix(const BufferView& dataset, const BufferView& queries, size_t k,
+                                  pairwise::Metric metric, size_t num_threads) {
+    const int type_num = sizeof(T) == sizeof(float) ? NPY_FLOAT : NPY_DOUBLE;
+    npy_intp dims[2] = {static_cast<npy_intp>(queries.rows()), static_cast<npy_intp>(k)};
+    PyObject* indices = PyArray_SimpleNew(2, dims, NPY_INT64);
+    PyObject* values = PyArray_SimpleNew(2, dims, type_num);
+    if (indices == NULL || values == NULL) {
+        Py_XDECREF(indices);
+        Py_XDECREF(values);
+        return NULL;
+    }
+
+    std::vector<T> dataset_scratch, query_scratch;
+    const T* data = dataset.data(dataset_scratch);
+    const T* query_data = queries.data(query_scratch);
+    int64_t* index_data = static_cast<int64_t*>(PyArray_DATA(reinterpret_cast<PyArrayObject*>(indices)));
+    T* value_data = static_cast<T*>(PyArray_DATA(reinterpret_cast<PyArrayObject*>(values)));
+    std::exception_ptr error;
+
+    Py_BEGIN_ALLOW_THREADS
+    try {
+        exact_knn::search(data, dataset.rows(), query_data, queries.rows(), queries.cols(), k, metric, index_data,
+                          value_data, num_threads);
+    } catch (...) {
+        error = std::current_exception();
+    }
+    Py_END_ALLOW_THREADS
+
+    if (error) {
+        Py_DECREF(indices);
+        Py_DECREF(values);
+        try {
+            std::rethrow_exception(error);
+        } catch (...) {
+            return set_python_error();
+        }
+    }
+    return Py_BuildValue("(NN)", indices, values);
+}
+
+// exact_knn(dataset, queries, k, metric="euclidean", num_threads=0) -> (indices, distances)
+static PyObject* py_exact_knn(PyObject* self, PyObject* args, PyObject* kwds) {
+    static const char* kwlist[] = {"dataset", "queries", "k", "metric", "num_threads", NULL};
+    PyObject* py_dataset;
+    PyObject* py_queries;
+    Py_ssize_t k;
+    const char* metric_name = "euclidean";
+    Py_ssize_t num_threads = 0;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "OOn|sn", const_cast<char**>(kwlist), &py_dataset, &py_queries, &k,
+                                     &metric_name, &num_threads)) {
+        return NULL;
+    }
+    if (k < 0 || num_threads < 0) {
+        PyErr_SetString(PyExc_ValueError, "k and num_threads must be non-negative");
+        return NULL;
+    }
+    pairwise::Metric metric;
+    if (!pairwise::parse_metric(metric_name, metric)) {
+        PyErr_SetString(PyExc_ValueError, metrics::kUnknownMetric);
+        return NULL;
+    }
+
+    BufferView dataset, queries;
+    if (!dataset.acquire(py_dataset, 2, "Dataset must be a 2-dimensional array") ||
+        !queries.acquire(py_queries, 2, "Queries must be a 2-dimensional array")) {
+        return NULL;
+    }
+    // Rows of width zero would be scanned as rows of the other operand's width
+    if ((dataset.rows() > 0 && dataset.cols() == 0) || (queries.rows() > 0 && queries.cols() == 0)) {
+        PyErr_SetString(PyExc_ValueError, "Queries and dataset must have at least one column");
+        return NULL;
+    }
+    if (dataset.rows() > 0 && queries.rows() > 0 && dataset.cols() != queries.cols()) {
+        PyErr_SetString(PyExc_ValueError, "Queries and dataset must have the same dimension");
+        return NULL;
+    }
+
+    const bool float32 = dataset.type() == BufferView::Type::Float32 && queries.type() == BufferView::Type::Float32;
+    const size_t width = static_cast<size_t>(k);
+    const size_t threads = static_cast<size_t>(num_threads);
+    return float32 ? exact_knn_matrix<float>(dataset, queries, width, metric, threads)
+                   : exact_knn_matrix<double>(dataset, queries, width, metric, threads);
+}
+
 // Module method definitions
 static PyMethodDef QueryEngineMethods[] = {
     {"exact_nearest_neighbors", py_exact_nearest_neighbors, METH_VARARGS, "Find exact nearest neighbors"},
+    {"exact_nearest_neighbors_batch", (PyCFunction)(void (*)(void))py_exact_nearest_neighbors_batch,
+     METH_VARARGS | METH_KEYWORDS,
+     "Find the k exact nearest neighbors of every query, returning (M, k) indices and distances"},
+    {"exact_knn", (PyCFunction)(void (*)(void))py_exact_knn, METH_VARARGS | METH_KEYWORDS,
+     "exact_knn(dataset, queries, k, metric='euclidean', num_threads=0)\n\n"
+     "Exact k nearest rows of an (N, D) dataset for every row of an (M, D) query matrix, returned as\n"
+     "(M, k) indices and values. 'euclidean', 'sqeuclidean', 'manhattan' and 'hamming' give ascending\n"
+     "distances; 'ip' and 'cosine' give descending similarities. Missing neighbours are -1 / inf\n"
+     "(-inf for similarities). The GIL is released and the blocked scan runs on num_threads threads\n"
+     "(0 uses all). float32 inputs are searched in float32 without a copy."},
     {NULL, NULL, 0, NULL}  // Sentinel
 };
 
 // Module definition
 static struct PyModuleDef queryenginemodule = {
     PyModuleDef_HEAD_INIT,
-    "QueryEngine",   // name of module
+    "exact_query",   // name of module
     NULL,            // module documentation, may be NULL
     -1,              // size of per-interpreter state of the module,
                      // or -1 if the module keeps state in global variables.
@@ -72,7 +270,8 @@ static struct PyModuleDef queryenginemodule = {
 };
 
 // Module initialization
-PyMODINIT_FUNC PyInit_QueryEngine(void) {
+PyMODINIT_FUNC PyInit_exact_query(void) {
     import_array();  // Necessary for NumPy API initialization
+    simd::init();    // Pick the distance kernels for this CPU once
     return PyModule_Create(&queryenginemodule);
 }
\ No newline at end of file
@@ -0,0 +1,350 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <type_traits>
+#include <utility>
+#include <stdexcept>
+
+#include "kmeans.h"
+#include "pq.h"
+#include "DistanceMetrics/id_set.h"
+#include "DistanceMetrics/index_io.h"
+#include "DistanceMetrics/metrics.h"
+#include "DistanceMetrics/query_stats.h"
+#include "DistanceMetrics/simd_kernels.h"
+#include "DistanceMetrics/storage.h"
+#include "DistanceMetrics/topk.h"
+
+// Inverted-file index: k-means centroids partition the dataset into nlist lists, and a query only
+// scans the nprobe lists whose centroids are nearest to it. Each list stores its vectors back to
+// back (with their original row ids alongside), so a probe is one sequential pass over memory.
+//
+// With product quantization (pq_m > 0) the lists hold pq_m-byte codes of each row's residual from
+// its list centroid instead of the row itself (IVFADC): a probe builds one distance table for the
+// query's residual and scans the codes with table lookups, and distances become estimates.
+//
+// Uncompressed lists hold the rows as float64, or in a float32, float16 or int8 VectorStore
+// (see storage.h) scored against a float32 copy of the query.
+class IVFIndex {
+public:
+    typedef std::pair<double, size_t> Neighbor;  // (distance, row id)
+
+    // Lists with fewer training points than this give poorly placed centroids
+    static constexpr size_t kMinPointsPerList = 39;
+
+    // Default list count: about sqrt(n), capped so every list can be trained on enough points
+    static size_t default_nlist(size_t n) {
+        const size_t by_size = static_cast<size_t>(std::sqrt(static_cast<double>(n)));
+        return std::max<size_t>(1, std::min(by_size, n / kMinPointsPerList));
+    }
+
+    // Number of lists probed for an accuracy in [0, 1]: nlist^accuracy, so 0 probes the single
+    // nearest list, 0.5 about sqrt(nlist) lists and 1 every list (an exact search)
+    static size_t nprobe_for_accuracy(double accuracy, size_t nlist) {
+        if (nlist == 0) {
+            return 0;
+        }
+        const double clamped = std::min(1.0, std::max(0.0, accuracy));
+        const size_t nprobe = static_cast<size_t>(std::lround(std::pow(static_cast<double>(nlist), clamped)));
+        return std::min(nlist, std::max<size_t>(1, nprobe));
+    }
+
+    // Train on (a sample of) the row-major (n, dim) data and file every row in its nearest list.
+    // nlist = 0 picks default_nlist(n); pq_m = 0 stores the rows uncompressed, otherwise dim must
+    // be a multiple of pq_m. storage picks the element type of uncompressed rows; without one they
+    // stay float64.
+    IVFIndex(const double* data, size_t n, size_t dim, size_t nlist = 0, size_t pq_m = 0, uint64_t seed = 0,
+             size_t num_threads = 0, size_t iterations = 10, std::optional<StorageType> storage = std::nullopt)
+        : dim_(dim), size_(n) {
+        if (dim == 0 && n > 0) {
+            throw std::invalid_argument("Vectors must have at least one dimension.");
+        }
+        if (pq_m > 0 && storage) {
+            throw std::invalid_argument("storage applies to uncompressed lists only; use it with pq_m = 0.");
+        }
+        if (pq_m > 0) {
+            pq_ = ProductQuantizer(dim, pq_m);
+        }
+        if (storage) {
+            store_ = VectorStore(*storage);
+            stored_ = true;
+        }
+        if (n == 0) {
+            list_offsets_ = std::vector<uint64_t>(1, 0);
+            return;
+        }
+        nlist_ = nlist == 0 ? default_nlist(n) : std::min(nlist, n);
+        centroids_ = kmeans::train(data, n, dim, nlist_, iterations, seed, num_threads);
+
+        std::vector<uint32_t> labels(n);
+        kmeans::assign(data, n, dim, centroids_.data(), nlist_, labels.data(), num_threads);
+
+        // Counting sort of the rows by list keeps each list in ascending row order
+        std::vector<uint64_t> offsets(nlist_ + 1, 0);
+        for (uint32_t label : labels) {
+            ++offsets[label + 1];
+        }
+        for (size_t l = 0; l < nlist_; ++l) {
+            offsets[l + 1] += offsets[l];
+        }
+        std::vector<uint64_t> next(offsets.begin(), offsets.end() - 1);
+        std::vector<uint64_t> ids(n);
+        for (size_t i = 0; i < n; ++i) {
+            ids[next[labels[i]]++] = i;
+        }
+        list_offsets_ = std::move(offsets);
+        ids_ = std::move(ids);
+
+        if (stored_) {
+            store_.reserve(n, dim);
+            for (size_t slot = 0; slot < n; ++slot) {
+                store_.append(data + ids_[slot] * dim, 1, dim);
+            }
+            return;
+        }
+        if (!compressed()) {
+            std::vector<double> rows(n * dim);
+            for (size_t slot = 0; slot < n; ++slot) {
+                std::copy(data + ids_[slot] * dim, data + (ids_[slot] + 1) * dim, rows.begin() + slot * dim);
+            }
+            vectors_ = std::move(rows);
+            return;
+        }
+
+        // Residuals in slot order; one quantizer is shared by every list
+        std::vector<double> residuals(n * dim);
+        for (size_t l = 0; l < nlist_; ++l) {
+            for (size_t slot = list_offsets_[l]; slot < list_offsets_[l + 1]; ++slot) {
+                residual(data + ids_[slot] * dim, l, residuals.data() + slot * dim);
+            }
+        }
+        pq_.train(residuals.data(), n, seed, num_threads);
+        std::vector<uint8_t> codes(n * pq_.code_size());
+        pq_.encode(residuals.data(), n, codes.data(), num_threads);
+        codes_ = std::move(codes);
+    }
+
+    // Sections: parameters (dim, n, nlist, whether the rows are in a vector store), centroids,
+    // list offsets, row ids, the quantizer, then the rows or their codes in slot order
+    void save(index_io::Writer& writer) const {
+        writer.write(std::vector<uint64_t>{dim_, size_, nlist_, stored_ ? 1u : 0u});
+        writer.write(centroids_);
+        writer.write(list_offsets_);
+        writer.write(ids_);
+        pq_.save(writer);
+        if (compressed()) {
+            writer.write(codes_);
+        } else if (stored_) {
+            store_.save(writer);
+        } else {
+            writer.write(vectors_);
+        }
+    }
+
+    // Index read back from the sections written by save(). Every array stays mapped; only the
+    // list offsets are checked, so loading does not touch the rows.
+    explicit IVFIndex(index_io::Reader& reader) {
+        const std::vector<uint64_t> params = reader.vector<uint64_t>(4);
+        dim_ = static_cast<size_t>(params[0]);
+        size_ = static_cast<size_t>(params[1]);
+        nlist_ = static_cast<size_t>(params[2]);
+        stored_ = params[3] != 0;
+        centroids_ = reader.array<double>();
+        list_offsets_ = reader.array<uint64_t>();
+        ids_ = reader.array<uint64_t>();
+        pq_ = ProductQuantizer(reader);
+        bool rows_match;
+        if (compressed()) {
+            codes_ = reader.array<uint8_t>();
+            rows_match = !stored_ && pq_.dimension() == dim_ && pq_.trained() &&
+                         codes_.size() == size_ * pq_.code_size();
+        } else if (stored_) {
+            store_ = VectorStore(reader);
+            rows_match = store_.size() == size_ && (size_ == 0 || store_.dimension() == dim_);
+        } else {
+            vectors_ = reader.array<double>();
+            rows_match = vectors_.size() == size_ * dim_;
+        }
+        if (centroids_.size() != nlist_ * dim_ || list_offsets_.size() != nlist_ + 1 || ids_.size() != size_ ||
+            !rows_match) {
+            throw std::invalid_argument("IVF index file is inconsistent.");
+        }
+        for (size_t l = 0; l < nlist_; ++l) {
+            if (list_offsets_[l] > list_offsets_[l + 1]) {
+                throw std::invalid_argument("IVF index file is inconsistent.");
+            }
+        }
+        if (list_offsets_[0] != 0 || list_offsets_[nlist_] != size_) {
+            throw std::invalid_argument("IVF index file is inconsistent.");
+        }
+    }
+
+    size_t size() const { return size_; }
+    size_t dimension() const { return dim_; }
+    size_t nlist() const { return nlist_; }
+    size_t list_size(size_t list) const { return list_offsets_[list + 1] - list_offsets_[list]; }
+    const double* centroids() const { return centroids_.data(); }
+    bool compressed() const { return pq_.num_subspaces() > 0; }
+    // Element type of uncompressed rows held in a vector store; empty for float64 rows and codes
+    std::optional<StorageType> storage() const {
+        return stored_ ? std::optional<StorageType>(store_.type()) : std::nullopt;
+    }
+    // Bytes stored per row: pq_m codes, the stored row, or the raw float64 vector
+    size_t code_size() const {
+        if (compressed()) {
+            return pq_.code_size();
+        }
+        if (stored_) {
+            return size_ == 0 ? 0 : store_.bytes_per_row();
+        }
+        return dim_ * sizeof(double);
+    }
+    const ProductQuantizer& quantizer() const { return pq_; }
+
+    // The probe lists for a query: the nprobe nearest centroids, nearest first
+    std::vector<size_t> probe_lists(const double* query, size_t nprobe) const {
+        const auto l2sq = simd::kernels<double>().l2sq;
+        stats::count(stats::Distances, nlist_);
+        stats::count(stats::Bytes, nlist_ * dim_ * sizeof(double));
+        TopK<double> nearest(std::min(nprobe, nlist_));
+        for (size_t l = 0; l < nlist_; ++l) {
+            nearest.push(l2sq(query, centroids_.data() + l * dim_, dim_), l);
+        }
+        std::vector<size_t> lists;
+        for (const auto& entry : nearest.take_sorted()) {
+            lists.push_back(entry.second);
+        }
+        return lists;
+    }
+
+    // k nearest rows among the nprobe probed lists, as (metric value, row id) nearest first, for a
+    // metric trait of metrics.h. Lists are always probed by Euclidean distance to their centroids;
+    // the rows inside them are ranked by Metric, and only the k results are turned into values.
+    // Product-quantized lists support the Euclidean metrics only. Rows whose id filter rejects (see
+    // IdFilter in id_set.h) are skipped before they are scored.
+    template <typename Metric = metrics::Euclidean, typename Filter = AcceptAll>
+    std::vector<Neighbor> search(const double* query, size_t k, size_t nprobe, const Filter& filter = Filter()) const {
+        if (compressed() && Metric::basis != metrics::Basis::SquaredL2) {
+            throw std::invalid_argument("Product-quantized lists can only be searched by Euclidean distance.");
+        }
+        stats::PhaseTimer phase(stats::Probe);
+        const std::vector<size_t> lists = probe_lists(query, nprobe);
+        stats::count(stats::Visited, lists.size());
+        phase.next(stats::Scan);
+        TopK<double> best(std::min(k, size_));
+        if (compressed()) {
+            search_codes(query, lists, best, filter);
+        } else if (stored_) {
+            search_store<Metric>(query, lists, best, filter);
+        } else {
+            for (size_t list : lists) {
+                size_t scored = 0;
+                for (size_t slot = list_offsets_[list]; slot < list_offsets_[list + 1]; ++slot) {
+                    if (filter(ids_[slot])) {
+                        best.push(Metric::rank(query, vectors_.data() + slot * dim_, dim_), ids_[slot]);
+                        ++scored;
+                    }
+                }
+                stats::count(stats::Candidates, scored);
+                stats::count(stats::Distances, scored);
+                stats::count(stats::Bytes, scored * dim_ * sizeof(double));
+            }
+        }
+        phase.next(stats::Select);
+        std::vector<Neighbor> neighbors = best.take_sorted();
+        for (Neighbor& neighbor : neighbors) {
+            neighbor.first = Metric::value(neighbor.first);
+        }
+        return neighbors;
+    }
+
+private:
+    // out = x - centroid of list l
+    void residual(const double* x, size_t l, double* out) const {
+        const double* centroid = centroids_.data() + l * dim_;
+        for (size_t d = 0; d < dim_; ++d) {
+            out[d] = x[d] - centroid[d];
+        }
+    }
+
+    // ADC scan of the probed lists: |q - c - r|^2 is read off a table built for q - c, so every
+    // list needs its own table but each code costs only pq_m lookups. A filter compacts the
+    // accepted slots of a list first so that only their codes are scanned.
+    template <typename Filter>
+    void search_codes(const double* query, const std::vector<size_t>& lists, TopK<double>& best,
+                      const Filter& filter) const {
+        const size_t code_size = pq_.code_size();
+        std::vector<double> query_residual(dim_);
+        std::vector<float> table(pq_.table_size());
+        std::vector<float> distances;
+        const bool filtered = !std::is_same<Filter, AcceptAll>::value;
+        std::vector<size_t> accepted;        // Ids of the accepted slots of a filtered list
+        std::vector<uint8_t> accepted_codes; // And their codes, back to back
+        for (size_t list : lists) {
+            const size_t begin = list_offsets_[list];
+            const size_t count = list_offsets_[list + 1] - begin;
+            const uint8_t* codes = codes_.data() + begin * code_size;
+            size_t scanned = count;
+            if (filtered) {
+                accepted.clear();
+                accepted_codes.clear();
+                for (size_t i = 0; i < count; ++i) {
+                    if (filter(ids_[begin + i])) {
+                        accepted.push_back(ids_[begin + i]);
+                        accepted_codes.insert(accepted_codes.end(), codes + i * code_size, codes + (i + 1) * code_size);
+                    }
+                }
+                if (accepted.empty()) {
+                    continue;
+                }
+                codes = accepted_codes.data();
+                scanned = accepted.size();
+            }
+            residual(query, list, query_residual.data());
+            pq_.distance_table(query_residual.data(), table.data());
+            distances.resize(scanned);
+            pq_.scan(table.data(), codes, scanned, distances.data());
+            stats::count(stats::Candidates, scanned);
+            stats::count(stats::Distances, scanned);
+            stats::count(stats::Bytes, scanned * code_size);
+            for (size_t i = 0; i < scanned; ++i) {
+                best.push(distances[i], filtered ? accepted[i] : ids_[begin + i]);
+            }
+        }
+    }
+
+    // Scan of rows kept in the vector store, scored against a float32 copy of the query
+    template <typename Metric, typename Filter>
+    void search_store(const double* query, const std::vector<size_t>& lists, TopK<double>& best,
+                      const Filter& filter) const {
+        const std::vector<float> query32(query, query + dim_);
+        const VectorStore::Query prepared = store_.prepare(query32.data());
+        for (size_t list : lists) {
+            size_t scored = 0;
+            for (size_t slot = list_offsets_[list]; slot < list_offsets_[list + 1]; ++slot) {
+                if (filter(ids_[slot])) {
+                    best.push(store_.rank<Metric>(prepared, slot), ids_[slot]);
+                    ++scored;
+                }
+            }
+            stats::count(stats::Candidates, scored); // The store counts the distances
+        }
+    }
+
+    size_t dim_ = 0;
+    size_t size_ = 0;
+    size_t nlist_ = 0;
+    index_io::Array<double> centroids_;      // (nlist, dim)
+    index_io::Array<uint64_t> list_offsets_; // List l owns slots [list_offsets_[l], list_offsets_[l + 1])
+    index_io::Array<uint64_t> ids_;          // Original row id of each slot
+    index_io::Array<double> vectors_;        // (n, dim) float64 rows grouped by list
+    bool stored_ = false;                    // Rows are in store_ instead of vectors_
+    VectorStore store_;                      // (n, dim) compact rows grouped by list
+    ProductQuantizer pq_;                    // Residual quantizer, when compressed
+    index_io::Array<uint8_t> codes_;         // (n, pq_m) residual codes grouped by list
+};
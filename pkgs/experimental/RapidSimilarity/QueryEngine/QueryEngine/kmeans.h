@@ -0,0 +1,120 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <numeric>
+#include <random>
+#include <limits>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+
+#include "DistanceMetrics/pairwise.h"
+#include "DistanceMetrics/thread_pool.h"
+
+// Lloyd's k-means for the coarse quantizers. Assignment, the expensive step, runs as blocked
+// squared-L2 distance tiles on the thread pool; centroid updates are a cheap sequential pass.
+namespace kmeans {
+
+// Rows assigned per task; each task holds a (kAssignBlock, k) distance buffer
+constexpr size_t kAssignBlock = 256;
+
+// labels[i] = index of the centroid nearest to row i (lowest index on ties)
+template <typename T>
+void assign(const T* data, size_t n, size_t dim, const T* centroids, size_t k, uint32_t* labels,
+            size_t num_threads = 0, T* nearest_distances = nullptr) {
+    if (n == 0) {
+        return;
+    }
+    const size_t blocks = (n + kAssignBlock - 1) / kAssignBlock;
+    ThreadPool::instance().parallel_for(blocks, num_threads, [&](size_t block) {
+        const size_t begin = block * kAssignBlock;
+        const size_t rows = std::min(kAssignBlock, n - begin);
+        std::vector<T> distances(rows * k);
+        pairwise::cdist(data + begin * dim, rows, centroids, k, dim, pairwise::Metric::SqEuclidean, distances.data(), 1);
+        for (size_t r = 0; r < rows; ++r) {
+            const T* row = distances.data() + r * k;
+            const size_t best = static_cast<size_t>(std::min_element(row, row + k) - row);
+            labels[begin + r] = static_cast<uint32_t>(best);
+            if (nearest_distances != nullptr) {
+                nearest_distances[begin + r] = row[best];
+            }
+        }
+    });
+}
+
+// Train k centroids on the (n, dim) rows. At most max_points_per_centroid * k rows, drawn at random,
+// are used; centroids start at distinct sample rows. Empty clusters are re-seeded by splitting the
+// largest one, so every centroid ends up owning points. Deterministic for a given seed.
+template <typename T>
+std::vector<T> train(const T* data, size_t n, size_t dim, size_t k, size_t iterations = 20, uint64_t seed = 0,
+                     size_t num_threads = 0, size_t max_points_per_centroid = 256) {
+    if (k == 0 || k > n) {
+        throw std::invalid_argument("k-means needs between 1 and n centroids.");
+    }
+    std::mt19937_64 rng(seed);
+
+    // Random sample without replacement (partial Fisher-Yates over the row ids)
+    const size_t sample_size = std::min(n, std::max(k, k * max_points_per_centroid));
+    std::vector<size_t> ids(n);
+    std::iota(ids.begin(), ids.end(), size_t(0));
+    for (size_t i = 0; i < sample_size; ++i) {
+        std::uniform_int_distribution<size_t> pick(i, n - 1);
+        std::swap(ids[i], ids[pick(rng)]);
+    }
+    std::vector<T> sample(sample_size * dim);
+    for (size_t i = 0; i < sample_size; ++i) {
+        std::copy(data + ids[i] * dim, data + (ids[i] + 1) * dim, sample.begin() + i * dim);
+    }
+
+    // The sample order is already random, so its first k rows make distinct starting centroids
+    std::vector<T> centroids(sample.begin(), sample.begin() + k * dim);
+    std::vector<uint32_t> labels(sample_size);
+    std::vector<double> sums(k * dim);
+    std::vector<size_t> counts(k);
+
+    for (size_t iteration = 0; iteration < iterations; ++iteration) {
+        assign(sample.data(), sample_size, dim, centroids.data(), k, labels.data(), num_threads);
+
+        std::fill(sums.begin(), sums.end(), 0.0);
+        std::fill(counts.begin(), counts.end(), size_t(0));
+        for (size_t i = 0; i < sample_size; ++i) {
+            const T* row = sample.data() + i * dim;
+            double* sum = sums.data() + static_cast<size_t>(labels[i]) * dim;
+            for (size_t d = 0; d < dim; ++d) {
+                sum[d] += row[d];
+            }
+            ++counts[labels[i]];
+        }
+        for (size_t c = 0; c < k; ++c) {
+            if (counts[c] > 0) {
+                for (size_t d = 0; d < dim; ++d) {
+                    centroids[c * dim + d] = static_cast<T>(sums[c * dim + d] / static_cast<double>(counts[c]));
+                }
+            }
+        }
+
+        // Split the largest cluster into any empty one: both centroids are nudged apart
+        // symmetrically and its points are shared between them on the next assignment
+        for (size_t c = 0; c < k; ++c) {
+            if (counts[c] > 0) {
+                continue;
+            }
+            const size_t largest = static_cast<size_t>(std::max_element(counts.begin(), counts.end()) - counts.begin());
+            if (counts[largest] < 2) {
+                break;  // fewer distinct points than centroids
+            }
+            const T eps = static_cast<T>(1.0 / 1024);
+            for (size_t d = 0; d < dim; ++d) {
+                const T value = centroids[largest * dim + d];
+                centroids[c * dim + d] = value * (T(1) + eps) + (d % 2 == 0 ? eps : -eps);
+                centroids[largest * dim + d] = value * (T(1) - eps) - (d % 2 == 0 ? eps : -eps);
+            }
+            counts[c] = counts[largest] / 2;
+            counts[largest] -= counts[c];
+        }
+    }
+    return centroids;
+}
+
+} // namespace kmeans
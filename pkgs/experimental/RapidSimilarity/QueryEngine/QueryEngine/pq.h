@@ -0,0 +1,186 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+
+#include "kmeans.h"
+#include "DistanceMetrics/index_io.h"
+#include "DistanceMetrics/simd_kernels.h"
+#include "DistanceMetrics/thread_pool.h"
+
+// Product quantizer: a dim-dimensional vector is cut into m sub-vectors of dim / m values and each
+// sub-vector is replaced by the index of its nearest centroid in that subspace's codebook of up to
+// 256 centroids, so a vector is stored in m bytes. Squared distances from a query to encoded
+// vectors are asymmetric: the query stays exact and one (m, 256) table of its squared distances to
+// every centroid turns each code into m table lookups (ADC).
+class ProductQuantizer {
+public:
+    static constexpr size_t kMaxCentroids = 256;  // 8-bit codes
+    // Training rows per codebook centroid; low-dimensional codebooks settle on far fewer rows
+    // than the coarse quantizer needs
+    static constexpr size_t kTrainPointsPerCentroid = 64;
+
+    ProductQuantizer() = default;
+
+    ProductQuantizer(size_t dim, size_t m) : dim_(dim), m_(m), dsub_(m == 0 ? 0 : dim / m) {
+        if (m == 0 || dim == 0 || dim % m != 0) {
+            throw std::invalid_argument("The vector dimension must be a positive multiple of pq_m.");
+        }
+    }
+
+    // Sections: parameters (dim, m, centroids per codebook), then the codebooks
+    void save(index_io::Writer& writer) const {
+        writer.write(std::vector<uint64_t>{dim_, m_, ksub_});
+        writer.write(centroids_);
+    }
+
+    // Quantizer read back from the sections written by save(); the codebooks stay mapped
+    explicit ProductQuantizer(index_io::Reader& reader) {
+        const std::vector<uint64_t> params = reader.vector<uint64_t>(3);
+        dim_ = static_cast<size_t>(params[0]);
+        m_ = static_cast<size_t>(params[1]);
+        ksub_ = static_cast<size_t>(params[2]);
+        dsub_ = m_ == 0 ? 0 : dim_ / m_;
+        centroids_ = reader.array<float>();
+        if ((m_ > 0 && dim_ % m_ != 0) || ksub_ > kMaxCentroids || centroids_.size() != m_ * ksub_ * dsub_) {
+            throw std::invalid_argument("Product quantizer section is inconsistent.");
+        }
+    }
+
+    size_t dimension() const { return dim_; }
+    size_t num_subspaces() const { return m_; }
+    size_t code_size() const { return m_; }
+    // Centroids per codebook: 256, or n when training on fewer rows
+    size_t num_centroids() const { return ksub_; }
+    // Entries of a distance table
+    size_t table_size() const { return m_ * ksub_; }
+    bool trained() const { return ksub_ > 0; }
+
+    // Train every codebook with k-means on the matching columns of the (n, dim) rows
+    template <typename T>
+    void train(const T* data, size_t n, uint64_t seed = 0, size_t num_threads = 0, size_t iterations = 10) {
+        if (n == 0) {
+            throw std::invalid_argument("Product quantizer training needs at least one vector.");
+        }
+        ksub_ = std::min(kMaxCentroids, n);
+        std::vector<float> codebooks(m_ * ksub_ * dsub_, 0.0f);
+        std::vector<float> columns;
+        for (size_t s = 0; s < m_; ++s) {
+            subspace(data, n, s, columns);
+            const std::vector<float> codebook =
+                kmeans::train(columns.data(), n, dsub_, ksub_, iterations, seed + s, num_threads,
+                              kTrainPointsPerCentroid);
+            std::copy(codebook.begin(), codebook.end(), codebooks.begin() + s * ksub_ * dsub_);
+        }
+        centroids_ = std::move(codebooks);
+    }
+
+    // m-byte codes of the (n, dim) rows into codes (n * code_size() bytes)
+    template <typename T>
+    void encode(const T* data, size_t n, uint8_t* codes, size_t num_threads = 0) const {
+        check_trained();
+        std::vector<float> columns;
+        std::vector<uint32_t> labels(n);
+        for (size_t s = 0; s < m_; ++s) {
+            subspace(data, n, s, columns);
+            kmeans::assign(columns.data(), n, dsub_, codebook(s), ksub_, labels.data(), num_threads);
+            for (size_t i = 0; i < n; ++i) {
+                codes[i * m_ + s] = static_cast<uint8_t>(labels[i]);
+            }
+        }
+    }
+
+    // Approximate vector of one code
+    template <typename T>
+    void decode(const uint8_t* code, T* out) const {
+        check_trained();
+        for (size_t s = 0; s < m_; ++s) {
+            const float* centroid = codebook(s) + static_cast<size_t>(code[s]) * dsub_;
+            for (size_t d = 0; d < dsub_; ++d) {
+                out[s * dsub_ + d] = static_cast<T>(centroid[d]);
+            }
+        }
+    }
+
+    // table[s * num_centroids() + c] = squared distance from sub-vector s of the query to centroid c
+    template <typename T>
+    void distance_table(const T* query, float* table) const {
+        check_trained();
+        // Sub-vectors are short, so plain loops beat a kernel call per centroid
+        std::vector<float> sub(dsub_);
+        for (size_t s = 0; s < m_; ++s) {
+            std::copy(query + s * dsub_, query + (s + 1) * dsub_, sub.begin());
+            const float* centroid = codebook(s);
+            float* row = table + s * ksub_;
+            for (size_t c = 0; c < ksub_; ++c, centroid += dsub_) {
+                float sum = 0.0f;
+                for (size_t d = 0; d < dsub_; ++d) {
+                    const float diff = sub[d] - centroid[d];
+                    sum += diff * diff;
+                }
+                row[c] = sum;
+            }
+        }
+    }
+
+    // Estimated squared distance of one code from the query behind the table
+    float distance(const float* table, const uint8_t* code) const {
+        float sum = 0.0f;
+        for (size_t s = 0; s < m_; ++s) {
+            sum += table[s * ksub_ + code[s]];
+        }
+        return sum;
+    }
+
+    // out[i] = distance(table, codes + i * code_size()) for n consecutive codes. Four codes are
+    // summed at a time so the independent lookups overlap; the table stays in L1.
+    void scan(const float* table, const uint8_t* codes, size_t n, float* out) const {
+        size_t i = 0;
+        for (; i + 4 <= n; i += 4) {
+            const uint8_t* c = codes + i * m_;
+            float s0 = 0.0f, s1 = 0.0f, s2 = 0.0f, s3 = 0.0f;
+            for (size_t s = 0; s < m_; ++s) {
+                const float* sub = table + s * ksub_;
+                s0 += sub[c[s]];
+                s1 += sub[c[m_ + s]];
+                s2 += sub[c[2 * m_ + s]];
+                s3 += sub[c[3 * m_ + s]];
+            }
+            out[i] = s0;
+            out[i + 1] = s1;
+            out[i + 2] = s2;
+            out[i + 3] = s3;
+        }
+        for (; i < n; ++i) {
+            out[i] = distance(table, codes + i * m_);
+        }
+    }
+
+private:
+    size_t dim_ = 0;
+    size_t m_ = 0;
+    size_t dsub_ = 0;
+    size_t ksub_ = 0;
+    index_io::Array<float> centroids_;  // (m, ksub, dsub)
+
+    const float* codebook(size_t s) const { return centroids_.data() + s * ksub_ * dsub_; }
+
+    void check_trained() const {
+        if (!trained()) {
+            throw std::logic_error("Product quantizer is not trained.");
+        }
+    }
+
+    // Columns [s * dsub, (s + 1) * dsub) of the rows as a contiguous float32 (n, dsub) matrix
+    template <typename T>
+    void subspace(const T* data, size_t n, size_t s, std::vector<float>& out) const {
+        out.resize(n * dsub_);
+        for (size_t i = 0; i < n; ++i) {
+            const T* row = data + i * dim_ + s * dsub_;
+            std::copy(row, row + dsub_, out.begin() + i * dsub_);
+        }
+    }
+};
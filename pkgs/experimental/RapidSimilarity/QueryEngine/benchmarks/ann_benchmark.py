@@ -0,0 +1,417 @@
+"""End-to-end benchmark of the RapidSimilarity indexes on an ANN dataset.
+
+For every engine this builds an index over the base vectors, records the build time and the
+index size, then sweeps the engine's speed/recall knob (``probes``, ``ef_search``, ``accuracy``)
+and measures recall@k against exact ground truth, batch throughput and single-query latency
+percentiles. The report is one JSON document, so two runs can be diffed or compared by a script
+to catch regressions between releases::
+
+    python ann_benchmark.py synthetic --output synthetic.json
+    python ann_benchmark.py ~/data/sift --k 10 --output sift1m.json      # texmex layout
+    python ann_benchmark.py glove-100-angular.hdf5 --max-base 200000     # ann-benchmarks
+    python ann_benchmark.py base.fvecs --queries query.fvecs --engines hnsw,ivf
+
+Datasets are a texmex directory (``*_base.fvecs``, ``*_query.fvecs`` and optionally
+``*_groundtruth.ivecs``, as SIFT1M and GIST1M ship), an ann-benchmarks HDF5 file (``train``,
+``test``, ``neighbors``; needs h5py), a single ``.fvecs``/``.bvecs``/``.npy`` file or a GloVe
+text file (one word and its vector per line), or ``synthetic`` for clustered Gaussian data.
+Without a query file the last ``--num-queries`` base rows are held out as queries. Ground truth
+comes from the dataset when it has any for the chosen metric and is otherwise computed with
+``exact_query.exact_knn`` (or numpy, when QueryEngine is not installed).
+
+The engines are ``kdtree`` (exact ``KDTree``, Euclidean only), ``lsh`` (``LSHIndex``), ``hnsw``
+(``HNSWIndex``) and ``ivf`` (``ApproximateQueryEngine``). Engines whose package is not installed
+are skipped. Queries run on ``--threads`` threads for
+throughput (1 by default, which makes QPS comparable between machines) and one at a time for
+the latency percentiles.
+"""
+
+import argparse
+import glob
+import json
+import os
+import platform
+import resource
+import sys
+import tempfile
+import time
+
+import numpy as np
+
+ENGINES = ("kdtree", "lsh", "hnsw", "ivf")
+
+
+# --- Datasets ---------------------------------------------------------------------------------
+
+
+def read_vecs(path, dtype):
+    """Rows of a texmex .fvecs (float32), .ivecs (int32) or .bvecs (uint8) file."""
+    raw = np.fromfile(path, dtype=np.uint8)
+    if raw.size == 0:
+        return np.zeros((0, 0), dtype=dtype)
+    dim = int(raw[:4].view(np.int32)[0])
+    itemsize = np.dtype(dtype).itemsize
+    rows = raw.reshape(-1, 4 + dim * itemsize)
+    return rows[:, 4:].copy().view(dtype).reshape(len(rows), dim)
+
+
+def read_vectors(path):
+    extension = os.path.splitext(path)[1].lower()
+    if extension == ".fvecs":
+        return read_vecs(path, np.float32)
+    if extension == ".bvecs":
+        return read_vecs(path, np.uint8).astype(np.float32)
+    if extension == ".npy":
+        return np.load(path, mmap_mode="r").astype(np.float32)
+    if extension == ".txt":  # GloVe: word followed by its vector
+        with open(path, encoding="utf-8") as lines:
+            return np.array([line.rstrip().split(" ")[1:] for line in lines], dtype=np.float32)
+    raise ValueError(f"Unknown vector file type: {path}")
+
+
+def synthetic(size, dim, num_queries, seed):
+    """Gaussian clusters around random centres, with queries drawn the same way."""
+    rng = np.random.default_rng(seed)
+    centres = rng.standard_normal((max(size // 1000, 1), dim)).astype(np.float32) * 4
+    labels = rng.integers(0, len(centres), size=size + num_queries)
+    points = centres[labels] + rng.standard_normal((size + num_queries, dim)).astype(np.float32)
+    return points[:size], points[size:]
+
+
+def load_dataset(args):
+    """(name, base, queries, ground-truth ids or None when there are none for args.metric and k)."""
+    spec = args.dataset
+    neighbors, neighbors_metric = None, "euclidean"
+    if spec == "synthetic":
+        base, queries = synthetic(args.size, args.dim, args.num_queries, args.seed)
+    elif os.path.isdir(spec):
+        base = read_vectors(_one(spec, "*base.fvecs", "*base.bvecs"))
+        queries = read_vectors(_one(spec, "*query.fvecs", "*query.bvecs"))
+        truth = glob.glob(os.path.join(spec, "*groundtruth.ivecs"))
+        neighbors = read_vecs(truth[0], np.int32) if truth else None
+    elif spec.endswith((".hdf5", ".h5")):
+        import h5py
+
+        with h5py.File(spec, "r") as data:
+            base = np.asarray(data["train"], dtype=np.float32)
+            queries = np.asarray(data["test"], dtype=np.float32)
+            neighbors = np.asarray(data["neighbors"]) if "neighbors" in data else None
+            distance = data.attrs.get("distance", "euclidean")
+            neighbors_metric = {"angular": "cosine", "euclidean": "euclidean"}.get(distance, distance)
+    else:
+        base = read_vectors(spec)
+        if args.queries:
+            queries = read_vectors(args.queries)
+        else:
+            base, queries = base[: -args.num_queries], base[-args.num_queries :]
+        if args.groundtruth:
+            neighbors = read_vecs(args.groundtruth, np.int32)
+
+    if args.max_base and len(base) > args.max_base:
+        base, neighbors = base[: args.max_base], None  # Ground truth is for the full base set
+    queries = queries[: args.num_queries]
+    if neighbors is not None:
+        neighbors = neighbors[: len(queries)]
+    if neighbors is not None and (neighbors_metric != args.metric or neighbors.shape[1] < args.k):
+        neighbors = None
+    name = spec if spec == "synthetic" else os.path.basename(os.path.normpath(spec))
+    base = np.ascontiguousarray(base, dtype=np.float32)
+    return name, base, np.ascontiguousarray(queries, dtype=np.float32), neighbors
+
+
+def _one(directory, *patterns):
+    for pattern in patterns:
+        found = sorted(glob.glob(os.path.join(directory, pattern)))
+        if found:
+            return found[0]
+    raise FileNotFoundError(f"No {' or '.join(patterns)} file in {directory}")
+
+
+def ground_truth(base, queries, k, metric, threads):
+    """Exact k nearest base ids of every query, by exact_knn or, without QueryEngine, by numpy."""
+    try:
+        from QueryEngine import exact_query
+    except ImportError:
+        exact_query = None
+    if exact_query is not None:
+        ids, _ = exact_query.exact_knn(base, queries, k, metric=metric, num_threads=threads)
+        return np.asarray(ids)
+    if metric == "cosine":
+        base = base / np.maximum(np.linalg.norm(base, axis=1, keepdims=True), 1e-30)
+    ids = []
+    for block in np.array_split(queries, max(len(queries) // 64, 1)):
+        if metric == "euclidean":
+            scores = (base * base).sum(axis=1) - 2 * block @ base.T  # Rank-equivalent to the distance
+        else:
+            scores = -(block @ base.T)
+        nearest = np.argpartition(scores, k - 1, axis=1)[:, :k]
+        order = np.argsort(np.take_along_axis(scores, nearest, axis=1), axis=1, kind="stable")
+        ids.append(np.take_along_axis(nearest, order, axis=1))
+    return np.concatenate(ids)
+
+
+# --- Engines ----------------------------------------------------------------------------------
+#
+# Each engine is a build(base, args) function and a sweep of (parameter setting, batch search,
+# single search) entries. Searches return (M, k) ids with -1 for missing neighbours.
+
+
+def kdtree_engine(base, args):
+    from IndexBuilder.tree_index import KDTree
+
+    tree = KDTree(base, leaf_size=args.leaf_size, num_threads=args.threads)
+    params = {"leaf_size": args.leaf_size}
+
+    def sweep():
+        yield (
+            {},
+            lambda q: tree.knn_batch(q, args.k, num_threads=args.threads)[0],
+            lambda q: tree.knn(q, args.k)[0],
+        )
+
+    return tree, params, sweep
+
+
+def lsh_engine(base, args):
+    from IndexBuilder.hash_index import LSHIndex
+
+    # Random hyperplanes bucket by angle, quantized projections by Euclidean distance
+    family = "e2lsh" if args.metric == "euclidean" else "simhash"
+    index = LSHIndex(
+        args.lsh_hashes,
+        len(base),
+        num_tables=args.lsh_tables,
+        family=family,
+        bucket_width=args.lsh_bucket_width,
+        seed=args.seed,
+    )
+    index.insert_batch(base)
+    index.compact()
+    params = {"num_hashes": args.lsh_hashes, "num_tables": args.lsh_tables, "family": family}
+    if family == "e2lsh":
+        params["bucket_width"] = args.lsh_bucket_width
+
+    # query() returns every candidate, so single queries go through a batch of one for the top k
+    def sweep():
+        for probes in (0, 1, 2, 4, 8, 16, 32, 64):
+            yield (
+                {"probes": probes},
+                lambda q, p=probes: index.query_batch(
+                    q, args.k, probes=p, num_threads=args.threads, metric=args.metric
+                )[0],
+                lambda q, p=probes: index.query_batch(q[None, :], args.k, probes=p, metric=args.metric)[0][0],
+            )
+
+    return index, params, sweep
+
+
+def hnsw_engine(base, args):
+    from IndexBuilder.hnsw_index import HNSWIndex
+
+    index = HNSWIndex(M=args.hnsw_m, ef_construction=args.ef_construction, seed=args.seed, metric=args.metric)
+    index.insert_batch(base, num_threads=args.threads)
+    params = {"M": args.hnsw_m, "ef_construction": args.ef_construction}
+
+    def sweep():
+        for ef in sorted({args.k, 16, 32, 64, 128, 256, 512} - set(range(args.k))):
+            yield (
+                {"ef_search": ef},
+                lambda q, e=ef: index.knn_batch(q, args.k, ef_search=e, num_threads=args.threads)[0],
+                lambda q, e=ef: index.knn(q, args.k, ef_search=e)[0],
+            )
+
+    return index, params, sweep
+
+
+def ivf_engine(base, args):
+    from QueryEngine.approx_query import ApproximateQueryEngine
+
+    engine = ApproximateQueryEngine(
+        base, num_neighbors=args.k, seed=args.seed, num_threads=args.threads, storage=args.ivf_storage
+    )
+    params = {"nlist": engine.nlist, "storage": engine.storage}
+
+    def sweep():
+        for accuracy in (0.0, 0.2, 0.4, 0.5, 0.6, 0.8, 1.0):
+            engine.accuracy = accuracy
+            settings = {"accuracy": accuracy, "nprobe": engine.nprobe}
+            yield (
+                settings,
+                lambda q: engine.query_batch(q, num_threads=args.threads, metric=args.metric)[0],
+                lambda q: engine.query(q, metric=args.metric)[0],
+            )
+
+    return engine, params, sweep
+
+
+BUILDERS = {"kdtree": kdtree_engine, "lsh": lsh_engine, "hnsw": hnsw_engine, "ivf": ivf_engine}
+
+
+# --- Measurements -----------------------------------------------------------------------------
+
+
+def rss_bytes():
+    """Resident set size of this process, from /proc on Linux and the peak elsewhere."""
+    try:
+        with open("/proc/self/statm") as statm:
+            return int(statm.read().split()[1]) * os.sysconf("SC_PAGE_SIZE")
+    except OSError:
+        peak = resource.getrusage(resource.RUSAGE_SELF).ru_maxrss
+        return peak if sys.platform == "darwin" else peak * 1024
+
+
+def saved_bytes(index):
+    """Size of the index on disk, which counts its arrays without allocator or interpreter overhead."""
+    with tempfile.TemporaryDirectory() as directory:
+        path = os.path.join(directory, "index")
+        index.save(path)
+        return os.path.getsize(path)
+
+
+def recall(found, truth, k):
+    hits = sum(len(np.intersect1d(row[row >= 0], expected[:k])) for row, expected in zip(found, truth))
+    return hits / (k * len(truth))
+
+
+def measure(batch, single, queries, truth, args):
+    start = time.perf_counter()
+    found = np.asarray(batch(queries))
+    seconds = time.perf_counter() - start
+
+    latencies = []
+    for query in queries[: max(args.latency_queries, 1)]:
+        start = time.perf_counter()
+        single(query)
+        latencies.append(time.perf_counter() - start)
+    latencies = np.array(latencies) * 1e3
+    return {
+        "recall": recall(found, truth, args.k),
+        "qps": len(queries) / seconds,
+        "p50_ms": float(np.percentile(latencies, 50)),
+        "p99_ms": float(np.percentile(latencies, 99)),
+        "mean_ms": float(latencies.mean()),
+    }
+
+
+def run_engine(name, base, queries, truth, args):
+    rss_before = rss_bytes()
+    start = time.perf_counter()
+    index, params, sweep = BUILDERS[name](base, args)
+    build_seconds = time.perf_counter() - start
+    result = {
+        "engine": name,
+        "params": params,
+        "build_seconds": build_seconds,
+        "rss_growth_bytes": max(rss_bytes() - rss_before, 0),
+        "index_bytes": saved_bytes(index),
+        "curve": [],
+    }
+    for settings, batch, single in sweep():
+        point = dict(settings, **measure(batch, single, queries, truth, args))
+        result["curve"].append(point)
+        print(f"{name:>6} {json.dumps(settings):<36} recall {point['recall']:.4f}  qps {point['qps']:10.1f}  "
+              f"p50 {point['p50_ms']:.3f} ms  p99 {point['p99_ms']:.3f} ms", file=sys.stderr)
+    return result
+
+
+def versions():
+    found = {"python": platform.python_version(), "numpy": np.__version__}
+    for package in ("DistanceMetrics", "IndexBuilder", "QueryEngine"):
+        try:
+            found[package] = __import__(package).__version__
+        except ImportError:
+            pass
+    return found
+
+
+def simd_level():
+    try:
+        from DistanceMetrics import euclidean
+
+        return euclidean.simd_level()
+    except ImportError:
+        return None
+
+
+def parse_args(argv):
+    parser = argparse.ArgumentParser(description=__doc__.split("\n\n")[0])
+    parser.add_argument("dataset", help="'synthetic', a texmex directory, an .hdf5 file or a vector file")
+    parser.add_argument("--queries", help="query vectors for a single-file dataset")
+    parser.add_argument("--groundtruth", help="ground-truth .ivecs for a single-file dataset")
+    parser.add_argument("--engines", default=",".join(ENGINES), help="comma-separated subset of " + ", ".join(ENGINES))
+    parser.add_argument("--metric", default="euclidean", choices=["euclidean", "cosine", "ip"])
+    parser.add_argument("--k", type=int, default=10)
+    parser.add_argument("--num-queries", type=int, default=1000)
+    parser.add_argument("--latency-queries", type=int, default=200, help="queries timed one at a time")
+    parser.add_argument("--max-base", type=int, default=0, help="use only this many base vectors")
+    parser.add_argument("--threads", type=int, default=1)
+    parser.add_argument("--seed", type=int, default=0)
+    parser.add_argument("--size", type=int, default=20000, help="synthetic base vectors")
+    parser.add_argument("--dim", type=int, default=64, help="synthetic dimension")
+    parser.add_argument("--leaf-size", type=int, default=32)
+    parser.add_argument("--lsh-hashes", type=int, default=12)
+    parser.add_argument("--lsh-tables", type=int, default=8)
+    parser.add_argument("--lsh-bucket-width", type=float, default=4.0)
+    parser.add_argument("--hnsw-m", type=int, default=16)
+    parser.add_argument("--ef-construction", type=int, default=200)
+    parser.add_argument("--ivf-storage", default="float32")
+    parser.add_argument("--output", help="write the JSON report here instead of to stdout")
+    return parser.parse_args(argv)
+
+
+def main(argv=None):
+    args = parse_args(argv)
+    engines = [name.strip() for name in args.engines.split(",") if name.strip()]
+    unknown = sorted(set(engines) - set(ENGINES))
+    if unknown:
+        raise SystemExit(f"Unknown engines: {', '.join(unknown)}")
+
+    name, base, queries, truth = load_dataset(args)
+    start = time.perf_counter()
+    if truth is None:
+        truth = ground_truth(base, queries, args.k, args.metric, args.threads)
+    truth_seconds = time.perf_counter() - start
+    print(f"{name}: {len(base)} base, {len(queries)} queries, dim {base.shape[1]}", file=sys.stderr)
+
+    results = []
+    for engine in engines:
+        if engine == "kdtree" and args.metric != "euclidean":
+            continue  # The KD-tree prunes on coordinate distances and has no cosine or ip search
+        try:
+            results.append(run_engine(engine, base, queries, truth, args))
+        except ImportError as error:
+            print(f"{engine}: skipped ({error})", file=sys.stderr)
+
+    report = {
+        "benchmark": "ann",
+        "schema": 1,
+        "timestamp": time.strftime("%Y-%m-%dT%H:%M:%SZ", time.gmtime()),
+        "host": {
+            "platform": platform.platform(),
+            "machine": platform.machine(),
+            "cpu_count": os.cpu_count(),
+            "simd_level": simd_level(),
+        },
+        "versions": versions(),
+        "dataset": {
+            "name": name,
+            "size": len(base),
+            "queries": len(queries),
+            "dim": int(base.shape[1]),
+            "metric": args.metric,
+            "k": args.k,
+            "ground_truth_seconds": truth_seconds,
+        },
+        "threads": args.threads,
+        "results": results,
+    }
+    text = json.dumps(report, indent=2)
+    if args.output:
+        with open(args.output, "w") as out:
+            out.write(text + "\n")
+    else:
+        print(text)
+
+
+if __name__ == "__main__":
+    main()
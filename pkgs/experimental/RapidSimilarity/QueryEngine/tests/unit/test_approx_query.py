@@ -80,3 +80,317 @@ def test_approx_query_large_dataset():
 
     assert len(result) == num_neighbors
     assert all(isinstance(i, int) for i in result)
+
+
+@pytest.mark.unit
+def test_approx_query_batch():
+    """Test batched approximate queries against the single-query interface."""
+    from approx_query import approx_query_batch
+
+    rng = np.random.default_rng(0)
+    dataset = rng.random((200, 3))
+    queries = rng.random((10, 3))
+
+    indices, distances = approx_query_batch(dataset, queries, 4, 0.1, num_threads=2)
+
+    assert indices.shape == (10, 4)
+    assert distances.shape == (10, 4)
+    for row, query in enumerate(queries):
+        expected = approx_query(dataset.tolist(), query.tolist(), 4, 0.1)
+        assert indices[row].tolist() == expected
+        assert np.all(np.diff(distances[row]) >= 0)
+
+    with pytest.raises(ValueError):
+        approx_query_batch(dataset, rng.random((2, 4)), 4, 0.1)
+
+
+@pytest.mark.unit
+def test_approx_query_accepts_arrays():
+    """Test that NumPy arrays, float32 data and lists give the same neighbours."""
+    rng = np.random.default_rng(3)
+    dataset = rng.random((100, 8))
+    query_point = rng.random(8)
+
+    expected = approx_query(dataset.tolist(), query_point.tolist(), 5, 0.1)
+
+    assert approx_query(dataset, query_point, 5, 0.1) == expected
+    assert approx_query(dataset[:, ::1], memoryview(query_point), 5, 0.1) == expected
+
+    with pytest.raises(ValueError):
+        approx_query(dataset, query_point[:4], 5, 0.1)
+
+
+@pytest.mark.unit
+def test_approx_query_matches_full_sort():
+    """Test the bounded top-k selection against a full stable sort, including k > n."""
+    rng = np.random.default_rng(5)
+    dataset = rng.integers(0, 4, size=(300, 2)).astype(np.float64)  # many tied distances
+    queries = rng.integers(0, 4, size=(6, 2)).astype(np.float64)
+
+    from approx_query import approx_query_batch
+
+    for k in (1, 10, 400):
+        indices, distances = approx_query_batch(dataset, queries, k, 0.1)
+        for row, query in enumerate(queries):
+            exact = np.linalg.norm(dataset - query, axis=1)
+            order = np.argsort(exact, kind="stable")[:k]
+            found = min(k, len(dataset))
+            assert indices[row, :found].tolist() == order.tolist()
+            assert np.allclose(distances[row, :found], exact[order])
+            assert approx_query(dataset, query, k, 0.1) == order.tolist()
+
+
+def clustered_data(rng, n, dim, clusters):
+    """Points scattered around random cluster centres."""
+    centres = rng.normal(scale=5.0, size=(clusters, dim))
+    return centres[rng.integers(0, clusters, size=n)] + rng.normal(size=(n, dim))
+
+
+@pytest.mark.unit
+def test_approximate_query_engine_exact_at_full_accuracy():
+    """Test that accuracy=1 probes every list and matches a brute-force search."""
+    from approx_query import ApproximateQueryEngine
+
+    rng = np.random.default_rng(11)
+    dataset = clustered_data(rng, 3000, 8, 20)
+    queries = clustered_data(rng, 20, 8, 20)
+    engine = ApproximateQueryEngine(dataset, num_neighbors=5, accuracy=1.0, seed=1)
+
+    assert len(engine) == 3000
+    assert engine.nprobe == engine.nlist
+    indices, distances = engine.query_batch(queries)
+    for row, query in enumerate(queries):
+        exact = np.linalg.norm(dataset - query, axis=1)
+        order = np.argsort(exact, kind="stable")[:5]
+        assert indices[row].tolist() == order.tolist()
+        assert np.allclose(distances[row], exact[order])
+
+
+@pytest.mark.unit
+def test_approximate_query_engine_accuracy_dial():
+    """Test that nprobe grows with accuracy and recall stays high on clustered data."""
+    from approx_query import ApproximateQueryEngine
+
+    rng = np.random.default_rng(12)
+    dataset = clustered_data(rng, 5000, 16, 30)
+    queries = clustered_data(rng, 50, 16, 30)
+    engine = ApproximateQueryEngine(dataset, num_neighbors=10, accuracy=0.0, seed=2)
+
+    probes = []
+    for accuracy in (0.0, 0.25, 0.5, 0.75, 1.0):
+        engine.accuracy = accuracy
+        probes.append(engine.nprobe)
+    assert probes[0] == 1
+    assert probes == sorted(probes)
+    assert probes[-1] == engine.nlist
+
+    engine.accuracy = 0.5
+    indices, _ = engine.query_batch(queries, num_threads=2)
+    hits = 0
+    for row, query in enumerate(queries):
+        truth = set(np.argsort(np.linalg.norm(dataset - query, axis=1), kind="stable")[:10])
+        hits += len(truth & set(indices[row].tolist()))
+    assert hits / (10 * len(queries)) > 0.9
+
+    single_indices, single_distances = engine.query(queries[0], 3)
+    assert single_indices.tolist() == indices[0, :3].tolist()
+    assert np.all(np.diff(single_distances) >= 0)
+
+
+@pytest.mark.unit
+def test_approximate_query_engine_validates_inputs():
+    """Test argument checks of the persistent engine."""
+    from approx_query import ApproximateQueryEngine
+
+    dataset = np.random.default_rng(13).random((100, 4))
+    with pytest.raises(ValueError):
+        ApproximateQueryEngine(dataset, accuracy=1.5)
+    engine = ApproximateQueryEngine(dataset, accuracy=1.0)
+    with pytest.raises(ValueError):
+        engine.query(np.ones(3))
+    with pytest.raises(ValueError):
+        engine.accuracy = -0.1
+    indices, distances = engine.query(dataset[0], 200)
+    assert len(indices) == 100  # k larger than the dataset returns every row
+
+
+@pytest.mark.unit
+@pytest.mark.parametrize("nlist, min_recall", [(0, 0.8), (1, 0.6)])
+def test_approximate_query_engine_product_quantization(nlist, min_recall):
+    """Test that PQ-compressed lists store pq_m bytes per row and keep most true neighbours."""
+    from approx_query import ApproximateQueryEngine
+
+    rng = np.random.default_rng(14)
+    dataset = clustered_data(rng, 3000, 16, 30)
+    queries = dataset[::60] + rng.normal(scale=0.1, size=(50, 16))
+    engine = ApproximateQueryEngine(dataset, num_neighbors=10, accuracy=1.0, nlist=nlist, seed=4, pq_m=8)
+
+    assert engine.pq_m == 8
+    assert engine.code_size == 8
+    indices, distances = engine.query_batch(queries)
+    hits = 0
+    for row, query in enumerate(queries):
+        truth = set(np.argsort(np.linalg.norm(dataset - query, axis=1), kind="stable")[:10])
+        hits += len(truth & set(indices[row].tolist()))
+    assert hits / (10 * len(queries)) > min_recall
+    assert np.all(np.diff(distances, axis=1) >= 0)
+
+    with pytest.raises(ValueError):
+        ApproximateQueryEngine(dataset, pq_m=3)  # 16 dimensions do not split into 3 sub-vectors
+
+
+@pytest.mark.unit
+@pytest.mark.parametrize("pq_m", [0, 4])
+def test_approximate_query_engine_save_and_load(tmp_path, pq_m):
+    """A loaded engine keeps its settings and returns the same neighbours."""
+    from approx_query import ApproximateQueryEngine
+
+    rng = np.random.default_rng(6)
+    dataset = rng.standard_normal((1000, 8))
+    engine = ApproximateQueryEngine(dataset, num_neighbors=5, accuracy=0.7, nlist=10, seed=3, pq_m=pq_m)
+    path = tmp_path / "ivf.idx"
+    engine.save(path)
+
+    loaded = ApproximateQueryEngine.load(path)
+
+    assert len(loaded) == 1000
+    assert (loaded.nlist, loaded.nprobe, loaded.pq_m) == (engine.nlist, engine.nprobe, engine.pq_m)
+    assert loaded.accuracy == pytest.approx(0.7)
+    indices, distances = engine.query_batch(dataset[:20])
+    loaded_indices, loaded_distances = loaded.query_batch(dataset[:20])
+    assert np.array_equal(loaded_indices, indices)
+    assert np.array_equal(loaded_distances, distances)
+
+
+@pytest.mark.unit
+@pytest.mark.parametrize("storage, code_size, min_recall, atol", [("float64", 128, 0.99, 1e-9),
+                                                                  ("float32", 64, 0.99, 1e-4),
+                                                                  ("float16", 32, 0.95, 0.05),
+                                                                  ("int8", 32, 0.9, 0.25)])
+def test_approximate_query_engine_storage_modes(tmp_path, storage, code_size, min_recall, atol):
+    """Uncompressed lists can hold compact rows; an exhaustive probe still finds nearly every neighbour."""
+    from approx_query import ApproximateQueryEngine
+
+    rng = np.random.default_rng(15)
+    dataset = clustered_data(rng, 2000, 16, 20)
+    queries = dataset[::40] + rng.normal(scale=0.1, size=(50, 16))
+    engine = ApproximateQueryEngine(dataset, num_neighbors=10, accuracy=1.0, seed=5, storage=storage)
+
+    assert engine.storage == storage
+    assert engine.code_size == code_size
+    indices, distances = engine.query_batch(queries)
+    hits = 0
+    for row, query in enumerate(queries):
+        truth = set(np.argsort(np.linalg.norm(dataset - query, axis=1), kind="stable")[:10])
+        hits += len(truth & set(indices[row].tolist()))
+    assert hits / (10 * len(queries)) > min_recall
+    exact = np.linalg.norm(dataset[indices[0]] - queries[0], axis=1)
+    assert np.allclose(distances[0], exact, rtol=0, atol=atol)
+
+    path = tmp_path / "ivf.idx"
+    engine.save(path)
+    loaded = ApproximateQueryEngine.load(path)
+    assert loaded.storage == storage
+    assert np.array_equal(loaded.query_batch(queries)[0], indices)
+
+    with pytest.raises(ValueError):
+        ApproximateQueryEngine(dataset, storage="int4")
+    with pytest.raises(ValueError):
+        ApproximateQueryEngine(dataset, pq_m=4, storage="int8")
+
+
+@pytest.mark.unit
+@pytest.mark.parametrize("metric", ["cosine", "manhattan"])
+def test_approximate_query_engine_metrics(metric):
+    """An exhaustive probe ranked by another metric matches a brute-force scan of that metric."""
+    from approx_query import ApproximateQueryEngine, approx_query_batch
+
+    rng = np.random.default_rng(16)
+    dataset = clustered_data(rng, 1000, 8, 10)
+    queries = clustered_data(rng, 10, 8, 10)
+    engine = ApproximateQueryEngine(dataset, num_neighbors=5, accuracy=1.0, seed=6)
+    if metric == "cosine":
+        values = -(queries @ dataset.T) / np.outer(np.linalg.norm(queries, axis=1), np.linalg.norm(dataset, axis=1))
+    else:
+        values = np.abs(queries[:, None, :] - dataset[None, :, :]).sum(axis=2)
+    order = np.argsort(values, axis=1, kind="stable")[:, :5]
+
+    indices, distances = engine.query_batch(queries, metric=metric)
+    assert np.array_equal(indices, order)
+    expected = np.take_along_axis(values, order, axis=1)
+    assert np.allclose(distances, -expected if metric == "cosine" else expected)
+    single_indices, _ = engine.query(queries[0], 5, metric=metric)
+    assert single_indices.tolist() == order[0].tolist()
+    batch_indices, _ = approx_query_batch(dataset, queries, 5, 1.0, metric=metric)
+    assert np.array_equal(batch_indices, order)
+
+    with pytest.raises(ValueError):
+        engine.query(queries[0], metric="chebyshev")
+    compressed = ApproximateQueryEngine(dataset, accuracy=1.0, pq_m=4)
+    with pytest.raises(ValueError):
+        compressed.query_batch(queries, metric=metric)  # PQ codes only approximate Euclidean distances
+
+
+@pytest.mark.unit
+def test_approximate_query_engine_filter():
+    """Filtered queries return the nearest rows among those the filter accepts."""
+    from approx_query import ApproximateQueryEngine
+
+    rng = np.random.default_rng(17)
+    dataset = clustered_data(rng, 2000, 8, 10)
+    queries = clustered_data(rng, 10, 8, 10)
+    tenant = rng.integers(0, 20, size=2000)
+    engine = ApproximateQueryEngine(dataset, num_neighbors=5, accuracy=1.0, seed=3)
+    distances = np.linalg.norm(queries[:, None, :] - dataset[None, :, :], axis=2)
+
+    def nearest(accepted):
+        rows = np.flatnonzero(accepted)
+        return rows[np.argsort(distances[:, rows], axis=1, kind="stable")[:, :5]]
+
+    for filter, accepted in [
+        ((tenant, "==", 4), tenant == 4),
+        ((tenant, "in", [1, 2]), np.isin(tenant, [1, 2])),
+        ((tenant, ">=", 15), tenant >= 15),
+        (tenant % 3 == 0, tenant % 3 == 0),
+        (np.flatnonzero(tenant == 7), tenant == 7),
+    ]:
+        indices, _ = engine.query_batch(queries, filter=filter)
+        assert np.array_equal(indices, nearest(accepted))
+        assert engine.query(queries[0], filter=filter)[0].tolist() == nearest(accepted)[0].tolist()
+
+    indices, _ = engine.query_batch(queries, filter=[3, 5])
+    assert np.all(np.sort(indices[:, :2], axis=1) == [3, 5]) and np.all(indices[:, 2:] == -1)
+    with pytest.raises(ValueError):
+        engine.query(queries[0], filter=(tenant, "~", 1))
+    with pytest.raises(TypeError):
+        engine.query(queries[0], filter=dataset[:, 0])
+
+
+@pytest.mark.unit
+def test_approximate_query_engine_stats():
+    """stats() summarises every counted query and last_trace() the last single one."""
+    from approx_query import ApproximateQueryEngine
+
+    rng = np.random.default_rng(16)
+    dataset = clustered_data(rng, 1000, 8, 10)
+    engine = ApproximateQueryEngine(dataset, num_neighbors=5, accuracy=0.5, seed=4)
+    counters = ["latency_ns", "distances", "visited", "candidates", "bytes", "hash_ns", "probe_ns", "scan_ns",
+                "select_ns"]
+
+    engine.query_batch(dataset[:6])
+    engine.query(dataset[0])
+    stats = engine.stats()
+    assert set(stats) == {"enabled", "queries", *counters}
+    assert set(stats["latency_ns"]) == {"total", "mean", "p50", "p90", "p99", "max", "buckets"}
+    if not stats["enabled"]:
+        assert stats["queries"] == 0 and engine.last_trace() is None
+        return
+
+    trace = engine.last_trace()
+    assert stats["queries"] == 7 and set(trace) == set(counters)
+    assert trace["visited"] == engine.nprobe
+    assert trace["distances"] == engine.nlist + trace["candidates"] and trace["candidates"] >= 5
+    assert trace["bytes"] == trace["distances"] * 8 * 8
+    assert stats["visited"]["total"] == 7 * engine.nprobe and stats["visited"]["max"] == engine.nprobe
+    assert engine.stats(reset=True)["queries"] == 7
+    assert engine.stats()["queries"] == 0
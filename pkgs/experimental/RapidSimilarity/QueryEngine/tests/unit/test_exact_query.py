@@ -64,3 +64,105 @@ def test_exact_nearest_neighbors_parametrized(dataset, query, k, expected_neighb
     """Test exact nearest neighbors with parameterized datasets."""
     neighbors = exact_query.exact_nearest_neighbors(dataset, query, k)
     assert list(neighbors) == expected_neighbors
+
+
+@pytest.mark.unit
+def test_exact_nearest_neighbors_batch():
+    """Test that batched queries match one call per query and pad short rows."""
+    dataset = np.array([1.0, 2.0, 3.0, 4.0, 5.0], dtype=np.float32)
+    queries = np.array([3.0, 5.0, 1.0], dtype=np.float32)
+
+    indices, distances = exact_query.exact_nearest_neighbors_batch(dataset, queries, 2, num_threads=2)
+
+    assert indices.shape == (3, 2)
+    for row, query in enumerate(queries):
+        assert indices[row].tolist() == exact_query.exact_nearest_neighbors(dataset, float(query), 2)
+    assert np.allclose(distances[0], [0.0, 1.0])
+
+    indices, distances = exact_query.exact_nearest_neighbors_batch(dataset, queries[:1], 7)
+    assert indices[0, 5:].tolist() == [-1, -1]
+    assert np.all(np.isinf(distances[0, 5:]))
+
+
+@pytest.mark.unit
+def test_exact_nearest_neighbors_matches_full_sort():
+    """Test the bounded top-k selection against a full stable sort of the distances."""
+    rng = np.random.default_rng(7)
+    dataset = rng.integers(0, 20, size=500).astype(np.float32)  # many tied distances
+    for query in (0.0, 7.5, 13.0):
+        distances = np.abs(dataset - np.float32(query))
+        for k in (1, 10, 600):
+            expected = np.argsort(distances, kind="stable")[:k].tolist()
+            assert exact_query.exact_nearest_neighbors(dataset, query, k) == expected
+
+
+@pytest.mark.unit
+@pytest.mark.parametrize("dtype", [np.float32, np.float64])
+def test_exact_knn_matches_brute_force(dtype):
+    """Test the blocked multi-dimensional search against a full distance matrix."""
+    rng = np.random.default_rng(8)
+    dataset = rng.standard_normal((700, 24)).astype(dtype)
+    queries = rng.standard_normal((130, 24)).astype(dtype)
+
+    indices, distances = exact_query.exact_knn(dataset, queries, 5, num_threads=2)
+
+    assert indices.shape == (130, 5) and distances.dtype == dtype
+    full = np.linalg.norm(queries[:, None, :] - dataset[None, :, :], axis=2)
+    expected = np.argsort(full, axis=1, kind="stable")[:, :5]
+    assert (indices == expected).mean() > 0.99  # float rounding may swap near-ties
+    assert np.allclose(distances, np.take_along_axis(full, indices, axis=1), rtol=1e-3, atol=1e-3)
+
+
+@pytest.mark.unit
+def test_exact_knn_similarity_metrics():
+    """Test that 'ip' and 'cosine' return the most similar rows first and pad short rows."""
+    rng = np.random.default_rng(9)
+    dataset = rng.standard_normal((50, 8)).astype(np.float32)
+    queries = dataset[:3]
+
+    indices, similarities = exact_query.exact_knn(dataset, queries, 3, metric="cosine")
+    assert indices[:, 0].tolist() == [0, 1, 2]
+    assert np.allclose(similarities[:, 0], 1.0, atol=1e-5)
+    assert np.all(np.diff(similarities, axis=1) <= 0)
+
+    product = queries @ dataset.T
+    indices, similarities = exact_query.exact_knn(dataset, queries, 60, metric="ip")
+    assert indices[:, :5].tolist() == np.argsort(-product, axis=1, kind="stable")[:, :5].tolist()
+    assert np.allclose(similarities[:, :50], -np.sort(-product, axis=1), atol=1e-4)
+    assert (indices[:, 50:] == -1).all() and np.isneginf(similarities[:, 50:]).all()
+
+
+@pytest.mark.unit
+@pytest.mark.parametrize("metric", ["manhattan", "hamming"])
+def test_exact_knn_non_euclidean_distances(metric):
+    """Test the metrics that no inner product gives against a brute-force NumPy scan."""
+    rng = np.random.default_rng(10)
+    dataset = np.round(rng.standard_normal((300, 12)))
+    queries = np.round(rng.standard_normal((7, 12)))
+
+    indices, distances = exact_query.exact_knn(dataset, queries, 4, metric=metric)
+
+    diff = queries[:, None, :] - dataset[None, :, :]
+    full = np.abs(diff).sum(axis=2) if metric == "manhattan" else (diff != 0).sum(axis=2).astype(float)
+    assert np.allclose(distances, np.sort(full, axis=1)[:, :4])
+    assert np.allclose(np.take_along_axis(full, indices, axis=1), distances)
+
+
+@pytest.mark.unit
+def test_exact_knn_invalid_input():
+    """Test argument checks of exact_knn."""
+    dataset = np.zeros((4, 3), dtype=np.float32)
+    with pytest.raises(ValueError):
+        exact_query.exact_knn(dataset, np.zeros((2, 2), dtype=np.float32), 1)
+    with pytest.raises(ValueError):
+        exact_query.exact_knn(dataset, dataset, 1, metric="chebyshev")
+    with pytest.raises(ValueError):
+        exact_query.exact_knn(dataset, dataset, -1)
+    with pytest.raises(ValueError):
+        exact_query.exact_knn(dataset, np.zeros(3, dtype=np.float32), 1)
+    with pytest.raises(ValueError):
+        exact_query.exact_knn(np.empty((5, 0), dtype=np.float32), np.zeros((2, 4), dtype=np.float32), 1)
+    with pytest.raises(ValueError):
+        exact_query.exact_knn(dataset, np.empty((2, 0), dtype=np.float32), 1)
+    indices, _ = exact_query.exact_knn(dataset, np.empty((0, 3), dtype=np.float32), 1)
+    assert indices.shape == (0, 1)